@@ -0,0 +1,115 @@
+/*
+ * TinyOS Arena Allocator
+ *
+ * Chunked bump allocator on top of the general heap.
+ */
+
+#include "arena.h"
+#include "memory.h"
+
+#define ARENA_ALIGN         16
+#define ARENA_ALIGN_UP(x)   (((x) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+#define CHUNK_HEADER_SIZE   ARENA_ALIGN_UP(sizeof(arena_chunk_t))
+#define DEFAULT_CHUNK_SIZE  4096
+
+/* Registered arenas, newest first */
+static arena_t* arena_list = NULL;
+
+static inline uint8_t* chunk_data(arena_chunk_t* c) {
+    return (uint8_t*)c + CHUNK_HEADER_SIZE;
+}
+
+void arena_init(arena_t* a, const char* name, size_t chunk_size) {
+    /* Already registered - keep its chunks and statistics */
+    for (arena_t* it = arena_list; it != NULL; it = it->next_arena) {
+        if (it == a) return;
+    }
+
+    a->name = name;
+    a->chunks = NULL;
+    a->chunk_size = chunk_size ? ARENA_ALIGN_UP(chunk_size) : DEFAULT_CHUNK_SIZE;
+    a->used = 0;
+    a->reserved = 0;
+    a->peak = 0;
+    a->allocs = 0;
+    a->resets = 0;
+    a->next_arena = arena_list;
+    arena_list = a;
+}
+
+/* Get a fresh chunk able to hold at least 'size' bytes */
+static arena_chunk_t* arena_grow(arena_t* a, size_t size) {
+    size_t payload = a->chunk_size;
+    if (size > payload) payload = ARENA_ALIGN_UP(size);
+
+    arena_chunk_t* c = (arena_chunk_t*)malloc(CHUNK_HEADER_SIZE + payload);
+    if (c == NULL) return NULL;
+
+    c->size = payload;
+    c->used = 0;
+    c->next = a->chunks;
+    a->chunks = c;
+    a->reserved += CHUNK_HEADER_SIZE + payload;
+    return c;
+}
+
+void* arena_alloc(arena_t* a, size_t size) {
+    if (size == 0) return NULL;
+    size = ARENA_ALIGN_UP(size);
+
+    arena_chunk_t* c = a->chunks;
+    if (c == NULL || c->size - c->used < size) {
+        c = arena_grow(a, size);
+        if (c == NULL) return NULL;
+    }
+
+    void* p = chunk_data(c) + c->used;
+    c->used += size;
+
+    a->used += size;
+    a->allocs++;
+    if (a->used > a->peak) a->peak = a->used;
+    return p;
+}
+
+void* arena_calloc(arena_t* a, size_t size) {
+    void* p = arena_alloc(a, size);
+    if (p != NULL) memset(p, 0, size);
+    return p;
+}
+
+void arena_reset(arena_t* a) {
+    arena_chunk_t* c = a->chunks;
+    if (c == NULL) return;
+
+    /* Keep the oldest chunk (the default-sized one) for the next session */
+    while (c->next != NULL) {
+        arena_chunk_t* next = c->next;
+        a->reserved -= CHUNK_HEADER_SIZE + c->size;
+        free(c);
+        c = next;
+    }
+    c->used = 0;
+    a->chunks = c;
+
+    a->used = 0;
+    a->allocs = 0;
+    a->resets++;
+}
+
+void arena_release(arena_t* a) {
+    arena_chunk_t* c = a->chunks;
+    while (c != NULL) {
+        arena_chunk_t* next = c->next;
+        free(c);
+        c = next;
+    }
+    a->chunks = NULL;
+    a->reserved = 0;
+    a->used = 0;
+    a->allocs = 0;
+}
+
+arena_t* arena_first(void) {
+    return arena_list;
+}
@@ -0,0 +1,294 @@
+/*
+ * TinyOS Block Cache
+ *
+ * Fixed pool of sector buffers found through a hash of the sector number
+ * and kept on an LRU list (head = most recently used). Writes only dirty
+ * the cached copy; dirty sectors go to the device when they are evicted
+ * or on bcache_flush(). Partial-sector updates in the filesystem become
+ * a cached read plus a cached write instead of two device round trips.
+ *
+ * Device requests cover runs of up to BCACHE_RUN_MAX sectors: reads
+ * fetch every consecutive missing sector at once, and write-back takes
+ * the dirty neighbours of a sector along with it.
+ */
+
+#include "bcache.h"
+#include "virtio_blk.h"
+#include "memory.h"
+
+#define NONE    -1
+
+typedef struct {
+    uint64_t sector;
+    int16_t hash_next;
+    int16_t lru_prev;
+    int16_t lru_next;
+    uint8_t valid;          /* Holds the sector's data and is hashed */
+    uint8_t dirty;          /* Newer than the disk */
+} bcache_entry_t;
+
+static bcache_entry_t entries[BCACHE_BLOCKS];
+static uint8_t data[BCACHE_BLOCKS][SECTOR_SIZE] __attribute__((aligned(16)));
+static int16_t buckets[BCACHE_HASH_SIZE];
+static int16_t lru_head = NONE;
+static int16_t lru_tail = NONE;
+static int initialized = 0;
+static bcache_stats_t stats;
+
+/* Staging buffers for multi-sector write-back and prefetch. Separate,
+ * since caching a prefetched run can write back a dirty one */
+static uint8_t wb_buf[BCACHE_RUN_MAX * SECTOR_SIZE] __attribute__((aligned(16)));
+static uint8_t prefetch_buf[BCACHE_RUN_MAX * SECTOR_SIZE] __attribute__((aligned(16)));
+
+static inline uint32_t hash(uint64_t sector) {
+    return (uint32_t)sector & (BCACHE_HASH_SIZE - 1);
+}
+
+static void lru_unlink(int i) {
+    bcache_entry_t* e = &entries[i];
+    if (e->lru_prev != NONE) entries[e->lru_prev].lru_next = e->lru_next;
+    else lru_head = e->lru_next;
+    if (e->lru_next != NONE) entries[e->lru_next].lru_prev = e->lru_prev;
+    else lru_tail = e->lru_prev;
+}
+
+static void lru_push_front(int i) {
+    entries[i].lru_prev = NONE;
+    entries[i].lru_next = lru_head;
+    if (lru_head != NONE) entries[lru_head].lru_prev = i;
+    lru_head = i;
+    if (lru_tail == NONE) lru_tail = i;
+}
+
+static void lru_push_back(int i) {
+    entries[i].lru_next = NONE;
+    entries[i].lru_prev = lru_tail;
+    if (lru_tail != NONE) entries[lru_tail].lru_next = i;
+    lru_tail = i;
+    if (lru_head == NONE) lru_head = i;
+}
+
+static void init(void) {
+    for (int i = 0; i < BCACHE_HASH_SIZE; i++) {
+        buckets[i] = NONE;
+    }
+    lru_head = lru_tail = NONE;
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        entries[i].valid = 0;
+        entries[i].dirty = 0;
+        entries[i].hash_next = NONE;
+        lru_push_back(i);
+    }
+    initialized = 1;
+}
+
+static void hash_insert(int i) {
+    uint32_t h = hash(entries[i].sector);
+    entries[i].hash_next = buckets[h];
+    buckets[h] = i;
+    entries[i].valid = 1;
+}
+
+static void hash_remove(int i) {
+    int16_t* link = &buckets[hash(entries[i].sector)];
+    while (*link != NONE) {
+        if (*link == i) {
+            *link = entries[i].hash_next;
+            break;
+        }
+        link = &entries[*link].hash_next;
+    }
+    entries[i].valid = 0;
+}
+
+static int find(uint64_t sector) {
+    for (int i = buckets[hash(sector)]; i != NONE; i = entries[i].hash_next) {
+        if (entries[i].sector == sector) return i;
+    }
+    return NONE;
+}
+
+/* Find a cached sector and mark it most recently used */
+static int lookup(uint64_t sector) {
+    int i = find(sector);
+    if (i != NONE) {
+        lru_unlink(i);
+        lru_push_front(i);
+    }
+    return i;
+}
+
+static int is_dirty(uint64_t sector) {
+    int i = find(sector);
+    return i != NONE && entries[i].dirty;
+}
+
+/* Write back the run of dirty sectors around entry i in one request */
+static int write_back(int i) {
+    uint64_t start = entries[i].sector;
+    uint32_t n = 1;
+    while (n < BCACHE_RUN_MAX && start > 0 && is_dirty(start - 1)) {
+        start--;
+        n++;
+    }
+    while (n < BCACHE_RUN_MAX && is_dirty(start + n)) {
+        n++;
+    }
+
+    if (n == 1) {
+        if (blk_write(start, 1, data[i]) != 0) return -1;
+    } else {
+        for (uint32_t k = 0; k < n; k++) {
+            memcpy(wb_buf + k * SECTOR_SIZE, data[find(start + k)], SECTOR_SIZE);
+        }
+        if (blk_write(start, n, wb_buf) != 0) return -1;
+    }
+
+    for (uint32_t k = 0; k < n; k++) {
+        entries[find(start + k)].dirty = 0;
+    }
+    stats.dirty -= n;
+    stats.writebacks += n;
+    return 0;
+}
+
+/* Recycle the least recently used buffer (writing it back if dirty) and
+ * make it most recently used. Returns its index, or NONE on device error */
+static int take_slot(uint64_t sector) {
+    int i = lru_tail;
+    bcache_entry_t* e = &entries[i];
+
+    if (e->valid) {
+        if (e->dirty && write_back(i) != 0) {
+            return NONE;
+        }
+        hash_remove(i);
+        stats.cached--;
+    }
+    e->sector = sector;
+    lru_unlink(i);
+    lru_push_front(i);
+    return i;
+}
+
+/* Return a recycled buffer that never got valid data to the LRU tail */
+static void drop_slot(int i) {
+    lru_unlink(i);
+    lru_push_back(i);
+}
+
+/* Length of the run of uncached sectors starting at sector (max limit) */
+static uint32_t miss_run(uint64_t sector, uint32_t limit) {
+    uint32_t n = 0;
+    while (n < limit && n < BCACHE_RUN_MAX && find(sector + n) == NONE) {
+        n++;
+    }
+    return n;
+}
+
+/* Cache n sectors just read from the device */
+static int insert_run(uint64_t sector, uint32_t n, const uint8_t* src) {
+    for (uint32_t k = 0; k < n; k++) {
+        int i = take_slot(sector + k);
+        if (i == NONE) return -1;
+        memcpy(data[i], src + k * SECTOR_SIZE, SECTOR_SIZE);
+        hash_insert(i);
+        stats.cached++;
+    }
+    return 0;
+}
+
+int bcache_read(uint64_t sector, uint32_t count, void* buf) {
+    if (!initialized) init();
+
+    uint8_t* out = (uint8_t*)buf;
+    while (count > 0) {
+        int i = lookup(sector);
+        if (i != NONE) {
+            stats.hits++;
+            memcpy(out, data[i], SECTOR_SIZE);
+            sector++;
+            count--;
+            out += SECTOR_SIZE;
+            continue;
+        }
+
+        /* Read the whole miss run straight into the caller's buffer */
+        uint32_t n = miss_run(sector, count);
+        stats.misses += n;
+        if (blk_read(sector, n, out) != 0) return -1;
+        if (insert_run(sector, n, out) != 0) return -1;
+        sector += n;
+        count -= n;
+        out += n * SECTOR_SIZE;
+    }
+    return 0;
+}
+
+int bcache_prefetch(uint64_t sector, uint32_t count) {
+    if (!initialized) init();
+
+    while (count > 0) {
+        uint32_t n = miss_run(sector, count);
+        if (n == 0) {
+            sector++;
+            count--;
+            continue;
+        }
+        if (blk_read(sector, n, prefetch_buf) != 0) return -1;
+        if (insert_run(sector, n, prefetch_buf) != 0) return -1;
+        sector += n;
+        count -= n;
+    }
+    return 0;
+}
+
+int bcache_write(uint64_t sector, uint32_t count, const void* buf) {
+    if (!initialized) init();
+
+    const uint8_t* in = (const uint8_t*)buf;
+    for (uint32_t n = 0; n < count; n++, sector++, in += SECTOR_SIZE) {
+        int i = lookup(sector);
+        if (i == NONE) {
+            i = take_slot(sector);
+            if (i == NONE) return -1;
+            hash_insert(i);
+            stats.cached++;
+        }
+        memcpy(data[i], in, SECTOR_SIZE);
+        if (!entries[i].dirty) {
+            entries[i].dirty = 1;
+            stats.dirty++;
+        }
+    }
+    return 0;
+}
+
+int bcache_flush(void) {
+    if (!initialized) return blk_flush();
+
+    int ret = 0;
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        if (entries[i].valid && entries[i].dirty && write_back(i) != 0) {
+            ret = -1;
+        }
+    }
+    if (blk_flush() != 0) ret = -1;
+    return ret;
+}
+
+void bcache_invalidate(void) {
+    if (!initialized) return;
+
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        if (entries[i].valid && !entries[i].dirty) {
+            hash_remove(i);
+            stats.cached--;
+            drop_slot(i);
+        }
+    }
+}
+
+void bcache_stats(bcache_stats_t* out) {
+    *out = stats;
+}
@@ -0,0 +1,450 @@
+/*
+ * TinyOS Micro-benchmarks
+ *
+ * Each benchmark runs a fixed number of iterations between two reads of
+ * the generic timer (wall time) and, when the CPU exposes a PMU, the
+ * cycle counter. Results are plain numbers so they can be appended to a
+ * TinyFS log and diffed between builds.
+ */
+
+#include "bench.h"
+#include "font.h"
+#include "fs.h"
+#include "goldfish_fb.h"
+#include "memory.h"
+#include "net.h"
+#include "tcp.h"
+#include "timer.h"
+#include "virtio_blk.h"
+
+/* Buffer size for memcpy/memset and file/blk tests */
+#define BENCH_BUF_SIZE      65536
+
+/* Bytes moved per memory test, split across iterations */
+#define BENCH_MEM_BYTES     (4 * 1024 * 1024)
+
+#define BENCH_ALLOC_ITERS   2000
+#define BENCH_ALLOC_SLOTS   32
+#define BENCH_DRAW_ITERS    200
+#define BENCH_FB_ITERS      10
+#define BENCH_FILE_BYTES    (32 * 1024)
+#define BENCH_FILE_NAME     "bench.tmp"
+#define BENCH_BLK_SECTORS   128         /* 64KB per read */
+#define BENCH_BLK_ITERS     16
+#define BENCH_TCP_ITERS     3
+#define BENCH_TCP_PORT      80
+#define BENCH_TCP_TIMEOUT_MS 2000
+
+static int pmu_available = 0;
+
+/* Timestamp pair for one measurement */
+typedef struct {
+    uint64_t ticks;
+    uint64_t cycles;
+} bench_stamp_t;
+
+/* ==================== Counters ==================== */
+
+static void pmu_init(void) {
+    uint64_t dfr0;
+    __asm__ volatile("mrs %0, id_aa64dfr0_el1" : "=r"(dfr0));
+    uint32_t pmuver = (dfr0 >> 8) & 0xF;
+    if (pmuver == 0 || pmuver == 0xF) {
+        pmu_available = 0;
+        return;
+    }
+
+    uint64_t pmcr;
+    __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+    pmcr |= (1 << 0);                   /* E: enable counters */
+    __asm__ volatile("msr pmcr_el0, %0" : : "r"(pmcr));
+    __asm__ volatile("msr pmccfiltr_el0, %0" : : "r"((uint64_t)0));
+    __asm__ volatile("msr pmcntenset_el0, %0" : : "r"((uint64_t)1 << 31));
+    __asm__ volatile("isb");
+    pmu_available = 1;
+}
+
+static inline uint64_t read_cycles(void) {
+    uint64_t val = 0;
+    if (pmu_available) {
+        __asm__ volatile("isb; mrs %0, pmccntr_el0" : "=r"(val));
+    }
+    return val;
+}
+
+static void stamp(bench_stamp_t* s) {
+    s->ticks = timer_counter();
+    s->cycles = read_cycles();
+}
+
+/* ==================== Result helpers ==================== */
+
+static bench_result_t* result_begin(bench_result_t* results, int* count,
+                                    int max, const char* name) {
+    if (*count >= max) return NULL;
+    bench_result_t* r = &results[(*count)++];
+    memset(r, 0, sizeof(*r));
+    int i = 0;
+    while (name[i] && i < BENCH_NAME_LEN - 1) {
+        r->name[i] = name[i];
+        i++;
+    }
+    r->name[i] = 0;
+    return r;
+}
+
+static void result_end(bench_result_t* r, const bench_stamp_t* start,
+                       uint32_t iters, uint64_t bytes) {
+    bench_stamp_t end;
+    stamp(&end);
+    r->iters = iters;
+    r->ticks = end.ticks - start->ticks;
+    r->cycles = pmu_available ? end.cycles - start->cycles : 0;
+    r->bytes = bytes;
+    r->status = BENCH_OK;
+}
+
+/* Line builder for bench_format */
+typedef struct {
+    char* buf;
+    int pos;
+    int len;
+} line_t;
+
+static void put_char(line_t* l, char c) {
+    if (l->pos < l->len - 1) l->buf[l->pos++] = c;
+}
+
+static void put_str(line_t* l, const char* s) {
+    while (*s) put_char(l, *s++);
+}
+
+/* Right-aligned decimal in a field of `width` */
+static void put_dec(line_t* l, uint64_t val, int width) {
+    char tmp[24];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + (val % 10);
+        val /= 10;
+    } while (val > 0);
+    for (int i = n; i < width; i++) put_char(l, ' ');
+    while (n > 0) put_char(l, tmp[--n]);
+}
+
+static void put_pad(line_t* l, int column) {
+    while (l->pos < column) put_char(l, ' ');
+}
+
+/* ==================== Benchmarks ==================== */
+
+static void bench_memcpy(bench_result_t* r, uint8_t* dst, const uint8_t* src,
+                         uint32_t size) {
+    uint32_t iters = BENCH_MEM_BYTES / size;
+    bench_stamp_t start;
+    stamp(&start);
+    for (uint32_t i = 0; i < iters; i++) {
+        memcpy(dst, src, size);
+    }
+    result_end(r, &start, iters, (uint64_t)iters * size);
+}
+
+static void bench_memset(bench_result_t* r, uint8_t* dst, uint32_t size) {
+    uint32_t iters = BENCH_MEM_BYTES / size;
+    bench_stamp_t start;
+    stamp(&start);
+    for (uint32_t i = 0; i < iters; i++) {
+        memset(dst, (int)i, size);
+    }
+    result_end(r, &start, iters, (uint64_t)iters * size);
+}
+
+/* Mixed-size malloc/free churn over a small ring of live blocks */
+static void bench_alloc(bench_result_t* r) {
+    void* slots[BENCH_ALLOC_SLOTS] = {0};
+    uint32_t seed = 0x2545F491;
+    bench_stamp_t start;
+    stamp(&start);
+    for (uint32_t i = 0; i < BENCH_ALLOC_ITERS; i++) {
+        uint32_t slot = i % BENCH_ALLOC_SLOTS;
+        if (slots[slot]) free(slots[slot]);
+        seed = seed * 1103515245 + 12345;
+        slots[slot] = malloc(16 + ((seed >> 16) & 2047));
+    }
+    for (int i = 0; i < BENCH_ALLOC_SLOTS; i++) {
+        if (slots[i]) free(slots[i]);
+    }
+    result_end(r, &start, BENCH_ALLOC_ITERS, 0);
+}
+
+static void bench_draw_string(bench_result_t* r) {
+    uint32_t* fb = goldfish_fb_get_buffer();
+    if (!fb) {
+        r->status = BENCH_SKIPPED;
+        return;
+    }
+    int w = goldfish_fb_get_width();
+    int h = goldfish_fb_get_height();
+    static const char text[] = "The quick brown fox jumps over the lazy dog";
+    bench_stamp_t start;
+    stamp(&start);
+    for (uint32_t i = 0; i < BENCH_DRAW_ITERS; i++) {
+        draw_string(fb, 8, 100 + (i % 32) * FONT_HEIGHT, text, 0x00FFFFFF, w, h);
+    }
+    result_end(r, &start, BENCH_DRAW_ITERS, 0);
+}
+
+static void bench_fb_clear(bench_result_t* r) {
+    if (!goldfish_fb_get_buffer()) {
+        r->status = BENCH_SKIPPED;
+        return;
+    }
+    uint64_t frame = (uint64_t)goldfish_fb_get_width() * goldfish_fb_get_height() * 4;
+    bench_stamp_t start;
+    stamp(&start);
+    for (uint32_t i = 0; i < BENCH_FB_ITERS; i++) {
+        goldfish_fb_clear(0x00101010 * (i & 1));
+    }
+    result_end(r, &start, BENCH_FB_ITERS, frame * BENCH_FB_ITERS);
+}
+
+static void bench_gpu_flush(bench_result_t* r) {
+    if (!goldfish_fb_get_buffer()) {
+        r->status = BENCH_SKIPPED;
+        return;
+    }
+    uint64_t frame = (uint64_t)goldfish_fb_get_width() * goldfish_fb_get_height() * 4;
+    bench_stamp_t start;
+    stamp(&start);
+    for (uint32_t i = 0; i < BENCH_FB_ITERS; i++) {
+        /* Flushes are incremental - force a full-frame transfer each time */
+        goldfish_fb_damage_all();
+        goldfish_fb_flush();
+    }
+    /* Flushes are pipelined; count the time until the last one lands */
+    goldfish_fb_sync();
+    result_end(r, &start, BENCH_FB_ITERS, frame * BENCH_FB_ITERS);
+}
+
+/* Sequential write then read of a scratch file, one cluster at a time */
+static void bench_fs(bench_result_t* wr, bench_result_t* rd, uint8_t* buf) {
+    if (!fs_mounted()) {
+        wr->status = BENCH_SKIPPED;
+        rd->status = BENCH_SKIPPED;
+        return;
+    }
+    uint32_t iters = BENCH_FILE_BYTES / FS_CLUSTER_SIZE;
+    bench_stamp_t start;
+
+    int fd = fs_open(BENCH_FILE_NAME, FS_O_WRITE | FS_O_CREATE | FS_O_TRUNC);
+    if (fd < 0) {
+        wr->status = BENCH_FAILED;
+        rd->status = BENCH_FAILED;
+        return;
+    }
+    stamp(&start);
+    for (uint32_t i = 0; i < iters; i++) {
+        if (fs_write(fd, buf, FS_CLUSTER_SIZE) != FS_CLUSTER_SIZE) {
+            fs_close(fd);
+            fs_remove(BENCH_FILE_NAME);
+            wr->status = BENCH_FAILED;
+            rd->status = BENCH_FAILED;
+            return;
+        }
+    }
+    fs_close(fd);
+    result_end(wr, &start, iters, (uint64_t)iters * FS_CLUSTER_SIZE);
+
+    fd = fs_open(BENCH_FILE_NAME, FS_O_READ);
+    if (fd < 0) {
+        rd->status = BENCH_FAILED;
+        fs_remove(BENCH_FILE_NAME);
+        return;
+    }
+    stamp(&start);
+    uint64_t total = 0;
+    int len;
+    while ((len = fs_read(fd, buf, FS_CLUSTER_SIZE)) > 0) {
+        total += len;
+    }
+    fs_close(fd);
+    result_end(rd, &start, iters, total);
+    if (total != BENCH_FILE_BYTES) rd->status = BENCH_FAILED;
+
+    fs_remove(BENCH_FILE_NAME);
+}
+
+static void bench_blk_read(bench_result_t* r, uint8_t* buf) {
+    if (!blk_available()) {
+        r->status = BENCH_SKIPPED;
+        return;
+    }
+    uint64_t capacity = blk_get_info()->capacity;
+    uint32_t iters = BENCH_BLK_ITERS;
+    if (capacity < (uint64_t)BENCH_BLK_SECTORS * iters) {
+        iters = capacity / BENCH_BLK_SECTORS;
+    }
+    bench_stamp_t start;
+    stamp(&start);
+    for (uint32_t i = 0; i < iters; i++) {
+        if (blk_read((uint64_t)i * BENCH_BLK_SECTORS, BENCH_BLK_SECTORS, buf) != 0) {
+            r->status = BENCH_FAILED;
+            return;
+        }
+    }
+    result_end(r, &start, iters, (uint64_t)iters * BENCH_BLK_SECTORS * SECTOR_SIZE);
+}
+
+/*
+ * TCP handshake round trips to the gateway. A SYN/ACK or an RST both
+ * count as one round trip; each connection is closed before the next so
+ * the small connection table isn't exhausted.
+ */
+static void bench_tcp_rtt(bench_result_t* r) {
+    net_config_t* nc = net_get_config();
+    if (!nc->configured) {
+        r->status = BENCH_SKIPPED;
+        return;
+    }
+    uint32_t done = 0;
+    uint64_t ticks = 0, cycles = 0;
+    for (uint32_t i = 0; i < BENCH_TCP_ITERS; i++) {
+        bench_stamp_t start, end;
+        stamp(&start);
+        int conn = tcp_connect(nc->gateway, BENCH_TCP_PORT);
+        if (conn < 0) break;
+        uint32_t deadline = timer_ms() + BENCH_TCP_TIMEOUT_MS;
+        while (tcp_get_state(conn) == TCP_SYN_SENT && !timer_expired(deadline)) {
+            net_poll();
+        }
+        stamp(&end);
+        int state = tcp_get_state(conn);
+        tcp_close(conn);
+        /* Let the FIN exchange finish so the slot frees up */
+        deadline = timer_ms() + BENCH_TCP_TIMEOUT_MS;
+        while ((tcp_get_state(conn) == TCP_FIN_WAIT_1 ||
+                tcp_get_state(conn) == TCP_FIN_WAIT_2) && !timer_expired(deadline)) {
+            net_poll();
+        }
+        if (state == TCP_SYN_SENT) break;   /* Timed out */
+        ticks += end.ticks - start.ticks;
+        cycles += end.cycles - start.cycles;
+        done++;
+    }
+    r->iters = done;
+    r->ticks = ticks;
+    r->cycles = pmu_available ? cycles : 0;
+    r->status = done > 0 ? BENCH_OK : BENCH_FAILED;
+}
+
+/* ==================== Public API ==================== */
+
+int bench_run_all(bench_result_t* results, int max) {
+    static const uint32_t mem_sizes[] = {64, 1024, 65536};
+    static const char* const copy_names[] = {"memcpy 64", "memcpy 1K", "memcpy 64K"};
+    static const char* const set_names[] = {"memset 64", "memset 1K", "memset 64K"};
+    int count = 0;
+    bench_result_t* r;
+
+    pmu_init();
+
+    uint8_t* src = malloc(BENCH_BUF_SIZE);
+    uint8_t* dst = malloc(BENCH_BUF_SIZE);
+    if (!src || !dst) {
+        if (src) free(src);
+        if (dst) free(dst);
+        return 0;
+    }
+    memset(src, 0xA5, BENCH_BUF_SIZE);
+
+    for (int i = 0; i < 3; i++) {
+        if ((r = result_begin(results, &count, max, copy_names[i])))
+            bench_memcpy(r, dst, src, mem_sizes[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        if ((r = result_begin(results, &count, max, set_names[i])))
+            bench_memset(r, dst, mem_sizes[i]);
+    }
+    if ((r = result_begin(results, &count, max, "malloc/free")))
+        bench_alloc(r);
+    if ((r = result_begin(results, &count, max, "draw_string")))
+        bench_draw_string(r);
+    if ((r = result_begin(results, &count, max, "fb_clear")))
+        bench_fb_clear(r);
+    if ((r = result_begin(results, &count, max, "gpu_flush")))
+        bench_gpu_flush(r);
+
+    bench_result_t* wr = result_begin(results, &count, max, "fs_write");
+    bench_result_t* rd = result_begin(results, &count, max, "fs_read");
+    if (wr && rd)
+        bench_fs(wr, rd, src);
+
+    if ((r = result_begin(results, &count, max, "blk_read")))
+        bench_blk_read(r, dst);
+    if ((r = result_begin(results, &count, max, "tcp_rtt")))
+        bench_tcp_rtt(r);
+
+    free(src);
+    free(dst);
+    return count;
+}
+
+/*
+ * memcpy 64K         64 it     12345 cyc     1234 us   567 MB/s
+ */
+int bench_format(const bench_result_t* r, char* buf, int len) {
+    line_t l = {buf, 0, len};
+
+    put_str(&l, r->name);
+    put_pad(&l, BENCH_NAME_LEN);
+    if (r->status == BENCH_SKIPPED) {
+        put_str(&l, "skipped");
+    } else if (r->status == BENCH_FAILED && r->iters == 0) {
+        put_str(&l, "FAILED");
+    } else {
+        uint32_t freq = timer_freq();
+        put_dec(&l, r->iters, 5);
+        put_str(&l, " it");
+        if (r->cycles && r->iters) {
+            put_dec(&l, r->cycles / r->iters, 10);
+            put_str(&l, " cyc");
+        } else {
+            put_str(&l, "         - cyc");
+        }
+        put_dec(&l, freq ? r->ticks * 1000000 / freq : 0, 9);
+        put_str(&l, " us");
+        if (r->bytes && r->ticks) {
+            put_dec(&l, r->bytes * freq / r->ticks / (1024 * 1024), 6);
+            put_str(&l, " MB/s");
+        }
+        if (r->status == BENCH_FAILED) put_str(&l, " !");
+    }
+    l.buf[l.pos] = 0;
+    return l.pos;
+}
+
+int bench_save(const bench_result_t* results, int count) {
+    if (!fs_mounted()) return -1;
+
+    int fd = fs_open(BENCH_LOG_FILE, FS_O_WRITE | FS_O_CREATE | FS_O_APPEND);
+    if (fd < 0) return -1;
+
+    char line[BENCH_LINE_LEN + 1];
+    line_t l = {line, 0, sizeof(line)};
+    put_str(&l, "# run at ");
+    put_dec(&l, timer_ms(), 0);
+    put_str(&l, " ms, ");
+    put_dec(&l, timer_freq(), 0);
+    put_str(&l, " Hz, pmu=");
+    put_dec(&l, pmu_available, 0);
+    put_char(&l, '\n');
+    int ok = fs_write(fd, line, l.pos) == l.pos;
+
+    for (int i = 0; i < count && ok; i++) {
+        int n = bench_format(&results[i], line, sizeof(line) - 1);
+        line[n++] = '\n';
+        ok = fs_write(fd, line, n) == n;
+    }
+
+    fs_close(fd);
+    return ok ? 0 : -1;
+}
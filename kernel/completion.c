@@ -0,0 +1,38 @@
+/*
+ * TinyOS Completions
+ *
+ * Drivers submit a request, then either return and let the callback fire
+ * from their IRQ handler, or block in completion_wait(). Waiting sleeps
+ * in WFI, so the core is idle while the device works instead of spinning
+ * on the used ring. Timeouts are wall-clock, so a slow host gets the same
+ * grace period as a fast one.
+ */
+
+#include "completion.h"
+#include "gic.h"
+#include "timer.h"
+
+int completion_wait(completion_t* c, void (*poll)(void), uint32_t timeout_ms) {
+    uint32_t deadline = timer_ms() + timeout_ms;
+
+    while (!c->done) {
+        /* Reap with IRQs masked so we never race the driver's handler.
+         * This also covers early boot and a misrouted device IRQ. */
+        if (poll) {
+            int irqs = interrupts_enabled();
+            disable_interrupts();
+            poll();
+            if (irqs) enable_interrupts();
+            if (c->done) break;
+        }
+        if (timer_expired(deadline)) {
+            return -1;
+        }
+        /* A completion IRQ (or at worst the next tick) ends the sleep */
+        if (interrupts_enabled()) {
+            timer_idle();
+        }
+    }
+    __asm__ volatile("dmb sy" ::: "memory");
+    return 0;
+}
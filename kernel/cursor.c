@@ -1,17 +1,61 @@
 #include "cursor.h"
+#include "goldfish_fb.h"
 #include "virtio_input.h"
 
+/*
+ * Save-under overlay: the pixels beneath the pointer are kept so it can
+ * be taken off the screen without the app repainting anything. A move
+ * costs two small damage rectangles instead of a full redraw.
+ */
+#define SAVE_W 13 /* Arrow plus outline */
+#define SAVE_H 12
+
+static uint32_t saved[SAVE_W * SAVE_H];
+static fb_rect_t saved_rect;
+static int shown = 0;
+
+void cursor_hide(uint32_t *fb, uint32_t screen_w) {
+  if (!shown)
+    return;
+  for (int dy = 0; dy < saved_rect.h; dy++) {
+    for (int dx = 0; dx < saved_rect.w; dx++) {
+      fb[(saved_rect.y + dy) * screen_w + saved_rect.x + dx] =
+          saved[dy * SAVE_W + dx];
+    }
+  }
+  goldfish_fb_damage(saved_rect.x, saved_rect.y, saved_rect.w, saved_rect.h);
+  shown = 0;
+}
+
 void cursor_draw(uint32_t *fb, uint32_t screen_w, uint32_t screen_h) {
   int32_t cursor_px, cursor_py;
   virtio_input_get_touch(&cursor_px, &cursor_py, (void *)0);
 
+  /* Still showing from the last frame - take it off first */
+  cursor_hide(fb, screen_w);
+
   /* cursor_px/py are in pixel coordinates */
   if (cursor_px >= 0 && cursor_px < (int32_t)screen_w && cursor_py >= 0 &&
       cursor_py < (int32_t)screen_h) {
-    /* Draw simple arrow cursor - white with black outline */
     int cx = cursor_px;
     int cy = cursor_py;
 
+    /* Save what the cursor will cover (clipped to the screen) */
+    saved_rect.x = cx;
+    saved_rect.y = cy;
+    saved_rect.w =
+        cx + SAVE_W > (int)screen_w ? (int)screen_w - cx : SAVE_W;
+    saved_rect.h =
+        cy + SAVE_H > (int)screen_h ? (int)screen_h - cy : SAVE_H;
+    for (int dy = 0; dy < saved_rect.h; dy++) {
+      for (int dx = 0; dx < saved_rect.w; dx++) {
+        saved[dy * SAVE_W + dx] = fb[(cy + dy) * screen_w + cx + dx];
+      }
+    }
+    shown = 1;
+
+    /* Draw simple arrow cursor - white with black outline */
+
     /* Cursor shape: small triangle pointer */
     for (int dy = 0; dy < 12; dy++) {
       int width = (dy < 8) ? (dy / 2 + 1) : (12 - dy);
@@ -34,5 +78,8 @@ void cursor_draw(uint32_t *fb, uint32_t screen_w, uint32_t screen_h) {
         fb[py * screen_w + px] = 0x00000000;
       }
     }
+
+    goldfish_fb_damage(saved_rect.x, saved_rect.y, saved_rect.w,
+                       saved_rect.h);
   }
 }
@@ -75,7 +75,18 @@ void gic_init(void) {
     /* Enable distributor */
     gicd_write(GICD_CTLR, 1);
 
-    /* Configure CPU interface */
+    /* Configure this core's CPU interface */
+    gic_cpu_init();
+}
+
+void gic_cpu_init(void) {
+    /* SGI/PPI enables and priorities are banked per core */
+    gicd_write(GICD_ICENABLER, 0xFFFF0000);     /* PPIs off */
+    gicd_write(GICD_ISENABLER, 0x0000FFFF);     /* SGIs on */
+    for (uint32_t i = 0; i < GIC_SPI_START / 4; i++) {
+        gicd_write(GICD_IPRIORITYR + i * 4, 0xA0A0A0A0);
+    }
+
     /* Set priority mask to allow all priorities */
     gicc_write(GICC_PMR, 0xFF);
 
@@ -139,6 +150,12 @@ void disable_interrupts(void) {
     __asm__ volatile("msr daifset, #2" ::: "memory");
 }
 
+int interrupts_enabled(void) {
+    uint64_t daif;
+    __asm__ volatile("mrs %0, daif" : "=r"(daif));
+    return (daif & (1 << 7)) == 0;
+}
+
 /* Called from vectors.S on IRQ */
 void irq_handler(void) {
     uint32_t irq = gic_acknowledge();
@@ -7,24 +7,118 @@
 
 /* External virtio-gpu functions */
 extern void virtio_gpu_init(void);
-extern void virtio_gpu_flush(void);
+extern int virtio_gpu_flush(void);
+extern int virtio_gpu_flush_rects(const fb_rect_t* rects, int count);
+extern int virtio_gpu_sync(void);
 extern uint32_t* virtio_gpu_get_framebuffer(void);
 extern uint32_t virtio_gpu_get_width(void);
 extern uint32_t virtio_gpu_get_height(void);
 
-static uint32_t* framebuffer;
+/* The draw buffer flips after every flush, so it is never cached here */
+
+/*
+ * Damage tracking. Overlapping rectangles are merged as they are added;
+ * when the list is full the new rectangle joins whichever entry grows
+ * least. Once most of the screen is dirty a single full transfer is
+ * cheaper than many small ones, so the list collapses to "everything".
+ */
+static fb_rect_t damage[FB_DAMAGE_MAX];
+static int damage_count = 0;
+static int damage_full = 0;
+
+static inline int rect_area(const fb_rect_t* r) {
+    return r->w * r->h;
+}
+
+static void rect_union(fb_rect_t* out, const fb_rect_t* a, const fb_rect_t* b) {
+    int x0 = a->x < b->x ? a->x : b->x;
+    int y0 = a->y < b->y ? a->y : b->y;
+    int x1 = (a->x + a->w) > (b->x + b->w) ? (a->x + a->w) : (b->x + b->w);
+    int y1 = (a->y + a->h) > (b->y + b->h) ? (a->y + a->h) : (b->y + b->h);
+    out->x = x0;
+    out->y = y0;
+    out->w = x1 - x0;
+    out->h = y1 - y0;
+}
+
+/* Overlapping or edge-adjacent */
+static int rect_touches(const fb_rect_t* a, const fb_rect_t* b) {
+    return a->x <= b->x + b->w && b->x <= a->x + a->w &&
+           a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
 
 void goldfish_fb_init(void) {
     virtio_gpu_init();
-    framebuffer = virtio_gpu_get_framebuffer();
+    damage_count = 0;
+    damage_full = 1;    /* First flush shows the whole frame */
+}
+
+void goldfish_fb_damage(int x, int y, int w, int h) {
+    int sw = (int)virtio_gpu_get_width();
+    int sh = (int)virtio_gpu_get_height();
+
+    if (damage_full) return;
+
+    /* Clip to the screen */
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > sw) w = sw - x;
+    if (y + h > sh) h = sh - y;
+    if (w <= 0 || h <= 0) return;
+
+    fb_rect_t r = {x, y, w, h};
+
+    /* Absorb every entry the new rectangle touches */
+    int i = 0;
+    while (i < damage_count) {
+        if (rect_touches(&r, &damage[i])) {
+            rect_union(&r, &r, &damage[i]);
+            damage[i] = damage[--damage_count];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (damage_count == FB_DAMAGE_MAX) {
+        /* Full: grow the entry whose area increases least */
+        int best = 0, best_growth = 0;
+        for (i = 0; i < damage_count; i++) {
+            fb_rect_t u;
+            rect_union(&u, &r, &damage[i]);
+            int growth = rect_area(&u) - rect_area(&damage[i]);
+            if (i == 0 || growth < best_growth) {
+                best = i;
+                best_growth = growth;
+            }
+        }
+        rect_union(&damage[best], &damage[best], &r);
+    } else {
+        damage[damage_count++] = r;
+    }
+
+    /* Mostly dirty - one full transfer is cheaper */
+    int total = 0;
+    for (i = 0; i < damage_count; i++) total += rect_area(&damage[i]);
+    if (total * 2 > sw * sh) {
+        damage_full = 1;
+        damage_count = 0;
+    }
+}
+
+void goldfish_fb_damage_all(void) {
+    damage_full = 1;
+    damage_count = 0;
 }
 
 void goldfish_fb_clear(uint32_t color) {
     uint32_t w = virtio_gpu_get_width();
     uint32_t h = virtio_gpu_get_height();
+    uint32_t* framebuffer = virtio_gpu_get_framebuffer();
     for (uint32_t i = 0; i < w * h; i++) {
         framebuffer[i] = color;
     }
+    goldfish_fb_damage_all();
     /* Don't flush here - caller should flush after all drawing is complete */
 }
 
@@ -32,12 +126,13 @@ void goldfish_fb_putpixel(int x, int y, uint32_t color) {
     uint32_t w = virtio_gpu_get_width();
     uint32_t h = virtio_gpu_get_height();
     if (x >= 0 && x < (int)w && y >= 0 && y < (int)h) {
-        framebuffer[y * w + x] = color;
+        virtio_gpu_get_framebuffer()[y * w + x] = color;
+        goldfish_fb_damage(x, y, 1, 1);
     }
 }
 
 uint32_t* goldfish_fb_get_buffer(void) {
-    return framebuffer;
+    return virtio_gpu_get_framebuffer();
 }
 
 uint32_t goldfish_fb_get_width(void) {
@@ -49,7 +144,26 @@ uint32_t goldfish_fb_get_height(void) {
 }
 
 void goldfish_fb_flush(void) {
-    virtio_gpu_flush();
+    int ret = 0;
+    if (damage_full) {
+        ret = virtio_gpu_flush();
+    } else if (damage_count > 0) {
+        ret = virtio_gpu_flush_rects(damage, damage_count);
+    }
+    damage_count = 0;
+    /* A failed transfer leaves the host copy unknown - resend everything */
+    damage_full = (ret != 0);
+}
+
+void goldfish_fb_flush_rect(int x, int y, int w, int h) {
+    goldfish_fb_damage(x, y, w, h);
+    goldfish_fb_flush();
+}
+
+void goldfish_fb_sync(void) {
+    if (virtio_gpu_sync() != 0) {
+        damage_full = 1;
+    }
 }
 
 #else
@@ -102,4 +216,19 @@ uint32_t goldfish_fb_get_height(void) {
     return FB_HEIGHT;
 }
 
+/* PL110 scans out of RAM directly - nothing to transfer */
+void goldfish_fb_damage(int x, int y, int w, int h) {
+    (void)x; (void)y; (void)w; (void)h;
+}
+
+void goldfish_fb_damage_all(void) {
+}
+
+void goldfish_fb_flush_rect(int x, int y, int w, int h) {
+    (void)x; (void)y; (void)w; (void)h;
+}
+
+void goldfish_fb_sync(void) {
+}
+
 #endif
@@ -1,10 +1,24 @@
 /*
  * Virtio Block Driver
  * Handles disk I/O through virtio-blk device
+ *
+ * Requests are asynchronous. blk_submit() queues a request, which is
+ * split into parts of at most BLK_PART_SECTORS. Each part takes a slot:
+ * its own header and status byte, plus a fixed chain of three
+ * descriptors whose data descriptor points straight at the caller's
+ * buffer, so nothing is copied; that memory is cacheable, so each part
+ * is cleaned to memory before it starts and read parts are invalidated
+ * again when they finish. Parts are started as slots free up and
+ * share one notify per batch. Completions are reaped from the IRQ
+ * handler (or by a waiter with IRQs masked), which also starts queued
+ * parts, so the queue stays full for as long as there is work.
  */
 
 #include "types.h"
 #include "virtio_blk.h"
+#include "completion.h"
+#include "gic.h"
+#include "mmu.h"
 #include "memory.h"
 
 /* Virtio MMIO scan range */
@@ -48,10 +62,16 @@
 #define VIRTQ_DESC_F_NEXT       1
 #define VIRTQ_DESC_F_WRITE      2
 
+/* Give up waiting on a request after this long (wall clock) */
+#define BLK_TIMEOUT_MS          5000
+
 /* Memory regions - must be in valid RAM */
 #define BLK_VIRTQUEUE_BASE      0x47100000
-#define BLK_REQUEST_BASE        0x47110000
-#define BLK_DATA_BASE           0x47120000
+#define BLK_REQUEST_BASE        0x47110000  /* Per-slot headers and status */
+
+/* Largest queue we set up; each slot uses three descriptors */
+#define BLK_QUEUE_MAX           64
+#define BLK_MAX_SLOTS           (BLK_QUEUE_MAX / 3)
 
 /* Virtqueue structures */
 struct virtq_desc {
@@ -64,7 +84,7 @@ struct virtq_desc {
 struct virtq_avail {
     uint16_t flags;
     uint16_t idx;
-    uint16_t ring[16];
+    uint16_t ring[BLK_QUEUE_MAX];
 } __attribute__((packed, aligned(2)));
 
 struct virtq_used_elem {
@@ -75,7 +95,7 @@ struct virtq_used_elem {
 struct virtq_used {
     uint16_t flags;
     uint16_t idx;
-    struct virtq_used_elem ring[16];
+    struct virtq_used_elem ring[BLK_QUEUE_MAX];
 } __attribute__((packed, aligned(4)));
 
 /* Virtio-blk request header */
@@ -91,19 +111,30 @@ static int blk_version = 0;
 static int blk_initialized = 0;
 static disk_info_t disk_info;
 
+/* One in-flight part: descriptors 3 * slot .. 3 * slot + 2 */
+struct blk_slot {
+    struct virtio_blk_req hdr;
+    uint8_t status;
+    uint8_t busy;
+    uint8_t padding[6];
+    blk_req_t* req;         /* Owner, NULL when free */
+};
+
 /* Virtqueue state */
 static struct virtq_desc* vq_desc;
 static struct virtq_avail* vq_avail;
 static struct virtq_used* vq_used;
 static uint16_t vq_num = 0;
-static uint16_t vq_free_head = 0;
 static uint16_t vq_last_used = 0;
-static int descs_in_use = 0;
 
-/* Request/data buffers */
-static struct virtio_blk_req* req_header;
-static uint8_t* data_buffer;
-static uint8_t* status_byte;
+/* Request slots */
+static struct blk_slot* slots;
+static int num_slots = 0;
+static int slots_free = 0;
+
+/* Requests with parts still to start (FIFO) */
+static blk_req_t* pending_head = NULL;
+static blk_req_t* pending_tail = NULL;
 
 static inline void mmio_write(uint64_t base, uint32_t offset, uint32_t value) {
     *(volatile uint32_t*)(base + offset) = value;
@@ -160,9 +191,9 @@ static void virtqueue_init(void) {
     /* Select queue 0 */
     mmio_write(blk_base, VIRTIO_MMIO_QUEUE_SEL, 0);
 
-    /* Get max queue size - use small fixed size for reliability */
+    /* Get max queue size */
     uint32_t max_num = mmio_read(blk_base, VIRTIO_MMIO_QUEUE_NUM_MAX);
-    vq_num = 16;  /* Use small queue size */
+    vq_num = BLK_QUEUE_MAX;
     if (max_num > 0 && max_num < vq_num) vq_num = max_num;
 
     /* Set queue size */
@@ -191,16 +222,28 @@ static void virtqueue_init(void) {
     vq_used->flags = 0;
     vq_used->idx = 0;
 
-    /* Initialize descriptor free list */
-    for (uint16_t i = 0; i < vq_num; i++) {
-        vq_desc[i].addr = 0;
-        vq_desc[i].len = 0;
-        vq_desc[i].flags = 0;
-        vq_desc[i].next = (i + 1) % vq_num;
+    /* Fixed descriptor chains, one per slot: header -> data -> status */
+    slots = (struct blk_slot*)BLK_REQUEST_BASE;
+    num_slots = vq_num / 3;
+    slots_free = num_slots;
+    for (int i = 0; i < num_slots; i++) {
+        struct virtq_desc* d = &vq_desc[i * 3];
+        slots[i].busy = 0;
+        slots[i].req = NULL;
+
+        d[0].addr = (uint64_t)&slots[i].hdr;
+        d[0].len = sizeof(struct virtio_blk_req);
+        d[0].flags = VIRTQ_DESC_F_NEXT;
+        d[0].next = i * 3 + 1;
+
+        d[1].next = i * 3 + 2;
+
+        d[2].addr = (uint64_t)&slots[i].status;
+        d[2].len = 1;
+        d[2].flags = VIRTQ_DESC_F_WRITE;
+        d[2].next = 0;
     }
-    vq_free_head = 0;
     vq_last_used = 0;
-    descs_in_use = 0;
 
     __asm__ volatile("dmb sy" ::: "memory");
 
@@ -218,122 +261,248 @@ static void virtqueue_init(void) {
     }
 }
 
-/* Allocate descriptor */
-static int alloc_desc(void) {
-    if (descs_in_use >= vq_num) {
-        return -1;  /* No free descriptors */
-    }
-    int desc = vq_free_head;
-    vq_free_head = vq_desc[desc].next;
-    descs_in_use++;
-    return desc;
-}
-
-/* Free descriptor */
-static void free_desc(int desc) {
-    if (desc < 0 || desc >= vq_num) return;
-    vq_desc[desc].next = vq_free_head;
-    vq_free_head = desc;
-    if (descs_in_use > 0) descs_in_use--;
-}
+/* Reset the device and bring it up with an empty queue. Once the reset
+ * completes the device no longer touches any buffer it was given */
+static void device_setup(void) {
+    mmio_write(blk_base, VIRTIO_MMIO_STATUS, 0);
+    for (int i = 0; i < 100000 && mmio_read(blk_base, VIRTIO_MMIO_STATUS) != 0; i++);
 
-/* Perform I/O operation */
-static int do_blk_io(uint32_t type, uint64_t sector, uint32_t count, void* buf) {
-    if (!blk_initialized) return -1;
-    if (count == 0) return 0;
-    if (count > 128) count = 128;  /* Limit to data buffer size */
+    /* Legacy v1: set guest page size */
+    if (blk_version == 1) {
+        mmio_write(blk_base, VIRTIO_MMIO_GUEST_PAGE_SIZE, 4096);
+    }
 
-    /* Setup request header */
-    req_header->type = type;
-    req_header->reserved = 0;
-    req_header->sector = sector;
+    /* Acknowledge */
+    mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1);
 
-    /* For writes, copy data to buffer */
-    if (type == VIRTIO_BLK_T_OUT && buf) {
-        memcpy(data_buffer, buf, count * SECTOR_SIZE);
-    }
+    /* Driver loaded */
+    mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1 | 2);
 
-    /* Clear status */
-    *status_byte = 0xFF;
+    /* Accept features (none special needed) */
+    mmio_write(blk_base, VIRTIO_MMIO_DEV_FEAT_SEL, 0);
+    mmio_write(blk_base, VIRTIO_MMIO_DRV_FEAT_SEL, 0);
+    mmio_write(blk_base, VIRTIO_MMIO_DRV_FEAT, 0);
 
-    /* Allocate descriptors: header, data, status */
-    int desc0 = alloc_desc();
-    int desc1 = alloc_desc();
-    int desc2 = alloc_desc();
+    /* Initialize virtqueue */
+    virtqueue_init();
 
-    /* Check allocation succeeded */
-    if (desc0 < 0 || desc1 < 0 || desc2 < 0) {
-        if (desc0 >= 0) free_desc(desc0);
-        if (desc1 >= 0) free_desc(desc1);
-        if (desc2 >= 0) free_desc(desc2);
-        return -1;
+    /* Set driver ready */
+    if (blk_version == 1) {
+        mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1 | 2 | 4);
+    } else {
+        mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1 | 2 | 8);
+        mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1 | 2 | 8 | 4);
     }
+}
 
-    /* Header descriptor (device-readable) */
-    vq_desc[desc0].addr = (uint64_t)req_header;
-    vq_desc[desc0].len = sizeof(struct virtio_blk_req);
-    vq_desc[desc0].flags = VIRTQ_DESC_F_NEXT;
-    vq_desc[desc0].next = desc1;
-
-    /* Data descriptor */
-    vq_desc[desc1].addr = (uint64_t)data_buffer;
-    vq_desc[desc1].len = count * SECTOR_SIZE;
-    if (type == VIRTIO_BLK_T_IN) {
-        vq_desc[desc1].flags = VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_NEXT;
+/* Queue a request's part on free slot i (IRQs masked) */
+static void start_part(blk_req_t* req, int i) {
+    struct blk_slot* slot = &slots[i];
+    struct virtq_desc* d = &vq_desc[i * 3];
+    uint32_t n = req->count - req->next_part;
+    if (n > BLK_PART_SECTORS) n = BLK_PART_SECTORS;
+
+    slot->hdr.type = req->type;
+    slot->hdr.reserved = 0;
+    slot->hdr.sector = req->sector + req->next_part;
+    slot->status = 0xFF;
+    slot->busy = 1;
+    slot->req = req;
+    slots_free--;
+
+    if (n == 0) {
+        /* Flush: header straight to status */
+        d[0].next = i * 3 + 2;
     } else {
-        vq_desc[desc1].flags = VIRTQ_DESC_F_NEXT;
+        d[0].next = i * 3 + 1;
+        d[1].addr = (uint64_t)((uint8_t*)req->buf + req->next_part * SECTOR_SIZE);
+        d[1].len = n * SECTOR_SIZE;
+        d[1].flags = VIRTQ_DESC_F_NEXT;
+        if (req->type == VIRTIO_BLK_T_IN) {
+            /* No dirty line may be evicted over the device's data */
+            d[1].flags |= VIRTQ_DESC_F_WRITE;
+            dcache_flush_range((void*)d[1].addr, d[1].len);
+        } else {
+            dcache_clean_range((void*)d[1].addr, d[1].len);
+        }
     }
-    vq_desc[desc1].next = desc2;
-
-    /* Status descriptor (device-writable) */
-    vq_desc[desc2].addr = (uint64_t)status_byte;
-    vq_desc[desc2].len = 1;
-    vq_desc[desc2].flags = VIRTQ_DESC_F_WRITE;
-    vq_desc[desc2].next = 0;
+    req->next_part += n;
+    req->parts_left++;
 
     __asm__ volatile("dmb sy" ::: "memory");
-
-    /* Add to available ring */
     uint16_t avail_idx = vq_avail->idx;
-    vq_avail->ring[avail_idx % vq_num] = desc0;
+    vq_avail->ring[avail_idx % vq_num] = i * 3;
     __asm__ volatile("dmb sy" ::: "memory");
     vq_avail->idx = avail_idx + 1;
-    __asm__ volatile("dmb sy" ::: "memory");
+}
 
-    /* Notify device */
-    mmio_write(blk_base, VIRTIO_MMIO_QUEUE_NOTIFY, 0);
+/* Fill free slots from the pending queue, then notify once */
+static void start_pending(void) {
+    int started = 0;
+    int i = 0;
+
+    while (pending_head && slots_free > 0) {
+        while (slots[i].busy) i++;
+        blk_req_t* req = pending_head;
+        start_part(req, i);
+        started = 1;
+        /* A flush is a single part; data requests until count is issued */
+        if (req->count == 0 || req->next_part >= req->count) {
+            pending_head = req->next;
+            if (!pending_head) pending_tail = NULL;
+        }
+    }
 
-    /* Wait for completion */
-    volatile int timeout = 10000000;
-    while (vq_used->idx == vq_last_used && timeout > 0) {
+    if (started) {
         __asm__ volatile("dmb sy" ::: "memory");
-        timeout--;
+        mmio_write(blk_base, VIRTIO_MMIO_QUEUE_NOTIFY, 0);
     }
+}
 
-    /* Acknowledge interrupts */
+/*
+ * Retire every part the device has returned on the used ring, complete
+ * requests whose last part finished and start queued parts. Runs from
+ * the IRQ handler, or with IRQs masked from blk_wait/blk_poll.
+ */
+static void blk_service(void) {
+    while (*(volatile uint16_t*)&vq_used->idx != vq_last_used) {
+        __asm__ volatile("dmb sy" ::: "memory");
+        uint32_t id = vq_used->ring[vq_last_used % vq_num].id;
+        vq_last_used++;
+        if (id >= (uint32_t)num_slots * 3 || id % 3 != 0) continue;
+
+        struct blk_slot* slot = &slots[id / 3];
+        blk_req_t* req = slot->req;
+        if (slot->hdr.type == VIRTIO_BLK_T_IN) {
+            /* Drop lines fetched while the device was writing */
+            dcache_flush_range((void*)vq_desc[id + 1].addr, vq_desc[id + 1].len);
+        }
+        slot->busy = 0;
+        slot->req = NULL;
+        slots_free++;
+        if (!req) continue;
+
+        if (slot->status != VIRTIO_BLK_S_OK) req->status = -1;
+        req->parts_left--;
+        if (req->parts_left == 0 &&
+            (req->count == 0 || req->next_part >= req->count)) {
+            completion_signal(&req->done, req->status);
+        }
+    }
+    start_pending();
+}
+
+static void blk_irq(uint32_t irq) {
+    (void)irq;
     uint32_t int_status = mmio_read(blk_base, VIRTIO_MMIO_INT_STATUS);
     if (int_status) {
         mmio_write(blk_base, VIRTIO_MMIO_INT_ACK, int_status);
     }
+    blk_service();
+}
 
-    vq_last_used = vq_used->idx;
+int blk_submit(blk_req_t* req) {
+    if (!blk_initialized) return -1;
+    if (req->type != VIRTIO_BLK_T_FLUSH && (req->count == 0 || !req->buf)) {
+        return -1;
+    }
+
+    completion_init(&req->done, req->fn, req->arg);
+    req->next_part = 0;
+    req->parts_left = 0;
+    req->status = 0;
+    req->next = NULL;
+    if (req->type == VIRTIO_BLK_T_FLUSH) req->count = 0;
+
+    int irqs = interrupts_enabled();
+    disable_interrupts();
+    if (pending_tail) pending_tail->next = req;
+    else pending_head = req;
+    pending_tail = req;
+    start_pending();
+    if (irqs) enable_interrupts();
+    return 0;
+}
 
-    /* Free descriptors */
-    free_desc(desc0);
-    free_desc(desc1);
-    free_desc(desc2);
+int blk_poll(blk_req_t* req) {
+    int irqs = interrupts_enabled();
+    disable_interrupts();
+    blk_service();
+    if (irqs) enable_interrupts();
+    return req->done.done;
+}
 
-    /* Check status */
-    if (*status_byte != VIRTIO_BLK_S_OK) {
-        return -1;
+/* Take a request off the pending queue if it is on it (IRQs masked) */
+static void pending_remove(blk_req_t* req) {
+    blk_req_t** link = &pending_head;
+    pending_tail = NULL;
+    while (*link) {
+        if (*link == req) {
+            *link = req->next;
+        } else {
+            pending_tail = *link;
+            link = &(*link)->next;
+        }
+    }
+}
+
+/*
+ * Give up on a request that timed out. Its parts still in flight point
+ * at the caller's buffer, which is reused as soon as blk_wait returns,
+ * so the device is reset rather than left to complete them late. Other
+ * requests with parts in flight fail with it; requests not yet started
+ * run on the fresh queue.
+ */
+static void abandon(blk_req_t* req) {
+    int irqs = interrupts_enabled();
+    disable_interrupts();
+
+    /* Owners of the other parts in flight (the reset frees their slots) */
+    blk_req_t* failed[BLK_MAX_SLOTS];
+    int n = 0;
+    for (int i = 0; i < num_slots; i++) {
+        blk_req_t* r = slots[i].req;
+        if (!slots[i].busy || !r || r == req) continue;
+        int seen = 0;
+        for (int k = 0; k < n; k++) seen |= failed[k] == r;
+        if (!seen) failed[n++] = r;
     }
 
-    /* For reads, copy data from buffer */
-    if (type == VIRTIO_BLK_T_IN && buf) {
-        memcpy(buf, data_buffer, count * SECTOR_SIZE);
+    pending_remove(req);
+    device_setup();
+
+    for (int k = 0; k < n; k++) {
+        pending_remove(failed[k]);
+        completion_signal(&failed[k]->done, -1);
     }
+    start_pending();
 
-    return 0;
+    if (irqs) enable_interrupts();
+}
+
+int blk_wait(blk_req_t* req) {
+    if (completion_wait(&req->done, blk_service, BLK_TIMEOUT_MS) != 0) {
+        debug_puts("virtio-blk: request timed out\r\n");
+        abandon(req);
+        return -1;
+    }
+    return req->done.status;
+}
+
+/* Submit one request and sleep until it completes */
+static int blk_io(uint32_t type, uint64_t sector, uint32_t count, void* buf) {
+    if (!blk_initialized) return -1;
+    if (count == 0 && type != VIRTIO_BLK_T_FLUSH) return 0;
+
+    blk_req_t req;
+    req.type = type;
+    req.sector = sector;
+    req.count = count;
+    req.buf = buf;
+    req.fn = NULL;
+    req.arg = NULL;
+    if (blk_submit(&req) != 0) return -1;
+    return blk_wait(&req);
 }
 
 void blk_init(void) {
@@ -350,42 +519,8 @@ void blk_init(void) {
     debug_hex64(blk_base);
     debug_puts("\r\n");
 
-    /* Get version and reset */
     blk_version = mmio_read(blk_base, VIRTIO_MMIO_VERSION);
-    mmio_write(blk_base, VIRTIO_MMIO_STATUS, 0);
-    for (volatile int i = 0; i < 10000; i++);
-
-    /* Legacy v1: set guest page size */
-    if (blk_version == 1) {
-        mmio_write(blk_base, VIRTIO_MMIO_GUEST_PAGE_SIZE, 4096);
-    }
-
-    /* Acknowledge */
-    mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1);
-
-    /* Driver loaded */
-    mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1 | 2);
-
-    /* Accept features (none special needed) */
-    mmio_write(blk_base, VIRTIO_MMIO_DEV_FEAT_SEL, 0);
-    mmio_write(blk_base, VIRTIO_MMIO_DRV_FEAT_SEL, 0);
-    mmio_write(blk_base, VIRTIO_MMIO_DRV_FEAT, 0);
-
-    /* Initialize virtqueue */
-    virtqueue_init();
-
-    /* Set driver ready */
-    if (blk_version == 1) {
-        mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1 | 2 | 4);
-    } else {
-        mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1 | 2 | 8);
-        mmio_write(blk_base, VIRTIO_MMIO_STATUS, 1 | 2 | 8 | 4);
-    }
-
-    /* Setup buffers */
-    req_header = (struct virtio_blk_req*)BLK_REQUEST_BASE;
-    data_buffer = (uint8_t*)BLK_DATA_BASE;
-    status_byte = (uint8_t*)(BLK_REQUEST_BASE + sizeof(struct virtio_blk_req));
+    device_setup();
 
     /* Read capacity from config space */
     uint32_t cap_low = mmio_read(blk_base, VIRTIO_BLK_CFG_CAPACITY);
@@ -410,6 +545,11 @@ void blk_init(void) {
     debug_puts(&buf[i + 1]);
     debug_puts(" MB)\r\n");
 
+    /* Completion interrupt for this transport slot */
+    uint32_t irq = VIRTIO_MMIO_SLOT_IRQ((blk_base - VIRTIO_MMIO_START) / VIRTIO_MMIO_SIZE);
+    gic_register_handler(irq, blk_irq);
+    gic_enable_irq(irq);
+
     blk_initialized = 1;
 }
 
@@ -422,81 +562,13 @@ int blk_available(void) {
 }
 
 int blk_read(uint64_t sector, uint32_t count, void* buf) {
-    /* Read in chunks if count is large (data buffer is 64KB = 128 sectors) */
-    while (count > 0) {
-        uint32_t chunk = count > 128 ? 128 : count;
-        if (do_blk_io(VIRTIO_BLK_T_IN, sector, chunk, buf) != 0) {
-            return -1;
-        }
-        sector += chunk;
-        count -= chunk;
-        buf = (uint8_t*)buf + chunk * SECTOR_SIZE;
-    }
-    return 0;
+    return blk_io(VIRTIO_BLK_T_IN, sector, count, buf);
 }
 
 int blk_write(uint64_t sector, uint32_t count, const void* buf) {
-    /* Write in chunks */
-    while (count > 0) {
-        uint32_t chunk = count > 128 ? 128 : count;
-        if (do_blk_io(VIRTIO_BLK_T_OUT, sector, chunk, (void*)buf) != 0) {
-            return -1;
-        }
-        sector += chunk;
-        count -= chunk;
-        buf = (const uint8_t*)buf + chunk * SECTOR_SIZE;
-    }
-    return 0;
+    return blk_io(VIRTIO_BLK_T_OUT, sector, count, (void*)buf);
 }
 
 int blk_flush(void) {
-    if (!blk_initialized) return -1;
-
-    /* Setup flush request */
-    req_header->type = VIRTIO_BLK_T_FLUSH;
-    req_header->reserved = 0;
-    req_header->sector = 0;
-    *status_byte = 0xFF;
-
-    int desc0 = alloc_desc();
-    int desc1 = alloc_desc();
-
-    /* Header */
-    vq_desc[desc0].addr = (uint64_t)req_header;
-    vq_desc[desc0].len = sizeof(struct virtio_blk_req);
-    vq_desc[desc0].flags = VIRTQ_DESC_F_NEXT;
-    vq_desc[desc0].next = desc1;
-
-    /* Status */
-    vq_desc[desc1].addr = (uint64_t)status_byte;
-    vq_desc[desc1].len = 1;
-    vq_desc[desc1].flags = VIRTQ_DESC_F_WRITE;
-    vq_desc[desc1].next = 0;
-
-    __asm__ volatile("dmb sy" ::: "memory");
-
-    uint16_t avail_idx = vq_avail->idx;
-    vq_avail->ring[avail_idx % vq_num] = desc0;
-    __asm__ volatile("dmb sy" ::: "memory");
-    vq_avail->idx = avail_idx + 1;
-    __asm__ volatile("dmb sy" ::: "memory");
-
-    mmio_write(blk_base, VIRTIO_MMIO_QUEUE_NOTIFY, 0);
-
-    volatile int timeout = 10000000;
-    while (vq_used->idx == vq_last_used && timeout > 0) {
-        __asm__ volatile("dmb sy" ::: "memory");
-        timeout--;
-    }
-
-    uint32_t int_status = mmio_read(blk_base, VIRTIO_MMIO_INT_STATUS);
-    if (int_status) {
-        mmio_write(blk_base, VIRTIO_MMIO_INT_ACK, int_status);
-    }
-
-    vq_last_used = vq_used->idx;
-    free_desc(desc0);
-    free_desc(desc1);
-
-    return (*status_byte == VIRTIO_BLK_S_OK) ? 0 : -1;
+    return blk_io(VIRTIO_BLK_T_FLUSH, 0, 0, NULL);
 }
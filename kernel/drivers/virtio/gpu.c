@@ -4,6 +4,10 @@
  */
 
 #include "types.h"
+#include "completion.h"
+#include "goldfish_fb.h"
+#include "gic.h"
+#include "memory.h"
 
 /* Virtio MMIO base addresses - scan for GPU device */
 #define VIRTIO_MMIO_START       0x0a000000
@@ -42,6 +46,9 @@
 
 static int virtio_version = 0;
 
+/* Give up waiting on a control command after this long (wall clock) */
+#define GPU_TIMEOUT_MS          5000
+
 /* Virtio GPU commands */
 #define VIRTIO_GPU_CMD_GET_DISPLAY_INFO     0x0100
 #define VIRTIO_GPU_CMD_RESOURCE_CREATE_2D   0x0101
@@ -56,6 +63,9 @@ static int virtio_version = 0;
 #define VIRTIO_GPU_CMD_GET_CAPSET_INFO      0x0108
 #define VIRTIO_GPU_CMD_GET_CAPSET           0x0109
 
+/* Header flags */
+#define VIRTIO_GPU_FLAG_FENCE               (1 << 0)
+
 /* Response types */
 #define VIRTIO_GPU_RESP_OK_NODATA           0x1100
 #define VIRTIO_GPU_RESP_OK_DISPLAY_INFO     0x1101
@@ -75,14 +85,44 @@ static uint32_t fb_width = 720;
 static uint32_t fb_height = 1280;
 
 /* Memory regions - MUST be within RAM (0x40080000 - 0x48080000) */
-#define FRAMEBUFFER_ADDR    0x42000000
+#define GPU_FRAMEBUFFER_ADDR    0x42000000
 #define VIRTQUEUE_ADDR      0x46000000
 #define CMD_BUFFER_ADDR     0x46100000
 
+/*
+ * Command ring: each slot owns a command/response buffer and a fixed
+ * descriptor pair (2 * slot, 2 * slot + 1). Slots are filled and retired
+ * in order; every command carries a fence id equal to its sequence
+ * number + 1, so "fence f done" means every slot before it retired.
+ */
+#define GPU_CMD_SLOTS       64
+#define GPU_SLOT_SIZE       1024    /* Command at +0, response at +512 */
+#define GPU_RESP_OFFSET     512
+
+/*
+ * Double buffering: each buffer is backed by its own host resource
+ * (resource id = index + 1). Drawing goes to the back buffer while the
+ * front one stays on the scanout; a flush transfers the back buffer and
+ * flips SET_SCANOUT to it, so the host never shows a half-drawn frame.
+ */
+#define GPU_NUM_BUFFERS     2
+#define GPU_FB_REGION_END   VIRTQUEUE_ADDR  /* Buffers must end below */
+#define GPU_FB_ALIGN        0x100000        /* 1MB between buffers */
+#define RESOURCE_ID(buf)    ((uint32_t)(buf) + 1)
+
 static uint64_t gpu_base = 0;
-static uint32_t* framebuffer = (uint32_t*)FRAMEBUFFER_ADDR;
+static uint32_t* buffers[GPU_NUM_BUFFERS] = { (uint32_t*)GPU_FRAMEBUFFER_ADDR };
+static int num_buffers = 1;
+static int back_buf = 0;                /* Buffer being drawn */
+static uint32_t scanout_res = 0;        /* Resource on the scanout (0 = none) */
+static uint32_t* framebuffer = (uint32_t*)GPU_FRAMEBUFFER_ADDR; /* = buffers[back_buf] */
 static int gpu_initialized = 0;
 
+/* Damage presented by the previous flush. With two resources the new back
+ * resource missed it, so it is transferred again along with new damage. */
+static fb_rect_t prev_damage[FB_DAMAGE_MAX];
+static int prev_count = 0;
+
 static inline void mmio_write(uint64_t base, uint32_t offset, uint32_t value) {
     *(volatile uint32_t*)(base + offset) = value;
     __asm__ volatile("dmb sy" ::: "memory");
@@ -191,20 +231,29 @@ struct virtio_gpu_resource_flush {
 static struct virtq_desc* vq_desc;
 static struct virtq_avail* vq_avail;
 static struct virtq_used* vq_used;
-static uint16_t vq_free_head = 0;
 static uint16_t vq_last_used = 0;
 static uint16_t vq_num = 0;
 
 /* Command/response buffers */
 static uint8_t* cmd_buf;
-static uint8_t* resp_buf;
 
-/* Track if scanout has been set (delay until first flush) */
-static int scanout_set = 0;
+/* Completion per command, indexed by head descriptor */
+static completion_t cmd_done[128];
+
+/* Command ring state (free-running sequence numbers) */
+static uint32_t num_slots = 0;
+static uint32_t slot_head = 0;      /* Next command to fill = last fence issued */
+static uint32_t slot_tail = 0;      /* Oldest unretired = last fence done */
+static uint32_t slot_kicked = 0;    /* Commands the device was notified of */
+static int gpu_stalled = 0;         /* Timed out; fail fast until it moves */
+
+/* Last fence that reads each buffer; it must pass before the buffer is
+ * drawn into again */
+static uint32_t buf_fence[GPU_NUM_BUFFERS];
 
 /* Forward declarations */
-void virtio_gpu_flush(void);
-static void set_scanout(void);
+int virtio_gpu_flush(void);
+static uint32_t set_scanout(uint32_t resource_id);
 
 static uint64_t find_virtio_gpu(void) {
     /* Scan MMIO for virtio-gpu (device ID 16) */
@@ -254,19 +303,16 @@ static void virtqueue_init(void) {
     vq_avail = (struct virtq_avail*)(queue_base + desc_size);
     vq_used = (struct virtq_used*)(queue_base + used_offset);
     cmd_buf = (uint8_t*)(CMD_BUFFER_ADDR);
-    resp_buf = (uint8_t*)(CMD_BUFFER_ADDR + 0x1000);
+
+    /* Two descriptors per ring slot */
+    num_slots = vq_num / 2;
+    if (num_slots > GPU_CMD_SLOTS) num_slots = GPU_CMD_SLOTS;
 
     /* Clear structures */
     for (uint32_t i = 0; i < used_offset + 4096; i++) {
         ((volatile uint8_t*)queue_base)[i] = 0;
     }
 
-    /* Initialize descriptor chain */
-    for (int i = 0; i < (int)vq_num - 1; i++) {
-        vq_desc[i].next = i + 1;
-    }
-    vq_free_head = 0;
-
     if (virtio_version == 1) {
         /* Version 1 (legacy): use page frame number */
         mmio_write(gpu_base, VIRTIO_MMIO_QUEUE_ALIGN, 4096);
@@ -283,34 +329,104 @@ static void virtqueue_init(void) {
     }
 }
 
-static int alloc_desc(void) {
-    int desc = vq_free_head;
-    vq_free_head = vq_desc[desc].next;
-    return desc;
+/* Complete every command the device has returned on the used ring.
+ * Runs from the IRQ handler, or with IRQs masked from completion_wait */
+static void gpu_reap(void) {
+    while (*(volatile uint16_t*)&vq_used->idx != vq_last_used) {
+        __asm__ volatile("dmb sy" ::: "memory");
+        uint32_t id = vq_used->ring[vq_last_used % vq_num].id;
+        vq_last_used++;
+        if (id < vq_num) {
+            completion_signal(&cmd_done[id], 0);
+        }
+    }
+}
+
+static void gpu_irq(uint32_t irq) {
+    (void)irq;
+    uint32_t int_status = mmio_read(gpu_base, VIRTIO_MMIO_INT_STATUS);
+    if (int_status) {
+        mmio_write(gpu_base, VIRTIO_MMIO_INT_ACK, int_status);
+    }
+    gpu_reap();
 }
 
-static void free_desc(int desc) {
-    vq_desc[desc].next = vq_free_head;
-    vq_free_head = desc;
+static inline uint32_t slot_desc(uint32_t seq) {
+    return (seq % num_slots) * 2;
 }
 
-static void send_command(void* cmd, uint32_t cmd_len, void* resp, uint32_t resp_len) {
-    /* Allocate descriptors */
-    int desc0 = alloc_desc();
-    int desc1 = alloc_desc();
+/* Retire finished commands in order */
+static void retire(void) {
+    while (slot_tail != slot_head && cmd_done[slot_desc(slot_tail)].done) {
+        slot_tail++;
+        gpu_stalled = 0;
+    }
+}
+
+/* Wait for one command; a timeout marks the ring stalled */
+static int wait_seq(uint32_t seq) {
+    completion_t* c = &cmd_done[slot_desc(seq)];
+    if (gpu_stalled) {
+        gpu_reap();
+        retire();
+        return c->done ? 0 : -1;
+    }
+    if (completion_wait(c, gpu_reap, GPU_TIMEOUT_MS) != 0) {
+        gpu_stalled = 1;
+        return -1;
+    }
+    return 0;
+}
+
+/* Notify the device of everything submitted since the last kick */
+static void gpu_kick(void) {
+    if (slot_kicked == slot_head) return;
+    slot_kicked = slot_head;
+    mmio_write(gpu_base, VIRTIO_MMIO_QUEUE_NOTIFY, 0);
+}
+
+/*
+ * Reserve the next slot and return its command buffer (response at
+ * +GPU_RESP_OFFSET). Waits for the oldest command when the ring is full
+ * (kicking first, it may not have been notified yet); returns NULL if it
+ * does not finish.
+ */
+static void* cmd_alloc(void) {
+    retire();
+    if (slot_head - slot_tail == num_slots) {
+        gpu_kick();
+        if (wait_seq(slot_tail) != 0) return NULL;
+        retire();
+    }
+    return cmd_buf + (slot_head % num_slots) * GPU_SLOT_SIZE;
+}
+
+/*
+ * Publish the command in the reserved slot. The device sees it after
+ * the next gpu_kick(), so several commands share one notify.
+ * Returns the command's fence id.
+ */
+static uint32_t cmd_submit(uint32_t cmd_len, uint32_t resp_len) {
+    uint32_t seq = slot_head;
+    uint32_t desc0 = slot_desc(seq);
+    uint32_t desc1 = desc0 + 1;
+    uint8_t* cmd = cmd_buf + (seq % num_slots) * GPU_SLOT_SIZE;
+    struct virtio_gpu_ctrl_hdr* hdr = (void*)cmd;
+
+    hdr->flags |= VIRTIO_GPU_FLAG_FENCE;
+    hdr->fence_id = seq + 1;
 
-    /* Setup command descriptor */
     vq_desc[desc0].addr = (uint64_t)cmd;
     vq_desc[desc0].len = cmd_len;
     vq_desc[desc0].flags = VIRTQ_DESC_F_NEXT;
     vq_desc[desc0].next = desc1;
 
-    /* Setup response descriptor */
-    vq_desc[desc1].addr = (uint64_t)resp;
+    vq_desc[desc1].addr = (uint64_t)(cmd + GPU_RESP_OFFSET);
     vq_desc[desc1].len = resp_len;
     vq_desc[desc1].flags = VIRTQ_DESC_F_WRITE;
     vq_desc[desc1].next = 0;
 
+    completion_init(&cmd_done[desc0], NULL, NULL);
     __asm__ volatile("dmb sy" ::: "memory");
 
     /* Add to available ring */
@@ -320,32 +436,31 @@ static void send_command(void* cmd, uint32_t cmd_len, void* resp, uint32_t resp_
     vq_avail->idx = avail_idx + 1;
     __asm__ volatile("dmb sy" ::: "memory");
 
-    /* Notify device */
-    mmio_write(gpu_base, VIRTIO_MMIO_QUEUE_NOTIFY, 0);
-
-    /* Wait for completion with timeout */
-    volatile int timeout = 5000000;
-    while (vq_used->idx == vq_last_used && timeout > 0) {
-        __asm__ volatile("dmb sy" ::: "memory");
-        timeout--;
-    }
+    slot_head++;
+    return seq + 1;
+}
 
-    /* Acknowledge any interrupts */
-    uint32_t int_status = mmio_read(gpu_base, VIRTIO_MMIO_INT_STATUS);
-    if (int_status) {
-        mmio_write(gpu_base, VIRTIO_MMIO_INT_ACK, int_status);
+/* Sleep until every command up to fence has completed.
+ * Returns 0 when done, -1 on timeout or while stalled */
+static int fence_wait(uint32_t fence) {
+    gpu_kick();
+    while ((int32_t)(fence - slot_tail) > 0) {
+        if (wait_seq(slot_tail) != 0) return -1;
+        retire();
     }
+    return 0;
+}
 
-    vq_last_used = vq_used->idx;
-
-    /* Free descriptors */
-    free_desc(desc0);
-    free_desc(desc1);
+/* Submit one command and wait for it (setup path) */
+static int send_command(uint32_t cmd_len, uint32_t resp_len) {
+    return fence_wait(cmd_submit(cmd_len, resp_len));
 }
 
 static void get_display_info(void) {
-    struct virtio_gpu_ctrl_hdr* cmd = (void*)cmd_buf;
-    struct virtio_gpu_resp_display_info* resp = (void*)resp_buf;
+    struct virtio_gpu_ctrl_hdr* cmd = cmd_alloc();
+    if (!cmd) return;
+    struct virtio_gpu_resp_display_info* resp =
+        (void*)((uint8_t*)cmd + GPU_RESP_OFFSET);
 
     cmd->type = VIRTIO_GPU_CMD_GET_DISPLAY_INFO;
     cmd->flags = 0;
@@ -353,7 +468,9 @@ static void get_display_info(void) {
     cmd->ctx_id = 0;
     cmd->padding = 0;
 
-    send_command(cmd, sizeof(*cmd), resp, sizeof(*resp));
+    if (send_command(sizeof(*cmd), sizeof(*resp)) != 0) {
+        return;  /* Keep the default mode */
+    }
 
     if (resp->hdr.type == VIRTIO_GPU_RESP_OK_DISPLAY_INFO) {
         if (resp->pmodes[0].enabled) {
@@ -365,48 +482,49 @@ static void get_display_info(void) {
     }
 }
 
-static void create_resource(void) {
-    struct virtio_gpu_resource_create_2d* cmd = (void*)cmd_buf;
-    struct virtio_gpu_ctrl_hdr* resp = (void*)resp_buf;
+static int create_resource(uint32_t resource_id) {
+    struct virtio_gpu_resource_create_2d* cmd = cmd_alloc();
+    if (!cmd) return -1;
 
     cmd->hdr.type = VIRTIO_GPU_CMD_RESOURCE_CREATE_2D;
     cmd->hdr.flags = 0;
     cmd->hdr.fence_id = 0;
     cmd->hdr.ctx_id = 0;
     cmd->hdr.padding = 0;
-    cmd->resource_id = 1;
+    cmd->resource_id = resource_id;
     cmd->format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
     cmd->width = fb_width;
     cmd->height = fb_height;
 
-    send_command(cmd, sizeof(*cmd), resp, sizeof(*resp));
+    return send_command(sizeof(*cmd), sizeof(struct virtio_gpu_ctrl_hdr));
 }
 
-static void attach_backing(void) {
+static int attach_backing(uint32_t resource_id, uint32_t* backing) {
     /* Command with inline memory entry */
     struct {
         struct virtio_gpu_resource_attach_backing cmd;
         struct virtio_gpu_mem_entry entry;
-    } __attribute__((packed)) *attach = (void*)cmd_buf;
-    struct virtio_gpu_ctrl_hdr* resp = (void*)resp_buf;
+    } __attribute__((packed)) *attach = cmd_alloc();
+    if (!attach) return -1;
 
     attach->cmd.hdr.type = VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING;
     attach->cmd.hdr.flags = 0;
     attach->cmd.hdr.fence_id = 0;
     attach->cmd.hdr.ctx_id = 0;
     attach->cmd.hdr.padding = 0;
-    attach->cmd.resource_id = 1;
+    attach->cmd.resource_id = resource_id;
     attach->cmd.nr_entries = 1;
-    attach->entry.addr = (uint64_t)framebuffer;
+    attach->entry.addr = (uint64_t)backing;
     attach->entry.length = fb_width * fb_height * 4;
     attach->entry.padding = 0;
 
-    send_command(attach, sizeof(*attach), resp, sizeof(*resp));
+    return send_command(sizeof(*attach), sizeof(struct virtio_gpu_ctrl_hdr));
 }
 
-static void set_scanout(void) {
-    struct virtio_gpu_set_scanout* cmd = (void*)cmd_buf;
-    struct virtio_gpu_ctrl_hdr* resp = (void*)resp_buf;
+/* Queue a scanout switch; returns its fence, 0 if the ring is stuck */
+static uint32_t set_scanout(uint32_t resource_id) {
+    struct virtio_gpu_set_scanout* cmd = cmd_alloc();
+    if (!cmd) return 0;
 
     cmd->hdr.type = VIRTIO_GPU_CMD_SET_SCANOUT;
     cmd->hdr.flags = 0;
@@ -418,9 +536,41 @@ static void set_scanout(void) {
     cmd->r.width = fb_width;
     cmd->r.height = fb_height;
     cmd->scanout_id = 0;
-    cmd->resource_id = 1;
+    cmd->resource_id = resource_id;
 
-    send_command(cmd, sizeof(*cmd), resp, sizeof(*resp));
+    return cmd_submit(sizeof(*cmd), sizeof(struct virtio_gpu_ctrl_hdr));
+}
+
+/*
+ * Place the buffers back to back (1MB aligned) in the region below the
+ * virtqueue and give each its own resource. Falls back to one buffer if
+ * the mode is too large for two or the second resource can't be set up.
+ */
+static void setup_buffers(void) {
+    uint64_t size = (uint64_t)fb_width * fb_height * 4;
+    uint64_t stride = (size + GPU_FB_ALIGN - 1) & ~(uint64_t)(GPU_FB_ALIGN - 1);
+
+    num_buffers = 1;
+    for (int i = 1; i < GPU_NUM_BUFFERS; i++) {
+        uint64_t addr = GPU_FRAMEBUFFER_ADDR + i * stride;
+        if (addr + size > GPU_FB_REGION_END) break;
+        buffers[i] = (uint32_t*)addr;
+        num_buffers++;
+    }
+
+    create_resource(RESOURCE_ID(0));
+    attach_backing(RESOURCE_ID(0), buffers[0]);
+    for (int i = 1; i < num_buffers; i++) {
+        if (create_resource(RESOURCE_ID(i)) != 0 ||
+            attach_backing(RESOURCE_ID(i), buffers[i]) != 0) {
+            num_buffers = i;
+            break;
+        }
+    }
+
+    back_buf = 0;
+    framebuffer = buffers[0];
+    prev_count = 0;
 }
 
 /* Goldfish Framebuffer - ARM64 ranchu address from device tree */
@@ -448,6 +598,11 @@ void virtio_gpu_init(void) {
         return;
     }
 
+    /* Completion interrupt for this transport slot */
+    uint32_t irq = VIRTIO_MMIO_SLOT_IRQ((gpu_base - VIRTIO_MMIO_START) / VIRTIO_MMIO_SIZE);
+    gic_register_handler(irq, gpu_irq);
+    gic_enable_irq(irq);
+
     /* Get version and reset device */
     virtio_version = mmio_read(gpu_base, VIRTIO_MMIO_VERSION);
     mmio_write(gpu_base, VIRTIO_MMIO_STATUS, 0);
@@ -483,67 +638,178 @@ void virtio_gpu_init(void) {
 
     /* Setup display - delay set_scanout until first flush */
     get_display_info();
-    create_resource();
-    attach_backing();
+    setup_buffers();
     /* set_scanout() called on first flush to avoid showing garbage */
 
     gpu_initialized = 1;
 }
 
-void virtio_gpu_flush(void) {
-    if (!gpu_initialized) return;
-
-    /* For Goldfish FB, just update the base address */
-    if (use_goldfish_fb) {
-        goldfish_fb_write(GOLDFISH_FB_SET_BASE, (uint32_t)(uint64_t)framebuffer);
-        return;
-    }
-
-    if (gpu_base == 0) return;
-
-    /* Set scanout on first flush (after framebuffer is drawn) */
-    if (!scanout_set) {
-        set_scanout();
-        scanout_set = 1;
-    }
-
-    /* Transfer to host */
-    struct virtio_gpu_transfer_to_host_2d* transfer = (void*)cmd_buf;
-    struct virtio_gpu_ctrl_hdr* resp = (void*)resp_buf;
+/* Queue a copy of one rectangle of guest memory into the host resource;
+ * returns its fence, 0 if the ring is stuck */
+static uint32_t transfer_rect(uint32_t resource_id, uint32_t x, uint32_t y,
+                              uint32_t w, uint32_t h) {
+    struct virtio_gpu_transfer_to_host_2d* transfer = cmd_alloc();
+    if (!transfer) return 0;
 
     transfer->hdr.type = VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D;
     transfer->hdr.flags = 0;
     transfer->hdr.fence_id = 0;
     transfer->hdr.ctx_id = 0;
     transfer->hdr.padding = 0;
-    transfer->r.x = 0;
-    transfer->r.y = 0;
-    transfer->r.width = fb_width;
-    transfer->r.height = fb_height;
-    transfer->offset = 0;
-    transfer->resource_id = 1;
+    transfer->r.x = x;
+    transfer->r.y = y;
+    transfer->r.width = w;
+    transfer->r.height = h;
+    /* Byte offset of the rectangle's first pixel in the backing store */
+    transfer->offset = ((uint64_t)y * fb_width + x) * 4;
+    transfer->resource_id = resource_id;
     transfer->padding = 0;
 
-    send_command(transfer, sizeof(*transfer), resp, sizeof(*resp));
+    return cmd_submit(sizeof(*transfer), sizeof(struct virtio_gpu_ctrl_hdr));
+}
 
-    /* Resource flush */
-    struct virtio_gpu_resource_flush* flush = (void*)cmd_buf;
+/* Queue a present of a rectangle of the host resource on the scanout;
+ * returns its fence, 0 if the ring is stuck */
+static uint32_t flush_rect(uint32_t resource_id, uint32_t x, uint32_t y,
+                           uint32_t w, uint32_t h) {
+    struct virtio_gpu_resource_flush* flush = cmd_alloc();
+    if (!flush) return 0;
 
     flush->hdr.type = VIRTIO_GPU_CMD_RESOURCE_FLUSH;
     flush->hdr.flags = 0;
     flush->hdr.fence_id = 0;
     flush->hdr.ctx_id = 0;
     flush->hdr.padding = 0;
-    flush->r.x = 0;
-    flush->r.y = 0;
-    flush->r.width = fb_width;
-    flush->r.height = fb_height;
-    flush->resource_id = 1;
+    flush->r.x = x;
+    flush->r.y = y;
+    flush->r.width = w;
+    flush->r.height = h;
+    flush->resource_id = resource_id;
     flush->padding = 0;
 
-    send_command(flush, sizeof(*flush), resp, sizeof(*resp));
+    return cmd_submit(sizeof(*flush), sizeof(struct virtio_gpu_ctrl_hdr));
+}
+
+/* Grow a bounding box (x0,y0)-(x1,y1) to include r */
+static void bbox_add(const fb_rect_t* r, int* x0, int* y0, int* x1, int* y1) {
+    if (r->x < *x0) *x0 = r->x;
+    if (r->y < *y0) *y0 = r->y;
+    if (r->x + r->w > *x1) *x1 = r->x + r->w;
+    if (r->y + r->h > *y1) *y1 = r->y + r->h;
+}
+
+/*
+ * The frame just presented becomes the front buffer. Copy its damaged
+ * rectangles into the new back buffer so renderers that only repaint
+ * what changed keep drawing on top of the current frame.
+ */
+static void flip_buffers(const fb_rect_t* rects, int count) {
+    if (num_buffers < 2) return;
+
+    uint32_t* front = buffers[back_buf];
+    back_buf = (back_buf + 1) % num_buffers;
+    framebuffer = buffers[back_buf];
+
+    for (int i = 0; i < count; i++) {
+        const fb_rect_t* r = &rects[i];
+        for (int y = r->y; y < r->y + r->h; y++) {
+            uint32_t off = (uint32_t)y * fb_width + r->x;
+            memcpy(framebuffer + off, front + off, (size_t)r->w * 4);
+        }
+        prev_damage[i] = *r;
+    }
+    prev_count = count;
+}
+
+/*
+ * Present the back buffer: queue the transfers for this frame's damage
+ * (plus what the back resource missed last frame), the scanout switch
+ * and one flush of the bounding box, then notify the device once.
+ * With two buffers we only wait for the commands that still read the
+ * buffer we flip to, so the next frame is drawn while this one is in
+ * flight. Rectangles must already be clipped.
+ */
+static int present(const fb_rect_t* rects, int count) {
+    if (!gpu_initialized) return 0;
+
+    /* For Goldfish FB, just update the base address */
+    if (use_goldfish_fb) {
+        goldfish_fb_write(GOLDFISH_FB_SET_BASE, (uint32_t)(uint64_t)framebuffer);
+        flip_buffers(rects, count);
+        return 0;
+    }
+
+    if (gpu_base == 0) return 0;
+
+    uint32_t res = RESOURCE_ID(back_buf);
+    int x0 = rects[0].x, y0 = rects[0].y;
+    int x1 = rects[0].x + rects[0].w, y1 = rects[0].y + rects[0].h;
+
+    for (int i = 0; i < count; i++) {
+        const fb_rect_t* r = &rects[i];
+        if (!transfer_rect(res, r->x, r->y, r->w, r->h)) goto busy;
+        bbox_add(r, &x0, &y0, &x1, &y1);
+    }
+    if (num_buffers > 1) {
+        for (int i = 0; i < prev_count; i++) {
+            const fb_rect_t* r = &prev_damage[i];
+            if (!transfer_rect(res, r->x, r->y, r->w, r->h)) goto busy;
+            bbox_add(r, &x0, &y0, &x1, &y1);
+        }
+    }
+
+    /* Scanout is set on the first flush (after the frame is drawn) and
+     * then flips between the resources */
+    if (scanout_res != res) {
+        if (!set_scanout(res)) goto busy;
+        scanout_res = res;
+    }
+    uint32_t fence = flush_rect(res, x0, y0, x1 - x0, y1 - y0);
+    if (!fence) goto busy;
+    gpu_kick();
+    buf_fence[back_buf] = fence;
+
+    if (num_buffers < 2) {
+        /* Single buffer: drawing must not race the transfer */
+        return fence_wait(fence);
+    }
+
+    /* The buffer we flip to was presented last frame - the copy-forward
+     * and the next frame's drawing must wait until the host read it */
+    uint32_t next = (back_buf + 1) % num_buffers;
+    if (fence_wait(buf_fence[next]) != 0) {
+        return -1;  /* Our commands are queued; caller redraws and retries */
+    }
+    flip_buffers(rects, count);
+    return 0;
+
+busy:
+    gpu_kick();
+    return -1;  /* Device busy - caller retries */
+}
+
+int virtio_gpu_flush(void) {
+    fb_rect_t full = { 0, 0, (int)fb_width, (int)fb_height };
+    return present(&full, 1);
+}
+
+/*
+ * Transfer only the damaged rectangles, then present their bounding box
+ * with a single RESOURCE_FLUSH. Rectangles must already be clipped.
+ */
+int virtio_gpu_flush_rects(const fb_rect_t* rects, int count) {
+    if (count <= 0) return 0;
+    if (count > FB_DAMAGE_MAX) return virtio_gpu_flush();
+    return present(rects, count);
+}
+
+/* Wait until every queued command has completed (0 = idle, -1 = timeout) */
+int virtio_gpu_sync(void) {
+    if (!gpu_initialized || use_goldfish_fb || gpu_base == 0) return 0;
+    return fence_wait(slot_head);
 }
 
+/* Buffer to draw the next frame into - changes after every flush */
 uint32_t* virtio_gpu_get_framebuffer(void) {
     return framebuffer;
 }
@@ -429,6 +429,18 @@ static int query_ev_bits(uint64_t base, uint8_t ev_type) {
   return size;
 }
 
+/* Acknowledge the interrupt; events are taken by virtio_input_poll() */
+static void input_irq(uint32_t irq) {
+  for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+    struct input_device *dev = &input_devices[i];
+    if (!dev->base || dev->irq != (int)irq)
+      continue;
+    uint32_t status = mmio_read(dev->base, VIRTIO_MMIO_INT_STATUS);
+    if (status)
+      mmio_write(dev->base, VIRTIO_MMIO_INT_ACK, status);
+  }
+}
+
 /* Initialize a single input device */
 static int init_input_device(uint64_t base, int dev_idx) {
   debug_puts("  init dev ");
@@ -516,7 +528,11 @@ static int init_input_device(uint64_t base, int dev_idx) {
     debug_puts("    -> keyboard\r\n");
   }
 
-  dev->irq = 32 + dev_idx + 16;
+  /* Used-ring interrupt: wakes the CPU, virtio_input_ready() tells the
+   * scheduler */
+  dev->irq = VIRTIO_MMIO_SLOT_IRQ((base - VIRTIO_MMIO_START) / VIRTIO_MMIO_SIZE);
+  gic_register_handler(dev->irq, input_irq);
+  gic_enable_irq(dev->irq);
   dev->active = 1;
 
   return 0;
@@ -705,6 +721,17 @@ int virtio_input_touch_available(void) { return touch_available; }
 
 int virtio_input_pending(void) { return event_pending(); }
 
+int virtio_input_ready(void) {
+  if (goldfish_events_active)
+    return 1; /* No interrupt: polled */
+  for (int i = 0; i < num_input_devices; i++) {
+    struct input_device *dev = &input_devices[i];
+    if (dev->active && *(volatile uint16_t *)&dev->used->idx != dev->last_used)
+      return 1;
+  }
+  return 0;
+}
+
 void virtio_input_get_touch(int32_t *x, int32_t *y, int *is_down) {
   if (x)
     *x = touch_x;
@@ -4,6 +4,8 @@
 
 #include "virtio_net.h"
 #include "memory.h"
+#include "gic.h"
+#include "pcap.h"
 
 /* Virtio MMIO registers */
 #define VIRTIO_MAGIC         0x000
@@ -31,8 +33,14 @@
 #define VIRTIO_STATUS_FEATURES_OK 8
 
 /* Virtio net features */
-#define VIRTIO_NET_F_MAC    (1 << 5)
-#define VIRTIO_NET_F_STATUS (1 << 16)
+#define VIRTIO_NET_F_CSUM       (1 << 0)    /* Device completes TX checksums */
+#define VIRTIO_NET_F_GUEST_CSUM (1 << 1)    /* Device validates RX checksums */
+#define VIRTIO_NET_F_MAC        (1 << 5)
+#define VIRTIO_NET_F_STATUS     (1 << 16)
+
+/* virtio_net_hdr flags */
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM  1
+#define VIRTIO_NET_HDR_F_DATA_VALID  2
 
 /* Virtqueue structures */
 struct virtq_desc {
@@ -45,6 +53,9 @@ struct virtq_desc {
 #define VIRTQ_DESC_F_NEXT     1
 #define VIRTQ_DESC_F_WRITE    2
 
+#define VIRTQ_USED_F_NO_NOTIFY 1
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+
 struct virtq_avail {
     uint16_t flags;
     uint16_t idx;
@@ -63,7 +74,7 @@ struct virtq_used {
 };
 
 /* Queue configuration */
-#define QUEUE_SIZE 16
+#define QUEUE_SIZE 64
 #define RX_QUEUE 0
 #define TX_QUEUE 1
 
@@ -73,10 +84,11 @@ struct virtq_used {
 /* Driver state */
 static volatile uint32_t* mmio_base = 0;
 static net_status_t status = {0};
+static net_link_stats_t stats = {0};
 
 /* Memory will be allocated from heap */
 static uint8_t* net_memory = 0;
-#define NET_MEM_SIZE     (64 * 1024)  /* 64KB for all network buffers */
+#define NET_MEM_SIZE     (512 * 1024) /* 512KB for all network buffers */
 
 /* Virtqueue pointers */
 static struct virtq_desc* rx_desc;
@@ -88,11 +100,24 @@ static struct virtq_used* tx_used;
 
 /* Packet buffers */
 static uint8_t* rx_buffers;  /* QUEUE_SIZE * PACKET_BUF_SIZE */
-static uint8_t* tx_buffer;   /* Single TX buffer */
+static uint8_t* tx_buffers;  /* QUEUE_SIZE * PACKET_BUF_SIZE, one per descriptor */
+
+/* RX buffers handed out stay off the ring until their last reference
+ * is released. Holds beyond the frame being processed are capped so the
+ * device always keeps buffers to receive into */
+#define RX_HOLD_MAX (QUEUE_SIZE / 2)
+static uint8_t rx_refs[QUEUE_SIZE];
+static uint16_t rx_out = 0;         /* Buffers taken and not yet recycled */
 
 /* Tracking */
 static uint16_t rx_last_used = 0;
-static uint16_t tx_free_desc = 0;
+static uint16_t rx_avail_next = 0;  /* Recycled buffers not yet published */
+
+/* TX descriptors not owned by the device, reclaimed from the used ring */
+static uint16_t tx_free[QUEUE_SIZE];
+static uint16_t tx_free_count = 0;
+static uint16_t tx_last_used = 0;
+static uint16_t tx_avail_next = 0;  /* Queued frames not yet published */
 
 /* MMIO helpers */
 static inline uint32_t mmio_read(uint32_t offset) {
@@ -146,11 +171,35 @@ static void setup_rx_buffers(void) {
         rx_avail->ring[i] = i;
     }
     rx_avail->idx = QUEUE_SIZE;
+    rx_avail_next = QUEUE_SIZE;
 
     /* Notify device */
     mmio_write(VIRTIO_QUEUE_NOTIFY, RX_QUEUE);
 }
 
+/* Each TX descriptor owns a fixed buffer; all start free */
+static void setup_tx_buffers(void) {
+    for (int i = 0; i < QUEUE_SIZE; i++) {
+        tx_desc[i].addr = (uint64_t)(tx_buffers + i * PACKET_BUF_SIZE);
+        tx_desc[i].flags = 0;
+        tx_desc[i].next = 0;
+        tx_free[i] = QUEUE_SIZE - 1 - i;
+    }
+    tx_free_count = QUEUE_SIZE;
+    tx_last_used = 0;
+    tx_avail_next = 0;
+}
+
+/* Acknowledge the interrupt; it only wakes the CPU, frames are taken
+ * by net_poll() once virtio_net_rx_pending() reports them */
+static void net_irq(uint32_t irq) {
+    (void)irq;
+    uint32_t int_status = mmio_read(VIRTIO_INT_STATUS);
+    if (int_status) {
+        mmio_write(VIRTIO_INT_ACK, int_status);
+    }
+}
+
 /* Debug UART */
 #define NET_UART_BASE 0x09000000
 static void net_puts(const char* s) {
@@ -188,10 +237,12 @@ void virtio_net_init(void) {
         mmio_write(VIRTIO_STATUS, VIRTIO_STATUS_ACK);
         mmio_write(VIRTIO_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
 
-        /* Read features and negotiate MAC feature */
+        /* Read features and negotiate MAC and checksum offload */
         uint32_t features = mmio_read(VIRTIO_DEV_FEATURES);
-        uint32_t wanted = VIRTIO_NET_F_MAC;
+        uint32_t wanted = VIRTIO_NET_F_MAC | VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM;
         mmio_write(VIRTIO_DRV_FEATURES, features & wanted);
+        status.tx_csum = (features & VIRTIO_NET_F_CSUM) != 0;
+        status.rx_csum = (features & VIRTIO_NET_F_GUEST_CSUM) != 0;
 
         /* Read MAC address from config space */
         volatile uint8_t* mac_cfg = (volatile uint8_t*)((uint64_t)mmio_base + VIRTIO_CONFIG);
@@ -219,7 +270,7 @@ void virtio_net_init(void) {
         uint8_t* rx_queue_base = net_memory;
         uint8_t* tx_queue_base = net_memory + 0x2000;  /* 8KB offset - enough for RX queue */
         rx_buffers = net_memory + 0x4000;              /* 16KB offset */
-        tx_buffer = rx_buffers + QUEUE_SIZE * PACKET_BUF_SIZE;
+        tx_buffers = rx_buffers + QUEUE_SIZE * PACKET_BUF_SIZE;
 
         /* Initialize RX queue with correct layout */
         init_queue_at(RX_QUEUE, rx_queue_base, &rx_desc, &rx_avail, &rx_used);
@@ -227,6 +278,13 @@ void virtio_net_init(void) {
 
         /* Initialize TX queue with correct layout */
         init_queue_at(TX_QUEUE, tx_queue_base, &tx_desc, &tx_avail, &tx_used);
+        setup_tx_buffers();
+
+        /* Only receives interrupt; sent buffers are reclaimed lazily */
+        tx_avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+        uint32_t irq = VIRTIO_MMIO_SLOT_IRQ(slot);
+        gic_register_handler(irq, net_irq);
+        gic_enable_irq(irq);
 
         /* Set driver OK */
         if (version == 1) {
@@ -261,95 +319,209 @@ net_status_t* virtio_net_get_status(void) {
     return &status;
 }
 
-int virtio_net_send(const void* data, uint32_t len) {
-    if (!status.available || !tx_buffer || len > PACKET_BUF_SIZE - VIRTIO_NET_HDR_SIZE) {
+net_link_stats_t* virtio_net_get_stats(void) {
+    return &stats;
+}
+
+/* Take back descriptors the device has finished sending */
+static void tx_reclaim(void) {
+    __asm__ volatile("dmb ish" ::: "memory");
+
+    volatile struct virtq_used* used = tx_used;
+    while (used->idx != tx_last_used) {
+        uint32_t id = used->ring[tx_last_used % QUEUE_SIZE].id;
+        tx_last_used++;
+        if (id < QUEUE_SIZE) {
+            tx_free[tx_free_count++] = id;
+        }
+    }
+}
+
+int virtio_net_tx_space(void) {
+    if (!status.available || !tx_used) return 0;
+    tx_reclaim();
+    return tx_free_count;
+}
+
+void virtio_net_tx_kick(void) {
+    if (!status.available || !tx_avail) return;
+
+    volatile struct virtq_avail* avail = tx_avail;
+    if (avail->idx == tx_avail_next) return;
+
+    /* Ring entries must be visible before the index that publishes them */
+    __asm__ volatile("dmb ish" ::: "memory");
+    avail->idx = tx_avail_next;
+    __asm__ volatile("dmb ish" ::: "memory");
+
+    volatile struct virtq_used* used = tx_used;
+    if (!(used->flags & VIRTQ_USED_F_NO_NOTIFY)) {
+        mmio_write(VIRTIO_QUEUE_NOTIFY, TX_QUEUE);
+        stats.tx_kicks++;
+    }
+}
+
+/* Queue a frame; a nonzero csum_start asks the device for the checksum */
+static int xmit(const void* data, uint32_t len, uint16_t csum_start,
+                uint16_t csum_offset, int more) {
+    if (!status.available || !tx_buffers) return -1;
+    if (len > PACKET_BUF_SIZE - VIRTIO_NET_HDR_SIZE) {
+        stats.tx_too_big++;
         return -1;
     }
 
-    /* Get TX buffer */
-    uint8_t* buf = tx_buffer;
+    if (tx_free_count == 0) {
+        tx_reclaim();
+        if (tx_free_count == 0) {
+            /* Ring full: push out what is queued so space frees up */
+            virtio_net_tx_kick();
+            stats.tx_ring_full++;
+            return -1;
+        }
+    }
+
+    /* The descriptor's own buffer: untouched until the device returns it */
+    uint16_t id = tx_free[--tx_free_count];
+    uint8_t* buf = (uint8_t*)(uintptr_t)tx_desc[id].addr;
 
     /* Prepare virtio-net header */
-    struct virtio_net_hdr* hdr = (struct virtio_net_hdr*)buf;
-    memset(hdr, 0, VIRTIO_NET_HDR_SIZE);
+    memset(buf, 0, VIRTIO_NET_HDR_SIZE);
+    if (csum_start) {
+        struct virtio_net_hdr* hdr = (struct virtio_net_hdr*)buf;
+        hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr->csum_start = csum_start;
+        hdr->csum_offset = csum_offset;
+    }
 
     /* Copy packet data after header */
     memcpy(buf + VIRTIO_NET_HDR_SIZE, data, len);
+    tx_desc[id].len = VIRTIO_NET_HDR_SIZE + len;
 
-    /* Setup descriptor */
-    tx_desc[tx_free_desc].addr = (uint64_t)buf;
-    tx_desc[tx_free_desc].len = VIRTIO_NET_HDR_SIZE + len;
-    tx_desc[tx_free_desc].flags = 0;
-    tx_desc[tx_free_desc].next = 0;
-
-    /* Add to available ring */
-    uint16_t avail_idx = tx_avail->idx % QUEUE_SIZE;
-    tx_avail->ring[avail_idx] = tx_free_desc;
+    /* Add to available ring; published by the kick */
+    tx_avail->ring[tx_avail_next % QUEUE_SIZE] = id;
+    tx_avail_next++;
+    stats.tx_packets++;
+    stats.tx_bytes += len;
+    pcap_record(data, len);
 
-    /* Memory barrier */
-    __asm__ volatile("dmb sy" ::: "memory");
+    if (!more) {
+        virtio_net_tx_kick();
+    }
+    return 0;
+}
 
-    tx_avail->idx++;
+int virtio_net_xmit(const void* data, uint32_t len, int more) {
+    return xmit(data, len, 0, 0, more);
+}
 
-    /* Notify device */
-    mmio_write(VIRTIO_QUEUE_NOTIFY, TX_QUEUE);
+int virtio_net_xmit_csum(const void* data, uint32_t len, uint16_t csum_start,
+                         uint16_t csum_offset, int more) {
+    if (!status.tx_csum) return -1;
+    return xmit(data, len, csum_start, csum_offset, more);
+}
 
-    /* Cycle through descriptors */
-    tx_free_desc = (tx_free_desc + 1) % QUEUE_SIZE;
+int virtio_net_send(const void* data, uint32_t len) {
+    return virtio_net_xmit(data, len, 0);
+}
 
-    return 0;
+/* Queue a buffer for virtio_net_rx_refill() to give back to the device */
+static void rx_recycle(uint16_t id) {
+    rx_avail->ring[rx_avail_next % QUEUE_SIZE] = id;
+    rx_avail_next++;
 }
 
-int virtio_net_recv(void* buffer, uint32_t max_len) {
+int virtio_net_rx_take(net_rxbuf_t* out) {
     if (!status.available || !rx_used || !rx_desc) return 0;
 
     /* Memory barrier before reading used ring */
     __asm__ volatile("dmb ish" ::: "memory");
 
-    /* Check if device has returned any buffers */
     volatile struct virtq_used* used = rx_used;
-    uint16_t used_idx = used->idx;
-    if (used_idx == rx_last_used) {
-        return 0;  /* No new packets */
-    }
+    while (used->idx != rx_last_used) {
+        uint16_t ring_idx = rx_last_used % QUEUE_SIZE;
+        uint32_t desc_idx = used->ring[ring_idx].id;
+        uint32_t total_len = used->ring[ring_idx].len;
+        rx_last_used++;
 
-    /* Get used buffer info */
-    uint16_t ring_idx = rx_last_used % QUEUE_SIZE;
-    uint32_t desc_idx = rx_used->ring[ring_idx].id;
-    uint32_t total_len = rx_used->ring[ring_idx].len;
+        /* Validate descriptor index */
+        if (desc_idx >= QUEUE_SIZE) continue;
 
-    /* Validate descriptor index */
-    if (desc_idx >= QUEUE_SIZE) {
-        rx_last_used++;
-        return 0;
+        /* Runt frames go straight back */
+        if (total_len <= VIRTIO_NET_HDR_SIZE) {
+            rx_recycle(desc_idx);
+            stats.rx_runts++;
+            continue;
+        }
+
+        /* Frame stays in place, just past the virtio-net header */
+        uint8_t* pkt = (uint8_t*)(uintptr_t)rx_desc[desc_idx].addr;
+        out->data = pkt + VIRTIO_NET_HDR_SIZE;
+        out->len = total_len - VIRTIO_NET_HDR_SIZE;
+        out->id = desc_idx;
+
+        /* A partial checksum comes from the host itself, so it is trusted
+         * like a validated one */
+        uint8_t flags = ((struct virtio_net_hdr*)pkt)->flags;
+        out->csum_valid = status.rx_csum &&
+            (flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM));
+        rx_refs[desc_idx] = 1;
+        rx_out++;
+        stats.rx_packets++;
+        stats.rx_bytes += out->len;
+        pcap_record(out->data, out->len);
+        return 1;
     }
+    return 0;
+}
 
-    /* Skip virtio-net header */
-    uint8_t* pkt = (uint8_t*)(uintptr_t)rx_desc[desc_idx].addr;
-    if (total_len <= VIRTIO_NET_HDR_SIZE) {
-        rx_last_used++;
-        return 0;
+int virtio_net_rx_hold(uint16_t id) {
+    if (id >= QUEUE_SIZE || rx_refs[id] == 0) return -1;
+
+    /* The first reference is the caller's own; a new buffer must fit */
+    if (rx_refs[id] == 1 && rx_out > RX_HOLD_MAX) {
+        stats.rx_hold_full++;
+        return -1;
     }
+    rx_refs[id]++;
+    return 0;
+}
+
+int virtio_net_rx_hold_room(void) {
+    return rx_out < RX_HOLD_MAX ? RX_HOLD_MAX - rx_out : 0;
+}
 
-    uint32_t pkt_len = total_len - VIRTIO_NET_HDR_SIZE;
-    if (pkt_len > max_len) pkt_len = max_len;
+void virtio_net_rx_release(uint16_t id) {
+    if (id >= QUEUE_SIZE || rx_refs[id] == 0) return;
 
-    /* Copy packet data (skip header) */
-    memcpy(buffer, pkt + VIRTIO_NET_HDR_SIZE, pkt_len);
+    if (--rx_refs[id] == 0) {
+        rx_out--;
+        rx_recycle(id);
+    }
+}
 
-    /* Return buffer to available ring */
-    uint16_t avail_idx = rx_avail->idx % QUEUE_SIZE;
-    rx_avail->ring[avail_idx] = desc_idx;
+int virtio_net_rx_pending(void) {
+    if (!status.available || !rx_used) return 0;
 
     __asm__ volatile("dmb ish" ::: "memory");
+    volatile struct virtq_used* used = rx_used;
+    return (uint16_t)(used->idx - rx_last_used);
+}
 
-    rx_avail->idx++;
-    rx_last_used++;
+void virtio_net_rx_refill(void) {
+    if (!status.available || !rx_avail) return;
 
-    /* Notify device we have more buffers */
-    mmio_write(VIRTIO_QUEUE_NOTIFY, RX_QUEUE);
+    volatile struct virtq_avail* avail = rx_avail;
+    if (avail->idx == rx_avail_next) return;
 
-    return pkt_len;
+    /* Ring entries must be visible before the index that publishes them */
+    __asm__ volatile("dmb ish" ::: "memory");
+    avail->idx = rx_avail_next;
+    __asm__ volatile("dmb ish" ::: "memory");
+
+    volatile struct virtq_used* used = rx_used;
+    if (!(used->flags & VIRTQ_USED_F_NO_NOTIFY)) {
+        mmio_write(VIRTIO_QUEUE_NOTIFY, RX_QUEUE);
+    }
 }
 
 void virtio_net_poll(void) {
@@ -1,6 +1,10 @@
 /*
  * TinyOS Event Queue
  * Lock-free SPSC ring buffer for input events
+ *
+ * Motion is coalesced at push time: a TOUCH_MOVE for the same slot as the
+ * newest queued TOUCH_MOVE just updates its position, so a fast drag
+ * costs one queue entry per frame instead of one per device report.
  */
 
 #include "event.h"
@@ -10,16 +14,51 @@ static input_event_t event_queue[EVENT_QUEUE_SIZE];
 static volatile uint32_t queue_head = 0;    /* Write index (producer/IRQ) */
 static volatile uint32_t queue_tail = 0;    /* Read index (consumer/main) */
 
+/* Statistics */
+static volatile uint32_t dropped_events = 0;
+static volatile uint32_t coalesced_events = 0;
+
 void event_queue_init(void) {
     queue_head = 0;
     queue_tail = 0;
+    dropped_events = 0;
+    coalesced_events = 0;
+}
+
+/*
+ * Merge a TOUCH_MOVE into the newest queued entry if it is a move for the
+ * same slot. The entry at queue_tail is never touched, since the consumer
+ * may be copying it right now; anything behind it is producer-owned.
+ */
+static int coalesce_move(const input_event_t* event) {
+    if (event->type != EVENT_TOUCH || event->subtype != TOUCH_MOVE) return 0;
+
+    uint32_t tail = queue_tail;
+    uint32_t last = (queue_head - 1) & EVENT_QUEUE_MASK;
+    if (queue_head == tail || last == tail) return 0;
+
+    input_event_t* prev = &event_queue[last];
+    if (prev->type != EVENT_TOUCH || prev->subtype != TOUCH_MOVE ||
+        prev->code != event->code) {
+        return 0;
+    }
+
+    prev->x = event->x;
+    prev->y = event->y;
+    coalesced_events++;
+    return 1;
 }
 
 int event_push(const input_event_t* event) {
+    if (coalesce_move(event)) {
+        return 0;
+    }
+
     uint32_t next_head = (queue_head + 1) & EVENT_QUEUE_MASK;
 
     /* Check if queue is full */
     if (next_head == queue_tail) {
+        dropped_events++;
         return -1;  /* Queue full, drop event */
     }
 
@@ -57,6 +96,30 @@ int event_pop(input_event_t* event) {
     return 0;
 }
 
+int event_pop_batch(input_event_t* events, int max) {
+    uint32_t tail = queue_tail;
+    uint32_t head = queue_head;
+    int n = 0;
+
+    /* Read head once, copy everything up to it, publish tail once */
+    __asm__ volatile("dmb sy" ::: "memory");
+    while (tail != head && n < max) {
+        events[n].type = event_queue[tail].type;
+        events[n].subtype = event_queue[tail].subtype;
+        events[n].code = event_queue[tail].code;
+        events[n].x = event_queue[tail].x;
+        events[n].y = event_queue[tail].y;
+        tail = (tail + 1) & EVENT_QUEUE_MASK;
+        n++;
+    }
+
+    if (n > 0) {
+        __asm__ volatile("dmb sy" ::: "memory");
+        queue_tail = tail;
+    }
+    return n;
+}
+
 int event_pending(void) {
     return queue_head != queue_tail;
 }
@@ -65,6 +128,14 @@ int event_count(void) {
     return (queue_head - queue_tail) & EVENT_QUEUE_MASK;
 }
 
+uint32_t event_dropped(void) {
+    return dropped_events;
+}
+
+uint32_t event_coalesced(void) {
+    return coalesced_events;
+}
+
 void event_push_key(uint16_t keycode, int pressed) {
     input_event_t ev;
     ev.type = EVENT_KEY;
@@ -4,11 +4,13 @@
  */
 
 #include "filemanager.h"
+#include "arena.h"
 #include "event.h"
 #include "font.h"
 #include "fs.h"
 #include "goldfish_fb.h"
 #include "keyboard.h"
+#include "raster.h"
 #include "types.h"
 #include "virtio_input.h"
 
@@ -56,12 +58,40 @@ static int edit_btn_pressed = 0;
 static int save_btn_pressed = 0;
 static int selected_for_action = -1; /* File selected for delete */
 
-/* Viewing/Editing file content */
+/* Viewing/Editing file content (buffer lives in the session arena) */
+#define VIEW_BUF_SIZE 512
+static arena_t fm_arena;
+
+/*
+ * Paged viewer: the file stays open and is read through a window that
+ * starts at the top visible line, so the page after it is already in
+ * memory when the user scrolls. Display lines (wrapped at the screen
+ * width) are found through a sparse index holding the offset of every
+ * view_stride-th line, filled in while scrolling; when it fills up, the
+ * stride doubles and every other checkpoint is dropped.
+ */
+#define VIEW_WINDOW_SIZE 8192
+#define VIEW_INDEX_MAX 256
+#define VIEW_INDEX_STRIDE 16
+#define VIEW_ARENA_SIZE                                                        \
+  (VIEW_BUF_SIZE + VIEW_WINDOW_SIZE + VIEW_INDEX_MAX * sizeof(uint32_t))
+static int view_fd = -1;
+static uint32_t view_size = 0;
+static char *view_window = NULL;
+static uint32_t view_win_start = 0;
+static uint32_t view_win_len = 0;
+static uint32_t *view_index = NULL; /* Offset of line k * view_stride */
+static int view_index_count = 0;
+static int view_stride = VIEW_INDEX_STRIDE;
+static int view_top = 0;          /* First visible line */
+static uint32_t view_top_off = 0; /* ... and where it starts */
+static int view_last = -1;        /* Last line, once the scan reached EOF */
+static int view_cols = 0;         /* Characters per display line */
 static int viewing_file = 0;
 static int editing_file = 0;
-static char view_content[512];
+static char *view_content = NULL;
 static int view_content_len = 0;
-static char view_filename[24];
+static char view_filename[FS_MAX_FILENAME];
 static int edit_cursor = 0;
 
 /* Screen dimensions */
@@ -96,6 +126,7 @@ static char keycode_to_char(uint16_t code) {
 /* Forward declarations */
 static void refresh_file_list(void);
 static void view_file(int idx);
+static void view_close(void);
 
 /* Draw back arrow */
 static void draw_back_arrow(uint32_t *fb, int cx, int cy, uint32_t color) {
@@ -122,15 +153,7 @@ static void draw_back_arrow(uint32_t *fb, int cx, int cy, uint32_t color) {
 /* Draw a filled rectangle */
 static void fill_rect(uint32_t *fb, int x, int y, int w, int h,
                       uint32_t color) {
-  for (int py = y; py < y + h && py < (int)screen_h; py++) {
-    if (py < 0)
-      continue;
-    for (int px = x; px < x + w && px < (int)screen_w; px++) {
-      if (px < 0)
-        continue;
-      fb[py * screen_w + px] = color;
-    }
-  }
+  raster_fill_rect(fb, x, y, w, h, color, 255, screen_w, screen_h);
 }
 
 /* Draw a file/folder icon */
@@ -387,6 +410,136 @@ static void draw_file_list(uint32_t *fb) {
   }
 }
 
+/* Fill the window from offset off */
+static int view_load(uint32_t off) {
+  if (fs_seek(view_fd, off, FS_SEEK_SET) < 0)
+    return -1;
+  int n = fs_read(view_fd, view_window, VIEW_WINDOW_SIZE);
+  view_win_start = off;
+  view_win_len = n > 0 ? n : 0;
+  return n > 0 ? 0 : -1;
+}
+
+/* Byte at off, moving the window there if needed (-1 past EOF) */
+static int view_byte(uint32_t off) {
+  if (off >= view_size)
+    return -1;
+  if (off < view_win_start || off >= view_win_start + view_win_len) {
+    if (view_load(off) != 0)
+      return -1;
+  }
+  return (unsigned char)view_window[off - view_win_start];
+}
+
+/* Start of the display line after the one at off (view_size at EOF) */
+static uint32_t view_next_line(uint32_t off) {
+  for (int col = 0; col < view_cols; col++) {
+    int c = view_byte(off);
+    if (c < 0)
+      return view_size;
+    off++;
+    if (c == '\n')
+      return off;
+  }
+  /* A newline right at the wrap point ends this line, not the next */
+  if (view_byte(off) == '\n')
+    off++;
+  return off;
+}
+
+/* Record that `line` starts at off if it is the next checkpoint */
+static void view_note(int line, uint32_t off) {
+  if (line % view_stride != 0 || line / view_stride != view_index_count)
+    return;
+  if (view_index_count == VIEW_INDEX_MAX) {
+    for (int k = 0; k < VIEW_INDEX_MAX / 2; k++)
+      view_index[k] = view_index[k * 2];
+    view_index_count = VIEW_INDEX_MAX / 2;
+    view_stride *= 2;
+    if (line % view_stride != 0 || line / view_stride != view_index_count)
+      return;
+  }
+  view_index[view_index_count++] = off;
+}
+
+/* Scan from `line` at off down to target (or the last line) and make it
+ * the top of the page */
+static void view_walk(int line, uint32_t off, int target) {
+  while (line < target) {
+    uint32_t next = view_next_line(off);
+    if (next >= view_size) {
+      view_last = line;
+      break;
+    }
+    line++;
+    off = next;
+    view_note(line, off);
+  }
+  view_top = line;
+  view_top_off = off;
+}
+
+/* Make `target` the top line, starting from the nearest checkpoint */
+static void view_goto(int target) {
+  if (target < 0)
+    target = 0;
+  if (view_last >= 0 && target > view_last)
+    target = view_last;
+  int k = target / view_stride;
+  if (k >= view_index_count)
+    k = view_index_count - 1;
+  view_walk(k * view_stride, view_index[k], target);
+}
+
+static int view_page_lines(void) {
+  int lines = ((int)screen_h - 40 - (TITLE_BAR_HEIGHT + 10)) / (FONT_HEIGHT + 2);
+  return lines > 1 ? lines : 1;
+}
+
+static void view_scroll(int lines) {
+  if (lines > 0) {
+    view_walk(view_top, view_top_off, view_top + lines);
+  } else {
+    view_goto(view_top + lines);
+  }
+}
+
+/* Draw the lines from view_top down, reading only this page */
+static void draw_paged_view(uint32_t *fb, int max_y) {
+  int y = TITLE_BAR_HEIGHT + 10;
+
+  if (view_size == 0) {
+    draw_string(fb, FILE_PADDING, y, "(empty file)", COLOR_EMPTY, screen_w,
+                screen_h);
+    return;
+  }
+
+  /* Keep this page and the next one in the window */
+  uint32_t win_end = view_win_start + view_win_len;
+  if (view_top_off < view_win_start ||
+      (win_end < view_size && view_top_off + VIEW_WINDOW_SIZE / 2 > win_end)) {
+    view_load(view_top_off);
+  }
+
+  uint32_t off = view_top_off;
+  while (y < max_y && off < view_size) {
+    uint32_t next = view_next_line(off);
+    char line[80];
+    int len = 0;
+    for (uint32_t i = off; i < next && len < 79; i++) {
+      int c = view_byte(i);
+      if (c == '\n')
+        break;
+      line[len++] = (c >= 32 && c < 127) ? c : '.';
+    }
+    line[len] = 0;
+    draw_string(fb, FILE_PADDING, y, line, COLOR_FILE_TEXT, screen_w,
+                screen_h);
+    y += FONT_HEIGHT + 2;
+    off = next;
+  }
+}
+
 /* Draw file viewer */
 static void draw_file_viewer(uint32_t *fb) {
   int y = TITLE_BAR_HEIGHT + 10;
@@ -400,6 +553,12 @@ static void draw_file_viewer(uint32_t *fb) {
                   ? (int)screen_h - keyboard_get_height() - 40
                   : (int)screen_h - 40;
 
+  if (!editing_file) {
+    draw_paged_view(fb, max_y);
+    return;
+  }
+
+  /* Editing: the whole (small) file is in the edit buffer */
   for (int i = 0; i <= view_content_len && y < max_y; i++) {
     /* Track cursor position */
     if (editing_file && i == edit_cursor) {
@@ -488,6 +647,14 @@ void filemanager_init(void) {
   status_msg[0] = 0;
   status_is_error = 0;
 
+  /* Fresh session arena for this app session */
+  view_close();
+  arena_init(&fm_arena, "files", VIEW_ARENA_SIZE);
+  arena_reset(&fm_arena);
+  view_content = NULL;
+  view_window = NULL;
+  view_index = NULL;
+
   /* Load files immediately */
   refresh_file_list();
 }
@@ -504,6 +671,51 @@ static void refresh_file_list(void) {
   scroll_offset = 0;
 }
 
+static void view_close(void) {
+  if (view_fd >= 0) {
+    fs_close(view_fd);
+    view_fd = -1;
+  }
+}
+
+/* Open view_filename in the paged viewer at its first line */
+static int view_open(void) {
+  view_close();
+  view_fd = fs_open(view_filename, FS_O_READ);
+  if (view_fd < 0)
+    return -1;
+
+  view_size = fs_size(view_fd);
+  view_win_start = 0;
+  view_win_len = 0;
+  view_cols = (screen_w - FILE_PADDING * 2) / FONT_WIDTH;
+  if (view_cols > 79)
+    view_cols = 79;
+  if (view_cols < 1)
+    view_cols = 1;
+  view_stride = VIEW_INDEX_STRIDE;
+  view_index[0] = 0;
+  view_index_count = 1;
+  view_top = 0;
+  view_top_off = 0;
+  view_last = -1;
+  view_load(0);
+  return 0;
+}
+
+/* Copy a small file into the edit buffer (-1 if it doesn't fit) */
+static int view_edit_load(void) {
+  if (view_size > VIEW_BUF_SIZE - 2)
+    return -1;
+  if (fs_seek(view_fd, 0, FS_SEEK_SET) < 0)
+    return -1;
+  view_content_len = fs_read(view_fd, view_content, view_size);
+  if (view_content_len < 0)
+    view_content_len = 0;
+  view_content[view_content_len] = 0;
+  return 0;
+}
+
 static void view_file(int idx) {
   if (idx < 0 || idx >= file_count)
     return;
@@ -512,8 +724,22 @@ static void view_file(int idx) {
   if (f->flags & 0x01)
     return; /* Skip folders */
 
-  int fd = fs_open(f->name, FS_O_READ);
-  if (fd < 0) {
+  /* Previous view's buffers are no longer referenced */
+  view_close();
+  arena_reset(&fm_arena);
+  view_content = arena_alloc(&fm_arena, VIEW_BUF_SIZE);
+  view_window = arena_alloc(&fm_arena, VIEW_WINDOW_SIZE);
+  view_index = arena_alloc(&fm_arena, VIEW_INDEX_MAX * sizeof(uint32_t));
+  view_content_len = 0;
+
+  /* Copy filename */
+  int i;
+  for (i = 0; f->name[i] && i < FS_MAX_FILENAME - 1; i++) {
+    view_filename[i] = f->name[i];
+  }
+  view_filename[i] = 0;
+
+  if (!view_content || !view_window || !view_index || view_open() != 0) {
     status_msg[0] = 'E';
     status_msg[1] = 'r';
     status_msg[2] = 'r';
@@ -524,19 +750,6 @@ static void view_file(int idx) {
     return;
   }
 
-  view_content_len = fs_read(fd, view_content, 511);
-  if (view_content_len < 0)
-    view_content_len = 0;
-  view_content[view_content_len] = 0;
-  fs_close(fd);
-
-  /* Copy filename */
-  int i;
-  for (i = 0; f->name[i] && i < 23; i++) {
-    view_filename[i] = f->name[i];
-  }
-  view_filename[i] = 0;
-
   viewing_file = 1;
   status_msg[0] = 0;
 }
@@ -574,10 +787,12 @@ static void save_file(void) {
   if (!viewing_file || !editing_file)
     return;
 
+  view_close();
   int fd = fs_open(view_filename, FS_O_WRITE | FS_O_CREATE | FS_O_TRUNC);
   if (fd >= 0) {
     fs_write(fd, view_content, view_content_len);
     fs_close(fd);
+    view_open();
     status_msg[0] = 'S';
     status_msg[1] = 'a';
     status_msg[2] = 'v';
@@ -588,6 +803,7 @@ static void save_file(void) {
     editing_file = 0;
     keyboard_hide();
   } else {
+    view_open();
     status_msg[0] = 'E';
     status_msg[1] = 'r';
     status_msg[2] = 'r';
@@ -685,7 +901,10 @@ int filemanager_update(void) {
     }
   }
 
-  while (event_pop(&ev) == 0) {
+  input_event_t batch[EVENT_BATCH_MAX];
+  int batch_len = event_pop_batch(batch, EVENT_BATCH_MAX);
+  for (int ei = 0; ei < batch_len; ei++) {
+    ev = batch[ei];
     /* Handle hardware keyboard */
     if (ev.type == EVENT_KEY) {
       /* Track shift state */
@@ -740,9 +959,19 @@ int filemanager_update(void) {
             needs_redraw = 1;
           }
         }
+      } else if (viewing_file && ev.code == KEY_DOWN) {
+        view_scroll(1);
+        needs_redraw = 1;
+      } else if (viewing_file && ev.code == KEY_UP) {
+        view_scroll(-1);
+        needs_redraw = 1;
+      } else if (viewing_file && ev.code == KEY_SPACE) {
+        view_scroll(view_page_lines());
+        needs_redraw = 1;
       } else if (ev.code == KEY_ESC) {
         /* ESC to go back */
         if (viewing_file) {
+          view_close();
           viewing_file = 0;
           status_msg[0] = 0;
         } else {
@@ -800,6 +1029,7 @@ int filemanager_update(void) {
             keyboard_hide();
             status_msg[0] = 0;
           } else if (viewing_file) {
+            view_close();
             viewing_file = 0;
             status_msg[0] = 0;
           } else {
@@ -807,12 +1037,24 @@ int filemanager_update(void) {
           }
         } else if (edit_btn_pressed && sy < TITLE_BAR_HEIGHT &&
                    sx >= (int)screen_w - 50) {
-          /* Enter edit mode */
-          editing_file = 1;
-          edit_cursor = view_content_len; /* Cursor at end */
-          keyboard_init(screen_w, screen_h);
-          keyboard_show();
-          status_msg[0] = 0;
+          /* Enter edit mode (small files only) */
+          if (view_edit_load() == 0) {
+            editing_file = 1;
+            edit_cursor = view_content_len; /* Cursor at end */
+            keyboard_init(screen_w, screen_h);
+            keyboard_show();
+            status_msg[0] = 0;
+          } else {
+            status_msg[0] = 'T';
+            status_msg[1] = 'o';
+            status_msg[2] = 'o';
+            status_msg[3] = ' ';
+            status_msg[4] = 'b';
+            status_msg[5] = 'i';
+            status_msg[6] = 'g';
+            status_msg[7] = 0;
+            status_is_error = 1;
+          }
         } else if (save_btn_pressed && sy < TITLE_BAR_HEIGHT &&
                    sx >= (int)screen_w - 50) {
           /* Save file */
@@ -822,6 +1064,10 @@ int filemanager_update(void) {
         } else if (del_btn_pressed && sy < TITLE_BAR_HEIGHT &&
                    selected_for_action >= 0) {
           do_delete_file(selected_for_action);
+        } else if (viewing_file && !editing_file && sy > TITLE_BAR_HEIGHT) {
+          /* Lower half pages forward, upper half back */
+          int page = view_page_lines();
+          view_scroll(sy > (int)screen_h / 2 ? page : -page);
         } else if (!viewing_file && touch_file_idx >= 0) {
           if (selected_for_action == touch_file_idx) {
             /* Double tap - view file */
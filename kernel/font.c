@@ -4,6 +4,7 @@
  */
 
 #include "font.h"
+#include "goldfish_fb.h"
 
 /* 8x12 font - each character is 12 bytes (rows), 8 bits per row */
 const uint8_t font_8x12[128][12] = {
@@ -125,34 +126,174 @@ const uint8_t font_8x12[128][12] = {
     [127] = {0,0,0,0,0,0,0,0,0,0,0,0}
 };
 
-/* Draw a single character */
-void draw_char(uint32_t* fb, int x, int y, char c, uint32_t color, int fb_width, int fb_height) {
-    if ((unsigned char)c > 127) return;
-    if (x < 0 || y < 0 || x + FONT_WIDTH > fb_width || y + FONT_HEIGHT > fb_height) return;
+/*
+ * Glyph rendering
+ *
+ * Every 8-pixel glyph row is drawn as one unit. row_masks[] expands each
+ * of the 256 possible row bit patterns into 8 per-pixel masks (all ones
+ * where a bit is set), built once on first use. A row is then a bitwise
+ * select between the text color and either the existing pixels
+ * (transparent text) or the background color (opaque text), done on
+ * ARM64 as two 128-bit NEON loads/stores. The masks are independent of
+ * the color, so one 8KB table serves every color pair.
+ *
+ * LD1/ST1 on 32-bit lanes only need 4-byte alignment, which every pixel
+ * address has, so this is also safe while the MMU is off.
+ */
+
+static uint32_t row_masks[256][FONT_WIDTH] __attribute__((aligned(16)));
+static int masks_ready = 0;
+
+static void build_masks(void) {
+    for (int bits = 0; bits < 256; bits++) {
+        for (int col = 0; col < FONT_WIDTH; col++) {
+            row_masks[bits][col] = (bits & (0x80 >> col)) ? 0xFFFFFFFF : 0;
+        }
+    }
+    masks_ready = 1;
+}
+
+/* Set the pixels of one row that are on in the mask, leave the rest */
+static inline void put_row(uint32_t* dst, const uint32_t* mask, uint32_t fg) {
+#ifdef __aarch64__
+    __asm__ volatile(
+        "ld1 {v0.4s, v1.4s}, [%0]\n"
+        "ld1 {v2.4s, v3.4s}, [%1]\n"
+        "dup v4.4s, %w2\n"
+        "bsl v2.16b, v4.16b, v0.16b\n"
+        "bsl v3.16b, v4.16b, v1.16b\n"
+        "st1 {v2.4s, v3.4s}, [%0]\n"
+        :
+        : "r"(dst), "r"(mask), "r"(fg)
+        : "v0", "v1", "v2", "v3", "v4", "memory");
+#else
+    for (int col = 0; col < FONT_WIDTH; col++) {
+        dst[col] = (fg & mask[col]) | (dst[col] & ~mask[col]);
+    }
+#endif
+}
 
+/* Write all 8 pixels of one row: fg where the mask is on, bg elsewhere */
+static inline void put_row_bg(uint32_t* dst, const uint32_t* mask,
+                              uint32_t fg, uint32_t bg) {
+#ifdef __aarch64__
+    __asm__ volatile(
+        "ld1 {v2.4s, v3.4s}, [%1]\n"
+        "dup v4.4s, %w2\n"
+        "dup v5.4s, %w3\n"
+        "bsl v2.16b, v4.16b, v5.16b\n"
+        "bsl v3.16b, v4.16b, v5.16b\n"
+        "st1 {v2.4s, v3.4s}, [%0]\n"
+        :
+        : "r"(dst), "r"(mask), "r"(fg), "r"(bg)
+        : "v2", "v3", "v4", "v5", "memory");
+#else
+    for (int col = 0; col < FONT_WIDTH; col++) {
+        dst[col] = (fg & mask[col]) | (bg & ~mask[col]);
+    }
+#endif
+}
+
+/* Draw a glyph that is known to be fully on the target */
+static void blit_glyph(uint32_t* fb, int x, int y, char c, uint32_t color, int fb_width) {
     const uint8_t* glyph = font_8x12[(unsigned char)c];
+    uint32_t* dst = fb + y * fb_width + x;
 
-    for (int row = 0; row < FONT_HEIGHT; row++) {
+    for (int row = 0; row < FONT_HEIGHT; row++, dst += fb_width) {
         uint8_t bits = glyph[row];
-        for (int col = 0; col < FONT_WIDTH; col++) {
-            if (bits & (0x80 >> col)) {
-                fb[(y + row) * fb_width + (x + col)] = color;
-            }
+        if (bits) put_row(dst, row_masks[bits], color);
+    }
+}
+
+/* Opaque variant: non-ASCII characters come out as background cells */
+static void blit_glyph_bg(uint32_t* fb, int x, int y, char c, uint32_t fg,
+                          uint32_t bg, int fb_width) {
+    unsigned char uc = (unsigned char)c;
+    const uint8_t* glyph = font_8x12[uc > 127 ? ' ' : uc];
+    uint32_t* dst = fb + y * fb_width + x;
+
+    for (int row = 0; row < FONT_HEIGHT; row++, dst += fb_width) {
+        put_row_bg(dst, row_masks[glyph[row]], fg, bg);
+    }
+}
+
+static int glyph_fits(int x, int y, char c, int fb_width, int fb_height) {
+    if ((unsigned char)c > 127) return 0;
+    return !(x < 0 || y < 0 || x + FONT_WIDTH > fb_width || y + FONT_HEIGHT > fb_height);
+}
+
+void draw_char(uint32_t* fb, int x, int y, char c, uint32_t color, int fb_width, int fb_height) {
+    if (!glyph_fits(x, y, c, fb_width, fb_height)) return;
+    if (!masks_ready) build_masks();
+
+    blit_glyph(fb, x, y, c, color, fb_width);
+
+    /* Offscreen targets don't need damage */
+    if (fb == goldfish_fb_get_buffer()) {
+        goldfish_fb_damage(x, y, FONT_WIDTH, FONT_HEIGHT);
+    }
+}
+
+/*
+ * Draw one line of n characters starting at (x, y). Clipping is done
+ * once for the whole line: glyphs that would not fit entirely are
+ * skipped, as draw_char does. The drawn x range is returned in x0..x1
+ * (x0 < 0 if nothing was drawn).
+ */
+static void draw_line(uint32_t* fb, int x, int y, const char* s, int n,
+                      uint32_t fg, uint32_t bg, int opaque,
+                      int fb_width, int fb_height, int* x0, int* x1) {
+    *x0 = -1;
+    if (n <= 0 || y < 0 || y + FONT_HEIGHT > fb_height) return;
+
+    if (x + FONT_WIDTH > fb_width) return;
+
+    int first = x < 0 ? (-x + FONT_WIDTH - 1) / FONT_WIDTH : 0;
+    int last = (fb_width - FONT_WIDTH - x) / FONT_WIDTH;    /* Inclusive */
+    if (last > n - 1) last = n - 1;
+    if (first > last) return;
+
+    for (int i = first; i <= last; i++) {
+        int cx = x + i * FONT_WIDTH;
+        if (opaque) {
+            blit_glyph_bg(fb, cx, y, s[i], fg, bg, fb_width);
+        } else if ((unsigned char)s[i] <= 127) {
+            blit_glyph(fb, cx, y, s[i], fg, fb_width);
         }
     }
+    *x0 = x + first * FONT_WIDTH;
+    *x1 = x + (last + 1) * FONT_WIDTH;
 }
 
-/* Draw a null-terminated string */
-void draw_string(uint32_t* fb, int x, int y, const char* str, uint32_t color, int fb_width, int fb_height) {
-    int startx = x;
-    while (*str) {
-        if (*str == '\n') {
-            x = startx;
-            y += FONT_HEIGHT;
-        } else {
-            draw_char(fb, x, y, *str, color, fb_width, fb_height);
-            x += FONT_WIDTH;
+/* Walk the lines of str, reporting one damage rect per line */
+static void draw_lines(uint32_t* fb, int x, int y, const char* str,
+                       uint32_t fg, uint32_t bg, int opaque,
+                       int fb_width, int fb_height) {
+    int on_screen = (fb == goldfish_fb_get_buffer());
+    if (!masks_ready) build_masks();
+
+    while (1) {
+        int n = 0;
+        while (str[n] && str[n] != '\n') n++;
+
+        int x0, x1;
+        draw_line(fb, x, y, str, n, fg, bg, opaque, fb_width, fb_height, &x0, &x1);
+        if (on_screen && x0 >= 0) {
+            goldfish_fb_damage(x0, y, x1 - x0, FONT_HEIGHT);
         }
-        str++;
+
+        if (str[n] == 0) break;
+        str += n + 1;
+        y += FONT_HEIGHT;
     }
 }
+
+/* Draw a null-terminated string, reporting one damage rect per line */
+void draw_string(uint32_t* fb, int x, int y, const char* str, uint32_t color, int fb_width, int fb_height) {
+    draw_lines(fb, x, y, str, color, 0, 0, fb_width, fb_height);
+}
+
+/* Draw a string on solid character cells - no need to clear first */
+void draw_string_bg(uint32_t* fb, int x, int y, const char* str, uint32_t fg, uint32_t bg, int fb_width, int fb_height) {
+    draw_lines(fb, x, y, str, fg, bg, 1, fb_width, fb_height);
+}
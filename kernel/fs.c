@@ -1,45 +1,167 @@
 /*
  * TinyFS - Simple Filesystem Implementation
  *
- * Disk Layout:
+ * Disk Layout (version 2):
  * Sector 0:      Superblock
- * Sector 1-8:    FAT (File Allocation Table)
- * Sector 9-16:   Root directory (64 entries)
- * Sector 17+:    Data clusters (2KB each = 4 sectors)
+ * Sector 1-16:   Intent log
+ * Sector 17+:    FAT (32-bit entry per cluster, sized to the disk)
+ * After FAT:     Data clusters (2KB each = 4 sectors)
+ *
+ * Directories are files holding 64-byte entries; the root directory
+ * starts at superblock.root_cluster. Cluster 0 is reserved so that
+ * FAT_FREE never names a real cluster.
+ *
+ * All sector I/O goes through the block cache (bcache.c), so repeated
+ * reads are served from memory and writes reach the disk when a file
+ * opened for writing is closed, on fs_sync(), or on eviction.
+ *
+ * Metadata (FAT and directory sectors) lives in a small page cache that
+ * keeps each sector next to the copy the disk holds; nothing of it is
+ * resident at mount beyond what is touched. Changes stay in memory, and
+ * fs_sync() writes file data first, then logs the changed words as a
+ * redo record, and only then rewrites their home sectors. Mount replays
+ * the last record, so a crash mid-update leaves either the old or the
+ * new metadata. Records that don't fit the log are split in allocate ->
+ * directory -> free order, so the worst case between two of them is a
+ * leaked cluster.
+ *
+ * Names are found through an in-memory hash index of (directory, name)
+ * built the first time a directory is looked into, so lookup does not
+ * depend on the directory's size.
+ *
+ * Free clusters are tracked in a bitmap built from the FAT at mount.
+ * Writes allocate the clusters they need as one adjacent run, found
+ * right after the file's last cluster or with a next-fit search, so
+ * file data stays contiguous for multi-sector I/O.
  */
 
 #include "fs.h"
 #include "virtio_blk.h"
+#include "bcache.h"
 #include "memory.h"
 
 /* Disk layout constants */
 #define SUPERBLOCK_SECTOR   0
-#define FAT_START_SECTOR    1
-#define FAT_SECTORS         8       /* 8 * 512 = 4096 bytes = 2048 FAT entries */
-#define ROOT_START_SECTOR   9
-#define ROOT_SECTORS        4       /* 64 entries * 32 bytes = 2048 bytes = 4 sectors */
-#define DATA_START_SECTOR   13
+#define LOG_START_SECTOR    1
+#define LOG_SECTORS         16      /* 8KB of redo records */
+#define FAT_START_SECTOR    (LOG_START_SECTOR + LOG_SECTORS)
+#define ROOT_CLUSTER        1
+
+/* Longest physically contiguous cluster run moved by one cache request */
+#define RUN_MAX_CLUSTERS    (BCACHE_RUN_MAX / FS_SECTORS_PER_CLUSTER)
+
+/* Clusters fetched ahead of a sequential reader */
+#define READAHEAD_CLUSTERS  4
+
+/* Metadata entries per sector */
+#define FAT_PER_SECTOR      (512 / sizeof(uint32_t))
+#define DIRENTS_PER_SECTOR  (512 / sizeof(fs_dirent_t))
+#define DIRENTS_PER_CLUSTER (FS_CLUSTER_SIZE / sizeof(fs_dirent_t))
+
+/* Metadata sectors kept in memory (each with its on-disk copy) */
+#define META_PAGES          64
+
+#define LOG_MAGIC           0x544C4F47  /* "TLOG" */
+
+/* Extents remembered per open file (ranges of adjacent clusters) */
+#define MAX_EXTENTS         8
+
+/* Run of consecutive file clusters stored in adjacent disk clusters */
+typedef struct {
+    uint32_t start;         /* First disk cluster */
+    uint32_t count;         /* Clusters in the run */
+} extent_t;
 
 /* Open file descriptor */
 typedef struct {
     int in_use;
-    int dirent_idx;         /* Index in root directory */
+    uint32_t dir_sector;    /* Sector holding the directory entry */
+    uint32_t dir_pos;       /* Entry index in its directory */
     uint32_t size;          /* File size */
     uint32_t pos;           /* Current read/write position */
-    uint16_t first_cluster; /* Starting cluster */
+    uint32_t first_cluster; /* Starting cluster */
     int flags;              /* Open flags */
+    uint32_t ra_pos;        /* Where the last read ended (sequential check) */
+
+    /* Chain cursor: cur_cluster is file cluster cur_index (FAT_EOF = unset) */
+    uint32_t cur_cluster;
+    uint32_t cur_index;
+
+    /* The first `mapped` file clusters, as extents in file order */
+    extent_t extents[MAX_EXTENTS];
+    int num_extents;
+    uint32_t mapped;
 } open_file_t;
 
+/* Cached metadata sector */
+typedef struct {
+    uint32_t sector;
+    uint8_t valid;
+    uint8_t dirty;
+    uint8_t is_fat;         /* FAT sector (else directory sector) */
+    uint8_t padding;
+    uint32_t last_use;
+    uint32_t data[128];     /* Current contents */
+    uint32_t disk[128];     /* What the disk holds (updated only through the log) */
+} meta_page_t;
+
+/*
+ * Name index entry, open addressing with linear probing. dir == 0 marks
+ * an empty slot (cluster 0 is never a directory). Name entries have an
+ * odd key (the name hash | 1); each indexed directory also has one
+ * record with key 0, whose sector field is the lowest entry index that
+ * may be free and pos the number of entry slots the directory has.
+ */
+typedef struct {
+    uint32_t dir;           /* First cluster of the directory */
+    uint32_t key;           /* Name hash | 1, or 0 for the directory record */
+    uint32_t sector;        /* Sector holding the entry */
+    uint32_t pos;           /* Entry index in the directory */
+} index_entry_t;
+
+#define INDEX_MIN_SIZE      256
+
 /* Cached filesystem state */
 static fs_superblock_t superblock;
-static uint16_t fat[2048];          /* FAT entries (up to 2048 clusters) */
-static fs_dirent_t root_dir[64];    /* Root directory */
+static fs_superblock_t super_disk;  /* What sector 0 holds */
 static open_file_t open_files[FS_MAX_OPEN];
 static int fs_is_mounted = 0;
 
 /* Sector buffer */
 static uint8_t sector_buf[512];
 
+static meta_page_t meta[META_PAGES];
+static uint32_t meta_clock = 0;
+
+static index_entry_t* name_index = NULL;
+static uint32_t index_size = 0;     /* Slots (power of two) */
+static uint32_t index_used = 0;
+
+/* Free clusters (bit set = free) and where the next-fit search resumes */
+static uint32_t* free_map = NULL;
+static uint32_t alloc_hint = 1;
+
+/* Log record: header, then changed metadata words */
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t checksum;              /* Over the records */
+    uint32_t count;
+} log_header_t;
+
+typedef struct {
+    uint32_t sector;
+    uint32_t word;                  /* Word index in the sector (0..127) */
+    uint32_t value;
+} log_rec_t;
+
+#define LOG_BYTES           (LOG_SECTORS * 512)
+#define LOG_MAX_RECS        ((LOG_BYTES - sizeof(log_header_t)) / sizeof(log_rec_t))
+
+static uint8_t log_buf[LOG_BYTES] __attribute__((aligned(4)));
+static log_rec_t* const log_recs = (log_rec_t*)(log_buf + sizeof(log_header_t));
+static uint32_t log_seq = 0;
+
 /* String utilities */
 static int str_len(const char* s) {
     int len = 0;
@@ -47,97 +169,758 @@ static int str_len(const char* s) {
     return len;
 }
 
-static int str_cmp(const char* a, const char* b) {
-    while (*a && *b && *a == *b) { a++; b++; }
-    return *a - *b;
+/* Does the stored name equal the len-byte component? */
+static int name_eq(const char* stored, const char* name, int len) {
+    for (int i = 0; i < len; i++) {
+        if (stored[i] != name[i]) return 0;
+    }
+    return stored[len] == 0;
 }
 
-static void str_cpy(char* dst, const char* src, int max) {
-    int i;
-    for (i = 0; i < max - 1 && src[i]; i++) {
-        dst[i] = src[i];
+/* FNV-1a over a path component; never 0 (reserved for directory records) */
+static uint32_t name_hash(const char* name, int len) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
     }
-    dst[i] = 0;
+    return h | 1;
 }
 
-/* Read superblock */
-static int read_superblock(void) {
-    if (blk_read(SUPERBLOCK_SECTOR, 1, &superblock) != 0) {
+static inline int is_cluster(uint32_t c) {
+    return c != FAT_FREE && c < superblock.total_clusters;
+}
+
+/* Convert cluster number to sector number */
+static uint32_t cluster_to_sector(uint32_t cluster) {
+    return superblock.data_start + cluster * FS_SECTORS_PER_CLUSTER;
+}
+
+/* ==================== Metadata page cache ==================== */
+
+static void meta_reset(void) {
+    for (int i = 0; i < META_PAGES; i++) {
+        meta[i].valid = 0;
+        meta[i].dirty = 0;
+    }
+}
+
+/*
+ * Cached copy of a metadata sector, loaded on demand; `write` marks it
+ * dirty (dirty pages stay until fs_sync). If every page is dirty the
+ * metadata is synced to make room. Returns NULL on device error. The
+ * pointer is only valid until the next meta_get().
+ */
+static meta_page_t* meta_get(uint32_t sector, int is_fat, int write) {
+    meta_page_t* victim = NULL;
+
+    for (int i = 0; i < META_PAGES; i++) {
+        meta_page_t* p = &meta[i];
+        if (p->valid && p->sector == sector) {
+            p->last_use = ++meta_clock;
+            if (write) p->dirty = 1;
+            return p;
+        }
+        if (!p->valid) {
+            if (!victim || victim->valid) victim = p;
+        } else if (!p->dirty && (!victim || (victim->valid && p->last_use < victim->last_use))) {
+            victim = p;
+        }
+    }
+
+    if (!victim) {
+        /* Everything is dirty: write it out, then take the oldest */
+        if (fs_sync() != 0) return NULL;
+        victim = &meta[0];
+        for (int i = 1; i < META_PAGES; i++) {
+            if (meta[i].last_use < victim->last_use) victim = &meta[i];
+        }
+    }
+
+    victim->valid = 0;
+    if (bcache_read(sector, 1, victim->data) != 0) return NULL;
+    memcpy(victim->disk, victim->data, 512);
+    victim->sector = sector;
+    victim->is_fat = is_fat;
+    victim->valid = 1;
+    victim->dirty = write;
+    victim->last_use = ++meta_clock;
+    return victim;
+}
+
+/* Forget cached pages for sectors [start, start + count) (freed clusters) */
+static void meta_drop(uint32_t start, uint32_t count) {
+    for (int i = 0; i < META_PAGES; i++) {
+        if (meta[i].valid && meta[i].sector >= start && meta[i].sector < start + count) {
+            meta[i].valid = 0;
+            meta[i].dirty = 0;
+        }
+    }
+}
+
+/* FAT entry of cluster c (FAT_BAD on device error) */
+static uint32_t fat_get(uint32_t c) {
+    meta_page_t* p = meta_get(superblock.fat_start + c / FAT_PER_SECTOR, 1, 0);
+    return p ? p->data[c % FAT_PER_SECTOR] : FAT_BAD;
+}
+
+static int set_fat(uint32_t c, uint32_t value) {
+    meta_page_t* p = meta_get(superblock.fat_start + c / FAT_PER_SECTOR, 1, 1);
+    if (!p) return -1;
+    p->data[c % FAT_PER_SECTOR] = value;
+    return 0;
+}
+
+/* Directory entry `pos` stored in `sector` (NULL on device error) */
+static fs_dirent_t* dirent_at(uint32_t sector, uint32_t pos, int write) {
+    meta_page_t* p = meta_get(sector, 0, write);
+    if (!p) return NULL;
+    return (fs_dirent_t*)p->data + pos % DIRENTS_PER_SECTOR;
+}
+
+/* ==================== Intent log ==================== */
+
+static uint32_t log_checksum(const uint8_t* p, uint32_t len) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        sum = ((sum << 5) | (sum >> 27)) ^ p[i];
+    }
+    return sum;
+}
+
+/*
+ * Patch the logged words into their home sectors. Values are absolute,
+ * so applying a record twice is harmless - which is what makes replay at
+ * mount safe. Records come grouped by sector.
+ */
+static int log_apply(uint32_t count) {
+    static uint32_t home[128];
+
+    for (uint32_t i = 0; i < count; ) {
+        uint32_t sector = log_recs[i].sector;
+        if (bcache_read(sector, 1, home) != 0) return -1;
+        while (i < count && log_recs[i].sector == sector) {
+            home[log_recs[i].word] = log_recs[i].value;
+            i++;
+        }
+        if (bcache_write(sector, 1, home) != 0) return -1;
+    }
+    return bcache_flush();
+}
+
+/* Make one record durable in the log, then apply it */
+static int log_commit(uint32_t count) {
+    log_header_t* hdr = (log_header_t*)log_buf;
+    uint32_t len = count * sizeof(log_rec_t);
+
+    hdr->magic = LOG_MAGIC;
+    hdr->seq = ++log_seq;
+    hdr->count = count;
+    hdr->checksum = log_checksum((const uint8_t*)log_recs, len);
+
+    uint32_t sectors = (sizeof(log_header_t) + len + 511) / 512;
+    if (bcache_write(superblock.log_start, sectors, log_buf) != 0 || bcache_flush() != 0) {
         return -1;
     }
+    return log_apply(count);
+}
+
+/* Replay the last logged record (no-op if it was fully applied) */
+static int log_replay(void) {
+    if (bcache_read(superblock.log_start, LOG_SECTORS, log_buf) != 0) return -1;
+
+    log_header_t* hdr = (log_header_t*)log_buf;
+    if (hdr->magic != LOG_MAGIC || hdr->count > LOG_MAX_RECS) return 0;
+    if (hdr->checksum != log_checksum((const uint8_t*)log_recs, hdr->count * sizeof(log_rec_t))) {
+        return 0;  /* Torn log write - the home sectors were never touched */
+    }
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        if (log_recs[i].sector >= superblock.total_sectors || log_recs[i].word >= 128) return 0;
+    }
+
+    log_seq = hdr->seq;
+    return log_apply(hdr->count);
+}
+
+/* Queue one changed word; commits when the log is full */
+static int log_add(uint32_t* count, uint32_t sector, uint32_t word, uint32_t value) {
+    if (*count == LOG_MAX_RECS) {
+        if (log_commit(*count) != 0) return -1;
+        *count = 0;
+    }
+    log_recs[*count].sector = sector;
+    log_recs[*count].word = word;
+    log_recs[*count].value = value;
+    (*count)++;
     return 0;
 }
 
-/* Write superblock */
-static int write_superblock(void) {
-    return blk_write(SUPERBLOCK_SECTOR, 1, &superblock);
+/* Log the words of dirty pages that differ from disk. FAT pages log
+ * either links (freed == 0) or frees (freed == 1) */
+static int log_pages(uint32_t* count, int is_fat, int freed) {
+    for (int i = 0; i < META_PAGES; i++) {
+        meta_page_t* p = &meta[i];
+        if (!p->valid || !p->dirty || p->is_fat != is_fat) continue;
+        for (uint32_t w = 0; w < 128; w++) {
+            if (p->data[w] == p->disk[w]) continue;
+            if (is_fat && (p->data[w] == FAT_FREE) != freed) continue;
+            if (log_add(count, p->sector, w, p->data[w]) != 0) return -1;
+        }
+    }
+    return 0;
 }
 
-/* Read FAT */
-static int read_fat(void) {
-    return blk_read(FAT_START_SECTOR, FAT_SECTORS, fat);
+int fs_sync(void) {
+    if (!fs_is_mounted) return -1;
+
+    /* Data first, so logged metadata never points at unwritten blocks */
+    if (bcache_flush() != 0) return -1;
+
+    uint32_t count = 0;
+
+    /* Clusters being linked in before the entries that reference them */
+    if (log_pages(&count, 1, 0) != 0) return -1;
+
+    if (log_pages(&count, 0, 0) != 0) return -1;
+    const uint32_t* sb = (const uint32_t*)&superblock;
+    const uint32_t* sb_disk = (const uint32_t*)&super_disk;
+    for (uint32_t w = 0; w < 128; w++) {
+        if (sb[w] != sb_disk[w] &&
+            log_add(&count, SUPERBLOCK_SECTOR, w, sb[w]) != 0) {
+            return -1;
+        }
+    }
+
+    /* Clusters only become free once nothing on disk points at them */
+    if (log_pages(&count, 1, 1) != 0) return -1;
+
+    if (count > 0 && log_commit(count) != 0) return -1;
+
+    for (int i = 0; i < META_PAGES; i++) {
+        if (meta[i].valid && meta[i].dirty) {
+            memcpy(meta[i].disk, meta[i].data, 512);
+            meta[i].dirty = 0;
+        }
+    }
+    super_disk = superblock;
+    return 0;
 }
 
-/* Write FAT */
-static int write_fat(void) {
-    return blk_write(FAT_START_SECTOR, FAT_SECTORS, fat);
+/* ==================== Cluster allocation ==================== */
+
+static inline int cluster_is_free(uint32_t c) {
+    return (free_map[c >> 5] >> (c & 31)) & 1;
 }
 
-/* Read root directory */
-static int read_root_dir(void) {
-    return blk_read(ROOT_START_SECTOR, ROOT_SECTORS, root_dir);
+static inline void mark_free(uint32_t c) {
+    free_map[c >> 5] |= 1u << (c & 31);
 }
 
-/* Write root directory */
-static int write_root_dir(void) {
-    return blk_write(ROOT_START_SECTOR, ROOT_SECTORS, root_dir);
+static inline void mark_used(uint32_t c) {
+    free_map[c >> 5] &= ~(1u << (c & 31));
 }
 
-/* Convert cluster number to sector number */
-static uint32_t cluster_to_sector(uint16_t cluster) {
-    return DATA_START_SECTOR + (cluster * FS_SECTORS_PER_CLUSTER);
+/* Allocate an all-used bitmap for the mounted volume */
+static int free_map_alloc(void) {
+    uint32_t bytes = (superblock.total_clusters + 31) / 32 * sizeof(uint32_t);
+    if (free_map) free(free_map);
+    free_map = (uint32_t*)malloc(bytes);
+    if (!free_map) return -1;
+    memset(free_map, 0, bytes);
+    alloc_hint = 1;
+    return 0;
 }
 
-/* Allocate a free cluster (start from 1, cluster 0 is reserved) */
-static int alloc_cluster(void) {
-    for (int i = 1; i < (int)superblock.total_clusters; i++) {
-        if (fat[i] == FAT_FREE) {
-            fat[i] = FAT_EOF;
-            superblock.free_clusters--;
-            return i;
+/* Build the free bitmap by streaming the FAT past the metadata cache
+ * (and correct the free count if it drifted) */
+static int build_free_map(void) {
+    uint32_t* run = (uint32_t*)log_buf;
+    uint32_t free_count = 0;
+
+    if (free_map_alloc() != 0) return -1;
+    for (uint32_t s = 0; s < superblock.fat_sectors; s += LOG_SECTORS) {
+        uint32_t n = superblock.fat_sectors - s;
+        if (n > LOG_SECTORS) n = LOG_SECTORS;
+        if (bcache_read(superblock.fat_start + s, n, run) != 0) return -1;
+        for (uint32_t k = 0; k < n * FAT_PER_SECTOR; k++) {
+            uint32_t c = s * FAT_PER_SECTOR + k;
+            if (c > 0 && c < superblock.total_clusters && run[k] == FAT_FREE) {
+                mark_free(c);
+                free_count++;
+            }
         }
     }
-    return -1;  /* No free clusters */
+    superblock.free_clusters = free_count;
+    return 0;
+}
+
+/* Length of the free run starting at cluster c (max limit) */
+static uint32_t free_run(uint32_t c, uint32_t limit) {
+    uint32_t n = 0;
+    while (n < limit && c + n < superblock.total_clusters && cluster_is_free(c + n)) {
+        n++;
+    }
+    return n;
+}
+
+/*
+ * Allocate up to `want` adjacent clusters, already chained and ending in
+ * FAT_EOF. A free run at `goal` (the cluster after a file's last one) is
+ * taken first so the file keeps growing in place; otherwise the first run
+ * of `want` clusters from the next-fit cursor, or the longest one seen if
+ * none is that long. Returns the first cluster (count in *got), or -1 if
+ * the disk is full. Cluster 0 is reserved and never handed out.
+ */
+static int alloc_run(uint32_t goal, uint32_t want, uint32_t* got) {
+    uint32_t total = superblock.total_clusters;
+    uint32_t best = 0, best_len = 0;
+
+    if (want == 0) want = 1;
+    if (superblock.free_clusters == 0) return -1;
+
+    if (goal > 0 && goal < total) {
+        best_len = free_run(goal, want);
+        best = goal;
+    }
+
+    uint32_t c = alloc_hint;
+    uint32_t scanned = best_len ? total : 0;
+    while (scanned < total) {
+        if (c >= total) c = 1;
+        if (free_map[c >> 5] == 0) {
+            /* No free cluster in this word */
+            uint32_t step = 32 - (c & 31);
+            c += step;
+            scanned += step;
+            continue;
+        }
+        if (!cluster_is_free(c)) {
+            c++;
+            scanned++;
+            continue;
+        }
+        uint32_t n = free_run(c, want);
+        if (n == want) {
+            best = c;
+            best_len = n;
+            break;
+        }
+        if (n > best_len) {
+            best = c;
+            best_len = n;
+        }
+        c += n;
+        scanned += n;
+    }
+    if (best_len == 0) return -1;
+
+    for (uint32_t k = 0; k < best_len; k++) {
+        uint32_t cl = best + k;
+        if (set_fat(cl, k + 1 < best_len ? cl + 1 : FAT_EOF) != 0) return -1;
+        mark_used(cl);
+        superblock.free_clusters--;
+    }
+    alloc_hint = best + best_len;
+    *got = best_len;
+    return (int)best;
 }
 
 /* Free a cluster chain */
-static void free_cluster_chain(uint16_t start) {
-    while (start != FAT_EOF && start != FAT_FREE && start < 2048) {
-        uint16_t next = fat[start];
-        fat[start] = FAT_FREE;
+static void free_cluster_chain(uint32_t start) {
+    while (is_cluster(start)) {
+        uint32_t next = fat_get(start);
+        if (set_fat(start, FAT_FREE) != 0) return;
+        mark_free(start);
         superblock.free_clusters++;
         start = next;
     }
 }
 
-/* Find file in root directory */
-static int find_file(const char* name) {
-    for (int i = 0; i < FS_MAX_FILES; i++) {
-        if (root_dir[i].name[0] != 0 && str_cmp(root_dir[i].name, name) == 0) {
-            return i;
+/* ==================== Open file cluster map ==================== */
+
+/* Number of clusters (max limit) that follow `cluster` in the chain
+ * and on disk, counting `cluster` itself */
+static uint32_t contiguous_run(uint32_t cluster, uint32_t limit) {
+    uint32_t run = 1;
+    while (run < limit && cluster + 1 < superblock.total_clusters &&
+           fat_get(cluster) == cluster + 1) {
+        cluster++;
+        run++;
+    }
+    return run;
+}
+
+/* Record that file cluster f->mapped is disk cluster `cluster`. Once
+ * every extent slot is used the map just stops growing. */
+static void map_append(open_file_t* f, uint32_t cluster) {
+    extent_t* last = f->num_extents > 0 ? &f->extents[f->num_extents - 1] : NULL;
+    if (last && last->start + last->count == cluster) {
+        last->count++;
+    } else if (f->num_extents < MAX_EXTENTS) {
+        f->extents[f->num_extents].start = cluster;
+        f->extents[f->num_extents].count = 1;
+        f->num_extents++;
+    } else {
+        return;
+    }
+    f->mapped++;
+}
+
+/* Build the extent map and reset the cursor (one chain walk at open) */
+static void map_build(open_file_t* f) {
+    f->num_extents = 0;
+    f->mapped = 0;
+    f->cur_cluster = FAT_EOF;
+    f->cur_index = 0;
+
+    uint32_t c = f->first_cluster;
+    while (is_cluster(c)) {
+        uint32_t before = f->mapped;
+        map_append(f, c);
+        if (f->mapped == before) break;  /* Map full */
+        c = fat_get(c);
+    }
+}
+
+/*
+ * Walk to file cluster `index`, starting from the extent map, the cursor
+ * or the first cluster, whichever is closest. Stops early at the end of
+ * the chain; *at is set to the index of the returned cluster. The file
+ * must have at least one cluster.
+ */
+static uint32_t walk_chain(open_file_t* f, uint32_t index, uint32_t* at) {
+    uint32_t c;
+    uint32_t i;
+
+    if (index < f->mapped) {
+        /* Inside the map: no FAT walk at all */
+        uint32_t base = 0;
+        int e = 0;
+        while (index >= base + f->extents[e].count) {
+            base += f->extents[e].count;
+            e++;
+        }
+        c = f->extents[e].start + (index - base);
+        i = index;
+    } else if (f->cur_cluster != FAT_EOF && f->cur_index <= index &&
+               f->cur_index + 1 >= f->mapped) {
+        c = f->cur_cluster;
+        i = f->cur_index;
+    } else if (f->mapped > 0) {
+        const extent_t* last = &f->extents[f->num_extents - 1];
+        c = last->start + last->count - 1;
+        i = f->mapped - 1;
+    } else {
+        c = f->first_cluster;
+        i = 0;
+    }
+
+    while (i < index) {
+        uint32_t next = fat_get(c);
+        if (!is_cluster(next)) break;
+        c = next;
+        i++;
+    }
+
+    f->cur_cluster = c;
+    f->cur_index = i;
+    *at = i;
+    return c;
+}
+
+/* Disk cluster holding file cluster `index`, or FAT_EOF past the end */
+static uint32_t file_cluster(open_file_t* f, uint32_t index) {
+    if (f->first_cluster == FAT_EOF) return FAT_EOF;
+    uint32_t at;
+    uint32_t c = walk_chain(f, index, &at);
+    return at == index ? c : FAT_EOF;
+}
+
+/* ==================== Name index ==================== */
+
+static inline uint32_t index_slot(uint32_t dir, uint32_t key) {
+    return ((dir * 0x9E3779B1u) ^ key) & (index_size - 1);
+}
+
+static void index_reset(void) {
+    if (name_index) free(name_index);
+    name_index = NULL;
+    index_size = 0;
+    index_used = 0;
+}
+
+static void index_put(const index_entry_t* e) {
+    uint32_t i = index_slot(e->dir, e->key);
+    while (name_index[i].dir != 0) {
+        i = (i + 1) & (index_size - 1);
+    }
+    name_index[i] = *e;
+    index_used++;
+}
+
+/* Add an entry, doubling the table at 3/4 load. Returns -1 if full */
+static int index_insert(uint32_t dir, uint32_t key, uint32_t sector, uint32_t pos) {
+    if ((index_used + 1) * 4 > index_size * 3) {
+        uint32_t new_size = index_size ? index_size * 2 : INDEX_MIN_SIZE;
+        index_entry_t* table = (index_entry_t*)malloc(new_size * sizeof(index_entry_t));
+        if (table) {
+            index_entry_t* old = name_index;
+            uint32_t old_size = index_size;
+            memset(table, 0, new_size * sizeof(index_entry_t));
+            name_index = table;
+            index_size = new_size;
+            index_used = 0;
+            for (uint32_t i = 0; i < old_size; i++) {
+                if (old[i].dir != 0) index_put(&old[i]);
+            }
+            if (old) free(old);
+        } else if (index_used + 1 >= index_size) {
+            return -1;
+        }
+    }
+
+    index_entry_t e = { dir, key, sector, pos };
+    index_put(&e);
+    return 0;
+}
+
+/* Remove an entry, shifting later members of its probe run back */
+static void index_remove(index_entry_t* e) {
+    uint32_t hole = e - name_index;
+    uint32_t i = hole;
+
+    name_index[hole].dir = 0;
+    index_used--;
+    while (1) {
+        i = (i + 1) & (index_size - 1);
+        if (name_index[i].dir == 0) break;
+        uint32_t home = index_slot(name_index[i].dir, name_index[i].key);
+        /* Move it if its home is not in (hole, i] */
+        if (((i - home) & (index_size - 1)) >= ((i - hole) & (index_size - 1))) {
+            name_index[hole] = name_index[i];
+            name_index[i].dir = 0;
+            hole = i;
         }
     }
-    return -1;
 }
 
-/* Find free directory entry */
-static int find_free_dirent(void) {
-    for (int i = 0; i < FS_MAX_FILES; i++) {
-        if (root_dir[i].name[0] == 0) {
-            return i;
+static index_entry_t* index_find(uint32_t dir, uint32_t key) {
+    if (index_size == 0) return NULL;
+    for (uint32_t i = index_slot(dir, key); name_index[i].dir != 0;
+         i = (i + 1) & (index_size - 1)) {
+        if (name_index[i].dir == dir && name_index[i].key == key) {
+            return &name_index[i];
         }
     }
-    return -1;
+    return NULL;
+}
+
+/* ==================== Directories ==================== */
+
+/* Sector holding entry `pos` of directory `dir` (FAT_EOF past its end) */
+static uint32_t dir_entry_sector(uint32_t dir, uint32_t pos) {
+    uint32_t c = dir;
+    for (uint32_t k = pos / DIRENTS_PER_CLUSTER; k > 0 && is_cluster(c); k--) {
+        c = fat_get(c);
+    }
+    if (!is_cluster(c)) return FAT_EOF;
+    return cluster_to_sector(c) + (pos % DIRENTS_PER_CLUSTER) / DIRENTS_PER_SECTOR;
+}
+
+/* Index every entry of a directory the first time it is used.
+ * Returns its directory record, or NULL on error */
+static index_entry_t* dir_record(uint32_t dir) {
+    index_entry_t* rec = index_find(dir, 0);
+    if (rec) return rec;
+
+    uint32_t pos = 0;
+    uint32_t first_free = FAT_EOF;
+    for (uint32_t c = dir; is_cluster(c); c = fat_get(c)) {
+        for (uint32_t s = 0; s < FS_SECTORS_PER_CLUSTER; s++) {
+            uint32_t sector = cluster_to_sector(c) + s;
+            for (uint32_t k = 0; k < DIRENTS_PER_SECTOR; k++, pos++) {
+                fs_dirent_t* d = dirent_at(sector, pos, 0);
+                if (!d) return NULL;
+                if (d->name[0] == 0) {
+                    if (first_free == FAT_EOF) first_free = pos;
+                    continue;
+                }
+                int len = str_len(d->name);
+                if (len >= FS_MAX_FILENAME) len = FS_MAX_FILENAME - 1;
+                if (index_insert(dir, name_hash(d->name, len), sector, pos) != 0) {
+                    return NULL;
+                }
+            }
+        }
+    }
+
+    if (index_insert(dir, 0, first_free == FAT_EOF ? pos : first_free, pos) != 0) {
+        return NULL;
+    }
+    return index_find(dir, 0);
+}
+
+/* Find a name in a directory. Returns its index entry or NULL */
+static index_entry_t* dir_lookup(uint32_t dir, const char* name, int len) {
+    if (!dir_record(dir)) return NULL;
+
+    uint32_t key = name_hash(name, len);
+    for (uint32_t i = index_slot(dir, key); name_index[i].dir != 0;
+         i = (i + 1) & (index_size - 1)) {
+        index_entry_t* e = &name_index[i];
+        if (e->dir != dir || e->key != key) continue;
+        fs_dirent_t* d = dirent_at(e->sector, e->pos, 0);
+        if (d && name_eq(d->name, name, len)) return e;
+    }
+    return NULL;
+}
+
+/* Clear the sectors of a new directory cluster */
+static int zero_cluster(uint32_t c) {
+    memset(sector_buf, 0, sizeof(sector_buf));
+    for (uint32_t s = 0; s < FS_SECTORS_PER_CLUSTER; s++) {
+        if (bcache_write(cluster_to_sector(c) + s, 1, sector_buf) != 0) return -1;
+    }
+    return 0;
+}
+
+/*
+ * Claim a free entry in `dir` for `name`, growing the directory by a
+ * cluster when it is full. The entry gets the name and flags, no data.
+ * Returns 0 and its location, -1 on error.
+ */
+static int dir_add(uint32_t dir, const char* name, int len, uint32_t flags,
+                   uint32_t* sector_out, uint32_t* pos_out) {
+    index_entry_t* rec = dir_record(dir);
+    if (!rec) return -1;
+
+    uint32_t pos = rec->sector;
+    uint32_t slots = rec->pos;
+    uint32_t sector;
+    fs_dirent_t* d;
+
+    while (1) {
+        if (pos == slots) {
+            /* Full: link in a zeroed cluster after the last one */
+            uint32_t last = dir;
+            for (uint32_t k = slots / DIRENTS_PER_CLUSTER; k > 1; k--) {
+                last = fat_get(last);
+            }
+            uint32_t got;
+            int c = alloc_run(last + 1, 1, &got);
+            if (c < 0) return -1;
+            if (zero_cluster(c) != 0 || set_fat(last, c) != 0) return -1;
+            meta_drop(cluster_to_sector(c), FS_SECTORS_PER_CLUSTER);
+            slots += DIRENTS_PER_CLUSTER;
+        }
+        sector = dir_entry_sector(dir, pos);
+        if (sector == FAT_EOF) return -1;
+        d = dirent_at(sector, pos, 0);
+        if (!d) return -1;
+        if (d->name[0] == 0) break;
+        pos++;
+    }
+
+    d = dirent_at(sector, pos, 1);
+    if (!d) return -1;
+    memset(d, 0, sizeof(fs_dirent_t));
+    memcpy(d->name, name, len);
+    d->first_cluster = FAT_EOF;
+    d->flags = flags;
+
+    /* rec may move when the index grows */
+    rec->sector = pos + 1;
+    rec->pos = slots;
+    if (index_insert(dir, name_hash(name, len), sector, pos) != 0) {
+        memset(d, 0, sizeof(fs_dirent_t));
+        return -1;
+    }
+    superblock.files_count++;
+    *sector_out = sector;
+    *pos_out = pos;
+    return 0;
+}
+
+/* Does directory `dir` hold any entries? (1 = empty, -1 = error) */
+static int dir_empty(uint32_t dir) {
+    uint32_t pos = 0;
+    for (uint32_t c = dir; is_cluster(c); c = fat_get(c)) {
+        for (uint32_t s = 0; s < FS_SECTORS_PER_CLUSTER; s++) {
+            for (uint32_t k = 0; k < DIRENTS_PER_SECTOR; k++, pos++) {
+                fs_dirent_t* d = dirent_at(cluster_to_sector(c) + s, pos, 0);
+                if (!d) return -1;
+                if (d->name[0] != 0) return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Length of the path component at p (up to '/' or the end) */
+static int component_len(const char* p) {
+    int len = 0;
+    while (p[len] && p[len] != '/') len++;
+    return len;
+}
+
+/*
+ * Split a path into its parent directory and last component. Every
+ * earlier component must be an existing directory. *name is left empty
+ * (len 0) for the root itself. Returns 0 on success, -1 on error.
+ */
+static int resolve_parent(const char* path, uint32_t* dir, const char** name, int* len) {
+    uint32_t d = superblock.root_cluster;
+
+    while (*path == '/') path++;
+    while (1) {
+        int n = component_len(path);
+        const char* next = path + n;
+        while (*next == '/') next++;
+        if (*next == 0) {
+            if (n >= FS_MAX_FILENAME) return -1;
+            *dir = d;
+            *name = path;
+            *len = n;
+            return 0;
+        }
+
+        index_entry_t* e = dir_lookup(d, path, n);
+        if (!e) return -1;
+        fs_dirent_t* de = dirent_at(e->sector, e->pos, 0);
+        if (!de || !(de->flags & FS_FLAG_DIR)) return -1;
+        d = de->first_cluster;
+        path = next;
+    }
+}
+
+/* Resolve a path to a directory's first cluster (FAT_EOF if it is not one) */
+static uint32_t resolve_dir(const char* path) {
+    uint32_t dir;
+    const char* name;
+    int len;
+
+    if (resolve_parent(path, &dir, &name, &len) != 0) return FAT_EOF;
+    if (len == 0) return dir;
+
+    index_entry_t* e = dir_lookup(dir, name, len);
+    if (!e) return FAT_EOF;
+    fs_dirent_t* d = dirent_at(e->sector, e->pos, 0);
+    if (!d || !(d->flags & FS_FLAG_DIR)) return FAT_EOF;
+    return d->first_cluster;
+}
+
+/* Names "." and ".." are not stored (no parent links) */
+static int name_valid(const char* name, int len) {
+    if (len == 0) return 0;
+    if (name[0] == '.' && (len == 1 || (len == 2 && name[1] == '.'))) return 0;
+    return 1;
+}
+
+/* ==================== Mount / format ==================== */
+
+static void reset_state(void) {
+    memset(open_files, 0, sizeof(open_files));
+    meta_reset();
+    index_reset();
 }
 
 int fs_init(void) {
@@ -145,23 +928,30 @@ int fs_init(void) {
         return -1;
     }
 
-    /* Clear open files */
-    memset(open_files, 0, sizeof(open_files));
+    reset_state();
+    fs_is_mounted = 0;
 
     /* Read superblock */
-    if (read_superblock() != 0) {
+    if (bcache_read(SUPERBLOCK_SECTOR, 1, &superblock) != 0) {
         return -1;
     }
 
-    /* Check magic */
-    if (superblock.magic != FS_MAGIC) {
+    /* Check magic; older layouts have to be reformatted */
+    if (superblock.magic != FS_MAGIC || superblock.version != FS_VERSION) {
         /* Disk not formatted or corrupted */
-        fs_is_mounted = 0;
         return 0;  /* Return success but not mounted */
     }
 
-    /* Read FAT and root directory */
-    if (read_fat() != 0 || read_root_dir() != 0) {
+    /* Finish a metadata update a crash interrupted */
+    if (log_replay() != 0) {
+        return -1;
+    }
+    if (bcache_read(SUPERBLOCK_SECTOR, 1, &superblock) != 0) {
+        return -1;
+    }
+    super_disk = superblock;
+
+    if (build_free_map() != 0) {
         return -1;
     }
 
@@ -182,13 +972,21 @@ int fs_format(void) {
 
     /* Calculate filesystem geometry */
     uint32_t total_sectors = info->capacity;
-    if (total_sectors < 32) {
+    if (total_sectors < 64) {
         return -1;  /* Disk too small */
     }
 
-    uint32_t data_sectors = total_sectors - DATA_START_SECTOR;
-    uint32_t total_clusters = data_sectors / FS_SECTORS_PER_CLUSTER;
-    if (total_clusters > 2048) total_clusters = 2048;  /* FAT limit */
+    /* Clusters and FAT size depend on each other: settle in two passes */
+    uint32_t avail = total_sectors - FAT_START_SECTOR;
+    uint32_t total_clusters = avail / FS_SECTORS_PER_CLUSTER;
+    uint32_t fat_sectors = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        fat_sectors = (total_clusters + FAT_PER_SECTOR - 1) / FAT_PER_SECTOR;
+        total_clusters = (avail - fat_sectors) / FS_SECTORS_PER_CLUSTER;
+    }
+
+    fs_is_mounted = 0;
+    reset_state();
 
     /* Initialize superblock */
     memset(&superblock, 0, sizeof(superblock));
@@ -196,43 +994,70 @@ int fs_format(void) {
     superblock.version = FS_VERSION;
     superblock.total_sectors = total_sectors;
     superblock.total_clusters = total_clusters;
-    superblock.free_clusters = total_clusters;
+    superblock.free_clusters = total_clusters - 2;  /* Reserved cluster 0, root */
     superblock.fat_start = FAT_START_SECTOR;
-    superblock.fat_sectors = FAT_SECTORS;
-    superblock.root_start = ROOT_START_SECTOR;
-    superblock.root_sectors = ROOT_SECTORS;
-    superblock.data_start = DATA_START_SECTOR;
-
-    /* Initialize FAT - all free except cluster 0 (reserved) */
-    memset(fat, 0, sizeof(fat));
-    fat[0] = FAT_EOF;  /* Reserve cluster 0 */
-    superblock.free_clusters--;  /* Adjust for reserved cluster */
+    superblock.fat_sectors = fat_sectors;
+    superblock.log_start = LOG_START_SECTOR;
+    superblock.log_sectors = LOG_SECTORS;
+    superblock.data_start = FAT_START_SECTOR + fat_sectors;
+    superblock.root_cluster = ROOT_CLUSTER;
+    superblock.files_count = 0;
+
+    /* Initialize FAT - all free except cluster 0 (reserved) and the root */
+    memset(log_buf, 0, sizeof(log_buf));
+    for (uint32_t s = 0; s < fat_sectors; s += LOG_SECTORS) {
+        uint32_t n = fat_sectors - s;
+        if (n > LOG_SECTORS) n = LOG_SECTORS;
+        if (bcache_write(FAT_START_SECTOR + s, n, log_buf) != 0) return -1;
+    }
+    uint32_t* first = (uint32_t*)sector_buf;
+    memset(sector_buf, 0, sizeof(sector_buf));
+    first[0] = FAT_EOF;
+    first[ROOT_CLUSTER] = FAT_EOF;
+    if (bcache_write(FAT_START_SECTOR, 1, sector_buf) != 0) return -1;
+
+    /* Empty root directory and log */
+    if (zero_cluster(ROOT_CLUSTER) != 0) return -1;
+    if (bcache_write(LOG_START_SECTOR, 1, log_buf) != 0) return -1;
+    if (bcache_write(SUPERBLOCK_SECTOR, 1, &superblock) != 0) return -1;
+    super_disk = superblock;
+
+    if (free_map_alloc() != 0) return -1;
+    for (uint32_t c = ROOT_CLUSTER + 1; c < total_clusters; c++) {
+        mark_free(c);
+    }
 
-    /* Initialize root directory - all empty */
-    memset(root_dir, 0, sizeof(root_dir));
+    /* Flush */
+    if (bcache_flush() != 0) return -1;
 
-    /* Clear open files */
-    memset(open_files, 0, sizeof(open_files));
+    fs_is_mounted = 1;
+    return 0;
+}
 
-    /* Write to disk */
-    if (write_superblock() != 0) return -1;
-    if (write_fat() != 0) return -1;
-    if (write_root_dir() != 0) return -1;
+/* ==================== Files ==================== */
 
-    /* Flush */
-    blk_flush();
+/* Store the size and first cluster of an open file in its entry */
+static int dirent_store(open_file_t* f) {
+    fs_dirent_t* d = dirent_at(f->dir_sector, f->dir_pos, 1);
+    if (!d) return -1;
+    d->size = f->size;
+    d->first_cluster = f->first_cluster;
+    return 0;
+}
 
-    fs_is_mounted = 1;
+static int entry_open(uint32_t sector, uint32_t pos) {
+    for (int i = 0; i < FS_MAX_OPEN; i++) {
+        if (open_files[i].in_use && open_files[i].dir_sector == sector &&
+            open_files[i].dir_pos == pos) {
+            return 1;
+        }
+    }
     return 0;
 }
 
 int fs_open(const char* path, int flags) {
     if (!fs_is_mounted) return -1;
 
-    /* Skip leading slash */
-    if (*path == '/') path++;
-    if (*path == 0) return -1;  /* Can't open root as file */
-
     /* Find free file descriptor */
     int fd = -1;
     for (int i = 0; i < FS_MAX_OPEN; i++) {
@@ -243,51 +1068,59 @@ int fs_open(const char* path, int flags) {
     }
     if (fd < 0) return -1;  /* Too many open files */
 
+    uint32_t dir;
+    const char* name;
+    int len;
+    if (resolve_parent(path, &dir, &name, &len) != 0) return -1;
+    if (len == 0) return -1;  /* Can't open root as file */
+
     /* Find file */
-    int idx = find_file(path);
+    uint32_t sector, pos;
+    index_entry_t* e = dir_lookup(dir, name, len);
 
-    if (idx < 0) {
+    if (!e) {
         /* File not found */
-        if (!(flags & FS_O_CREATE)) {
+        if (!(flags & FS_O_CREATE) || !name_valid(name, len)) {
             return -1;
         }
 
         /* Create new file */
-        idx = find_free_dirent();
-        if (idx < 0) return -1;  /* Directory full */
-
-        str_cpy(root_dir[idx].name, path, FS_MAX_FILENAME);
-        root_dir[idx].size = 0;
-        root_dir[idx].first_cluster = FAT_EOF;
-        root_dir[idx].flags = 0;
-        root_dir[idx].reserved = 0;
+        if (dir_add(dir, name, len, 0, &sector, &pos) != 0) return -1;
+    } else {
+        sector = e->sector;
+        pos = e->pos;
+    }
 
-        if (write_root_dir() != 0) {
-            root_dir[idx].name[0] = 0;
-            return -1;
-        }
-    } else if (flags & FS_O_TRUNC) {
-        /* Truncate existing file */
-        if (root_dir[idx].first_cluster != FAT_EOF) {
-            free_cluster_chain(root_dir[idx].first_cluster);
-            root_dir[idx].first_cluster = FAT_EOF;
-            root_dir[idx].size = 0;
-            write_fat();
-            write_root_dir();
-        }
+    fs_dirent_t* d = dirent_at(sector, pos, 0);
+    if (!d || (d->flags & FS_FLAG_DIR)) return -1;
+
+    if ((flags & FS_O_TRUNC) && d->first_cluster != FAT_EOF) {
+        /* Truncate existing file: the entry lets go before the clusters do */
+        uint32_t old = d->first_cluster;
+        d = dirent_at(sector, pos, 1);
+        if (!d) return -1;
+        d->first_cluster = FAT_EOF;
+        d->size = 0;
+        free_cluster_chain(old);
+        d = dirent_at(sector, pos, 0);
+        if (!d) return -1;
     }
 
     /* Setup file descriptor */
-    open_files[fd].in_use = 1;
-    open_files[fd].dirent_idx = idx;
-    open_files[fd].size = root_dir[idx].size;
-    open_files[fd].first_cluster = root_dir[idx].first_cluster;
-    open_files[fd].flags = flags;
+    open_file_t* f = &open_files[fd];
+    f->in_use = 1;
+    f->dir_sector = sector;
+    f->dir_pos = pos;
+    f->size = d->size;
+    f->first_cluster = d->first_cluster;
+    f->flags = flags;
+    f->ra_pos = 0;
+    map_build(f);
 
     if (flags & FS_O_APPEND) {
-        open_files[fd].pos = root_dir[idx].size;
+        f->pos = f->size;
     } else {
-        open_files[fd].pos = 0;
+        f->pos = 0;
     }
 
     return fd;
@@ -298,6 +1131,11 @@ int fs_close(int fd) {
     if (!open_files[fd].in_use) return -1;
 
     open_files[fd].in_use = 0;
+
+    /* Write back this file's data and metadata */
+    if (open_files[fd].flags & FS_O_WRITE) {
+        return fs_sync();
+    }
     return 0;
 }
 
@@ -309,6 +1147,7 @@ int fs_read(int fd, void* buf, int len) {
     open_file_t* f = &open_files[fd];
     uint8_t* out = (uint8_t*)buf;
     int bytes_read = 0;
+    int sequential = (f->pos == f->ra_pos);
 
     while (len > 0 && f->pos < f->size) {
         /* Calculate current cluster and offset */
@@ -316,47 +1155,86 @@ int fs_read(int fd, void* buf, int len) {
         uint32_t cluster_offset = f->pos % FS_CLUSTER_SIZE;
 
         /* Find the cluster */
-        uint16_t cluster = f->first_cluster;
-        for (uint32_t i = 0; i < cluster_num && cluster != FAT_EOF; i++) {
-            cluster = fat[cluster];
-        }
-        if (cluster == FAT_EOF || cluster == FAT_FREE) {
+        uint32_t cluster = file_cluster(f, cluster_num);
+        if (cluster == FAT_EOF) {
             break;  /* Past end of file */
         }
 
-        /* Read sector within cluster */
-        uint32_t sector_in_cluster = cluster_offset / 512;
+        uint32_t want = (uint32_t)len;
+        if (want > f->size - f->pos) want = f->size - f->pos;
+
+        /* Extend over clusters that are also adjacent on disk */
+        uint32_t run = contiguous_run(cluster,
+            (cluster_offset + want + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE);
+        if (run > RUN_MAX_CLUSTERS) run = RUN_MAX_CLUSTERS;
+        uint32_t avail = run * FS_CLUSTER_SIZE - cluster_offset;
+        if (want > avail) want = avail;
+
+        uint32_t sector = cluster_to_sector(cluster) + cluster_offset / 512;
         uint32_t sector_offset = cluster_offset % 512;
-        uint32_t sector = cluster_to_sector(cluster) + sector_in_cluster;
+        uint32_t to_copy;
 
-        if (blk_read(sector, 1, sector_buf) != 0) {
-            return bytes_read > 0 ? bytes_read : -1;
+        if (sector_offset == 0 && want >= 512) {
+            /* Whole sectors go straight into the caller's buffer */
+            uint32_t count = want / 512;
+            if (bcache_read(sector, count, out) != 0) {
+                return bytes_read > 0 ? bytes_read : -1;
+            }
+            to_copy = count * 512;
+        } else {
+            /* Partial sector via the bounce buffer */
+            if (bcache_read(sector, 1, sector_buf) != 0) {
+                return bytes_read > 0 ? bytes_read : -1;
+            }
+            to_copy = 512 - sector_offset;
+            if (to_copy > want) to_copy = want;
+            memcpy(out, sector_buf + sector_offset, to_copy);
         }
 
-        /* Copy data */
-        uint32_t to_copy = 512 - sector_offset;
-        if ((int)to_copy > len) to_copy = len;
-        if (f->pos + to_copy > f->size) to_copy = f->size - f->pos;
-
-        memcpy(out, sector_buf + sector_offset, to_copy);
         out += to_copy;
         f->pos += to_copy;
         bytes_read += to_copy;
         len -= to_copy;
     }
 
+    /* Sequential reader: pull the clusters after this read into the cache
+     * while they can still be fetched in one request */
+    uint32_t next = (f->pos + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+    if (sequential && bytes_read > 0 && next * FS_CLUSTER_SIZE < f->size) {
+        uint32_t cluster = file_cluster(f, next);
+        if (cluster != FAT_EOF) {
+            uint32_t left = (f->size - next * FS_CLUSTER_SIZE + FS_CLUSTER_SIZE - 1) /
+                            FS_CLUSTER_SIZE;
+            uint32_t run = contiguous_run(cluster,
+                left < READAHEAD_CLUSTERS ? left : READAHEAD_CLUSTERS);
+            bcache_prefetch(cluster_to_sector(cluster), run * FS_SECTORS_PER_CLUSTER);
+        }
+    }
+    f->ra_pos = f->pos;
+
     return bytes_read;
 }
 
+/* Finish a write: record the new size/chain in the entry */
+static int write_done(open_file_t* f, int bytes_written) {
+    if (dirent_store(f) != 0) return -1;
+    return bytes_written > 0 ? bytes_written : -1;
+}
+
 int fs_write(int fd, const void* buf, int len) {
     if (fd < 0 || fd >= FS_MAX_OPEN) return -1;
     if (!open_files[fd].in_use) return -1;
     if (!(open_files[fd].flags & FS_O_WRITE)) return -1;
+    if (len <= 0) return 0;
 
     open_file_t* f = &open_files[fd];
     const uint8_t* in = (const uint8_t*)buf;
     int bytes_written = 0;
-    int idx = f->dirent_idx;
+    uint32_t got;
+
+    /* Last file cluster this write touches: new clusters are allocated
+     * as one run up to it, so the data stays contiguous on disk */
+    uint32_t last_index = (f->pos + (uint32_t)len - 1) / FS_CLUSTER_SIZE;
 
     while (len > 0) {
         /* Calculate current cluster and offset */
@@ -364,35 +1242,37 @@ int fs_write(int fd, const void* buf, int len) {
         uint32_t cluster_offset = f->pos % FS_CLUSTER_SIZE;
 
         /* Find or allocate the cluster */
-        uint16_t cluster = f->first_cluster;
-        uint16_t prev_cluster = FAT_EOF;
-
-        if (cluster == FAT_EOF) {
-            /* File is empty, allocate first cluster */
-            int new_cluster = alloc_cluster();
+        if (f->first_cluster == FAT_EOF) {
+            /* File is empty, allocate its first run */
+            int new_cluster = alloc_run(0, last_index + 1, &got);
             if (new_cluster < 0) {
-                return bytes_written > 0 ? bytes_written : -1;
+                return write_done(f, bytes_written);
             }
-            cluster = (uint16_t)new_cluster;
-            f->first_cluster = cluster;
-            root_dir[idx].first_cluster = cluster;
-        }
-
-        /* Navigate to target cluster */
-        for (uint32_t i = 0; i < cluster_num; i++) {
-            prev_cluster = cluster;
-            if (fat[cluster] == FAT_EOF) {
-                /* Need to extend file */
-                int new_cluster = alloc_cluster();
-                if (new_cluster < 0) {
-                    write_fat();
-                    write_root_dir();
-                    write_superblock();
-                    return bytes_written > 0 ? bytes_written : -1;
-                }
-                fat[prev_cluster] = new_cluster;
+            f->first_cluster = (uint32_t)new_cluster;
+            for (uint32_t k = 0; k < got; k++) {
+                map_append(f, (uint32_t)new_cluster + k);
+            }
+            if (dirent_store(f) != 0) return -1;
+        }
+
+        /* Navigate to target cluster, extending the chain if needed */
+        uint32_t at;
+        uint32_t cluster = walk_chain(f, cluster_num, &at);
+        while (at < cluster_num) {
+            int new_cluster = alloc_run(cluster + 1, last_index - at, &got);
+            if (new_cluster < 0 || set_fat(cluster, (uint32_t)new_cluster) != 0) {
+                return write_done(f, bytes_written);
+            }
+            for (uint32_t k = 0; k < got; k++) {
+                cluster = (uint32_t)new_cluster + k;
+                at++;
+                if (at == f->mapped) map_append(f, cluster);
+            }
+            f->cur_cluster = cluster;
+            f->cur_index = at;
+            if (at > cluster_num) {
+                cluster = walk_chain(f, cluster_num, &at);
             }
-            cluster = fat[cluster];
         }
 
         /* Calculate sector */
@@ -400,23 +1280,31 @@ int fs_write(int fd, const void* buf, int len) {
         uint32_t sector_offset = cluster_offset % 512;
         uint32_t sector = cluster_to_sector(cluster) + sector_in_cluster;
 
-        /* Read-modify-write if not writing full sector */
-        if (sector_offset != 0 || len < 512) {
-            if (blk_read(sector, 1, sector_buf) != 0) {
+        uint32_t to_copy;
+        if (sector_offset == 0 && len >= 512) {
+            /* Whole sectors up to the end of the cluster: no read needed */
+            uint32_t count = (uint32_t)len / 512;
+            uint32_t left = FS_SECTORS_PER_CLUSTER - sector_in_cluster;
+            if (count > left) count = left;
+            if (bcache_write(sector, count, in) != 0) {
+                return write_done(f, bytes_written);
+            }
+            to_copy = count * 512;
+        } else {
+            /* Read-modify-write a partial sector */
+            if (bcache_read(sector, 1, sector_buf) != 0) {
                 /* New sector, just clear it */
                 memset(sector_buf, 0, 512);
             }
-        }
 
-        /* Copy data */
-        uint32_t to_copy = 512 - sector_offset;
-        if ((int)to_copy > len) to_copy = len;
+            to_copy = 512 - sector_offset;
+            if ((int)to_copy > len) to_copy = len;
 
-        memcpy(sector_buf + sector_offset, in, to_copy);
+            memcpy(sector_buf + sector_offset, in, to_copy);
 
-        /* Write sector */
-        if (blk_write(sector, 1, sector_buf) != 0) {
-            return bytes_written > 0 ? bytes_written : -1;
+            if (bcache_write(sector, 1, sector_buf) != 0) {
+                return write_done(f, bytes_written);
+            }
         }
 
         in += to_copy;
@@ -427,16 +1315,11 @@ int fs_write(int fd, const void* buf, int len) {
         /* Update size if needed */
         if (f->pos > f->size) {
             f->size = f->pos;
-            root_dir[idx].size = f->size;
         }
     }
 
-    /* Update metadata */
-    write_fat();
-    write_root_dir();
-    write_superblock();
-
-    return bytes_written;
+    /* Metadata reaches the disk on fs_close(), fs_sync() or the sync task */
+    return write_done(f, bytes_written);
 }
 
 int fs_seek(int fd, int offset, int whence) {
@@ -462,6 +1345,12 @@ int fs_seek(int fd, int offset, int whence) {
 
     if (new_pos < 0) new_pos = 0;
     f->pos = new_pos;
+
+    /* Point the chain cursor at the new position (map lookup, no FAT walk
+     * for mapped files) */
+    if ((uint32_t)new_pos < f->size) {
+        file_cluster(f, new_pos / FS_CLUSTER_SIZE);
+    }
     return new_pos;
 }
 
@@ -473,48 +1362,109 @@ int fs_size(int fd) {
 
 int fs_readdir(const char* path, fs_dirent_t* entries, int max_entries) {
     if (!fs_is_mounted) return -1;
-    (void)path;  /* Only root directory supported */
+
+    uint32_t dir = resolve_dir(path);
+    if (dir == FAT_EOF) return -1;
 
     int count = 0;
-    for (int i = 0; i < FS_MAX_FILES && count < max_entries; i++) {
-        if (root_dir[i].name[0] != 0) {
-            memcpy(&entries[count], &root_dir[i], sizeof(fs_dirent_t));
-            count++;
+    uint32_t pos = 0;
+    for (uint32_t c = dir; is_cluster(c) && count < max_entries; c = fat_get(c)) {
+        for (uint32_t s = 0; s < FS_SECTORS_PER_CLUSTER; s++) {
+            for (uint32_t k = 0; k < DIRENTS_PER_SECTOR; k++, pos++) {
+                fs_dirent_t* d = dirent_at(cluster_to_sector(c) + s, pos, 0);
+                if (!d) return -1;
+                if (d->name[0] != 0 && count < max_entries) {
+                    memcpy(&entries[count], d, sizeof(fs_dirent_t));
+                    count++;
+                }
+            }
         }
     }
     return count;
 }
 
+int fs_mkdir(const char* path) {
+    if (!fs_is_mounted) return -1;
+
+    uint32_t dir;
+    const char* name;
+    int len;
+    if (resolve_parent(path, &dir, &name, &len) != 0) return -1;
+    if (!name_valid(name, len) || dir_lookup(dir, name, len)) return -1;
+
+    /* Contents first, then the entry that points at them */
+    uint32_t got;
+    int c = alloc_run(0, 1, &got);
+    if (c < 0) return -1;
+    if (zero_cluster(c) != 0) return -1;
+    meta_drop(cluster_to_sector(c), FS_SECTORS_PER_CLUSTER);
+
+    uint32_t sector, pos;
+    if (dir_add(dir, name, len, FS_FLAG_DIR, &sector, &pos) != 0) {
+        free_cluster_chain(c);
+        return -1;
+    }
+    fs_dirent_t* d = dirent_at(sector, pos, 1);
+    if (!d) return -1;
+    d->first_cluster = c;
+    return 0;
+}
+
 int fs_remove(const char* path) {
     if (!fs_is_mounted) return -1;
 
-    /* Skip leading slash */
-    if (*path == '/') path++;
-    if (*path == 0) return -1;
+    uint32_t dir;
+    const char* name;
+    int len;
+    if (resolve_parent(path, &dir, &name, &len) != 0) return -1;
+    if (len == 0) return -1;
+
+    index_entry_t* e = dir_lookup(dir, name, len);
+    if (!e) return -1;  /* File not found */
+    uint32_t sector = e->sector;
+    uint32_t pos = e->pos;
 
     /* Check if file is open */
-    int idx = find_file(path);
-    if (idx < 0) return -1;  /* File not found */
+    if (entry_open(sector, pos)) return -1;
 
-    for (int i = 0; i < FS_MAX_OPEN; i++) {
-        if (open_files[i].in_use && open_files[i].dirent_idx == idx) {
-            return -1;  /* File is open */
-        }
-    }
+    fs_dirent_t* d = dirent_at(sector, pos, 0);
+    if (!d) return -1;
+    uint32_t first = d->first_cluster;
+    int is_dir = (d->flags & FS_FLAG_DIR) != 0;
 
-    /* Free clusters */
-    if (root_dir[idx].first_cluster != FAT_EOF) {
-        free_cluster_chain(root_dir[idx].first_cluster);
+    if (is_dir) {
+        if (dir_empty(first) != 1) return -1;
+        index_entry_t* rec = index_find(first, 0);
+        if (rec) index_remove(rec);
     }
 
-    /* Clear directory entry */
-    memset(&root_dir[idx], 0, sizeof(fs_dirent_t));
-
-    /* Write changes */
-    write_fat();
-    write_root_dir();
-    write_superblock();
+    /* Clear directory entry, then free the clusters it pointed at */
+    d = dirent_at(sector, pos, 1);
+    if (!d) return -1;
+    memset(d, 0, sizeof(fs_dirent_t));
+    superblock.files_count--;
+
+    /* The directory record may have shifted e; find the entry again */
+    uint32_t key = name_hash(name, len);
+    for (uint32_t i = index_slot(dir, key); name_index[i].dir != 0;
+         i = (i + 1) & (index_size - 1)) {
+        if (name_index[i].dir == dir && name_index[i].pos == pos && name_index[i].key == key) {
+            index_remove(&name_index[i]);
+            break;
+        }
+    }
+    index_entry_t* rec = index_find(dir, 0);
+    if (rec && pos < rec->sector) rec->sector = pos;
 
+    if (is_dir) {
+        /* Its sectors may be reused as file data */
+        for (uint32_t c = first; is_cluster(c); c = fat_get(c)) {
+            meta_drop(cluster_to_sector(c), FS_SECTORS_PER_CLUSTER);
+        }
+    }
+    if (first != FAT_EOF) {
+        free_cluster_chain(first);
+    }
     return 0;
 }
 
@@ -524,14 +1474,7 @@ int fs_stats(fs_stats_t* stats) {
     stats->total_clusters = superblock.total_clusters;
     stats->free_clusters = superblock.free_clusters;
     stats->cluster_size = FS_CLUSTER_SIZE;
-
-    /* Count files */
-    stats->files_count = 0;
-    for (int i = 0; i < FS_MAX_FILES; i++) {
-        if (root_dir[i].name[0] != 0) {
-            stats->files_count++;
-        }
-    }
+    stats->files_count = superblock.files_count;
 
     return 0;
 }
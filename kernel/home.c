@@ -8,12 +8,16 @@
 #include "font.h"
 #include "goldfish_fb.h"
 #include "image.h"
+#include "memory.h"
+#include "raster.h"
+#include "timer.h"
 #include "images/background.h"
 
 /* Background image */
 static const image_t background_img = {.width = BACKGROUND_WIDTH,
                                        .height = BACKGROUND_HEIGHT,
-                                       .data = background_data};
+                                       .packed = background_packed,
+                                       .packed_size = BACKGROUND_PACKED_SIZE};
 
 /* Colors - designed for dark purple/blue/cyan background */
 #define HOME_TEXT 0x00FFFFFF     /* Bright white text */
@@ -38,18 +42,30 @@ static int terminal_pressed = 0;
 static int files_pressed = 0;
 static int terminal_touch_active = 0;
 static int files_touch_active = 0;
-static int needs_redraw = 1;
+static int needs_redraw = 1; /* Whole screen, not just the logo */
 
 /* Screen dimensions */
 static uint32_t screen_w = 0;
 static uint32_t screen_h = 0;
 
 /* Animation state */
+#define ANIM_INTERVAL_MS 100
 static uint32_t anim_frame = 0;
 
 /* Internet connection status */
 static int internet_connected = 0;
-static int anim_tick = 0;
+static uint32_t next_anim_ms = 0;
+
+/*
+ * Everything except the animated logo is composed once into an offscreen
+ * layer; it is rebuilt only when an icon or the status line changes.
+ * Animation ticks restore the logo's box from the layer and redraw just
+ * the logo, so an idle home screen flushes only that region.
+ */
+static uint32_t *layer = NULL;
+static uint32_t layer_w = 0;
+static uint32_t layer_h = 0;
+static int layer_dirty = 1;
 
 void home_init(void) {
   screen_w = goldfish_fb_get_width();
@@ -100,15 +116,18 @@ static int point_in_icon_at(int32_t x, int32_t y, int ix) {
 int home_update(void) {
   input_event_t ev;
 
-  while (event_pop(&ev) == 0) {
+  input_event_t batch[EVENT_BATCH_MAX];
+  int batch_len = event_pop_batch(batch, EVENT_BATCH_MAX);
+  for (int ei = 0; ei < batch_len; ei++) {
+    ev = batch[ei];
     if (ev.type == EVENT_TOUCH) {
       if (ev.subtype == TOUCH_DOWN) {
         if (point_in_icon_at(ev.x, ev.y, terminal_icon_x)) {
           terminal_touch_active = 1;
-          needs_redraw = 1;
+          layer_dirty = needs_redraw = 1;
         } else if (point_in_icon_at(ev.x, ev.y, files_icon_x)) {
           files_touch_active = 1;
-          needs_redraw = 1;
+          layer_dirty = needs_redraw = 1;
         }
       } else if (ev.subtype == TOUCH_UP) {
         if (terminal_touch_active &&
@@ -120,16 +139,16 @@ int home_update(void) {
         }
         terminal_touch_active = 0;
         files_touch_active = 0;
-        needs_redraw = 1;
+        layer_dirty = needs_redraw = 1;
       } else if (ev.subtype == TOUCH_MOVE) {
         if (terminal_touch_active &&
             !point_in_icon_at(ev.x, ev.y, terminal_icon_x)) {
           terminal_touch_active = 0;
-          needs_redraw = 1;
+          layer_dirty = needs_redraw = 1;
         }
         if (files_touch_active && !point_in_icon_at(ev.x, ev.y, files_icon_x)) {
           files_touch_active = 0;
-          needs_redraw = 1;
+          layer_dirty = needs_redraw = 1;
         }
       }
     } else if (ev.type == EVENT_KEY) {
@@ -141,10 +160,9 @@ int home_update(void) {
     }
   }
 
-  /* Animation - update every ~100 ticks */
-  anim_tick++;
-  if (anim_tick >= 100) {
-    anim_tick = 0;
+  /* Animation - advance one frame every ANIM_INTERVAL_MS */
+  if (timer_expired(next_anim_ms)) {
+    next_anim_ms = timer_ms() + ANIM_INTERVAL_MS;
     anim_frame++;
     return 1;
   }
@@ -152,175 +170,6 @@ int home_update(void) {
   return needs_redraw;
 }
 
-/* Blend two colors with alpha (0-255) */
-static uint32_t blend_color(uint32_t bg, uint32_t fg, int alpha) {
-  int bg_r = (bg >> 16) & 0xFF;
-  int bg_g = (bg >> 8) & 0xFF;
-  int bg_b = bg & 0xFF;
-
-  int fg_r = (fg >> 16) & 0xFF;
-  int fg_g = (fg >> 8) & 0xFF;
-  int fg_b = fg & 0xFF;
-
-  int r = (fg_r * alpha + bg_r * (255 - alpha)) / 255;
-  int g = (fg_g * alpha + bg_g * (255 - alpha)) / 255;
-  int b = (fg_b * alpha + bg_b * (255 - alpha)) / 255;
-
-  return (r << 16) | (g << 8) | b;
-}
-
-/* Draw a filled rectangle */
-static void draw_rect(uint32_t *fb, int x, int y, int w, int h,
-                      uint32_t color) {
-  for (int py = y; py < y + h && py < (int)screen_h; py++) {
-    if (py < 0)
-      continue;
-    for (int px = x; px < x + w && px < (int)screen_w; px++) {
-      if (px < 0)
-        continue;
-      fb[py * screen_w + px] = color;
-    }
-  }
-}
-
-/* Draw a filled rectangle with alpha transparency */
-static void draw_rect_alpha(uint32_t *fb, int x, int y, int w, int h,
-                            uint32_t color, int alpha) {
-  for (int py = y; py < y + h && py < (int)screen_h; py++) {
-    if (py < 0)
-      continue;
-    for (int px = x; px < x + w && px < (int)screen_w; px++) {
-      if (px < 0)
-        continue;
-      uint32_t bg = fb[py * screen_w + px];
-      fb[py * screen_w + px] = blend_color(bg, color, alpha);
-    }
-  }
-}
-
-/* Draw a filled circle */
-static void draw_circle(uint32_t *fb, int cx, int cy, int r, uint32_t color) {
-  for (int py = cy - r; py <= cy + r; py++) {
-    if (py < 0 || py >= (int)screen_h)
-      continue;
-    for (int px = cx - r; px <= cx + r; px++) {
-      if (px < 0 || px >= (int)screen_w)
-        continue;
-      int dx = px - cx;
-      int dy = py - cy;
-      if (dx * dx + dy * dy <= r * r) {
-        fb[py * screen_w + px] = color;
-      }
-    }
-  }
-}
-
-/* Draw a filled circle with alpha */
-static void draw_circle_alpha(uint32_t *fb, int cx, int cy, int r,
-                              uint32_t color, int alpha) {
-  for (int py = cy - r; py <= cy + r; py++) {
-    if (py < 0 || py >= (int)screen_h)
-      continue;
-    for (int px = cx - r; px <= cx + r; px++) {
-      if (px < 0 || px >= (int)screen_w)
-        continue;
-      int dx = px - cx;
-      int dy = py - cy;
-      if (dx * dx + dy * dy <= r * r) {
-        uint32_t bg = fb[py * screen_w + px];
-        fb[py * screen_w + px] = blend_color(bg, color, alpha);
-      }
-    }
-  }
-}
-
-/* Draw circle border */
-static void draw_circle_ring(uint32_t *fb, int cx, int cy, int r, int thickness,
-                             uint32_t color) {
-  int r_outer = r;
-  int r_inner = r - thickness;
-  for (int py = cy - r_outer; py <= cy + r_outer; py++) {
-    if (py < 0 || py >= (int)screen_h)
-      continue;
-    for (int px = cx - r_outer; px <= cx + r_outer; px++) {
-      if (px < 0 || px >= (int)screen_w)
-        continue;
-      int dx = px - cx;
-      int dy = py - cy;
-      int d2 = dx * dx + dy * dy;
-      if (d2 <= r_outer * r_outer && d2 >= r_inner * r_inner) {
-        fb[py * screen_w + px] = color;
-      }
-    }
-  }
-}
-
-/* Draw rounded rectangle for dock */
-static void draw_rounded_rect(uint32_t *fb, int x, int y, int w, int h, int r,
-                              uint32_t color) {
-  /* Main body */
-  draw_rect(fb, x + r, y, w - 2 * r, h, color);
-  draw_rect(fb, x, y + r, w, h - 2 * r, color);
-
-  /* Corners */
-  draw_circle(fb, x + r, y + r, r, color);
-  draw_circle(fb, x + w - r - 1, y + r, r, color);
-  draw_circle(fb, x + r, y + h - r - 1, r, color);
-  draw_circle(fb, x + w - r - 1, y + h - r - 1, r, color);
-}
-
-/* Draw rounded rectangle with alpha transparency (no overlap) */
-static void draw_rounded_rect_alpha(uint32_t *fb, int x, int y, int w, int h,
-                                    int r, uint32_t color, int alpha) {
-  for (int py = y; py < y + h; py++) {
-    if (py < 0 || py >= (int)screen_h)
-      continue;
-    for (int px = x; px < x + w; px++) {
-      if (px < 0 || px >= (int)screen_w)
-        continue;
-
-      int inside = 0;
-
-      /* Check if in main rectangle (excluding corners) */
-      if ((px >= x + r && px < x + w - r) || (py >= y + r && py < y + h - r)) {
-        inside = 1;
-      } else {
-        /* Check corner circles */
-        int dx, dy, d2, r2 = r * r;
-
-        /* Top-left corner */
-        dx = px - (x + r);
-        dy = py - (y + r);
-        if (dx < 0 && dy < 0 && dx * dx + dy * dy <= r2)
-          inside = 1;
-
-        /* Top-right corner */
-        dx = px - (x + w - r - 1);
-        dy = py - (y + r);
-        if (dx > 0 && dy < 0 && dx * dx + dy * dy <= r2)
-          inside = 1;
-
-        /* Bottom-left corner */
-        dx = px - (x + r);
-        dy = py - (y + h - r - 1);
-        if (dx < 0 && dy > 0 && dx * dx + dy * dy <= r2)
-          inside = 1;
-
-        /* Bottom-right corner */
-        dx = px - (x + w - r - 1);
-        dy = py - (y + h - r - 1);
-        if (dx > 0 && dy > 0 && dx * dx + dy * dy <= r2)
-          inside = 1;
-      }
-
-      if (inside) {
-        uint32_t bg = fb[py * screen_w + px];
-        fb[py * screen_w + px] = blend_color(bg, color, alpha);
-      }
-    }
-  }
-}
-
 /* Draw circular terminal icon (semi-transparent) */
 static void draw_terminal_icon(uint32_t *fb, int x, int y, int size,
                                int pressed) {
@@ -331,13 +180,13 @@ static void draw_terminal_icon(uint32_t *fb, int x, int y, int size,
   /* Circular background with alpha */
   int alpha = pressed ? 200 : 160;
   uint32_t bg = pressed ? 0x402060 : 0x201030;
-  draw_circle_alpha(fb, cx, cy, r, bg, alpha);
+  raster_fill_circle(fb, cx, cy, r, bg, alpha, screen_w, screen_h);
 
   /* Border ring */
-  draw_circle_ring(fb, cx, cy, r, 2, ICON_BORDER);
+  raster_ring(fb, cx, cy, r, 2, ICON_BORDER, 255, screen_w, screen_h);
 
   /* Shiny highlight on top */
-  draw_circle_ring(fb, cx, cy - 2, r - 4, 1, 0x00806090);
+  raster_ring(fb, cx, cy - 2, r - 4, 1, 0x00806090, 255, screen_w, screen_h);
 
   /* Draw ">_" text inside icon */
   draw_string(fb, x + size / 2 - 12, y + size / 2 - 6, ">_", HOME_TEXT,
@@ -353,33 +202,21 @@ static void draw_files_icon(uint32_t *fb, int x, int y, int size, int pressed) {
   /* Circular background with alpha - blue tint */
   int alpha = pressed ? 200 : 160;
   uint32_t bg = pressed ? 0x203060 : 0x102040;
-  draw_circle_alpha(fb, cx, cy, r, bg, alpha);
+  raster_fill_circle(fb, cx, cy, r, bg, alpha, screen_w, screen_h);
 
   /* Border ring */
-  draw_circle_ring(fb, cx, cy, r, 2, 0x0060A0E0);
+  raster_ring(fb, cx, cy, r, 2, 0x0060A0E0, 255, screen_w, screen_h);
 
   /* Shiny highlight on top */
-  draw_circle_ring(fb, cx, cy - 2, r - 4, 1, 0x00608090);
+  raster_ring(fb, cx, cy - 2, r - 4, 1, 0x00608090, 255, screen_w, screen_h);
 
   /* Draw folder icon inside */
   int fx = cx - 10;
   int fy = cy - 6;
   /* Folder tab */
-  for (int py = fy; py < fy + 4; py++) {
-    for (int px = fx; px < fx + 8; px++) {
-      if (px >= 0 && py >= 0 && (uint32_t)px < screen_w &&
-          (uint32_t)py < screen_h)
-        fb[py * screen_w + px] = 0x00FFD700;
-    }
-  }
+  raster_fill_rect(fb, fx, fy, 8, 4, 0x00FFD700, 255, screen_w, screen_h);
   /* Folder body */
-  for (int py = fy + 3; py < fy + 14; py++) {
-    for (int px = fx; px < fx + 20; px++) {
-      if (px >= 0 && py >= 0 && (uint32_t)px < screen_w &&
-          (uint32_t)py < screen_h)
-        fb[py * screen_w + px] = 0x00FFD700;
-    }
-  }
+  raster_fill_rect(fb, fx, fy + 3, 20, 11, 0x00FFD700, 255, screen_w, screen_h);
 }
 
 /* Draw a scaled character (4x scale for big logo) */
@@ -464,47 +301,40 @@ static void draw_logo_shiny(uint32_t *fb, int x, int y, const char *str,
   }
 }
 
-void home_draw(void) {
-  uint32_t *fb = goldfish_fb_get_buffer();
+/* Logo placement (4x scale, centered, higher up) */
+#define LOGO_TEXT "ClaudeOS"
+#define LOGO_LEN 8
+#define LOGO_SHADOW 3 /* Glow layer offset */
 
-  if (screen_w == 0 || screen_h == 0) {
-    screen_w = goldfish_fb_get_width();
-    screen_h = goldfish_fb_get_height();
-    if (screen_w == 0)
-      screen_w = 360;
-    if (screen_h == 0)
-      screen_h = 640;
-  }
+static int logo_x(void) { return (screen_w - LOGO_LEN * FONT_WIDTH * 4) / 2; }
+
+static int logo_y(void) { return (screen_h - FONT_HEIGHT * 4) / 2 - 80; }
 
-  /* Solid dark background (temp: background image disabled) */
-  goldfish_fb_clear(0x001A1A2E);
+/* Compose the static layers: background, panel, text, bottom bar, icons */
+static void draw_static(uint32_t *fb) {
+  /* Background image (scaled once, then copied from the cache) */
+  image_draw_background(fb, screen_w, screen_h, &background_img);
 
   /* Calculate logo dimensions (4x scale) */
-  const char *logo = "ClaudeOS";
-  int logo_len = 8;
-  int logo_w = logo_len * FONT_WIDTH * 4; /* 4x width */
+  int logo_w = LOGO_LEN * FONT_WIDTH * 4; /* 4x width */
   int logo_h = FONT_HEIGHT * 4;
-  int logo_x = (screen_w - logo_w) / 2;
-  int logo_y =
-      (screen_h - logo_h) / 2 - 80; /* Centered vertically, higher up */
+  int lx = logo_x();
+  int ly = logo_y();
 
   /* Dark transparent panel behind logo (50% opacity) */
   int panel_pad = 20;
-  int panel_x = logo_x - panel_pad;
-  int panel_y = logo_y - panel_pad;
+  int panel_x = lx - panel_pad;
+  int panel_y = ly - panel_pad;
   int panel_w = logo_w + panel_pad * 2;
   int panel_h = logo_h + FONT_HEIGHT + 30 + panel_pad * 2; /* Include tagline */
-  draw_rounded_rect_alpha(fb, panel_x, panel_y, panel_w, panel_h, 15, 0x000000,
-                          140);
-
-  /* Big shiny logo */
-  draw_logo_shiny(fb, logo_x, logo_y, logo, anim_frame * 3);
+  raster_fill_rounded_rect(fb, panel_x, panel_y, panel_w, panel_h, 15,
+                           0x000000, 140, screen_w, screen_h);
 
   /* Tagline under logo */
   const char *tagline = "AI-First OS";
   int tag_len = 11;
   int tag_x = (screen_w - tag_len * FONT_WIDTH) / 2;
-  draw_string(fb, tag_x, logo_y + logo_h + 12, tagline, HOME_TEXT_DIM, screen_w,
+  draw_string(fb, tag_x, ly + logo_h + 12, tagline, HOME_TEXT_DIM, screen_w,
               screen_h);
 
   /* Internet connection status */
@@ -512,17 +342,18 @@ void home_draw(void) {
     const char *conn_msg = "Connected to Internet";
     int conn_len = 21;
     int conn_x = (screen_w - conn_len * FONT_WIDTH) / 2;
-    draw_string(fb, conn_x, logo_y + logo_h + 32, conn_msg, 0x0000FF88,
-                screen_w, screen_h);
+    draw_string(fb, conn_x, ly + logo_h + 32, conn_msg, 0x0000FF88, screen_w,
+                screen_h);
   }
 
   /* Full-width bottom bar (transparent) */
   int bar_h = 80;
   int bar_y = screen_h - bar_h;
-  draw_rect_alpha(fb, 0, bar_y, screen_w, bar_h, 0x000000, 140);
+  raster_fill_rect(fb, 0, bar_y, screen_w, bar_h, 0x000000, 140, screen_w,
+                   screen_h);
 
   /* Bar top border/highlight */
-  draw_rect_alpha(fb, 0, bar_y, screen_w, 1, 0x808080, 80);
+  raster_fill_rect(fb, 0, bar_y, screen_w, 1, 0x808080, 80, screen_w, screen_h);
 
   /* Icon Y position in bottom bar */
   int icon_cy = bar_y + (bar_h - ICON_SIZE) / 2 - 8;
@@ -539,6 +370,71 @@ void home_draw(void) {
   int files_label_x = files_icon_x + (ICON_SIZE - 5 * FONT_WIDTH) / 2;
   draw_string(fb, files_label_x, icon_cy + ICON_SIZE + 2, "Files",
               HOME_TEXT_DIM, screen_w, screen_h);
+}
+
+/* Rebuild the static layer if needed; returns 0 if there is no layer */
+static int update_layer(void) {
+  if (layer && (layer_w != screen_w || layer_h != screen_h)) {
+    free(layer);
+    layer = NULL;
+  }
+  if (!layer) {
+    layer = (uint32_t *)malloc(screen_w * screen_h * 4);
+    if (!layer)
+      return 0;
+    layer_w = screen_w;
+    layer_h = screen_h;
+    layer_dirty = 1;
+  }
+  if (layer_dirty) {
+    draw_static(layer);
+    layer_dirty = 0;
+  }
+  return 1;
+}
+
+void home_draw(void) {
+  uint32_t *fb = goldfish_fb_get_buffer();
+
+  if (screen_w == 0 || screen_h == 0) {
+    screen_w = goldfish_fb_get_width();
+    screen_h = goldfish_fb_get_height();
+    if (screen_w == 0)
+      screen_w = 360;
+    if (screen_h == 0)
+      screen_h = 640;
+  }
+
+  int lx = logo_x();
+  int ly = logo_y();
+
+  if (!update_layer()) {
+    /* No memory for the layer - compose straight to the screen */
+    draw_static(fb);
+    goldfish_fb_damage_all();
+  } else if (needs_redraw) {
+    memcpy(fb, layer, screen_w * screen_h * 4);
+    goldfish_fb_damage_all();
+  } else {
+    /* Animation tick: restore only the logo's box */
+    int x0 = lx < 0 ? 0 : lx;
+    int y0 = ly < 0 ? 0 : ly;
+    int x1 = lx + LOGO_LEN * FONT_WIDTH * 4 + LOGO_SHADOW;
+    int y1 = ly + FONT_HEIGHT * 4 + LOGO_SHADOW;
+    if (x1 > (int)screen_w)
+      x1 = screen_w;
+    if (y1 > (int)screen_h)
+      y1 = screen_h;
+    for (int y = y0; y < y1; y++) {
+      memcpy(fb + y * screen_w + x0, layer + y * screen_w + x0,
+             (x1 - x0) * 4);
+    }
+    if (x1 > x0 && y1 > y0)
+      goldfish_fb_damage(x0, y0, x1 - x0, y1 - y0);
+  }
+
+  /* Big shiny logo */
+  draw_logo_shiny(fb, lx, ly, LOGO_TEXT, anim_frame * 3);
 
   needs_redraw = 0;
 }
@@ -554,5 +450,7 @@ void home_clear_pressed(void) {
 
 void home_set_external_ip(const char *ip) {
   (void)ip; /* IP not displayed, just mark as connected */
+  if (!internet_connected)
+    layer_dirty = needs_redraw = 1;
   internet_connected = 1;
 }
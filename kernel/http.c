@@ -6,6 +6,8 @@
 #include "tcp.h"
 #include "net.h"
 #include "memory.h"
+#include "timer.h"
+#include "fs.h"
 
 /* String utilities */
 static int str_len(const char* s) {
@@ -152,8 +154,8 @@ static int build_request(http_request_t* req, char* buf, int buf_size,
     h = "User-Agent: TinyOS/1.0\r\n";
     while (*h && pos < buf_size - 1) buf[pos++] = *h++;
 
-    /* Connection */
-    h = "Connection: close\r\n";
+    /* Connection: kept open for the pool */
+    h = "Connection: keep-alive\r\n";
     while (*h && pos < buf_size - 1) buf[pos++] = *h++;
 
     /* Content-Length for POST/PUT */
@@ -192,9 +194,21 @@ static int build_request(http_request_t* req, char* buf, int buf_size,
     return pos;
 }
 
-/* Parse HTTP response headers */
-static int parse_response(http_request_t* req, const char* data, int len) {
+/* Case-insensitive match of a header name or token against lowercase s */
+static int header_is(const char* name, int len, const char* s) {
+    if (len != str_len(s)) return 0;
+    for (int i = 0; i < len; i++) {
+        if (to_lower(name[i]) != s[i]) return 0;
+    }
+    return 1;
+}
+
+/* Parse HTTP response headers from header_buf. Returns the offset of
+ * the first body byte, or 0 if the headers aren't complete yet */
+static int parse_response(http_request_t* req) {
     http_response_t* resp = &req->response;
+    const char* data = req->header_buf;
+    int len = req->header_len;
 
     /* Find end of headers */
     const char* header_end = NULL;
@@ -211,7 +225,6 @@ static int parse_response(http_request_t* req, const char* data, int len) {
     }
 
     req->header_complete = 1;
-    req->body_start = (char*)header_end;
 
     /* Parse status line */
     const char* p = data;
@@ -232,65 +245,380 @@ static int parse_response(http_request_t* req, const char* data, int len) {
     memcpy(resp->headers, data, hdr_len);
     resp->headers[hdr_len] = 0;
 
-    /* Parse Content-Length */
+    /* Parse the header lines of interest; all of them, not just the
+     * part kept in resp->headers. HTTP/1.1 is persistent by default */
     resp->content_length = -1;
     resp->chunked = 0;
-    p = resp->headers;
-    while (*p) {
+    resp->keep_alive = str_ncmp(data, "HTTP/1.1", 8) == 0;
+    const char* end = header_end - 2;   /* The blank line */
+    while (*p != '\n' && p < end) p++; /* Past the status line */
+    p++;
+    while (p < end) {
         /* Find header name */
         const char* line_start = p;
-        while (*p && *p != ':' && *p != '\r') p++;
-        if (*p != ':') { while (*p && *p != '\n') p++; if (*p) p++; continue; }
+        while (p < end && *p != ':' && *p != '\r') p++;
+        if (p == end || *p != ':') {
+            while (p < end && *p != '\n') p++;
+            p++;
+            continue;
+        }
 
         int name_len = p - line_start;
         p++;  /* Skip ':' */
         while (*p == ' ') p++;  /* Skip whitespace */
 
         const char* value_start = p;
-        while (*p && *p != '\r') p++;
-
-        /* Check for Content-Length */
-        if (name_len == 14) {
-            int match = 1;
-            const char* cl = "content-length";
-            for (int i = 0; i < 14; i++) {
-                if (to_lower(line_start[i]) != cl[i]) { match = 0; break; }
+        while (p < end && *p != '\r') p++;
+        int value_len = p - value_start;
+
+        if (header_is(line_start, name_len, "content-length")) {
+            resp->content_length = 0;
+            const char* v = value_start;
+            while (*v >= '0' && *v <= '9') {
+                resp->content_length = resp->content_length * 10 + (*v - '0');
+                v++;
             }
-            if (match) {
-                resp->content_length = 0;
-                const char* v = value_start;
-                while (*v >= '0' && *v <= '9') {
-                    resp->content_length = resp->content_length * 10 + (*v - '0');
-                    v++;
-                }
+        } else if (header_is(line_start, name_len, "transfer-encoding")) {
+            if (str_ncmp(value_start, "chunked", 7) == 0) {
+                resp->chunked = 1;
+            }
+        } else if (header_is(line_start, name_len, "connection")) {
+            if (header_is(value_start, value_len, "close")) {
+                resp->keep_alive = 0;
+            } else if (header_is(value_start, value_len, "keep-alive")) {
+                resp->keep_alive = 1;
             }
         }
 
-        /* Check for Transfer-Encoding: chunked */
-        if (name_len == 17) {
-            int match = 1;
-            const char* te = "transfer-encoding";
-            for (int i = 0; i < 17; i++) {
-                if (to_lower(line_start[i]) != te[i]) { match = 0; break; }
-            }
-            if (match && str_ncmp(value_start, "chunked", 7) == 0) {
-                resp->chunked = 1;
-            }
+        while (p < end && *p != '\n') p++;
+        p++;
+    }
+
+    /* Without a length, only the server closing ends the body */
+    if (!resp->chunked && resp->content_length < 0 &&
+        resp->status_code != 204 && resp->status_code != 304) {
+        resp->keep_alive = 0;
+    }
+
+    return header_end - data;
+}
+
+/* ==================== Body decoding ==================== */
+
+/* Hand decoded body bytes to the sink, or append what fits to
+ * response.body. Returns 0, or -1 if the sink gave up */
+static int body_out(http_request_t* req, const char* data, int len) {
+    http_response_t* resp = &req->response;
+    resp->body_total += len;
+    if (req->sink) {
+        return req->sink(req->sink_ctx, data, len);
+    }
+
+    int space = HTTP_MAX_BODY - 1 - resp->body_len;
+    if (len > space) len = space;
+    memcpy(resp->body + resp->body_len, data, len);
+    resp->body_len += len;
+    resp->body[resp->body_len] = 0;
+    return 0;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = to_lower(c);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+/* Decode a piece of chunked body. chunk_line counts the size digits read,
+ * negated once an extension starts (its characters are skipped), or the
+ * length of the current trailer line. Returns the bytes consumed, which
+ * stop after the last chunk, or -1 on a malformed chunk or sink failure */
+static int body_chunked(http_request_t* req, const char* data, int len) {
+    int used = 0;
+    while (used < len && req->chunk_state != HTTP_CHUNK_DONE) {
+        if (req->chunk_state == HTTP_CHUNK_DATA) {
+            int n = len - used;
+            if ((uint32_t)n > req->chunk_left) n = (int)req->chunk_left;
+            if (body_out(req, data + used, n) != 0) return -1;
+            used += n;
+            req->chunk_left -= n;
+            if (req->chunk_left == 0) req->chunk_state = HTTP_CHUNK_DATA_END;
+            continue;
         }
 
-        while (*p && *p != '\n') p++;
-        if (*p) p++;
+        char c = data[used++];
+        if (c == '\r') continue;
+
+        switch (req->chunk_state) {
+            case HTTP_CHUNK_SIZE:
+                if (c == '\n') {
+                    if (req->chunk_line == 0) return -1;
+                    req->chunk_state = req->chunk_left ? HTTP_CHUNK_DATA
+                                                       : HTTP_CHUNK_TRAILER;
+                    req->chunk_line = 0;
+                } else if (req->chunk_line >= 0 && hex_digit(c) >= 0) {
+                    if (req->chunk_left >> 27) return -1;   /* Too big */
+                    req->chunk_left = (req->chunk_left << 4) | hex_digit(c);
+                    req->chunk_line++;
+                } else if (req->chunk_line == 0) {
+                    return -1;
+                } else if (req->chunk_line > 0) {
+                    req->chunk_line = -req->chunk_line;     /* ";ext" */
+                }
+                break;
+
+            case HTTP_CHUNK_DATA_END:
+                if (c != '\n') return -1;
+                req->chunk_state = HTTP_CHUNK_SIZE;
+                break;
+
+            case HTTP_CHUNK_TRAILER:
+                if (c != '\n') req->chunk_line++;
+                else if (req->chunk_line > 0) req->chunk_line = 0;
+                else req->chunk_state = HTTP_CHUNK_DONE;
+                break;
+        }
     }
+    return used;
+}
 
-    return 1;
+/* Feed received body bytes through the transfer coding; the request is
+ * done once the last chunk or Content-Length bytes have arrived. Returns
+ * the bytes consumed - anything after the body belongs to the next
+ * response on the connection - or -1 on error */
+static int body_feed(http_request_t* req, const char* data, int len) {
+    http_response_t* resp = &req->response;
+
+    if (resp->chunked) {
+        int used = body_chunked(req, data, len);
+        if (req->chunk_state == HTTP_CHUNK_DONE) req->state = HTTP_STATE_DONE;
+        return used;
+    }
+
+    if (resp->content_length >= 0) {
+        int left = resp->content_length - resp->body_total;
+        if (len > left) len = left;
+    }
+    if (len > 0 && body_out(req, data, len) != 0) return -1;
+    if (resp->content_length >= 0 && resp->body_total >= resp->content_length) {
+        req->state = HTTP_STATE_DONE;
+    }
+    return len;
 }
 
-int http_request_start(http_request_t* req, int method, const char* url,
-                       const char* body, int body_len) {
+static int fd_sink(void* ctx, const void* data, int len) {
+    http_request_t* req = (http_request_t*)ctx;
+    return fs_write(req->sink_fd, data, len) == len ? 0 : -1;
+}
+
+void http_request_set_sink(http_request_t* req, http_sink_t sink, void* ctx) {
+    req->sink = sink;
+    req->sink_ctx = ctx;
+}
+
+void http_request_set_fd(http_request_t* req, int fd) {
+    req->sink_fd = fd;
+    http_request_set_sink(req, fd_sink, req);
+}
+
+/* ==================== Connection pool ==================== */
+
+/* A TCP connection to host:port and the requests whose responses it is
+ * carrying, oldest first. Only the oldest reads from it; bytes it reads
+ * past its own response wait in carry for the next one */
+typedef struct {
+    int in_use;
+    int tcp_conn;
+    char host[HTTP_MAX_HOST];
+    uint16_t port;
+    uint8_t ip[4];
+    int reusable;            /* No response so far said "close" */
+    uint32_t idle_since;     /* timer_ms when the queue emptied */
+    http_request_t* queue[HTTP_PIPELINE_DEPTH];
+    int queued;
+    char carry[HTTP_HEADER_BUF];
+    int carry_len;
+} http_conn_t;
+
+static http_conn_t pool[HTTP_POOL_SIZE];
+
+static void pool_free(http_conn_t* c) {
+    tcp_close(c->tcp_conn);
+    c->in_use = 0;
+    c->queued = 0;
+    c->carry_len = 0;
+}
+
+/* Close idle connections that timed out or that the server closed (or
+ * sent unasked-for data on) */
+static void pool_expire(void) {
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_conn_t* c = &pool[i];
+        if (!c->in_use || c->queued > 0) continue;
+        if (timer_ms() - c->idle_since > HTTP_POOL_IDLE_MS ||
+            tcp_get_state(c->tcp_conn) != TCP_ESTABLISHED ||
+            tcp_data_available(c->tcp_conn) || c->carry_len > 0) {
+            pool_free(c);
+        }
+    }
+}
+
+/* An open connection to the request's host:port it can use: an idle one,
+ * or with `pipeline` one whose requests have all been sent */
+static http_conn_t* pool_find(http_request_t* req, int pipeline) {
+    http_conn_t* busy = NULL;
+    for (int i = 0; i < HTTP_POOL_SIZE; i++) {
+        http_conn_t* c = &pool[i];
+        if (!c->in_use || !c->reusable || c->port != req->url.port ||
+            str_cmp(c->host, req->url.host) != 0 ||
+            tcp_get_state(c->tcp_conn) != TCP_ESTABLISHED) {
+            continue;
+        }
+        if (c->queued == 0) return c;
+        if (pipeline && !busy && c->queued < HTTP_PIPELINE_DEPTH &&
+            c->queue[c->queued - 1]->state >= HTTP_STATE_HEADERS) {
+            busy = c;
+        }
+    }
+    return busy;
+}
+
+/* Put the request at the back of the connection's queue */
+static void pool_join(http_conn_t* c, http_request_t* req) {
+    c->queue[c->queued++] = req;
+    req->pool = c - pool;
+    req->tcp_conn = c->tcp_conn;
+}
+
+/* Open a new pooled connection for the request (to resolved_ip). A free
+ * slot is used, else the longest-idle connection is closed for it */
+static int pool_open(http_request_t* req) {
+    http_conn_t* c = NULL;
+    for (int i = 0; i < HTTP_POOL_SIZE && !c; i++) {
+        if (!pool[i].in_use) c = &pool[i];
+    }
+    for (int i = 0; i < HTTP_POOL_SIZE && !c; i++) {
+        http_conn_t* idle = &pool[i];
+        if (idle->queued == 0 &&
+            (!c || (int32_t)(idle->idle_since - c->idle_since) < 0)) {
+            c = idle;
+        }
+    }
+    if (!c) return -1;
+    if (c->in_use) pool_free(c);
+
+    c->tcp_conn = tcp_connect(req->resolved_ip, req->url.port);
+    if (c->tcp_conn < 0) return -1;
+    c->in_use = 1;
+    str_cpy(c->host, req->url.host, HTTP_MAX_HOST);
+    c->port = req->url.port;
+    memcpy(c->ip, req->resolved_ip, 4);
+    c->reusable = 1;
+    c->queued = 0;
+    c->carry_len = 0;
+
+    req->reused = 0;
+    pool_join(c, req);
+    req->state = HTTP_STATE_CONNECTING;
+    return 0;
+}
+
+/* Bytes a request can read from its connection */
+static int conn_available(http_conn_t* c) {
+    return c->carry_len > 0 || tcp_data_available(c->tcp_conn);
+}
+
+/* Read from the connection, carried-over bytes first */
+static int conn_read(http_conn_t* c, char* buf, int max) {
+    if (c->carry_len == 0) return tcp_recv(c->tcp_conn, buf, max);
+
+    int n = c->carry_len < max ? c->carry_len : max;
+    memcpy(buf, c->carry, n);
+    c->carry_len -= n;
+    memmove(c->carry, c->carry + n, c->carry_len);
+    return n;
+}
+
+/* Give back bytes read past the end of a response. They came from one
+ * conn_read, so they fit: it either emptied carry or left what remains */
+static void conn_unread(http_conn_t* c, const char* data, int len) {
+    if (len <= 0) return;
+    memmove(c->carry + len, c->carry, c->carry_len);
+    memcpy(c->carry, data, len);
+    c->carry_len += len;
+}
+
+static void send_request(http_request_t* req) {
+    char request_buf[1024];
+    int req_len = build_request(req, request_buf, sizeof(request_buf), NULL, 0);
+    tcp_send(req->tcp_conn, request_buf, req_len);
+    req->state = HTTP_STATE_HEADERS;
+}
+
+/* Response finished: pass the connection to the next request in line, or
+ * keep it idle in the pool if the server allows */
+static void pool_release(http_request_t* req) {
+    http_conn_t* c = &pool[req->pool];
+    req->pool = -1;
+    req->tcp_conn = -1;
+
+    c->queued--;
+    memmove(c->queue, c->queue + 1, c->queued * sizeof(c->queue[0]));
+    if (!req->response.keep_alive) c->reusable = 0;
+
+    if (c->queued == 0) {
+        if (c->reusable && tcp_get_state(c->tcp_conn) == TCP_ESTABLISHED) {
+            c->idle_since = timer_ms();
+        } else {
+            pool_free(c);
+        }
+    }
+}
+
+/* Back to a fresh connection, as if just started */
+static void request_reopen(http_request_t* req) {
+    memset(&req->response, 0, sizeof(http_response_t));
+    req->response.content_length = -1;
+    req->header_complete = 0;
+    req->header_len = 0;
+    req->chunk_state = HTTP_CHUNK_SIZE;
+    req->chunk_left = 0;
+    req->chunk_line = 0;
+    if (pool_open(req) != 0) req->state = HTTP_STATE_ERROR;
+}
+
+/* The connection broke or its stream can't be trusted: close it. `failed`
+ * (if any) ends in error; requests queued behind it that were sent on an
+ * already open connection and never got a byte of answer are retried on
+ * a new one, except POSTs */
+static void pool_fail(http_conn_t* c, http_request_t* failed) {
+    http_request_t* queue[HTTP_PIPELINE_DEPTH];
+    int n = c->queued;
+    memcpy(queue, c->queue, n * sizeof(queue[0]));
+    pool_free(c);
+
+    for (int i = 0; i < n; i++) {
+        http_request_t* q = queue[i];
+        q->pool = -1;
+        q->tcp_conn = -1;
+        if (q != failed && q->reused && q->header_len == 0 &&
+            q->method != HTTP_POST) {
+            request_reopen(q);
+        } else {
+            q->state = HTTP_STATE_ERROR;
+        }
+    }
+}
+
+/* ==================== Requests ==================== */
+
+static int request_begin(http_request_t* req, int method, const char* url,
+                         int pipeline) {
     memset(req, 0, sizeof(http_request_t));
     req->state = HTTP_STATE_IDLE;
     req->method = method;
     req->tcp_conn = -1;
+    req->pool = -1;
     req->response.content_length = -1;  /* -1 means unknown */
 
     if (http_parse_url(url, &req->url) != 0) {
@@ -303,32 +631,50 @@ int http_request_start(http_request_t* req, int method, const char* url,
         return -1;
     }
 
+    /* An open connection to the host skips DNS and the handshake */
+    pool_expire();
+    http_conn_t* c = pool_find(req, pipeline);
+    if (c) {
+        memcpy(req->resolved_ip, c->ip, 4);
+        req->reused = 1;
+        pool_join(c, req);
+        send_request(req);
+        return 0;
+    }
+
     /* Check if host is IP address */
     if (is_ip_address(req->url.host, req->resolved_ip)) {
         /* Already have IP, go straight to connecting */
-        req->tcp_conn = tcp_connect(req->resolved_ip, req->url.port);
-        if (req->tcp_conn < 0) {
+        if (pool_open(req) != 0) {
             req->state = HTTP_STATE_ERROR;
             return -1;
         }
-        req->state = HTTP_STATE_CONNECTING;
     } else {
         /* Need DNS resolution */
         dns_resolve_start(&req->dns_query, req->url.host);
         req->state = HTTP_STATE_DNS;
     }
+    return 0;
+}
 
+int http_request_start(http_request_t* req, int method, const char* url,
+                       const char* body, int body_len) {
     /* Store body info for later (simplified - just use body/body_len params) */
     (void)body;
     (void)body_len;
 
-    return 0;
+    return request_begin(req, method, url, 0);
+}
+
+int http_request_queue(http_request_t* req, const char* url) {
+    return request_begin(req, HTTP_GET, url, 1);
 }
 
 int http_request_poll(http_request_t* req) {
     if (req->state == HTTP_STATE_DONE || req->state == HTTP_STATE_ERROR) {
         return req->state;
     }
+    pool_expire();
 
     /* Handle DNS state */
     if (req->state == HTTP_STATE_DNS) {
@@ -336,11 +682,8 @@ int http_request_poll(http_request_t* req) {
         if (dns_state == DNS_STATE_DONE) {
             /* Got IP, start TCP connection */
             memcpy(req->resolved_ip, req->dns_query.result_ip, 4);
-            req->tcp_conn = tcp_connect(req->resolved_ip, req->url.port);
-            if (req->tcp_conn < 0) {
+            if (pool_open(req) != 0) {
                 req->state = HTTP_STATE_ERROR;
-            } else {
-                req->state = HTTP_STATE_CONNECTING;
             }
         } else if (dns_state == DNS_STATE_ERROR) {
             req->state = HTTP_STATE_ERROR;
@@ -348,64 +691,88 @@ int http_request_poll(http_request_t* req) {
         return req->state;
     }
 
-    int tcp_state = tcp_get_state(req->tcp_conn);
+    if (req->pool < 0) return req->state;
+    http_conn_t* c = &pool[req->pool];
+    int tcp_state = tcp_get_state(c->tcp_conn);
+    int closed = (tcp_state == TCP_CLOSED || tcp_state == TCP_CLOSE_WAIT);
 
     switch (req->state) {
         case HTTP_STATE_CONNECTING:
             if (tcp_state == TCP_ESTABLISHED) {
-                /* Build and send request */
-                char request_buf[1024];
-                int req_len = build_request(req, request_buf, sizeof(request_buf),
-                                            NULL, 0);
-                tcp_send(req->tcp_conn, request_buf, req_len);
-                req->state = HTTP_STATE_HEADERS;
+                send_request(req);
             } else if (tcp_state == TCP_CLOSED) {
-                req->state = HTTP_STATE_ERROR;
+                pool_fail(c, req);
             }
             break;
 
         case HTTP_STATE_HEADERS:
+            /* Pipelined: an earlier response is still arriving */
+            if (c->queue[0] != req) break;
+
+            /* Gather the response head */
+            while (conn_available(c)) {
+                int space = HTTP_HEADER_BUF - 1 - req->header_len;
+                if (space == 0) {
+                    pool_fail(c, req);                  /* Head too large */
+                    return req->state;
+                }
+                req->header_len += conn_read(c, req->header_buf + req->header_len,
+                                             space);
+                req->header_buf[req->header_len] = 0;
+
+                int body_off = parse_response(req);
+                if (body_off == 0) continue;
+
+                /* No body follows these */
+                int rest = req->header_len - body_off;
+                int status = req->response.status_code;
+                if (status == 204 || status == 304) {
+                    req->state = HTTP_STATE_DONE;
+                    conn_unread(c, req->header_buf + body_off, rest);
+                    pool_release(req);
+                    return req->state;
+                }
+                req->state = HTTP_STATE_BODY;
+                int used = body_feed(req, req->header_buf + body_off, rest);
+                if (used < 0) {
+                    pool_fail(c, req);
+                    return req->state;
+                }
+                conn_unread(c, req->header_buf + body_off + used, rest - used);
+                break;
+            }
+            if (req->state == HTTP_STATE_HEADERS) {
+                /* A server may close an idle connection just as a request
+                 * goes out on it; pool_fail retries those */
+                if (closed && !conn_available(c)) pool_fail(c, NULL);
+                break;
+            }
+            /* Fall through */
+
         case HTTP_STATE_BODY:
-            if (tcp_data_available(req->tcp_conn)) {
+            /* Drain what is queued, straight through the decoder */
+            while (req->state == HTTP_STATE_BODY && conn_available(c)) {
                 char buf[1024];
-                int len = tcp_recv(req->tcp_conn, buf, sizeof(buf));
-
-                if (!req->header_complete) {
-                    /* Accumulate in body until headers complete */
-                    int space = HTTP_MAX_BODY - req->response.body_len;
-                    int to_copy = len;
-                    if (to_copy > space) to_copy = space;
-                    memcpy(req->response.body + req->response.body_len, buf, to_copy);
-                    req->response.body_len += to_copy;
-                    req->response.body[req->response.body_len] = 0;
-
-                    if (parse_response(req, req->response.body, req->response.body_len)) {
-                        /* Headers complete, move body data */
-                        int body_offset = req->body_start - req->response.body;
-                        int body_len = req->response.body_len - body_offset;
-                        memmove(req->response.body, req->body_start, body_len);
-                        req->response.body_len = body_len;
-                        req->response.body[body_len] = 0;
-                        req->state = HTTP_STATE_BODY;
-                    }
-                } else {
-                    /* Append body data */
-                    int space = HTTP_MAX_BODY - req->response.body_len - 1;
-                    int to_copy = len;
-                    if (to_copy > space) to_copy = space;
-                    memcpy(req->response.body + req->response.body_len, buf, to_copy);
-                    req->response.body_len += to_copy;
-                    req->response.body[req->response.body_len] = 0;
+                int len = conn_read(c, buf, sizeof(buf));
+                int used = body_feed(req, buf, len);
+                if (used < 0) {
+                    pool_fail(c, req);
+                    return req->state;
                 }
+                conn_unread(c, buf + used, len - used);
             }
 
-            /* Check if done */
-            if (tcp_state == TCP_CLOSED || tcp_state == TCP_CLOSE_WAIT) {
-                req->state = HTTP_STATE_DONE;
-            } else if (req->response.content_length >= 0 &&
-                       req->response.body_len >= req->response.content_length) {
-                req->state = HTTP_STATE_DONE;
-                tcp_close(req->tcp_conn);
+            if (req->state == HTTP_STATE_DONE) {
+                pool_release(req);
+            } else if (closed && !conn_available(c)) {
+                /* Closing ends a body of unknown length; otherwise the
+                 * body was cut short */
+                if (req->response.chunked || req->response.content_length >= 0) {
+                    pool_fail(c, req);
+                } else {
+                    req->state = HTTP_STATE_DONE;
+                    pool_release(req);
+                }
             }
             break;
 
@@ -421,9 +788,9 @@ int http_get_state(http_request_t* req) {
 }
 
 void http_request_close(http_request_t* req) {
-    if (req->tcp_conn >= 0) {
-        tcp_close(req->tcp_conn);
-        req->tcp_conn = -1;
+    if (req->pool >= 0) {
+        /* Unfinished: the rest of its response would confuse the next */
+        pool_fail(&pool[req->pool], req);
     }
     req->state = HTTP_STATE_IDLE;
 }
@@ -437,8 +804,8 @@ int http_get(const char* url, http_response_t* response) {
     }
 
     /* Poll until done (with timeout) */
-    int timeout = 50000;
-    while (timeout > 0) {
+    uint32_t deadline = timer_ms() + HTTP_BLOCKING_TIMEOUT_MS;
+    while (!timer_expired(deadline)) {
         tcp_poll();
         net_poll();
 
@@ -452,9 +819,6 @@ int http_get(const char* url, http_response_t* response) {
             return -1;
         }
 
-        /* Small delay */
-        for (volatile int i = 0; i < 1000; i++);
-        timeout--;
     }
 
     http_request_close(&req);
@@ -471,8 +835,8 @@ int http_post(const char* url, const char* body, int body_len,
     }
 
     /* Poll until done */
-    int timeout = 50000;
-    while (timeout > 0) {
+    uint32_t deadline = timer_ms() + HTTP_BLOCKING_TIMEOUT_MS;
+    while (!timer_expired(deadline)) {
         tcp_poll();
         net_poll();
 
@@ -486,8 +850,6 @@ int http_post(const char* url, const char* body, int body_len,
             return -1;
         }
 
-        for (volatile int i = 0; i < 1000; i++);
-        timeout--;
     }
 
     http_request_close(&req);
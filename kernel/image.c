@@ -5,20 +5,117 @@
 #include "image.h"
 #include "memory.h"
 
+/* Packed stream opcodes (see image.h, must match tools/png2header.py) */
+#define OP_MASK     0xC0
+#define OP_INDEX    0x00
+#define OP_DIFF     0x40
+#define OP_LUMA     0x80
+#define OP_RUN      0xC0
+#define OP_RGB      0xFE
+
+static inline uint32_t color_hash(uint32_t p) {
+    return (((p >> 16) & 0xFF) * 3 + ((p >> 8) & 0xFF) * 5 + (p & 0xFF) * 7) % 64;
+}
+
+static inline int image_valid(const image_t* img) {
+    return img && (img->data || img->packed);
+}
+
+void image_stream_init(image_stream_t* s, const image_t* img) {
+    s->p = img->packed;
+    s->end = img->packed + img->packed_size;
+    s->prev = 0;
+    s->run = 0;
+    memset(s->index, 0, sizeof(s->index));
+}
+
+int image_stream_read(image_stream_t* s, uint32_t* out, uint32_t n) {
+    uint32_t prev = s->prev;
+    uint32_t i = 0;
+
+    while (i < n) {
+        /* Runs may straddle rows, so they are carried between calls */
+        if (s->run) {
+            uint32_t k = s->run < n - i ? s->run : n - i;
+            s->run -= k;
+            while (k--) out[i++] = prev;
+            continue;
+        }
+        if (s->p >= s->end) break;
+
+        uint8_t op = *s->p++;
+        int r = (prev >> 16) & 0xFF;
+        int g = (prev >> 8) & 0xFF;
+        int b = prev & 0xFF;
+
+        if (op == OP_RGB) {
+            if (s->end - s->p < 3) {
+                s->p = s->end;
+                break;
+            }
+            r = s->p[0];
+            g = s->p[1];
+            b = s->p[2];
+            s->p += 3;
+        } else if ((op & OP_MASK) == OP_INDEX) {
+            prev = s->index[op & 63];
+            out[i++] = prev;
+            continue;
+        } else if ((op & OP_MASK) == OP_DIFF) {
+            r += ((op >> 4) & 3) - 2;
+            g += ((op >> 2) & 3) - 2;
+            b += (op & 3) - 2;
+        } else if ((op & OP_MASK) == OP_LUMA) {
+            if (s->p >= s->end) break;
+            int rb = *s->p++;
+            int dg = (op & 63) - 32;
+            r += dg + (rb >> 4) - 8;
+            g += dg;
+            b += dg + (rb & 15) - 8;
+        } else {
+            s->run = (op & 63) + 1;
+            continue;
+        }
+
+        prev = ((uint32_t)(r & 0xFF) << 16) | ((uint32_t)(g & 0xFF) << 8) |
+               (uint32_t)(b & 0xFF);
+        s->index[color_hash(prev)] = prev;
+        out[i++] = prev;
+    }
+
+    s->prev = prev;
+    if (i == n) return 0;
+
+    /* Truncated stream - pad so callers never read garbage */
+    while (i < n) out[i++] = prev;
+    return -1;
+}
+
 /* Draw image at position (no scaling) */
 void image_draw(uint32_t* fb, uint32_t fb_width, uint32_t fb_height,
                 const image_t* img, int x, int y) {
-    if (!img || !img->data) return;
+    if (!image_valid(img)) return;
+
+    image_stream_t s;
+    if (!img->data) image_stream_init(&s, img);
 
     for (uint32_t iy = 0; iy < img->height; iy++) {
         int dy = y + iy;
-        if (dy < 0 || dy >= (int)fb_height) continue;
+        if (img->data && (dy < 0 || dy >= (int)fb_height)) continue;
 
         for (uint32_t ix = 0; ix < img->width; ix++) {
             int dx = x + ix;
+            uint32_t pixel;
+            if (img->data) {
+                pixel = img->data[iy * img->width + ix];
+            } else {
+                /* Packed: every pixel has to be decoded, visible or not */
+                image_stream_read(&s, &pixel, 1);
+            }
+            if (dy < 0 || dy >= (int)fb_height) continue;
             if (dx < 0 || dx >= (int)fb_width) continue;
 
-            fb[dy * fb_width + dx] = img->data[iy * img->width + ix];
+            fb[dy * fb_width + dx] = pixel;
         }
     }
 }
@@ -28,16 +125,142 @@ void image_draw(uint32_t* fb, uint32_t fb_width, uint32_t fb_height,
 #define FP_ONE   (1 << FP_SHIFT)
 #define FP_MASK  (FP_ONE - 1)
 
-/* Extract RGB components */
-static inline void rgb_split(uint32_t c, uint32_t* r, uint32_t* g, uint32_t* b) {
-    *r = (c >> 16) & 0xFF;
-    *g = (c >> 8) & 0xFF;
-    *b = c & 0xFF;
+/*
+ * Blend two 0x00RRGGBB pixels, f = weight of b (0-256). Red and blue
+ * share one multiply: the 0x00FF00FF lanes can't carry into each other
+ * because the weights sum to 256.
+ */
+static inline uint32_t lerp_pixel(uint32_t a, uint32_t b, uint32_t f) {
+    uint32_t inv = 256 - f;
+    uint32_t rb = (((a & 0x00FF00FF) * inv + (b & 0x00FF00FF) * f) >> 8) & 0x00FF00FF;
+    uint32_t g = (((a & 0x0000FF00) * inv + (b & 0x0000FF00) * f) >> 8) & 0x0000FF00;
+    return rb | g;
 }
 
-/* Combine RGB components */
-static inline uint32_t rgb_combine(uint32_t r, uint32_t g, uint32_t b) {
-    return (r << 16) | (g << 8) | b;
+/* Blend two rows of n pixels with weight f (0-255) of the bottom row */
+static void blend_rows(uint32_t* dst, const uint32_t* top, const uint32_t* bot,
+                       int n, uint32_t f) {
+    if (f == 0) {
+        memcpy(dst, top, n * 4);
+        return;
+    }
+
+    int i = 0;
+#ifdef __aarch64__
+    /* 4 pixels per iteration: widen bytes to 16 bits, multiply-accumulate
+     * both rows, narrow back. 32-bit element loads only need 4-byte
+     * alignment, so dst may be the framebuffer. */
+    int chunks = n / 4;
+    if (chunks > 0) {
+        const uint32_t* t = top;
+        const uint32_t* b = bot;
+        uint32_t* d = dst;
+        __asm__ volatile(
+            "dup v5.16b, %w4\n"
+            "dup v6.16b, %w5\n"
+            "1: ld1 {v0.4s}, [%1], #16\n"
+            "   ld1 {v1.4s}, [%2], #16\n"
+            "   umull  v2.8h, v0.8b, v5.8b\n"
+            "   umlal  v2.8h, v1.8b, v6.8b\n"
+            "   umull2 v3.8h, v0.16b, v5.16b\n"
+            "   umlal2 v3.8h, v1.16b, v6.16b\n"
+            "   shrn   v4.8b, v2.8h, #8\n"
+            "   shrn2  v4.16b, v3.8h, #8\n"
+            "   st1 {v4.4s}, [%0], #16\n"
+            "   subs %w3, %w3, #1\n"
+            "   b.ne 1b\n"
+            : "+r"(d), "+r"(t), "+r"(b), "+r"(chunks)
+            : "r"(256 - f), "r"(f)
+            : "v0", "v1", "v2", "v3", "v4", "v5", "v6", "cc", "memory");
+        i = (n / 4) * 4;
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = lerp_pixel(top[i], bot[i], f);
+    }
+}
+
+/*
+ * Separable bilinear scaler. The image is scaled to w x h and placed at
+ * (x, y); only the part inside the dst_w x dst_h target is produced.
+ * Each source row is scaled horizontally once into a row buffer (column
+ * positions and weights are precomputed), then each output row blends
+ * the two buffered rows it falls between. Output rows walk the source
+ * top to bottom, so rows y0 and y0 + 1 always sit in buffers y0 & 1.
+ * That order also lets packed images be decoded one source row at a time.
+ * Returns -1 if the scratch buffers can't be allocated.
+ */
+static int scale_image(uint32_t* dst, uint32_t dst_w, uint32_t dst_h,
+                       const image_t* img, int x, int y, int w, int h) {
+    int cx0 = x < 0 ? 0 : x;
+    int cy0 = y < 0 ? 0 : y;
+    int cx1 = x + w > (int)dst_w ? (int)dst_w : x + w;
+    int cy1 = y + h > (int)dst_h ? (int)dst_h : y + h;
+    if (cx0 >= cx1 || cy0 >= cy1) return 0;
+    int n = cx1 - cx0;
+
+    /* Same stepping as the per-pixel sampler: corners map to corners */
+    uint32_t x_step = ((img->width - 1) << FP_SHIFT) / (w > 1 ? w - 1 : 1);
+    uint32_t y_step = ((img->height - 1) << FP_SHIFT) / (h > 1 ? h - 1 : 1);
+
+    /* Packed images also need one decoded source row */
+    uint32_t src_w = img->data ? 0 : img->width;
+    uint8_t* scratch = (uint8_t*)malloc(src_w * 4 + n * (2 * 4 + 4 + 1));
+    if (!scratch) return -1;
+    uint32_t* rows[2] = { (uint32_t*)scratch, (uint32_t*)scratch + n };
+    uint32_t* col_x = (uint32_t*)scratch + 2 * n;
+    uint32_t* src_row = (uint32_t*)scratch + 3 * n;
+    uint8_t* col_f = scratch + src_w * 4 + n * (2 * 4 + 4);
+    int row_src[2] = { -1, -1 };
+
+    image_stream_t stream;
+    uint32_t next_src = 0;      /* Next row the stream produces */
+    if (!img->data) image_stream_init(&stream, img);
+
+    for (int i = 0; i < n; i++) {
+        uint32_t fx = (uint32_t)(cx0 - x + i) * x_step;
+        col_x[i] = fx >> FP_SHIFT;
+        col_f[i] = (fx & FP_MASK) >> 8;
+    }
+
+    for (int dy = cy0; dy < cy1; dy++) {
+        uint32_t fy = (uint32_t)(dy - y) * y_step;
+        uint32_t y0 = fy >> FP_SHIFT;
+        uint32_t y1 = y0 + 1 < img->height ? y0 + 1 : y0;
+
+        /* Horizontal pass for source rows not buffered yet */
+        uint32_t need[2] = { y0, y1 };
+        for (int k = 0; k < 2; k++) {
+            uint32_t sy = need[k];
+            uint32_t* out = rows[sy & 1];
+            if (row_src[sy & 1] == (int)sy) continue;
+            const uint32_t* src;
+            if (img->data) {
+                src = img->data + sy * img->width;
+            } else {
+                /* Rows are requested in order; skipped ones are decoded
+                 * and dropped */
+                while (next_src <= sy) {
+                    image_stream_read(&stream, src_row, img->width);
+                    next_src++;
+                }
+                src = src_row;
+            }
+            for (int i = 0; i < n; i++) {
+                uint32_t sx = col_x[i];
+                uint32_t sx1 = sx + 1 < img->width ? sx + 1 : sx;
+                out[i] = lerp_pixel(src[sx], src[sx1], col_f[i]);
+            }
+            row_src[sy & 1] = sy;
+        }
+
+        /* Vertical pass */
+        blend_rows(dst + dy * dst_w + cx0, rows[y0 & 1], rows[y1 & 1], n,
+                   (fy & FP_MASK) >> 8);
+    }
+
+    free(scratch);
+    return 0;
 }
 
 /* Bilinear interpolation between 4 pixels using fixed-point math */
@@ -56,47 +279,23 @@ static uint32_t bilinear_sample(const uint32_t* data, uint32_t img_w, uint32_t i
     /* Fractional parts (0-255 range for easier math) */
     uint32_t xf = (fx & FP_MASK) >> 8;  /* 0-255 */
     uint32_t yf = (fy & FP_MASK) >> 8;  /* 0-255 */
-    uint32_t xf_inv = 256 - xf;
-    uint32_t yf_inv = 256 - yf;
-
-    /* Get 4 corner pixels */
-    uint32_t c00 = data[y0 * img_w + x0];
-    uint32_t c10 = data[y0 * img_w + x1];
-    uint32_t c01 = data[y1 * img_w + x0];
-    uint32_t c11 = data[y1 * img_w + x1];
-
-    /* Split into components */
-    uint32_t r00, g00, b00, r10, g10, b10, r01, g01, b01, r11, g11, b11;
-    rgb_split(c00, &r00, &g00, &b00);
-    rgb_split(c10, &r10, &g10, &b10);
-    rgb_split(c01, &r01, &g01, &b01);
-    rgb_split(c11, &r11, &g11, &b11);
-
-    /* Bilinear interpolation for each channel */
-    /* Top row interpolation */
-    uint32_t r_top = (r00 * xf_inv + r10 * xf) >> 8;
-    uint32_t g_top = (g00 * xf_inv + g10 * xf) >> 8;
-    uint32_t b_top = (b00 * xf_inv + b10 * xf) >> 8;
-
-    /* Bottom row interpolation */
-    uint32_t r_bot = (r01 * xf_inv + r11 * xf) >> 8;
-    uint32_t g_bot = (g01 * xf_inv + g11 * xf) >> 8;
-    uint32_t b_bot = (b01 * xf_inv + b11 * xf) >> 8;
-
-    /* Vertical interpolation */
-    uint32_t r = (r_top * yf_inv + r_bot * yf) >> 8;
-    uint32_t g = (g_top * yf_inv + g_bot * yf) >> 8;
-    uint32_t b = (b_top * yf_inv + b_bot * yf) >> 8;
-
-    return rgb_combine(r, g, b);
+
+    uint32_t top = lerp_pixel(data[y0 * img_w + x0], data[y0 * img_w + x1], xf);
+    uint32_t bot = lerp_pixel(data[y1 * img_w + x0], data[y1 * img_w + x1], xf);
+    return lerp_pixel(top, bot, yf);
 }
 
 /* Draw image scaled using bilinear interpolation */
 void image_draw_scaled(uint32_t* fb, uint32_t fb_width, uint32_t fb_height,
                        const image_t* img, int x, int y, int w, int h) {
-    if (!img || !img->data || w <= 0 || h <= 0) return;
+    if (!image_valid(img) || w <= 0 || h <= 0) return;
+
+    if (scale_image(fb, fb_width, fb_height, img, x, y, w, h) == 0) return;
+
+    /* The per-pixel fallback needs random access */
+    if (!img->data) return;
 
-    /* Calculate fixed-point step sizes */
+    /* No memory for the row buffers - sample per pixel */
     uint32_t x_step = ((img->width - 1) << FP_SHIFT) / (w > 1 ? w - 1 : 1);
     uint32_t y_step = ((img->height - 1) << FP_SHIFT) / (h > 1 ? h - 1 : 1);
 
@@ -125,10 +324,23 @@ void image_draw_scaled(uint32_t* fb, uint32_t fb_width, uint32_t fb_height,
     }
 }
 
+/* Cover-scaled background for the current screen size */
+static uint32_t* bg_cache = NULL;
+static const image_t* bg_cache_img = NULL;
+static uint32_t bg_cache_w = 0;
+static uint32_t bg_cache_h = 0;
+
 /* Draw image as fullscreen background (cover mode - fills screen) */
 void image_draw_background(uint32_t* fb, uint32_t fb_width, uint32_t fb_height,
                            const image_t* img) {
-    if (!img || !img->data) return;
+    if (!image_valid(img)) return;
+
+    /* Scaled once per image and resolution, then just copied */
+    if (bg_cache && bg_cache_img == img &&
+        bg_cache_w == fb_width && bg_cache_h == fb_height) {
+        memcpy(fb, bg_cache, fb_width * fb_height * 4);
+        return;
+    }
 
     /* COVER mode: Scale to fill entire screen (may crop edges) */
     uint32_t scaled_w, scaled_h;
@@ -146,7 +358,25 @@ void image_draw_background(uint32_t* fb, uint32_t fb_width, uint32_t fb_height,
     int x = ((int)fb_width - (int)scaled_w) / 2;
     int y = ((int)fb_height - (int)scaled_h) / 2;
 
-    image_draw_scaled(fb, fb_width, fb_height, img, x, y, scaled_w, scaled_h);
+    /* Rebuild the cache; without memory, scale straight to the screen */
+    if (bg_cache) {
+        free(bg_cache);
+        bg_cache = NULL;
+    }
+    bg_cache = (uint32_t*)malloc(fb_width * fb_height * 4);
+    if (!bg_cache ||
+        scale_image(bg_cache, fb_width, fb_height, img, x, y, scaled_w, scaled_h) != 0) {
+        if (bg_cache) {
+            free(bg_cache);
+            bg_cache = NULL;
+        }
+        image_draw_scaled(fb, fb_width, fb_height, img, x, y, scaled_w, scaled_h);
+        return;
+    }
+    bg_cache_img = img;
+    bg_cache_w = fb_width;
+    bg_cache_h = fb_height;
+    memcpy(fb, bg_cache, fb_width * fb_height * 4);
 }
 
 /* BMP file format structures */
@@ -0,0 +1,52 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "types.h"
+
+/*
+ * TinyOS Arena Allocator
+ *
+ * Bump allocator for short-lived, session-scoped memory. An arena takes
+ * chunks from the general heap, hands out memory by bumping a pointer and
+ * releases everything in one call. Every arena registers itself so the
+ * terminal can report per-subsystem usage and high-water marks.
+ */
+
+/* Chunk of heap memory owned by an arena */
+typedef struct arena_chunk {
+    struct arena_chunk* next;       /* Older chunk */
+    size_t size;                    /* Usable bytes after the header */
+    size_t used;                    /* Bytes handed out from this chunk */
+} arena_chunk_t;
+
+typedef struct arena {
+    const char* name;               /* Subsystem name for statistics */
+    arena_chunk_t* chunks;          /* Current chunk first */
+    size_t chunk_size;              /* Default chunk payload size */
+    size_t used;                    /* Bytes currently handed out */
+    size_t reserved;                /* Bytes currently taken from heap */
+    size_t peak;                    /* High-water mark of 'used' */
+    uint32_t allocs;                /* Allocations since last reset */
+    uint32_t resets;                /* Number of arena_reset calls */
+    struct arena* next_arena;       /* Registry link */
+} arena_t;
+
+/* Set up an arena and add it to the registry (no-op if already registered) */
+void arena_init(arena_t* a, const char* name, size_t chunk_size);
+
+/* Allocate 16-byte aligned memory from an arena, NULL if heap exhausted */
+void* arena_alloc(arena_t* a, size_t size);
+
+/* Allocate zeroed memory from an arena */
+void* arena_calloc(arena_t* a, size_t size);
+
+/* Release all allocations, keeping the first chunk for reuse */
+void arena_reset(arena_t* a);
+
+/* Release all allocations and return every chunk to the heap */
+void arena_release(arena_t* a);
+
+/* Iterate registered arenas: arena_first(), then a->next_arena */
+arena_t* arena_first(void);
+
+#endif /* ARENA_H */
@@ -0,0 +1,46 @@
+/*
+ * TinyOS Block Cache
+ * Write-back sector cache between the filesystem and virtio-blk
+ */
+
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "types.h"
+
+#define BCACHE_BLOCKS       128     /* Cached sectors (64KB) */
+#define BCACHE_HASH_SIZE    64      /* Hash buckets (power of two) */
+#define BCACHE_RUN_MAX      32      /* Sectors per device request (16KB) */
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t writebacks;    /* Dirty sectors written to the device */
+    uint32_t dirty;         /* Dirty sectors currently cached */
+    uint32_t cached;        /* Valid sectors currently cached */
+} bcache_stats_t;
+
+/* Read sectors through the cache. Consecutive misses are fetched with
+ * one device request. Returns 0 on success, -1 on device error */
+int bcache_read(uint64_t sector, uint32_t count, void* buf);
+
+/* Bring sectors into the cache without copying them out (readahead).
+ * Returns 0 on success, -1 on device error */
+int bcache_prefetch(uint64_t sector, uint32_t count);
+
+/* Write sectors into the cache; they reach the disk on eviction or
+ * bcache_flush(). Returns 0 on success, -1 on device error */
+int bcache_write(uint64_t sector, uint32_t count, const void* buf);
+
+/* Write back every dirty sector (adjacent ones in one request) and
+ * flush the disk's own cache.
+ * Returns 0 on success, -1 on device error (failed sectors stay dirty) */
+int bcache_flush(void);
+
+/* Drop every clean sector (dirty ones are kept) */
+void bcache_invalidate(void);
+
+/* Get cache counters */
+void bcache_stats(bcache_stats_t* stats);
+
+#endif /* BCACHE_H */
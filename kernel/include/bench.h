@@ -0,0 +1,41 @@
+/*
+ * TinyOS Micro-benchmarks
+ * Times kernel hot paths with the generic timer and PMU cycle counter
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "types.h"
+
+#define BENCH_MAX_RESULTS   24
+#define BENCH_NAME_LEN      16
+#define BENCH_LINE_LEN      64
+
+/* Results are appended here so runs can be compared across builds */
+#define BENCH_LOG_FILE      "bench.log"
+
+/* Result status */
+#define BENCH_OK            0
+#define BENCH_SKIPPED       1   /* Device not available */
+#define BENCH_FAILED        -1
+
+typedef struct {
+    char name[BENCH_NAME_LEN];
+    int status;
+    uint32_t iters;
+    uint64_t ticks;         /* Counter ticks for all iterations */
+    uint64_t cycles;        /* CPU cycles for all iterations (0 = no PMU) */
+    uint64_t bytes;         /* Bytes moved (0 = not a throughput test) */
+} bench_result_t;
+
+/* Run every benchmark; returns number of results filled in */
+int bench_run_all(bench_result_t* results, int max);
+
+/* Format one result as a text line (no newline); returns length */
+int bench_format(const bench_result_t* r, char* buf, int len);
+
+/* Append results to BENCH_LOG_FILE; returns 0 on success, -1 on error */
+int bench_save(const bench_result_t* results, int count);
+
+#endif /* BENCH_H */
@@ -0,0 +1,42 @@
+/*
+ * TinyOS Completions
+ * One-shot "request finished" flag signalled from IRQ context
+ */
+
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include "types.h"
+
+/* Optional callback run (in the signalling context) when a request completes */
+typedef void (*completion_fn)(void* arg, int status);
+
+typedef struct {
+    volatile int done;
+    int status;             /* Driver-defined, 0 = success */
+    completion_fn fn;
+    void* arg;
+} completion_t;
+
+static inline void completion_init(completion_t* c, completion_fn fn, void* arg) {
+    c->done = 0;
+    c->status = 0;
+    c->fn = fn;
+    c->arg = arg;
+}
+
+/* Mark complete and run the callback (called by the driver's IRQ handler) */
+static inline void completion_signal(completion_t* c, int status) {
+    c->status = status;
+    __asm__ volatile("dmb sy" ::: "memory");
+    c->done = 1;
+    if (c->fn) c->fn(c->arg, status);
+}
+
+/* Wait until signalled, sleeping in WFI between interrupts.
+ * `poll` reaps the device directly (run with IRQs masked) so waiting also
+ * works before interrupts are enabled; NULL if only the IRQ completes.
+ * Returns 0 when done, -1 if timeout_ms passed first */
+int completion_wait(completion_t* c, void (*poll)(void), uint32_t timeout_ms);
+
+#endif /* COMPLETION_H */
@@ -3,6 +3,11 @@
 
 #include "types.h"
 
+/* Draw the pointer on top of the frame, saving the pixels beneath it */
 void cursor_draw(uint32_t *fb, uint32_t screen_w, uint32_t screen_h);
 
+/* Put back the pixels under the pointer. Call before drawing into the
+ * frame, so the app never paints over (or scrolls) the cursor. */
+void cursor_hide(uint32_t *fb, uint32_t screen_w);
+
 #endif
@@ -36,23 +36,37 @@ typedef struct {
 #define EVENT_QUEUE_SIZE    256
 #define EVENT_QUEUE_MASK    (EVENT_QUEUE_SIZE - 1)
 
+/* Events an app drains per update (the rest wait for the next frame) */
+#define EVENT_BATCH_MAX     32
+
 /* Initialize the event queue */
 void event_queue_init(void);
 
 /* Push an event to the queue (called from IRQ context)
- * Returns 0 on success, -1 if queue is full */
+ * A TOUCH_MOVE may be merged into the previous queued move for its slot.
+ * Returns 0 on success, -1 if queue is full (counted as dropped) */
 int event_push(const input_event_t* event);
 
 /* Pop an event from the queue
  * Returns 0 on success, -1 if queue is empty */
 int event_pop(input_event_t* event);
 
+/* Pop up to max events in order
+ * Returns number of events copied (0 if queue is empty) */
+int event_pop_batch(input_event_t* events, int max);
+
 /* Check if queue has pending events */
 int event_pending(void);
 
 /* Get number of pending events */
 int event_count(void);
 
+/* Events lost because the queue was full */
+uint32_t event_dropped(void);
+
+/* TOUCH_MOVE events merged into an already-queued move */
+uint32_t event_coalesced(void);
+
 /* Helper: push a keyboard event */
 void event_push_key(uint16_t keycode, int pressed);
 
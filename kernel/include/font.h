@@ -11,4 +11,7 @@ extern const uint8_t font_8x12[][12];
 void draw_char(uint32_t* fb, int x, int y, char c, uint32_t color, int fb_width, int fb_height);
 void draw_string(uint32_t* fb, int x, int y, const char* str, uint32_t color, int fb_width, int fb_height);
 
+/* Opaque text: each character cell is filled with bg behind the glyph */
+void draw_string_bg(uint32_t* fb, int x, int y, const char* str, uint32_t fg, uint32_t bg, int fb_width, int fb_height);
+
 #endif
\ No newline at end of file
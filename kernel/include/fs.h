@@ -9,12 +9,12 @@
 
 /* Filesystem constants */
 #define FS_MAGIC            0x54465321  /* "TFS!" */
-#define FS_VERSION          1
-#define FS_MAX_FILENAME     20
-#define FS_MAX_FILES        64
+#define FS_VERSION          2
+#define FS_MAX_FILENAME     48          /* Per path component, with the NUL */
 #define FS_MAX_OPEN         8
 #define FS_CLUSTER_SIZE     2048        /* 4 sectors per cluster */
 #define FS_SECTORS_PER_CLUSTER  4
+#define FS_SYNC_INTERVAL_MS 5000        /* Background metadata write-back */
 
 /* File flags */
 #define FS_FLAG_DIR         0x01
@@ -33,16 +33,17 @@
 #define FS_SEEK_END         2
 
 /* FAT special values */
-#define FAT_FREE            0x0000
-#define FAT_EOF             0xFFFF
-#define FAT_BAD             0xFFF7
+#define FAT_FREE            0x00000000
+#define FAT_EOF             0xFFFFFFFF
+#define FAT_BAD             0xFFFFFFF7
 
-/* Directory entry structure (32 bytes) */
+/* Directory entry structure (64 bytes). Directories are files holding
+ * an array of these; a free slot has name[0] == 0 */
 typedef struct {
     char name[FS_MAX_FILENAME];     /* Filename (null-terminated) */
-    uint32_t size;                  /* File size in bytes */
-    uint16_t first_cluster;         /* Starting cluster */
-    uint16_t flags;                 /* File flags */
+    uint32_t size;                  /* File size in bytes (0 for directories) */
+    uint32_t first_cluster;         /* Starting cluster */
+    uint32_t flags;                 /* File flags */
     uint32_t reserved;              /* Reserved for future use */
 } fs_dirent_t;
 
@@ -55,10 +56,12 @@ typedef struct {
     uint32_t free_clusters;         /* Free clusters count */
     uint32_t fat_start;             /* FAT starting sector */
     uint32_t fat_sectors;           /* Sectors used by FAT */
-    uint32_t root_start;            /* Root directory start sector */
-    uint32_t root_sectors;          /* Sectors for root directory */
+    uint32_t log_start;             /* Intent log start sector */
+    uint32_t log_sectors;           /* Sectors for the intent log */
     uint32_t data_start;            /* Data area start sector */
-    uint8_t reserved[472];          /* Pad to 512 bytes */
+    uint32_t root_cluster;          /* First cluster of the root directory */
+    uint32_t files_count;           /* Files and directories */
+    uint8_t reserved[464];          /* Pad to 512 bytes */
 } fs_superblock_t;
 
 /* Initialize filesystem (mount or detect unformatted) */
@@ -71,7 +74,7 @@ int fs_mounted(void);
 int fs_format(void);
 
 /* Open file
- * path: file path (just filename for now, no subdirs)
+ * path: file path, components separated by '/' (e.g. "docs/notes.txt")
  * flags: FS_O_* flags
  * Returns: file descriptor (>= 0) or -1 on error
  */
@@ -99,16 +102,25 @@ int fs_seek(int fd, int offset, int whence);
 int fs_size(int fd);
 
 /* List directory
- * path: directory path (only "/" supported)
+ * path: directory path ("/" for the root)
  * entries: output array
  * max_entries: max entries to return
  * Returns: number of entries, -1 on error
  */
 int fs_readdir(const char* path, fs_dirent_t* entries, int max_entries);
 
-/* Delete file */
+/* Create a directory
+ * Returns: 0 on success, -1 on error (exists, parent missing, disk full)
+ */
+int fs_mkdir(const char* path);
+
+/* Delete file or empty directory */
 int fs_remove(const char* path);
 
+/* Write back cached file data, then metadata through the intent log.
+ * Returns 0 on success, -1 on error */
+int fs_sync(void);
+
 /* Get filesystem stats */
 typedef struct {
     uint32_t total_clusters;
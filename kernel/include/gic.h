@@ -48,15 +48,21 @@
 #define VIRTIO_GPU_IRQ      (VIRTIO_IRQ_BASE + 0)
 #define VIRTIO_INPUT_IRQ    (VIRTIO_IRQ_BASE + 1)
 
+/* IRQ of the virtio-mmio transport in a given slot (0x0a000000 + slot*0x200) */
+#define VIRTIO_MMIO_SLOT_IRQ(slot)  (VIRTIO_IRQ_BASE + (slot))
+
 /* Maximum supported interrupts */
 #define GIC_MAX_IRQ         256
 
 /* IRQ handler function type */
 typedef void (*irq_handler_fn)(uint32_t irq);
 
-/* Initialize the GIC */
+/* Initialize the GIC (distributor + CPU 0 interface) */
 void gic_init(void);
 
+/* Initialize the calling core's CPU interface and banked SGI/PPI state */
+void gic_cpu_init(void);
+
 /* Enable a specific interrupt */
 void gic_enable_irq(uint32_t irq);
 
@@ -84,4 +90,7 @@ void enable_interrupts(void);
 /* Disable interrupts globally (mask DAIF) */
 void disable_interrupts(void);
 
+/* Check if IRQs are unmasked on the calling CPU */
+int interrupts_enabled(void);
+
 #endif /* GIC_H */
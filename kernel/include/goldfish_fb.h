@@ -40,10 +40,36 @@
 #define CLCD_CNTL_LCDPWR    (1 << 11)
 #endif
 
+/* Screen rectangle in pixels */
+typedef struct {
+    int x, y, w, h;
+} fb_rect_t;
+
+/* Damage list size before rectangles get merged */
+#define FB_DAMAGE_MAX       16
+
 void goldfish_fb_init(void);
 void goldfish_fb_clear(uint32_t color);
 void goldfish_fb_putpixel(int x, int y, uint32_t color);
+
+/* Mark part of the screen buffer as changed (clipped to the screen).
+ * Anything that writes the buffer directly must report what it touched. */
+void goldfish_fb_damage(int x, int y, int w, int h);
+
+/* Mark the whole screen as changed */
+void goldfish_fb_damage_all(void);
+
+/* Send the damaged regions to the display and clear the damage list */
 void goldfish_fb_flush(void);
+
+/* Damage one rectangle and flush immediately */
+void goldfish_fb_flush_rect(int x, int y, int w, int h);
+
+/* Wait until every flush has reached the display (flushes are queued) */
+void goldfish_fb_sync(void);
+
+/* Back buffer for the next frame; changes after every flush, so fetch it
+ * again instead of keeping the pointer across flushes */
 uint32_t* goldfish_fb_get_buffer(void);
 uint32_t goldfish_fb_get_width(void);
 uint32_t goldfish_fb_get_height(void);
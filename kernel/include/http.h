@@ -27,7 +27,16 @@
 #define HTTP_MAX_HOST    64
 #define HTTP_MAX_PATH    128
 #define HTTP_MAX_HEADERS 512
-#define HTTP_MAX_BODY    4096
+#define HTTP_MAX_BODY    4096   /* Buffered bodies are cut off here */
+#define HTTP_HEADER_BUF  2048   /* Raw response head, parsed in place */
+
+/* Blocking http_get/http_post give up after this long */
+#define HTTP_BLOCKING_TIMEOUT_MS 30000
+
+/* Keep-alive pool: connections kept open between requests, by host:port */
+#define HTTP_POOL_SIZE       4
+#define HTTP_POOL_IDLE_MS    15000  /* Closed after this long unused */
+#define HTTP_PIPELINE_DEPTH  4      /* Requests in flight per connection */
 
 /* Parsed URL */
 typedef struct {
@@ -42,11 +51,24 @@ typedef struct {
     int status_code;
     char headers[HTTP_MAX_HEADERS];
     char body[HTTP_MAX_BODY];
-    int body_len;
+    int body_len;           /* Bytes in body (0 when streaming) */
+    int body_total;         /* Body bytes received, after chunked decoding */
     int content_length;
     int chunked;
+    int keep_alive;         /* Server leaves the connection open after it */
 } http_response_t;
 
+/* Streaming body consumer: called with each piece of the decoded body as
+ * it arrives. Returns 0, or -1 to abort the request */
+typedef int (*http_sink_t)(void* ctx, const void* data, int len);
+
+/* Chunked decoder states */
+#define HTTP_CHUNK_SIZE     0   /* Size line (hex, then extensions) */
+#define HTTP_CHUNK_DATA     1
+#define HTTP_CHUNK_DATA_END 2   /* CRLF after the data */
+#define HTTP_CHUNK_TRAILER  3   /* Trailer lines up to a blank one */
+#define HTTP_CHUNK_DONE     4
+
 /* HTTP request handle */
 typedef struct {
     int state;
@@ -54,8 +76,18 @@ typedef struct {
     int method;
     http_url_t url;
     http_response_t response;
+    int pool;               /* Pooled connection carrying it, -1 if none */
+    int reused;             /* That connection was already open; if it is
+                             * found closed before a reply, retry once */
     int header_complete;
-    char* body_start;
+    char header_buf[HTTP_HEADER_BUF];
+    int header_len;
+    http_sink_t sink;       /* NULL: buffer the body in response.body */
+    void* sink_ctx;
+    int sink_fd;            /* For the fs_write sink */
+    int chunk_state;
+    uint32_t chunk_left;    /* Data bytes left in the chunk */
+    int chunk_line;         /* Characters in the current size/trailer line */
     dns_query_t dns_query;  /* For async DNS resolution */
     uint8_t resolved_ip[4]; /* Resolved IP address */
 } http_request_t;
@@ -70,13 +102,26 @@ int http_parse_url(const char* url, http_url_t* parsed);
 int http_request_start(http_request_t* req, int method, const char* url,
                        const char* body, int body_len);
 
+/* Start a GET that may be pipelined: sent at once on an open connection
+ * to the same host even while earlier responses are still arriving on it.
+ * Poll it like any other request; answers come back in order */
+int http_request_queue(http_request_t* req, const char* url);
+
+/* Stream the body to sink instead of buffering it; call after
+ * http_request_start, before the first poll */
+void http_request_set_sink(http_request_t* req, http_sink_t sink, void* ctx);
+
+/* Stream the body into an open file (fs_write); the caller closes fd */
+void http_request_set_fd(http_request_t* req, int fd);
+
 /* Poll HTTP request (call repeatedly until done) */
 int http_request_poll(http_request_t* req);
 
 /* Get request state */
 int http_get_state(http_request_t* req);
 
-/* Close/cleanup request */
+/* Close/cleanup request. A finished request's connection stays in the
+ * pool if the server allows; an unfinished one's is closed */
 void http_request_close(http_request_t* req);
 
 /* Simple blocking GET request */
@@ -12,18 +12,50 @@
 typedef struct {
     uint32_t width;
     uint32_t height;
-    const uint32_t* data;  /* BGRX pixel data */
+    const uint32_t* data;  /* BGRX pixel data, or NULL if packed */
+    const uint8_t* packed; /* Packed pixel stream (tools/png2header.py) */
+    uint32_t packed_size;
 } image_t;
 
+/*
+ * Packed images: a byte stream of opcodes in raster order, each producing
+ * one or more pixels from the previous pixel or a 64-entry table of
+ * recently seen colors (index = (r * 3 + g * 5 + b * 7) % 64):
+ *   00iiiiii           color table entry i
+ *   01rrggbb           previous pixel + per-channel delta (-2..1)
+ *   10gggggg rrrrbbbb  green delta (-32..31), red/blue delta relative to
+ *                      green (-8..7)
+ *   11llllll           previous pixel repeated l + 1 times (1..62)
+ *   0xFE r g b         literal pixel
+ * Decoding is sequential, so images are unpacked a row at a time straight
+ * into their destination instead of into a full raw copy.
+ */
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint32_t prev;
+    uint32_t run;
+    uint32_t index[64];
+} image_stream_t;
+
+/* Start decoding img from its first pixel */
+void image_stream_init(image_stream_t* s, const image_t* img);
+
+/* Decode the next n pixels. Returns 0, or -1 if the stream ended early
+ * (the rest of out is filled with the last pixel) */
+int image_stream_read(image_stream_t* s, uint32_t* out, uint32_t n);
+
 /* Draw image to framebuffer at position (x, y) */
 void image_draw(uint32_t* fb, uint32_t fb_width, uint32_t fb_height,
                 const image_t* img, int x, int y);
 
-/* Draw image scaled to fill area */
+/* Draw image scaled to fill area (packed images need a few rows of
+ * scratch memory and are skipped without it) */
 void image_draw_scaled(uint32_t* fb, uint32_t fb_width, uint32_t fb_height,
                        const image_t* img, int x, int y, int w, int h);
 
-/* Draw image as background (scaled to fit screen) */
+/* Draw image as background (scaled to cover the screen). The scaled
+ * image is cached and only rebuilt when the image or size changes. */
 void image_draw_background(uint32_t* fb, uint32_t fb_width, uint32_t fb_height,
                            const image_t* img);
 
@@ -6,7 +6,9 @@
 /*
  * TinyOS Memory Allocator
  *
- * A simple first-fit free list allocator that supports:
+ * Segregated size-class allocator with boundary tags. Allocation picks
+ * a block from a per-class free list and free coalesces with physical
+ * neighbours in constant time. Supports:
  * - malloc: Allocate memory
  * - free: Release memory
  * - calloc: Allocate and zero memory
@@ -28,7 +30,7 @@ void* memcpy(void* dest, const void* src, size_t num);
 void* memmove(void* dest, const void* src, size_t num);
 int memcmp(const void* s1, const void* s2, size_t n);
 
-/* Debug: get heap statistics */
+/* Debug: get heap statistics (maintained counters, no heap walk) */
 size_t heap_free_bytes(void);
 size_t heap_used_bytes(void);
 
@@ -0,0 +1,46 @@
+/*
+ * TinyOS MMU setup
+ * Identity-mapped page tables with cacheable RAM and uncached DMA windows
+ */
+
+#ifndef MMU_H
+#define MMU_H
+
+#include "types.h"
+
+/*
+ * Physical memory map (identity mapped, 4KB granule, 39-bit VA):
+ *
+ *   0x00000000 - 0x3FFFFFFF  Device-nGnRE  GIC, UART, virtio-mmio, goldfish
+ *   0x40000000 - 0x41FFFFFF  Normal WB     Kernel image, heap
+ *   0x42000000 - 0x47DFFFFF  Normal NC     Framebuffer, virtqueues, DMA buffers
+ *   0x47E00000 - 0x7FFFFFFF  Normal WB     Boot stack and remaining RAM
+ *
+ * QEMU reads the framebuffer and virtqueue memory without snooping the
+ * CPU caches, so that window is mapped non-cacheable instead of relying
+ * on cache maintenance in every driver. Devices that transfer straight
+ * to or from cacheable memory (virtio-blk's caller buffers) need the
+ * maintenance below around each transfer.
+ */
+#define MMU_DMA_START       0x42000000
+#define MMU_DMA_END         0x47E00000
+#define MMU_RAM_START       0x40000000
+#define MMU_RAM_END         0x80000000
+
+/* Build page tables and enable MMU + caches on CPU 0 */
+void mmu_init(void);
+
+/* Enable MMU + caches with the tables from mmu_init (secondary CPUs) */
+void mmu_enable(void);
+
+/* Check if the MMU is on for the calling CPU */
+int mmu_is_enabled(void);
+
+/* Write dirty lines covering the range back to the point of coherency */
+void dcache_clean_range(const void* start, size_t size);
+
+/* Clean and invalidate: also drops the lines, so the next read sees
+ * what a device wrote */
+void dcache_flush_range(const void* start, size_t size);
+
+#endif /* MMU_H */
@@ -120,11 +120,59 @@ typedef struct {
     uint32_t last_ping_time;
 } ping_status_t;
 
+/* Stack counters, since init (the driver keeps its own, see
+ * virtio_net_get_stats) */
+typedef struct {
+    uint32_t arp_rx;            /* Frames taken, per protocol */
+    uint32_t ip_rx;
+    uint32_t icmp_rx;
+    uint32_t udp_rx;
+    uint32_t tcp_rx;
+    uint32_t rx_malformed;      /* Dropped: bad or truncated header */
+    uint32_t rx_not_ours;       /* Dropped: addressed to another host */
+    uint32_t rx_unknown;        /* Dropped: ethertype or protocol unhandled */
+    uint32_t rx_bad_csum;       /* Dropped: TCP checksum failed */
+    uint32_t arp_requests;      /* Sent */
+    uint32_t arp_replies;
+    uint32_t arp_miss;          /* Lookups without a resolved neighbor */
+    uint32_t arp_held;          /* Frames queued for a neighbor */
+    uint32_t arp_hold_full;     /* Dropped: couldn't be queued */
+    uint32_t arp_unresolved;    /* Dropped: neighbor never answered */
+} net_stats_t;
+
+/* Histogram of log2 buckets: 0 counts zeros, bucket b > 0 values from
+ * 2^(b-1) to 2^b - 1, and the last everything above */
+#define NET_HIST_BUCKETS 16
+
+typedef struct {
+    uint32_t count[NET_HIST_BUCKETS];
+    uint32_t samples;
+    uint32_t max;
+    uint64_t sum;
+} net_hist_t;
+
+void net_hist_add(net_hist_t* h, uint32_t value);
+
 /* Initialize network stack */
 void net_init(void);
 
-/* Process incoming packets */
-void net_poll(void);
+/* Frames handled per net_poll() before yielding to other tasks */
+#define NET_RX_BUDGET 16
+
+/* Process up to NET_RX_BUDGET incoming frames and run TCP timers.
+ * Returns the frames still waiting (non-zero: poll again soon) */
+int net_poll(void);
+
+/* Keep the frame being processed alive after its handler returns, so its
+ * payload can be queued without a copy. Returns a handle for
+ * net_rx_release(), or -1 if no more buffers may be held */
+int net_rx_hold(void);
+
+/* Further frames net_rx_hold() will keep (shared by all connections) */
+int net_rx_hold_room(void);
+
+/* Release a frame kept by net_rx_hold() */
+void net_rx_release(int handle);
 
 /* Get network configuration */
 net_config_t* net_get_config(void);
@@ -132,6 +180,9 @@ net_config_t* net_get_config(void);
 /* Get ping status */
 ping_status_t* net_get_ping_status(void);
 
+/* Get stack counters */
+net_stats_t* net_get_stats(void);
+
 /* Send a ping to gateway */
 void net_ping_gateway(void);
 
@@ -141,11 +192,35 @@ void net_ip_to_str(const uint8_t* ip, char* buf);
 /* Format MAC address to string */
 void net_mac_to_str(const uint8_t* mac, char* buf);
 
-/* ARP functions for TCP */
+/* Internet checksum (RFC 1071). net_csum_add() adds the ones' complement
+ * sum of a buffer to a running sum; net_csum_fold() turns one into the
+ * checksum field, stored without byte swapping. A buffer that includes
+ * a correct checksum folds to 0 */
+uint32_t net_csum_add(uint32_t sum, const void* data, int len);
+uint16_t net_csum_fold(uint32_t sum);
+
+/* Sum of the TCP/UDP pseudo-header for a `len` byte segment */
+uint32_t net_csum_pseudo(const struct ip_hdr* ip, uint8_t protocol, int len);
+
+/* ARP functions for TCP. net_arp_lookup() returns 1 with the neighbor's
+ * MAC, or 0 and starts resolving it */
 int net_arp_lookup(const uint8_t* ip, uint8_t* mac_out);
 void net_send_arp_request(const uint8_t* target_ip);
 
+/* Keep a copy of a frame a lookup just missed on; it goes out, with its
+ * destination MAC filled in, once the neighbor answers. Returns 0, or -1
+ * if it can't be held (neighbor's queue or hold pool full) */
+int net_arp_hold(const uint8_t* ip, const void* frame, int len);
+
 /* DNS resolution */
+#define DNS_TIMEOUT_MS     30000   /* Give up after 30 sec */
+#define DNS_RETRY_MS       1000    /* Resend query every 1 sec */
+
+/* Answer cache: A records for their TTL (capped), failures for a while */
+#define DNS_CACHE_SIZE     16
+#define DNS_MAX_TTL_MS     3600000 /* 1 hour */
+#define DNS_NEG_TTL_MS     60000   /* NXDOMAIN or no A record */
+
 #define DNS_STATE_IDLE     0
 #define DNS_STATE_PENDING  1
 #define DNS_STATE_DONE     2
@@ -155,8 +230,8 @@ typedef struct {
     int state;
     uint8_t result_ip[4];
     uint16_t query_id;
-    uint32_t timeout_tick;
-    uint32_t retry_tick;
+    uint32_t timeout_ms;     /* Give-up deadline (timer_ms) */
+    uint32_t retry_ms;       /* Next retransmit deadline (timer_ms) */
     char hostname[64];
 } dns_query_t;
 
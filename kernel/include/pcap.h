@@ -0,0 +1,40 @@
+/*
+ * TinyOS Packet Capture
+ * Keeps recent frames in memory and writes them out in pcap format
+ */
+
+#ifndef PCAP_H
+#define PCAP_H
+
+#include "types.h"
+
+#define PCAP_SNAPLEN        256     /* Bytes kept of each frame */
+#define PCAP_DEFAULT_FRAMES 256     /* Ring size when none is given */
+#define PCAP_MAX_FRAMES     4096
+
+/* Start capturing into a ring of `frames` (oldest overwritten), dropping
+ * an earlier capture. 0 picks PCAP_DEFAULT_FRAMES. Returns 0, or -1 if
+ * the ring can't be allocated */
+int pcap_start(int frames);
+
+/* Stop capturing (frames are kept for pcap_save) */
+void pcap_stop(void);
+
+int pcap_running(void);
+
+/* Called by the driver for every frame sent or received. Frames sent
+ * with checksum offload are recorded before the device fills in the
+ * transport checksum */
+void pcap_record(const void* frame, uint32_t len);
+
+/* Frames recorded since pcap_start (may exceed the ring) */
+uint32_t pcap_frames(void);
+
+/* Frames the ring currently holds */
+uint32_t pcap_kept(void);
+
+/* Write the kept frames, oldest first, as a pcap file (Ethernet link
+ * type). Returns the number of frames written, -1 on error */
+int pcap_save(const char* path);
+
+#endif /* PCAP_H */
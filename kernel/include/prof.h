@@ -0,0 +1,49 @@
+/*
+ * TinyOS Sampling Profiler
+ * Records interrupted PCs (and their callers) from a periodic interrupt
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include "types.h"
+
+/* Sample sources */
+#define PROF_SOURCE_PMU     0       /* PMU cycle counter overflow */
+#define PROF_SOURCE_TIMER   1       /* EL1 physical timer */
+
+#define PROF_PMU_IRQ        23      /* PPI 7: PMU overflow */
+#define PROF_TIMER_IRQ      30      /* PPI 14: EL1 physical timer */
+
+#define PROF_HZ             1000    /* Samples per second */
+#define PROF_RING_SIZE      2048    /* Samples kept (oldest overwritten) */
+#define PROF_DEPTH          8       /* PC plus up to 7 return addresses */
+
+/* One function in the report */
+typedef struct {
+    const char* name;               /* NULL if no symbol covers the PC */
+    uint64_t addr;                  /* Function start (or the raw PC) */
+    uint32_t count;                 /* Samples with the PC in it */
+} prof_entry_t;
+
+/* Start sampling on this core, clearing earlier samples. Falls back to
+ * the timer when there is no PMU. Returns the source used, -1 on error */
+int prof_start(int source);
+
+/* Stop sampling (samples are kept for the report) */
+void prof_stop(void);
+
+int prof_running(void);
+
+/* Samples taken since prof_start (may exceed PROF_RING_SIZE) */
+uint32_t prof_samples(void);
+
+/* Fill `out` with the functions holding the most samples, hottest first.
+ * Returns the number of entries */
+int prof_report(prof_entry_t* out, int max);
+
+/* Write the kept samples to a file, one per line: PC then callers, in
+ * hex. Returns the number of samples written, -1 on error */
+int prof_dump(const char* path);
+
+#endif /* PROF_H */
@@ -0,0 +1,39 @@
+/*
+ * TinyOS 2D Raster Library
+ * Span-based solid and alpha-blended fills shared by the apps
+ */
+
+#ifndef RASTER_H
+#define RASTER_H
+
+#include "types.h"
+
+/* Largest corner radius with precomputed spans */
+#define RASTER_MAX_RADIUS   64
+
+/*
+ * All shapes are clipped to the fb_width x fb_height target. alpha is
+ * 0-255: 255 (or more) writes the color, 0 leaves the target alone.
+ */
+
+/* Blend one 0x00RRGGBB pixel */
+uint32_t raster_blend(uint32_t bg, uint32_t fg, int alpha);
+
+/* Filled rectangle */
+void raster_fill_rect(uint32_t* fb, int x, int y, int w, int h,
+                      uint32_t color, int alpha, int fb_width, int fb_height);
+
+/* Filled rectangle with corners of radius r, each pixel blended once */
+void raster_fill_rounded_rect(uint32_t* fb, int x, int y, int w, int h, int r,
+                              uint32_t color, int alpha,
+                              int fb_width, int fb_height);
+
+/* Filled circle: pixels with dx*dx + dy*dy <= r*r */
+void raster_fill_circle(uint32_t* fb, int cx, int cy, int r,
+                        uint32_t color, int alpha, int fb_width, int fb_height);
+
+/* Ring between radius r - thickness (inclusive) and r */
+void raster_ring(uint32_t* fb, int cx, int cy, int r, int thickness,
+                 uint32_t color, int alpha, int fb_width, int fb_height);
+
+#endif /* RASTER_H */
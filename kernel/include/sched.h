@@ -0,0 +1,46 @@
+/*
+ * TinyOS Cooperative Scheduler
+ * Run-queue of poll tasks with priorities, wakeups and deadlines
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "types.h"
+
+#define SCHED_MAX_TASKS     16
+
+/* Priorities (lower runs first) */
+#define SCHED_PRIO_HIGH     0   /* Input and UI */
+#define SCHED_PRIO_NORMAL   1   /* Network stack */
+#define SCHED_PRIO_LOW      2   /* Background HTTP/WebSocket sessions */
+
+/* Poll return values (>= 0 means "run again in N ms") */
+#define SCHED_AGAIN         0   /* More work pending - run again soon */
+#define SCHED_WAIT          -1  /* Sleep until sched_wake() or ready() */
+#define SCHED_DONE          -2  /* Remove the task */
+
+/* Task body: do one bounded slice of work, return when to run next */
+typedef int (*sched_poll_fn)(void* arg);
+
+/* Optional readiness check (e.g. "input events queued"), may be NULL */
+typedef int (*sched_ready_fn)(void);
+
+/* Add a task; it runs on the first scheduler pass.
+ * Returns task id or -1 if the table is full */
+int sched_add(const char* name, sched_poll_fn poll, sched_ready_fn ready,
+              void* arg, int prio);
+
+/* Remove a task (safe to call from the task itself) */
+void sched_remove(int id);
+
+/* Mark a task ready (safe from IRQ context) */
+void sched_wake(int id);
+
+/* Run the highest-priority ready task; returns 1 if one ran */
+int sched_run_once(void);
+
+/* Main loop: run ready tasks, sleep in WFI when nothing is ready */
+void sched_run(void) __attribute__((noreturn));
+
+#endif /* SCHED_H */
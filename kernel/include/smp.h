@@ -0,0 +1,81 @@
+/*
+ * TinyOS SMP support
+ * PSCI secondary CPU bring-up and cross-core work queues
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+#include "types.h"
+
+/* Maximum CPUs brought up (QEMU -smp 4 / Android emulator default) */
+#define SMP_MAX_CPUS        4
+
+/* Per-CPU stack size for secondary cores */
+#define SMP_STACK_SIZE      0x4000
+
+/* Pending work items per CPU (must be power of 2) */
+#define SMP_WORK_QUEUE_SIZE 32
+#define SMP_WORK_QUEUE_MASK (SMP_WORK_QUEUE_SIZE - 1)
+
+/* PSCI 0.2 function IDs (SMC64 calling convention) */
+#define PSCI_CPU_ON_64      0xC4000003
+#define PSCI_VERSION        0x84000000
+
+/* PSCI return codes */
+#define PSCI_SUCCESS            0
+#define PSCI_ALREADY_ON         -4
+
+/* Work function run on a target core */
+typedef void (*smp_work_fn)(void* arg);
+
+/* Simple test-and-set spinlock */
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock(spinlock_t* lock) {
+    uint32_t tmp, one = 1;
+    __asm__ volatile(
+        "   sevl\n"
+        "1: wfe\n"
+        "2: ldaxr %w0, [%1]\n"
+        "   cbnz %w0, 1b\n"
+        "   stxr %w0, %w2, [%1]\n"
+        "   cbnz %w0, 2b\n"
+        : "=&r"(tmp)
+        : "r"(&lock->locked), "r"(one)
+        : "memory");
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    /* Store-release; clearing the exclusive monitor wakes WFE waiters */
+    __asm__ volatile("stlr wzr, [%0]" : : "r"(&lock->locked) : "memory");
+}
+
+/* Start all secondary cores via PSCI CPU_ON (call once from CPU 0) */
+void smp_init(void);
+
+/* Get the current CPU number (MPIDR Aff0) */
+int smp_cpu_id(void);
+
+/* Get number of CPUs online, including CPU 0 */
+int smp_num_cpus(void);
+
+/* Check if a CPU is online */
+int smp_cpu_online(int cpu);
+
+/* Queue fn(arg) to run on the given CPU
+ * Returns 0 on success, -1 if CPU is offline or its queue is full */
+int smp_call(int cpu, smp_work_fn fn, void* arg);
+
+/* Run work queued for the current CPU (CPU 0 calls this from its loop)
+ * Returns number of items run */
+int smp_run_pending(void);
+
+/* C entry point for secondary cores (called from boot.S) */
+void smp_secondary_main(uint64_t cpu);
+
+#endif /* SMP_H */
@@ -37,12 +37,57 @@ struct tcp_hdr {
 #define TCP_CLOSE_WAIT   5
 #define TCP_LAST_ACK     6
 #define TCP_TIME_WAIT    7
-
-/* Maximum TCP connections */
-#define MAX_TCP_CONNS    4
-
-/* TCP receive buffer size */
-#define TCP_RX_BUF_SIZE  4096
+#define TCP_SYN_RECEIVED 8
+
+/* Connection table: slots, and buckets of the 4-tuple hash (a power of
+ * two) that demultiplexes incoming segments */
+#define MAX_TCP_CONNS    16
+#define TCP_HASH_SIZE    32
+
+/* Listening sockets, and connections each may hold that tcp_accept()
+ * hasn't taken yet (handshaking or established) */
+#define MAX_TCP_LISTENERS   4
+#define TCP_MAX_BACKLOG     8
+
+/* Ephemeral ports for tcp_connect() */
+#define TCP_EPHEMERAL_FIRST 49152
+#define TCP_EPHEMERAL_LAST  65000
+
+/* Buffer sizes. Windows above 64KB are advertised with window scaling.
+ * Each queued segment pins an RX buffer lent by the driver (RX_HOLD_MAX
+ * in virtio net.c, 32 shared by all connections), and the window
+ * advertised is capped to the full segments that can still be queued,
+ * so a receive window beyond about RX_HOLD_MAX * TCP_MSS (45KB) is never
+ * offered */
+#define TCP_RX_BUF_SIZE  16384  /* Receive window: payload bytes queued */
+#define TCP_TX_BUF_SIZE  8192   /* Send ring: unacked plus unsent bytes */
+#define TCP_RX_SEGS      (TCP_RX_BUF_SIZE / 1024)
+#define TCP_OOO_SEGS     8      /* Held ahead of a hole */
+
+/* Segment sizes */
+#define TCP_MSS          1460   /* Largest payload we take (advertised) */
+#define TCP_DEFAULT_MSS  536    /* Peer sent no MSS option */
+#define TCP_INIT_CWND    3      /* Segments */
+
+/* Timeouts in milliseconds */
+#define TCP_SYN_TIMEOUT_MS   1000   /* SYN retransmit interval */
+#define TCP_SYN_RETRIES      5
+#define TCP_FIN_TIMEOUT_MS   5000   /* Give up on FIN_WAIT */
+#define TCP_TIME_WAIT_MS     2000   /* Linger in TIME_WAIT */
+#define TCP_RTO_INIT_MS      1000   /* Before the first RTT sample */
+#define TCP_RTO_MIN_MS       200
+#define TCP_RTO_MAX_MS       60000
+#define TCP_MAX_RETRIES      8      /* Retransmit timeouts in a row */
+#define TCP_DELACK_MS        40     /* Longest an ACK is held back */
+#define TCP_THRU_INTERVAL_MS 1000   /* Throughput histogram sample period */
+
+/* Received payload, still in its RX buffer (see net_rx_hold) */
+typedef struct {
+    const uint8_t* data;
+    int len;
+    int buf;                 /* net_rx_hold() handle */
+    uint32_t seq;            /* First byte (out-of-order queue only) */
+} tcp_seg_t;
 
 /* TCP connection */
 typedef struct {
@@ -53,22 +98,113 @@ typedef struct {
     uint32_t seq_num;        /* Our sequence number */
     uint32_t ack_num;        /* What we expect from peer */
     uint32_t last_ack_sent;  /* Last ACK we sent */
-    uint8_t rx_buffer[TCP_RX_BUF_SIZE];
-    int rx_len;              /* Data in receive buffer */
+    uint32_t wnd_sent;       /* Window in the last segment we sent */
+    int ack_pending;         /* Segments received since our last ACK */
+    uint32_t delack_deadline;
+    tcp_seg_t rx_segs[TCP_RX_SEGS];  /* In-order payload ring, oldest first */
+    int rx_head;             /* Index of the oldest segment */
+    int rx_count;            /* Segments queued */
+    int rx_len;              /* Payload bytes queued */
+    tcp_seg_t ooo[TCP_OOO_SEGS];     /* Beyond ack_num: sorted, disjoint */
+    int ooo_count;
+    uint32_t ooo_last;       /* Latest out-of-order arrival (first SACK) */
     int rx_ready;            /* New data available */
-    uint32_t timeout_tick;   /* For retransmission */
+    uint32_t timeout_ms;     /* SYN retry/state deadline (timer_ms) */
     int retries;
+    int listener;            /* Accepted from listener - 1, 0 if none */
+    int accepted;            /* Handed out by tcp_accept() */
+
+    /* Negotiated in the handshake */
+    uint16_t mss;            /* Payload per segment we send */
+    uint8_t snd_wscale;      /* Shift for the peer's window */
+    uint8_t rcv_wscale;      /* Shift for ours (0 without scaling) */
+    uint8_t ws_ok;           /* Window scaling in use */
+    uint8_t sack_ok;         /* Peer takes SACK blocks */
+    uint8_t ts_ok;           /* Timestamps on every segment */
+    uint32_t ts_recent;      /* Peer's TSval to echo */
+
+    /* Send ring: bytes from snd_una on; seq_num is the next one to send */
+    uint8_t tx_ring[TCP_TX_BUF_SIZE];
+    int tx_head;             /* Ring index of the byte at snd_una */
+    int tx_len;              /* Bytes queued (unacked plus unsent) */
+    uint32_t snd_una;        /* Oldest unacknowledged sequence number */
+    uint32_t snd_max;        /* Highest sequence number sent */
+    uint32_t snd_wnd;        /* Peer's advertised window */
+    int fin;                 /* Progress of our FIN */
+
+    /* Congestion control (NewReno) */
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t recover;        /* seq_num when loss was detected */
+    int in_recovery;
+    int dup_acks;
+
+    /* RTT estimation and retransmit timer (ms) */
+    int srtt;                /* Smoothed RTT << 3, 0 = no sample yet */
+    int rttvar;              /* RTT variance << 2 */
+    uint32_t rto_ms;
+    int rtt_timing;          /* A segment is being timed... */
+    uint32_t rtt_seq;        /* ...ending here... */
+    uint32_t rtt_start;      /* ...sent at this timer_ms() */
+    int rtx_armed;
+    uint32_t rtx_deadline;
+
+    /* Statistics (netstat) */
+    uint64_t bytes_in;       /* Payload delivered in order */
+    uint64_t bytes_out;      /* Payload acknowledged */
+    uint32_t retransmits;    /* Segments resent */
+    net_hist_t rtt_hist;     /* RTT samples, ms */
+    net_hist_t thru_hist;    /* KB/s over each busy TCP_THRU_INTERVAL_MS */
+    uint32_t thru_start;     /* Current interval began (timer_ms) */
+    uint32_t thru_bytes;     /* Bytes in plus acked in it */
 } tcp_conn_t;
 
+/* Counters over all connections, since init */
+typedef struct {
+    uint32_t segs_in;
+    uint32_t segs_out;
+    uint64_t bytes_in;       /* Payload on the wire, duplicates included */
+    uint64_t bytes_out;
+    uint32_t retransmits;    /* Segments resent, by any trigger... */
+    uint32_t rto_timeouts;   /* ...retransmit timer expiries */
+    uint32_t fast_retransmits; /* ...three duplicate ACKs */
+    uint32_t dup_segments;   /* Payload already received */
+    uint32_t ooo_segments;   /* Arrived past a hole */
+    uint32_t ooo_dropped;    /* ...and couldn't be kept */
+    uint32_t bad_header;     /* Dropped: bad data offset */
+    uint32_t no_conn;        /* Dropped: no matching connection */
+    uint32_t rst_rx;
+    uint32_t tx_fail;        /* Segment not queued (TX ring or ARP hold full) */
+    uint32_t active_opens;
+    uint32_t passive_opens;
+} tcp_stats_t;
+
 /* Initialize TCP */
 void tcp_init(void);
 
 /* Create a new connection (returns connection index or -1) */
 int tcp_connect(const uint8_t* ip, uint16_t port);
 
-/* Send data on connection */
+/* Accept connections to a local port, keeping up to `backlog` of them
+ * until taken. Returns a listener id or -1 */
+int tcp_listen(uint16_t port, int backlog);
+
+/* Take an established connection from a listener without blocking.
+ * Returns its connection index, or -1 if none is waiting */
+int tcp_accept(int listener);
+
+/* Stop listening; connections not yet accepted are reset */
+void tcp_unlisten(int listener);
+
+/* Queue data on a connection without blocking; it is sent as the peer's
+ * and the congestion window allow, and retransmitted until acknowledged.
+ * Returns bytes accepted (fewer than len when the send ring is full, 0 if
+ * it is) or -1 if the connection isn't established */
 int tcp_send(int conn, const void* data, int len);
 
+/* Bytes tcp_send would accept right now */
+int tcp_send_space(int conn);
+
 /* Receive data from connection (returns bytes read) */
 int tcp_recv(int conn, void* buffer, int max_len);
 
@@ -81,6 +217,12 @@ void tcp_close(int conn);
 /* Get connection state */
 int tcp_get_state(int conn);
 
+/* Get the connection in a slot (any state), NULL if out of range */
+tcp_conn_t* tcp_get_conn(int conn);
+
+/* Get counters over all connections */
+tcp_stats_t* tcp_get_stats(void);
+
 /* Poll for TCP events (called from net_poll) */
 void tcp_poll(void);
 
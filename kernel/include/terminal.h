@@ -16,9 +16,6 @@ int terminal_update(void);
 /* Draw the terminal to the framebuffer */
 void terminal_draw(void);
 
-/* Increment uptime counter (call from main loop) */
-void terminal_tick(void);
-
 /* Check if terminal wants to close (return to home) */
 int terminal_should_close(void);
 
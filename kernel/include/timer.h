@@ -0,0 +1,40 @@
+/*
+ * TinyOS Kernel Timebase
+ * ARM generic timer tick and millisecond clock
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "types.h"
+
+/* Tick rate of the periodic timer interrupt */
+#define TIMER_HZ        1000
+
+/* EL1 virtual timer PPI */
+#define TIMER_IRQ       27
+
+/* Start the periodic tick on the calling CPU (CPU 0) */
+void timer_init(void);
+
+/* Milliseconds since timer_init (from the counter, not the tick) */
+uint32_t timer_ms(void);
+
+/* Raw counter value (CNTVCT_EL0), timer_freq() ticks per second */
+uint64_t timer_counter(void);
+
+/* Number of tick interrupts taken */
+uint64_t timer_ticks(void);
+
+/* Counter frequency in Hz (CNTFRQ_EL0) */
+uint32_t timer_freq(void);
+
+/* Check if a millisecond deadline has passed (wrap-safe) */
+static inline int timer_expired(uint32_t deadline_ms) {
+    return (int32_t)(timer_ms() - deadline_ms) >= 0;
+}
+
+/* Sleep until the next interrupt (tick or device) */
+void timer_idle(void);
+
+#endif /* TIMER_H */
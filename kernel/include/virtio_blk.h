@@ -7,6 +7,7 @@
 #define VIRTIO_BLK_H
 
 #include "types.h"
+#include "completion.h"
 
 /* Virtio device ID for block device */
 #define VIRTIO_DEVICE_BLOCK     2
@@ -25,6 +26,32 @@
 #define VIRTIO_BLK_S_IOERR      1
 #define VIRTIO_BLK_S_UNSUPP     2
 
+/* Transfers are split into device requests of at most this many sectors */
+#define BLK_PART_SECTORS        128
+
+/*
+ * Asynchronous request. The caller fills in the first block and keeps
+ * the request and buffer alive until it completes; data moves directly
+ * between the device and buf. While a read is in flight nothing sharing
+ * a cache line with buf may be written (cache-line aligned buffers are
+ * safe).
+ */
+typedef struct blk_req {
+    uint32_t type;          /* VIRTIO_BLK_T_IN, _OUT or _FLUSH */
+    uint64_t sector;        /* Starting sector */
+    uint32_t count;         /* Sectors (ignored for flush) */
+    void* buf;              /* count * 512 bytes */
+    completion_fn fn;       /* Optional, runs in IRQ context when done */
+    void* arg;
+
+    /* Driver state */
+    completion_t done;      /* done.status: 0 = success, -1 = I/O error */
+    uint32_t next_part;     /* Sectors already handed to the device */
+    int parts_left;         /* Parts in flight */
+    int status;
+    struct blk_req* next;   /* Pending queue link */
+} blk_req_t;
+
 /* Disk info structure */
 typedef struct {
     uint64_t capacity;      /* Total sectors */
@@ -41,7 +68,7 @@ disk_info_t* blk_get_info(void);
 /* Check if disk is available */
 int blk_available(void);
 
-/* Read sectors from disk
+/* Read sectors from disk (synchronous blk_submit + blk_wait)
  * sector: starting sector number
  * count: number of sectors to read
  * buf: output buffer (must be at least count * 512 bytes)
@@ -60,4 +87,16 @@ int blk_write(uint64_t sector, uint32_t count, const void* buf);
 /* Flush disk cache */
 int blk_flush(void);
 
+/* Queue a request; it starts as soon as queue slots are free.
+ * Returns 0 if queued, -1 if the request is invalid or there's no disk */
+int blk_submit(blk_req_t* req);
+
+/* Reap completions without sleeping; returns 1 once req is done */
+int blk_poll(blk_req_t* req);
+
+/* Sleep until req completes. Returns its status (0 or -1), or -1 on
+ * timeout. A timed-out request is abandoned by resetting the device, so
+ * buf may be reused at once; other requests in flight then fail too */
+int blk_wait(blk_req_t* req);
+
 #endif /* VIRTIO_BLK_H */
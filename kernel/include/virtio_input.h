@@ -113,6 +113,10 @@ int virtio_input_pending(void);
 /* Poll for input events (call from main loop) */
 void virtio_input_poll(void);
 
+/* Devices have returned events virtio_input_poll() hasn't taken; their
+ * interrupt wakes the CPU when this turns true */
+int virtio_input_ready(void);
+
 /* Enable/disable debug output for touch events */
 void virtio_input_set_debug(int enable);
 
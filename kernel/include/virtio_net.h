@@ -24,8 +24,23 @@ typedef struct {
     int available;          /* Driver fully initialized, can send/recv */
     int link_up;            /* Link status */
     uint8_t mac[6];         /* MAC address */
+    int tx_csum;            /* Device completes TX checksums */
+    int rx_csum;            /* Device validates RX checksums */
 } net_status_t;
 
+/* Link counters, since init */
+typedef struct {
+    uint32_t rx_packets;
+    uint32_t tx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint32_t tx_ring_full;  /* No free TX descriptor */
+    uint32_t tx_too_big;    /* Frame larger than a TX buffer */
+    uint32_t tx_kicks;      /* Device notifications */
+    uint32_t rx_runts;      /* Returned without an Ethernet frame */
+    uint32_t rx_hold_full;  /* virtio_net_rx_hold() refused (RX_HOLD_MAX) */
+} net_link_stats_t;
+
 /* Initialize virtio-net driver */
 void virtio_net_init(void);
 
@@ -35,13 +50,62 @@ int virtio_net_available(void);
 /* Get network status */
 net_status_t* virtio_net_get_status(void);
 
-/* Send raw ethernet frame (without virtio header) */
+/* Get link counters */
+net_link_stats_t* virtio_net_get_stats(void);
+
+/* Send raw ethernet frame (without virtio header).
+ * Returns 0 on success, -1 if the TX ring is full or the frame too big */
 int virtio_net_send(const void* data, uint32_t len);
 
-/* Receive ethernet frame (without virtio header), returns length or 0 */
-int virtio_net_recv(void* buffer, uint32_t max_len);
+/* Queue a frame like virtio_net_send(); with `more` set the device isn't
+ * notified, so a burst costs one kick (the last frame passes more = 0,
+ * or call virtio_net_tx_kick) */
+int virtio_net_xmit(const void* data, uint32_t len, int more);
+
+/* Queue a frame like virtio_net_xmit() and have the device complete its
+ * transport checksum: it sums from csum_start (bytes into the frame) to
+ * the end and stores the result csum_offset bytes further on, where the
+ * caller left the pseudo-header sum. Returns -1 without TX offload */
+int virtio_net_xmit_csum(const void* data, uint32_t len, uint16_t csum_start,
+                         uint16_t csum_offset, int more);
+
+/* Notify the device of frames queued with `more` */
+void virtio_net_tx_kick(void);
+
+/* Free TX descriptors after reclaiming completed sends */
+int virtio_net_tx_space(void);
+
+/* Received frame, still in its RX descriptor buffer */
+typedef struct {
+    uint8_t* data;          /* Ethernet frame (virtio header skipped) */
+    uint16_t len;
+    uint16_t id;            /* Buffer handle for hold/release */
+    int csum_valid;         /* Device vouched for the transport checksum */
+} net_rxbuf_t;
+
+/* Take the next received frame without copying it. Returns 1 with `out`
+ * filled, 0 if none. The caller owns one reference and must release it */
+int virtio_net_rx_take(net_rxbuf_t* out);
+
+/* Add a reference so the frame outlives its processing (e.g. queued TCP
+ * payload). Returns -1 when too many buffers are already held */
+int virtio_net_rx_hold(uint16_t id);
+
+/* Buffers virtio_net_rx_hold() will still take, counting frames being
+ * processed as held (shared by every user) */
+int virtio_net_rx_hold_room(void);
+
+/* Drop a reference; the last one recycles the buffer */
+void virtio_net_rx_release(uint16_t id);
+
+/* Frames the device has filled that virtio_net_rx_take() hasn't taken.
+ * The receive interrupt wakes the CPU when this becomes non-zero */
+int virtio_net_rx_pending(void);
+
+/* Give recycled RX buffers back to the device (one notify per batch) */
+void virtio_net_rx_refill(void);
 
-/* Poll for incoming packets */
+/* Acknowledge device interrupts */
 void virtio_net_poll(void);
 
 #endif
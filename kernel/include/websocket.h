@@ -21,10 +21,25 @@
 #define WS_OP_PONG         0x0A
 
 /* Buffer sizes */
-#define WS_MAX_MESSAGE     2048
+#define WS_MAX_MESSAGE     262144   /* Largest reassembled message */
+#define WS_MSG_INITIAL     2048     /* First message buffer allocation */
+#define WS_MAX_CONTROL     125      /* Control frame payload limit */
+#define WS_MAX_HEADER      14       /* Frame header incl. 64-bit length, mask */
+#define WS_TX_COALESCE     1024     /* Small frames gathered per flush */
+#define WS_COALESCE_MAX    256      /* Larger frames go out at once */
 #define WS_MAX_HOST        64
 #define WS_MAX_PATH        128
 
+/* Close status codes */
+#define WS_CLOSE_PROTOCOL  1002
+#define WS_CLOSE_TOO_BIG   1009
+
+/* Streaming receive: called with each piece of a text or binary message
+ * as it arrives (unmasked, fin = 0), then once with fin = 1 and no data
+ * when the message is complete. Messages then have no size limit */
+typedef void (*ws_handler_t)(void* ctx, int opcode, const uint8_t* data,
+                             int len, int fin);
+
 /* WebSocket connection */
 typedef struct {
     int state;
@@ -37,19 +52,37 @@ typedef struct {
     int handshake_sent;
     int handshake_complete;
     char sec_key[32];       /* Base64 encoded key */
-
-    /* Receive buffer */
-    uint8_t rx_buffer[WS_MAX_MESSAGE];
-    int rx_len;
+    char hs_status[16];     /* Start of the upgrade response */
+    int hs_len;             /* Response bytes read */
+    uint32_t hs_tail;       /* Last four of them, to find the blank line */
+
+    /* Message being reassembled (heap, grows) and the one completed */
+    uint8_t* msg;
+    int msg_len;
+    int msg_cap;
+    uint8_t msg_opcode;     /* Text or binary while one is open, else 0 */
     int rx_ready;
     uint8_t rx_opcode;
-
-    /* Frame parsing state */
-    int frame_state;
-    int frame_len;
+    ws_handler_t handler;   /* Instead of reassembling, if set */
+    void* handler_ctx;
+
+    /* Frame parsing state: header bytes, then payload */
+    uint8_t hdr[WS_MAX_HEADER];
+    int hdr_len;
+    int hdr_need;
+    int in_payload;
+    uint8_t frame_opcode;
+    int frame_fin;
     int frame_mask;
     uint8_t frame_mask_key[4];
-
+    uint64_t frame_left;    /* Payload bytes still to come */
+    uint32_t frame_pos;     /* Payload bytes seen (mask phase) */
+    uint8_t ctrl[WS_MAX_CONTROL];
+    int ctrl_len;
+
+    /* Small frames waiting to go out together */
+    uint8_t tx_buf[WS_TX_COALESCE];
+    int tx_len;
 } websocket_t;
 
 /* Initialize WebSocket system */
@@ -58,10 +91,16 @@ void ws_init(void);
 /* Connect to WebSocket server */
 int ws_connect(websocket_t* ws, const char* url);
 
-/* Poll WebSocket (call repeatedly) */
+/* Stream received messages to a handler instead of ws_get_message */
+void ws_set_handler(websocket_t* ws, ws_handler_t handler, void* ctx);
+
+/* Poll WebSocket (call repeatedly); also flushes queued small frames */
 int ws_poll(websocket_t* ws);
 
-/* Send text message */
+/* Send a message as one frame. Frames up to WS_COALESCE_MAX are queued
+ * and sent together by the next ws_poll or ws_flush; larger ones go out
+ * at once, whole or not at all. Returns len, or -1 if it can't be sent
+ * now (TCP send ring full) */
 int ws_send_text(websocket_t* ws, const char* message);
 
 /* Send binary message */
@@ -70,10 +109,16 @@ int ws_send_binary(websocket_t* ws, const uint8_t* data, int len);
 /* Send ping */
 int ws_send_ping(websocket_t* ws);
 
-/* Check if message received */
+/* Send queued frames now. Returns 0, or -1 if they still wait for room */
+int ws_flush(websocket_t* ws);
+
+/* Check if message received. Reading stops until it is taken */
 int ws_message_ready(websocket_t* ws);
 
-/* Get received message */
+/* Length of the received message */
+int ws_message_len(websocket_t* ws);
+
+/* Get received message (truncated to max_len - 1, NUL terminated) */
 int ws_get_message(websocket_t* ws, char* buffer, int max_len);
 
 /* Get message opcode */
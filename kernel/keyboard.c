@@ -5,6 +5,7 @@
 #include "keyboard.h"
 #include "font.h"
 #include "event.h"
+#include "raster.h"
 
 /* Keyboard dimensions */
 #define KEY_ROWS        4
@@ -231,65 +232,10 @@ char keyboard_get_char(void) {
     return c;
 }
 
-/* Blend color with alpha */
-static uint32_t blend(uint32_t bg, uint32_t fg, int alpha) {
-    int bg_r = (bg >> 16) & 0xFF;
-    int bg_g = (bg >> 8) & 0xFF;
-    int bg_b = bg & 0xFF;
-    int fg_r = (fg >> 16) & 0xFF;
-    int fg_g = (fg >> 8) & 0xFF;
-    int fg_b = fg & 0xFF;
-    int r = (fg_r * alpha + bg_r * (255 - alpha)) / 255;
-    int g = (fg_g * alpha + bg_g * (255 - alpha)) / 255;
-    int b = (fg_b * alpha + bg_b * (255 - alpha)) / 255;
-    return (r << 16) | (g << 8) | b;
-}
-
-/* Draw filled rectangle with alpha */
-static void draw_rect_a(uint32_t* fb, int x, int y, int w, int h, uint32_t color, int alpha) {
-    for (int py = y; py < y + h && py < (int)scr_h; py++) {
-        if (py < 0) continue;
-        for (int px = x; px < x + w && px < (int)scr_w; px++) {
-            if (px < 0) continue;
-            if (alpha >= 255) {
-                fb[py * scr_w + px] = color;
-            } else {
-                fb[py * scr_w + px] = blend(fb[py * scr_w + px], color, alpha);
-            }
-        }
-    }
-}
-
-/* Draw key with rounded corners (simplified) */
+/* Draw key with rounded corners */
 static void draw_key(uint32_t* fb, int x, int y, int w, int h, uint32_t bg, int pressed) {
     uint32_t color = pressed ? KEY_BG_PRESS : bg;
-    int r = 6;
-
-    /* Main rectangle */
-    draw_rect_a(fb, x + r, y, w - 2 * r, h, color, 220);
-    draw_rect_a(fb, x, y + r, w, h - 2 * r, color, 220);
-
-    /* Rounded corners (simplified as filled circles) */
-    for (int py = 0; py < r; py++) {
-        for (int px = 0; px < r; px++) {
-            int dx = r - 1 - px;
-            int dy = r - 1 - py;
-            if (dx * dx + dy * dy <= r * r) {
-                /* Top-left */
-                if (x + px >= 0 && y + py >= 0)
-                    fb[(y + py) * scr_w + x + px] = blend(fb[(y + py) * scr_w + x + px], color, 220);
-                /* Top-right */
-                if (x + w - 1 - px >= 0 && y + py >= 0)
-                    fb[(y + py) * scr_w + x + w - 1 - px] = blend(fb[(y + py) * scr_w + x + w - 1 - px], color, 220);
-                /* Bottom-left */
-                if (x + px >= 0 && y + h - 1 - py >= 0)
-                    fb[(y + h - 1 - py) * scr_w + x + px] = blend(fb[(y + h - 1 - py) * scr_w + x + px], color, 220);
-                /* Bottom-right */
-                if (x + w - 1 - px >= 0 && y + h - 1 - py >= 0)
-                    fb[(y + h - 1 - py) * scr_w + x + w - 1 - px] = blend(fb[(y + h - 1 - py) * scr_w + x + w - 1 - px], color, 220);
-            }
-        }
-    }
+    raster_fill_rounded_rect(fb, x, y, w, h, 6, color, 220, scr_w, scr_h);
 }
 
 /* Draw centered text on key */
@@ -308,10 +254,10 @@ void keyboard_draw(uint32_t* fb, uint32_t fb_width, uint32_t fb_height) {
     (void)fb_height;
 
     /* Draw keyboard background */
-    draw_rect_a(fb, 0, kb_y, scr_w, kb_height, KB_BG, 230);
+    raster_fill_rect(fb, 0, kb_y, scr_w, kb_height, KB_BG, 230, scr_w, scr_h);
 
     /* Top border */
-    draw_rect_a(fb, 0, kb_y, scr_w, 1, 0x606070, 255);
+    raster_fill_rect(fb, 0, kb_y, scr_w, 1, 0x606070, 255, scr_w, scr_h);
 
     /* Draw main keys */
     const char** layout = kb_shift ? keys_upper : keys_lower;
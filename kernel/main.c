@@ -1,4 +1,5 @@
 #include "cursor.h"
+#include "event.h"
 #include "filemanager.h"
 #include "font.h"
 #include "fs.h"
@@ -7,13 +8,31 @@
 #include "home.h"
 #include "http.h"
 #include "memory.h"
+#include "mmu.h"
 #include "net.h"
+#include "sched.h"
+#include "smp.h"
 #include "tcp.h"
 #include "terminal.h"
+#include "timer.h"
 #include "virtio_blk.h"
 #include "virtio_input.h"
 #include "virtio_net.h"
 
+/* Delay network bring-up until the GUI is stable */
+#define NET_INIT_DELAY_MS 1000
+
+/* Network timer granularity: received frames wake the task at once, this
+ * only runs TCP, ARP and DHCP deadlines (the finest, the delayed ACK, is
+ * 40 ms) */
+#define NET_TIMER_MS 10
+
+/* UI refresh interval when no input arrives (animations) */
+#define UI_FRAME_MS 16
+
+/* How often to check for DHCP before fetching the external IP */
+#define EXT_IP_WAIT_MS 100
+
 /* UI State */
 #define STATE_HOME 0
 #define STATE_TERMINAL 1
@@ -101,12 +120,186 @@ static void test_memory_allocator(void) {
   uart_puts("Memory allocator test complete!\r\n");
 }
 
+/* ==================== Tasks ==================== */
+
+/* Take input events; runs when a device has returned some */
+static int input_task(void *arg) {
+  (void)arg;
+  virtio_input_poll();
+  return SCHED_WAIT;
+}
+
+static int32_t last_cursor_x = -1;
+static int32_t last_cursor_y = -1;
+
+static int cursor_moved(void) {
+  int32_t cur_x, cur_y;
+  virtio_input_get_touch(&cur_x, &cur_y, NULL);
+  return cur_x != last_cursor_x || cur_y != last_cursor_y;
+}
+
+static int ui_ready(void) { return event_pending() || cursor_moved(); }
+
+/* Run the active app: handle input, redraw on change, switch screens */
+static int ui_task(void *arg) {
+  (void)arg;
+  int moved = cursor_moved();
+  if (moved) {
+    virtio_input_get_touch(&last_cursor_x, &last_cursor_y, NULL);
+  }
+
+  uint32_t sw = goldfish_fb_get_width();
+  uint32_t sh = goldfish_fb_get_height();
+
+  /* Apps draw with the pointer taken off the frame (cursor_hide); a
+   * pointer move on its own only restores and redraws the cursor */
+  int drawn = 0;
+
+  if (ui_state == STATE_HOME) {
+    /* Home screen mode */
+    if (home_update()) {
+      cursor_hide(goldfish_fb_get_buffer(), sw);
+      home_draw();
+      drawn = 1;
+    }
+
+    /* Check if terminal icon was pressed */
+    if (home_terminal_pressed()) {
+      home_clear_pressed();
+      ui_state = STATE_TERMINAL;
+      terminal_init();
+      cursor_hide(goldfish_fb_get_buffer(), sw);
+      terminal_draw();
+      drawn = 1;
+    }
+    /* Check if files icon was pressed */
+    else if (home_files_pressed()) {
+      home_clear_pressed();
+      ui_state = STATE_FILES;
+      filemanager_init();
+      cursor_hide(goldfish_fb_get_buffer(), sw);
+      filemanager_draw();
+      drawn = 1;
+    }
+  } else if (ui_state == STATE_TERMINAL) {
+    /* Terminal mode */
+    if (terminal_update()) {
+      cursor_hide(goldfish_fb_get_buffer(), sw);
+      terminal_draw();
+      drawn = 1;
+    }
+
+    if (terminal_should_close()) {
+      terminal_clear_close();
+      ui_state = STATE_HOME;
+      home_init();
+      cursor_hide(goldfish_fb_get_buffer(), sw);
+      home_draw();
+      drawn = 1;
+    }
+  } else if (ui_state == STATE_FILES) {
+    /* File manager mode */
+    if (filemanager_update()) {
+      cursor_hide(goldfish_fb_get_buffer(), sw);
+      filemanager_draw();
+      drawn = 1;
+    }
+
+    if (filemanager_should_close()) {
+      filemanager_clear_close();
+      ui_state = STATE_HOME;
+      home_init();
+      cursor_hide(goldfish_fb_get_buffer(), sw);
+      home_draw();
+      drawn = 1;
+    }
+  }
+
+  if (drawn || moved) {
+    cursor_draw(goldfish_fb_get_buffer(), sw, sh);
+    goldfish_fb_flush();
+  }
+
+  /* Wake on input; otherwise one frame later for animations */
+  return UI_FRAME_MS;
+}
+
+/* Bring the network up once the GUI is stable, then poll it */
+static int net_task(void *arg) {
+  (void)arg;
+  static int net_tried = 0;
+
+  if (!net_tried) {
+    if (!timer_expired(NET_INIT_DELAY_MS))
+      return NET_INIT_DELAY_MS - timer_ms();
+    net_init();
+    net_tried = 1;
+    if (!virtio_net_available())
+      return SCHED_DONE;
+  }
+
+  /* Right away with a backlog; new frames wake us through net_ready */
+  if (net_poll() > 0)
+    return SCHED_AGAIN;
+  return NET_TIMER_MS;
+}
+
+static int net_ready(void) { return virtio_net_rx_pending() > 0; }
+
+/* Write back deferred filesystem metadata in the background */
+static int fs_sync_task(void *arg) {
+  (void)arg;
+  if (fs_mounted())
+    fs_sync();
+  return FS_SYNC_INTERVAL_MS;
+}
+
+/* Fetch the external IP for the home screen once DHCP completes */
+static int ext_ip_task(void *arg) {
+  (void)arg;
+  static int started = 0;
+  static http_request_t auto_req;
+
+  if (!started) {
+    if (!net_get_config()->configured)
+      return EXT_IP_WAIT_MS;
+    if (http_request_start(&auto_req, HTTP_GET, "http://ifconfig.me/ip", NULL,
+                           0) != 0)
+      return SCHED_DONE; /* Don't retry */
+    started = 1;
+  }
+
+  int state = http_request_poll(&auto_req);
+  if (state == HTTP_STATE_DONE) {
+    /* Store external IP for display in home screen */
+    if (auto_req.response.body_len > 0) {
+      home_set_external_ip(auto_req.response.body);
+    }
+    http_request_close(&auto_req);
+    return SCHED_DONE;
+  } else if (state == HTTP_STATE_ERROR) {
+    http_request_close(&auto_req);
+    return SCHED_DONE;
+  }
+  return 1;
+}
+
 void kernel_main(void) {
   uart_puts("\r\n*** TinyOS ***\r\n");
 
+  /* Identity map + caches before anything touches the heap */
+  mmu_init();
+  uart_puts("MMU and caches enabled\r\n");
+
   /* Initialize GIC first (needed for interrupts) */
   gic_init();
 
+  /* Start secondary cores - they idle in WFE until given work */
+  smp_init();
+
+  /* Kernel timebase (generic timer tick on CPU 0) */
+  timer_init();
+
   /* Initialize framebuffer FIRST - get GUI up immediately */
   goldfish_fb_init();
 
@@ -121,137 +314,16 @@ void kernel_main(void) {
   blk_init();
   fs_init();
 
+  /* Input and UI first, network next, background fetch last */
+  sched_add("input", input_task, virtio_input_ready, NULL, SCHED_PRIO_HIGH);
+  sched_add("ui", ui_task, ui_ready, NULL, SCHED_PRIO_HIGH);
+  sched_add("net", net_task, net_ready, NULL, SCHED_PRIO_NORMAL);
+  sched_add("ext-ip", ext_ip_task, NULL, NULL, SCHED_PRIO_LOW);
+  sched_add("fs-sync", fs_sync_task, NULL, NULL, SCHED_PRIO_LOW);
+
   /* Enable interrupts */
   enable_interrupts();
 
-  static uint32_t loop_count = 0;
-  static int net_tried = 0;
-  static int auto_curl_started = 0;
-  static http_request_t auto_req;
-
   /* Main event loop */
-  while (1) {
-    loop_count++;
-
-    /* Poll for input events */
-    virtio_input_poll();
-
-    /* Try network init ONCE after 10000 loops (GUI stable) */
-    if (!net_tried && loop_count > 10000) {
-      net_init();
-      net_tried = 1;
-    }
-
-    /* Poll network only if init was attempted */
-    if (net_tried) {
-      net_poll();
-    }
-
-    /* Auto-fetch external IP after DHCP completes */
-    net_config_t *nc = net_get_config();
-    if (net_tried && nc->configured && !auto_curl_started) {
-      if (http_request_start(&auto_req, HTTP_GET, "http://ifconfig.me/ip", NULL,
-                             0) == 0) {
-        auto_curl_started = 1;
-      } else {
-        auto_curl_started = 2; /* Mark as failed, don't retry */
-      }
-    }
-
-    /* Poll external IP request */
-    if (auto_curl_started == 1) {
-      int state = http_request_poll(&auto_req);
-      if (state == HTTP_STATE_DONE) {
-        /* Store external IP for display in home screen */
-        if (auto_req.response.body_len > 0) {
-          home_set_external_ip(auto_req.response.body);
-        }
-        http_request_close(&auto_req);
-        auto_curl_started = 2; /* Done */
-      } else if (state == HTTP_STATE_ERROR) {
-        http_request_close(&auto_req);
-        auto_curl_started = 2;
-      }
-    }
-
-    static int32_t last_cursor_x = -1;
-    static int32_t last_cursor_y = -1;
-    int32_t cur_x, cur_y;
-    virtio_input_get_touch(&cur_x, &cur_y, NULL);
-    int cursor_moved = (cur_x != last_cursor_x || cur_y != last_cursor_y);
-    if (cursor_moved) {
-      last_cursor_x = cur_x;
-      last_cursor_y = cur_y;
-    }
-
-    uint32_t sw = goldfish_fb_get_width();
-    uint32_t sh = goldfish_fb_get_height();
-    uint32_t *fb = goldfish_fb_get_buffer();
-
-    if (ui_state == STATE_HOME) {
-      /* Home screen mode */
-      if (home_update() || cursor_moved) {
-        home_draw();
-        cursor_draw(fb, sw, sh);
-        goldfish_fb_flush();
-      }
-
-      /* Check if terminal icon was pressed */
-      if (home_terminal_pressed()) {
-        home_clear_pressed();
-        ui_state = STATE_TERMINAL;
-        terminal_init();
-        terminal_draw();
-        cursor_draw(fb, sw, sh);
-        goldfish_fb_flush();
-      }
-      /* Check if files icon was pressed */
-      else if (home_files_pressed()) {
-        home_clear_pressed();
-        ui_state = STATE_FILES;
-        filemanager_init();
-        filemanager_draw();
-        cursor_draw(fb, sw, sh);
-        goldfish_fb_flush();
-      }
-    } else if (ui_state == STATE_TERMINAL) {
-      /* Terminal mode */
-      if (terminal_update() || cursor_moved) {
-        terminal_draw();
-        cursor_draw(fb, sw, sh);
-        goldfish_fb_flush();
-      }
-
-      if (terminal_should_close()) {
-        terminal_clear_close();
-        ui_state = STATE_HOME;
-        home_init();
-        home_draw();
-        cursor_draw(fb, sw, sh);
-        goldfish_fb_flush();
-      }
-
-      terminal_tick();
-    } else if (ui_state == STATE_FILES) {
-      /* File manager mode */
-      if (filemanager_update() || cursor_moved) {
-        filemanager_draw();
-        cursor_draw(fb, sw, sh);
-        goldfish_fb_flush();
-      }
-
-      if (filemanager_should_close()) {
-        filemanager_clear_close();
-        ui_state = STATE_HOME;
-        home_init();
-        home_draw();
-        cursor_draw(fb, sw, sh);
-        goldfish_fb_flush();
-      }
-    }
-
-    /* Brief delay to avoid spinning too fast */
-    for (volatile int i = 0; i < 10000; i++)
-      ;
-  }
-}
\ No newline at end of file
+  sched_run();
+}
@@ -1,39 +1,144 @@
 /*
  * TinyOS Memory Allocator
  *
- * First-fit free list allocator with block coalescing.
- * Designed for simplicity while providing real malloc/free support.
+ * Segregated free list allocator with boundary tags.
+ *
+ * Every block carries a header and a footer holding its size, so the
+ * physical neighbours of a block can be found in O(1) when it is freed.
+ * Free blocks are kept on doubly linked lists bucketed by power-of-two
+ * size class; a bitmap of non-empty classes lets malloc find a block that
+ * is guaranteed to fit without walking the heap.
  */
 
 #include "memory.h"
 
 /* Block header - placed before each allocation */
 typedef struct block_header {
-    size_t size;                    /* Total size including header */
-    struct block_header* next;      /* Next block in memory order */
+    size_t size;                    /* Total size including header/footer */
     uint32_t is_free;               /* 1 = free, 0 = allocated */
     uint32_t magic;                 /* Magic number for validation */
 } block_header_t;
 
+/* Free list links - live in the payload of free blocks only */
+typedef struct free_links {
+    struct block_header* next;      /* Next free block in same class */
+    struct block_header* prev;      /* Previous free block in same class */
+} free_links_t;
+
+/* Boundary tag - last word of every block */
+typedef struct block_footer {
+    size_t size;                    /* Copy of header size */
+} block_footer_t;
+
 #define BLOCK_MAGIC     0xDEADBEEF
 #define HEADER_SIZE     sizeof(block_header_t)
-#define MIN_BLOCK_SIZE  (HEADER_SIZE + 16)  /* Minimum useful block */
+#define FOOTER_SIZE     sizeof(block_footer_t)
+#define BLOCK_OVERHEAD  (HEADER_SIZE + FOOTER_SIZE)
 
 /* Alignment for ARM64 - 16 bytes */
 #define ALIGN_SIZE  16
 #define ALIGN(x)    (((x) + (ALIGN_SIZE - 1)) & ~(ALIGN_SIZE - 1))
 
+/* Minimum block must hold the free list links as well as both tags */
+#define MIN_BLOCK_SIZE  ALIGN(BLOCK_OVERHEAD + sizeof(free_links_t))
+
+/*
+ * Size classes: class n holds free blocks with size in [2^(n+4), 2^(n+5)).
+ * 32 classes comfortably cover any heap that fits in the address map.
+ */
+#define NUM_CLASSES         32
+#define CLASS_SCAN_LIMIT    8       /* Max entries tried in the exact class */
+
 /* Heap boundaries - defined in linker script */
 extern char __heap_start[];
 extern char __heap_end[];
 
-/* Head of the block list */
-static block_header_t* heap_head = NULL;
+/* Usable heap range after alignment */
+static char* heap_base = NULL;
+static char* heap_limit = NULL;
 static int heap_initialized = 0;
 
-/* Statistics */
+/* Segregated free lists and non-empty class bitmap */
+static block_header_t* free_lists[NUM_CLASSES];
+static uint32_t free_bitmap = 0;
+
+/* Statistics - maintained incrementally, never recomputed by scanning */
 static size_t total_allocated = 0;
 static size_t total_freed = 0;
+static size_t free_block_bytes = 0;    /* Sum of free block sizes */
+static size_t free_block_count = 0;
+static size_t used_block_bytes = 0;    /* Sum of allocated block sizes */
+static size_t used_block_count = 0;
+
+static inline free_links_t* block_links(block_header_t* block) {
+    return (free_links_t*)((char*)block + HEADER_SIZE);
+}
+
+static inline void set_footer(block_header_t* block) {
+    block_footer_t* footer =
+        (block_footer_t*)((char*)block + block->size - FOOTER_SIZE);
+    footer->size = block->size;
+}
+
+/* Block physically after this one, or NULL at the end of the heap */
+static inline block_header_t* next_block(block_header_t* block) {
+    char* next = (char*)block + block->size;
+    if (next >= heap_limit) return NULL;
+    return (block_header_t*)next;
+}
+
+/* Block physically before this one (found via its footer), or NULL */
+static inline block_header_t* prev_block(block_header_t* block) {
+    if ((char*)block <= heap_base) return NULL;
+    block_footer_t* footer = (block_footer_t*)((char*)block - FOOTER_SIZE);
+    return (block_header_t*)((char*)block - footer->size);
+}
+
+/* Map a block size to its size class */
+static inline int size_class(size_t size) {
+    int c = 63 - __builtin_clzll((uint64_t)size) - 4;
+    if (c < 0) c = 0;
+    if (c >= NUM_CLASSES) c = NUM_CLASSES - 1;
+    return c;
+}
+
+static void freelist_insert(block_header_t* block) {
+    int c = size_class(block->size);
+    free_links_t* links = block_links(block);
+
+    links->prev = NULL;
+    links->next = free_lists[c];
+    if (free_lists[c] != NULL) {
+        block_links(free_lists[c])->prev = block;
+    }
+    free_lists[c] = block;
+    free_bitmap |= (1u << c);
+
+    block->is_free = 1;
+    free_block_bytes += block->size;
+    free_block_count++;
+}
+
+static void freelist_remove(block_header_t* block) {
+    int c = size_class(block->size);
+    free_links_t* links = block_links(block);
+
+    if (links->prev != NULL) {
+        block_links(links->prev)->next = links->next;
+    } else {
+        free_lists[c] = links->next;
+    }
+    if (links->next != NULL) {
+        block_links(links->next)->prev = links->prev;
+    }
+    if (free_lists[c] == NULL) {
+        free_bitmap &= ~(1u << c);
+    }
+
+    block->is_free = 0;
+    free_block_bytes -= block->size;
+    free_block_count--;
+}
 
 /*
  * Initialize the heap with a single large free block
@@ -49,16 +154,72 @@ void heap_init(void) {
     heap_size -= (aligned_start - __heap_start);
     heap_size = heap_size & ~(ALIGN_SIZE - 1);  /* Align size down */
 
+    heap_base = aligned_start;
+    heap_limit = aligned_start + heap_size;
+
+    for (int i = 0; i < NUM_CLASSES; i++) {
+        free_lists[i] = NULL;
+    }
+    free_bitmap = 0;
+
     /* Create initial free block spanning entire heap */
-    heap_head = (block_header_t*)aligned_start;
-    heap_head->size = heap_size;
-    heap_head->next = NULL;
-    heap_head->is_free = 1;
-    heap_head->magic = BLOCK_MAGIC;
+    block_header_t* block = (block_header_t*)aligned_start;
+    block->size = heap_size;
+    block->magic = BLOCK_MAGIC;
+    set_footer(block);
+    freelist_insert(block);
 
     heap_initialized = 1;
 }
 
+/* Find a free block of at least 'need' bytes and unlink it */
+static block_header_t* find_free_block(size_t need) {
+    int c = size_class(need);
+
+    /* Exact class holds mixed sizes - try a few entries first-fit */
+    block_header_t* current = free_lists[c];
+    for (int tries = 0; current != NULL && tries < CLASS_SCAN_LIMIT; tries++) {
+        if (current->size >= need) {
+            freelist_remove(current);
+            return current;
+        }
+        current = block_links(current)->next;
+    }
+
+    /* Any block in a higher class is guaranteed to fit */
+    if (c + 1 >= NUM_CLASSES) return NULL;
+    uint32_t mask = free_bitmap & ~((2u << c) - 1);
+    if (mask == 0) return NULL;
+
+    current = free_lists[__builtin_ctz(mask)];
+    freelist_remove(current);
+    return current;
+}
+
+/* Trim a block down to 'need' bytes, returning the tail to the free lists */
+static void split_block(block_header_t* block, size_t need) {
+    if (block->size < need + MIN_BLOCK_SIZE) return;
+
+    block_header_t* rest = (block_header_t*)((char*)block + need);
+    rest->size = block->size - need;
+    rest->magic = BLOCK_MAGIC;
+    set_footer(rest);
+
+    block->size = need;
+    set_footer(block);
+
+    freelist_insert(rest);
+}
+
+/* Total block size needed for a payload of 'size' bytes */
+static inline size_t block_size_for(size_t size) {
+    size_t total_size = ALIGN(BLOCK_OVERHEAD + size);
+    if (total_size < MIN_BLOCK_SIZE) {
+        total_size = MIN_BLOCK_SIZE;
+    }
+    return total_size;
+}
+
 /*
  * Allocate memory of given size
  * Returns NULL if allocation fails
@@ -67,50 +228,30 @@ void* malloc(size_t size) {
     if (!heap_initialized) heap_init();
     if (size == 0) return NULL;
 
-    /* Calculate total size needed (header + aligned payload) */
-    size_t total_size = ALIGN(HEADER_SIZE + size);
-    if (total_size < MIN_BLOCK_SIZE) {
-        total_size = MIN_BLOCK_SIZE;
-    }
-
-    /* First-fit: find first free block that's big enough */
-    block_header_t* current = heap_head;
+    /* Reject sizes that would overflow the block size computation */
+    if (size > (size_t)(heap_limit - heap_base)) return NULL;
 
-    while (current != NULL) {
-        /* Validate block */
-        if (current->magic != BLOCK_MAGIC) {
-            /* Heap corruption detected! */
-            return NULL;
-        }
-
-        if (current->is_free && current->size >= total_size) {
-            /* Found a suitable block */
-
-            /* Split if block is significantly larger than needed */
-            if (current->size >= total_size + MIN_BLOCK_SIZE) {
-                /* Create new block from remainder */
-                block_header_t* new_block = (block_header_t*)((char*)current + total_size);
-                new_block->size = current->size - total_size;
-                new_block->next = current->next;
-                new_block->is_free = 1;
-                new_block->magic = BLOCK_MAGIC;
+    size_t total_size = block_size_for(size);
 
-                current->size = total_size;
-                current->next = new_block;
-            }
+    block_header_t* block = find_free_block(total_size);
+    if (block == NULL) {
+        /* No suitable block found */
+        return NULL;
+    }
 
-            current->is_free = 0;
-            total_allocated += current->size;
+    if (block->magic != BLOCK_MAGIC) {
+        /* Heap corruption detected! */
+        return NULL;
+    }
 
-            /* Return pointer to payload (after header) */
-            return (void*)((char*)current + HEADER_SIZE);
-        }
+    split_block(block, total_size);
 
-        current = current->next;
-    }
+    total_allocated += block->size;
+    used_block_bytes += block->size;
+    used_block_count++;
 
-    /* No suitable block found */
-    return NULL;
+    /* Return pointer to payload (after header) */
+    return (void*)((char*)block + HEADER_SIZE);
 }
 
 /*
@@ -133,35 +274,29 @@ void free(void* ptr) {
         return;  /* Double free - ignore */
     }
 
-    /* Mark as free */
-    block->is_free = 1;
     total_freed += block->size;
+    used_block_bytes -= block->size;
+    used_block_count--;
 
     /* Coalesce with next block if it's free */
-    if (block->next != NULL && block->next->is_free) {
-        block->size += block->next->size;
-        block->next = block->next->next;
-    }
-
-    /* Coalesce with previous block if it's free */
-    /* Need to find the previous block by walking from head */
-    block_header_t* current = heap_head;
-    while (current != NULL && current->next != NULL) {
-        if (current->is_free && current->next == block) {
-            /* Merge current with block */
-            current->size += block->size;
-            current->next = block->next;
-            break;
-        }
-        /* Also check if current->next is free and adjacent to its next */
-        if (current->next != NULL && current->next->is_free &&
-            current->next->next != NULL && current->next->next == block && block->is_free) {
-            /* Three-way merge */
-            current->next->size += block->size;
-            current->next->next = block->next;
-        }
-        current = current->next;
+    block_header_t* next = next_block(block);
+    if (next != NULL && next->magic == BLOCK_MAGIC && next->is_free) {
+        freelist_remove(next);
+        block->size += next->size;
+        next->magic = 0;
+    }
+
+    /* Coalesce with previous block if it's free (found via boundary tag) */
+    block_header_t* prev = prev_block(block);
+    if (prev != NULL && prev->magic == BLOCK_MAGIC && prev->is_free) {
+        freelist_remove(prev);
+        prev->size += block->size;
+        block->magic = 0;
+        block = prev;
     }
+
+    set_footer(block);
+    freelist_insert(block);
 }
 
 /*
@@ -198,17 +333,37 @@ void* realloc(void* ptr, size_t size) {
     block_header_t* block = (block_header_t*)((char*)ptr - HEADER_SIZE);
 
     /* Validate */
-    if (block->magic != BLOCK_MAGIC) {
+    if (block->magic != BLOCK_MAGIC || block->is_free) {
+        return NULL;
+    }
+    if (size > (size_t)(heap_limit - heap_base)) {
         return NULL;
     }
 
-    size_t current_payload = block->size - HEADER_SIZE;
+    size_t current_payload = block->size - BLOCK_OVERHEAD;
 
     /* If new size fits in current block, return same pointer */
     if (size <= current_payload) {
         return ptr;
     }
 
+    /* Try to grow in place by absorbing a free next neighbour */
+    size_t need = block_size_for(size);
+    block_header_t* next = next_block(block);
+    if (next != NULL && next->magic == BLOCK_MAGIC && next->is_free &&
+        block->size + next->size >= need) {
+        freelist_remove(next);
+        used_block_bytes -= block->size;
+        total_allocated -= block->size;
+        block->size += next->size;
+        next->magic = 0;
+        set_footer(block);
+        split_block(block, need);
+        used_block_bytes += block->size;
+        total_allocated += block->size;
+        return ptr;
+    }
+
     /* Need to allocate new block */
     void* new_ptr = malloc(size);
     if (new_ptr != NULL) {
@@ -218,12 +373,210 @@ void* realloc(void* ptr, size_t size) {
     return new_ptr;
 }
 
+/*
+ * Get total free bytes in heap
+ */
+size_t heap_free_bytes(void) {
+    if (!heap_initialized) heap_init();
+    return free_block_bytes - free_block_count * BLOCK_OVERHEAD;
+}
+
+/*
+ * Get total used bytes in heap
+ */
+size_t heap_used_bytes(void) {
+    if (!heap_initialized) heap_init();
+    return used_block_bytes - used_block_count * BLOCK_OVERHEAD;
+}
+
+/*
+ * Memory utilities
+ *
+ * On ARM64 the bulk of each operation runs as NEON LDP/STP loops on
+ * 16-byte aligned addresses, with byte loops for the unaligned head and
+ * tail. Wide accesses are only used when source and destination share
+ * alignment: the kernel can run with the MMU off, where all memory is
+ * Device type and unaligned accesses fault.
+ */
+
+#define WIDE_MIN        64      /* Below this, just copy bytes */
+#define LARGE_COPY_SIZE 4096    /* Page-sized blocks use the prefetch loop */
+
+#define CO_ALIGNED(a, b, n) \
+    ((((uintptr_t)(a) ^ (uintptr_t)(b)) & ((n) - 1)) == 0)
+
+#ifdef __aarch64__
+
+/* Byte copy forward, any alignment */
+static inline void copy_bytes_fwd(unsigned char* d, const unsigned char* s,
+                                  size_t n) {
+    if (n == 0) return;
+    __asm__ volatile(
+        "1: ldrb w3, [%1], #1\n"
+        "   subs %2, %2, #1\n"
+        "   strb w3, [%0], #1\n"
+        "   b.ne 1b\n"
+        : "+r"(d), "+r"(s), "+r"(n)
+        :
+        : "x3", "cc", "memory");
+}
+
+/* Byte copy backward from the ends of both ranges */
+static inline void copy_bytes_bwd(unsigned char* d_end,
+                                  const unsigned char* s_end, size_t n) {
+    if (n == 0) return;
+    __asm__ volatile(
+        "1: ldrb w3, [%1, #-1]!\n"
+        "   subs %2, %2, #1\n"
+        "   strb w3, [%0, #-1]!\n"
+        "   b.ne 1b\n"
+        : "+r"(d_end), "+r"(s_end), "+r"(n)
+        :
+        : "x3", "cc", "memory");
+}
+
+/*
+ * Forward copy with both pointers 16-byte aligned. Copies the largest
+ * multiple of 16 bytes and returns the number of bytes left over.
+ */
+static size_t copy_wide_fwd(unsigned char** dp, const unsigned char** sp,
+                            size_t n) {
+    unsigned char* d = *dp;
+    const unsigned char* s = *sp;
+
+    if (n >= LARGE_COPY_SIZE) {
+        /* 128 bytes per iteration, streaming prefetch well ahead */
+        __asm__ volatile(
+            "1: prfm pldl1strm, [%1, #512]\n"
+            "   ldp q0, q1, [%1]\n"
+            "   ldp q2, q3, [%1, #32]\n"
+            "   ldp q4, q5, [%1, #64]\n"
+            "   ldp q6, q7, [%1, #96]\n"
+            "   add %1, %1, #128\n"
+            "   sub %2, %2, #128\n"
+            "   stp q0, q1, [%0]\n"
+            "   stp q2, q3, [%0, #32]\n"
+            "   stp q4, q5, [%0, #64]\n"
+            "   stp q6, q7, [%0, #96]\n"
+            "   add %0, %0, #128\n"
+            "   cmp %2, #128\n"
+            "   b.hs 1b\n"
+            : "+r"(d), "+r"(s), "+r"(n)
+            :
+            : "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "cc",
+              "memory");
+    }
+    if (n >= 64) {
+        __asm__ volatile(
+            "1: ldp q0, q1, [%1], #32\n"
+            "   ldp q2, q3, [%1], #32\n"
+            "   sub %2, %2, #64\n"
+            "   stp q0, q1, [%0], #32\n"
+            "   stp q2, q3, [%0], #32\n"
+            "   cmp %2, #64\n"
+            "   b.hs 1b\n"
+            : "+r"(d), "+r"(s), "+r"(n)
+            :
+            : "v0", "v1", "v2", "v3", "cc", "memory");
+    }
+    if (n >= 16) {
+        __asm__ volatile(
+            "1: ldr q0, [%1], #16\n"
+            "   sub %2, %2, #16\n"
+            "   str q0, [%0], #16\n"
+            "   cmp %2, #16\n"
+            "   b.hs 1b\n"
+            : "+r"(d), "+r"(s), "+r"(n)
+            :
+            : "v0", "cc", "memory");
+    }
+
+    *dp = d;
+    *sp = s;
+    return n;
+}
+
+/*
+ * Backward copy with both end pointers 16-byte aligned. All loads of an
+ * iteration complete before its stores, so dest > src overlap is safe.
+ */
+static size_t copy_wide_bwd(unsigned char** dp, const unsigned char** sp,
+                            size_t n) {
+    unsigned char* d = *dp;
+    const unsigned char* s = *sp;
+
+    if (n >= 64) {
+        __asm__ volatile(
+            "1: ldp q0, q1, [%1, #-32]!\n"
+            "   ldp q2, q3, [%1, #-32]!\n"
+            "   sub %2, %2, #64\n"
+            "   stp q0, q1, [%0, #-32]!\n"
+            "   stp q2, q3, [%0, #-32]!\n"
+            "   cmp %2, #64\n"
+            "   b.hs 1b\n"
+            : "+r"(d), "+r"(s), "+r"(n)
+            :
+            : "v0", "v1", "v2", "v3", "cc", "memory");
+    }
+    if (n >= 16) {
+        __asm__ volatile(
+            "1: ldr q0, [%1, #-16]!\n"
+            "   sub %2, %2, #16\n"
+            "   str q0, [%0, #-16]!\n"
+            "   cmp %2, #16\n"
+            "   b.hs 1b\n"
+            : "+r"(d), "+r"(s), "+r"(n)
+            :
+            : "v0", "cc", "memory");
+    }
+
+    *dp = d;
+    *sp = s;
+    return n;
+}
+
 /*
  * Fill memory with a value
  */
 void* memset(void* ptr, int value, size_t num) {
     unsigned char* p = (unsigned char*)ptr;
     unsigned char v = (unsigned char)value;
+
+    if (num >= WIDE_MIN) {
+        /* Head: bytes up to 16-byte alignment */
+        while ((uintptr_t)p & 15) {
+            *p++ = v;
+            num--;
+        }
+
+        uint32_t w = v;
+        __asm__ volatile(
+            "   dup v0.16b, %w2\n"
+            "   mov v1.16b, v0.16b\n"
+            "   cmp %1, #128\n"
+            "   b.lo 2f\n"
+            /* Large blocks: 128 bytes per iteration */
+            "1: stp q0, q1, [%0]\n"
+            "   stp q0, q1, [%0, #32]\n"
+            "   stp q0, q1, [%0, #64]\n"
+            "   stp q0, q1, [%0, #96]\n"
+            "   add %0, %0, #128\n"
+            "   sub %1, %1, #128\n"
+            "   cmp %1, #128\n"
+            "   b.hs 1b\n"
+            "2: cmp %1, #16\n"
+            "   b.lo 4f\n"
+            "3: str q0, [%0], #16\n"
+            "   sub %1, %1, #16\n"
+            "   cmp %1, #16\n"
+            "   b.hs 3b\n"
+            "4:\n"
+            : "+r"(p), "+r"(num)
+            : "r"(w)
+            : "v0", "v1", "cc", "memory");
+    }
+
+    /* Tail */
     for (size_t i = 0; i < num; i++) {
         p[i] = v;
     }
@@ -236,46 +589,121 @@ void* memset(void* ptr, int value, size_t num) {
 void* memcpy(void* dest, const void* src, size_t num) {
     unsigned char* d = (unsigned char*)dest;
     const unsigned char* s = (const unsigned char*)src;
-    for (size_t i = 0; i < num; i++) {
-        d[i] = s[i];
+
+    if (num >= WIDE_MIN && CO_ALIGNED(d, s, 16)) {
+        /* Head: bytes up to 16-byte alignment */
+        size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+        copy_bytes_fwd(d, s, head);
+        d += head;
+        s += head;
+        num = copy_wide_fwd(&d, &s, num - head);
     }
+
+    /* Tail (or the whole copy when pointers don't share alignment) */
+    copy_bytes_fwd(d, s, num);
     return dest;
 }
 
 /*
- * Get total free bytes in heap
+ * Move memory (handles overlapping regions)
  */
-size_t heap_free_bytes(void) {
-    if (!heap_initialized) heap_init();
+void* memmove(void* dest, const void* src, size_t num) {
+    unsigned char* d = (unsigned char*)dest;
+    const unsigned char* s = (const unsigned char*)src;
 
-    size_t free_bytes = 0;
-    block_header_t* current = heap_head;
+    if (d == s || num == 0) return dest;
 
-    while (current != NULL) {
-        if (current->is_free) {
-            free_bytes += current->size - HEADER_SIZE;
-        }
-        current = current->next;
+    if (d < s || d >= s + num) {
+        /* Copy forward - loads of each chunk precede its stores */
+        return memcpy(dest, src, num);
     }
-    return free_bytes;
+
+    /* Copy backward (handles overlap) */
+    unsigned char* d_end = d + num;
+    const unsigned char* s_end = s + num;
+
+    if (num >= WIDE_MIN && CO_ALIGNED(d_end, s_end, 16)) {
+        /* Tail: bytes down to 16-byte alignment */
+        size_t tail = (uintptr_t)d_end & 15;
+        copy_bytes_bwd(d_end, s_end, tail);
+        d_end -= tail;
+        s_end -= tail;
+        num = copy_wide_bwd(&d_end, &s_end, num - tail);
+    }
+
+    copy_bytes_bwd(d_end, s_end, num);
+    return dest;
 }
 
 /*
- * Get total used bytes in heap
+ * Compare memory
  */
-size_t heap_used_bytes(void) {
-    if (!heap_initialized) heap_init();
+int memcmp(const void* s1, const void* s2, size_t n) {
+    const unsigned char* p1 = (const unsigned char*)s1;
+    const unsigned char* p2 = (const unsigned char*)s2;
+
+    if (n >= 32 && CO_ALIGNED(p1, p2, 8)) {
+        /* Head: bytes up to 8-byte alignment */
+        while ((uintptr_t)p1 & 7) {
+            if (*p1 != *p2) return *p1 - *p2;
+            p1++;
+            p2++;
+            n--;
+        }
 
-    size_t used_bytes = 0;
-    block_header_t* current = heap_head;
+        /* 16 bytes per step; stops on the first differing pair */
+        __asm__ volatile(
+            "   cmp %2, #16\n"
+            "   b.lo 2f\n"
+            "1: ldp x4, x5, [%0]\n"
+            "   ldp x6, x7, [%1]\n"
+            "   cmp x4, x6\n"
+            "   ccmp x5, x7, #0, eq\n"
+            "   b.ne 2f\n"
+            "   add %0, %0, #16\n"
+            "   add %1, %1, #16\n"
+            "   sub %2, %2, #16\n"
+            "   cmp %2, #16\n"
+            "   b.hs 1b\n"
+            "2:\n"
+            : "+r"(p1), "+r"(p2), "+r"(n)
+            :
+            : "x4", "x5", "x6", "x7", "cc", "memory");
+    }
 
-    while (current != NULL) {
-        if (!current->is_free) {
-            used_bytes += current->size - HEADER_SIZE;
+    /* Locate the difference (or finish the tail) byte by byte */
+    for (size_t i = 0; i < n; i++) {
+        if (p1[i] != p2[i]) {
+            return p1[i] - p2[i];
         }
-        current = current->next;
     }
-    return used_bytes;
+    return 0;
+}
+
+#else /* !__aarch64__ */
+
+/*
+ * Fill memory with a value
+ */
+void* memset(void* ptr, int value, size_t num) {
+    unsigned char* p = (unsigned char*)ptr;
+    unsigned char v = (unsigned char)value;
+    for (size_t i = 0; i < num; i++) {
+        p[i] = v;
+    }
+    return ptr;
+}
+
+/*
+ * Copy memory from src to dest
+ */
+void* memcpy(void* dest, const void* src, size_t num) {
+    unsigned char* d = (unsigned char*)dest;
+    const unsigned char* s = (const unsigned char*)src;
+    for (size_t i = 0; i < num; i++) {
+        d[i] = s[i];
+    }
+    return dest;
 }
 
 /*
@@ -313,3 +741,5 @@ int memcmp(const void* s1, const void* s2, size_t n) {
     }
     return 0;
 }
+
+#endif /* __aarch64__ */
@@ -0,0 +1,135 @@
+/*
+ * TinyOS MMU setup
+ *
+ * One level-1 table maps the low 512GB in 1GB blocks; the RAM gigabyte
+ * is split into 2MB blocks by a level-2 table so the DMA window can get
+ * non-cacheable attributes.
+ */
+
+#include "mmu.h"
+
+/* MAIR_EL1 attribute indices */
+#define MT_DEVICE_nGnRE     0
+#define MT_NORMAL           1
+#define MT_NORMAL_NC        2
+
+#define MAIR_VALUE  ((0x04ULL << (8 * MT_DEVICE_nGnRE)) | \
+                     (0xFFULL << (8 * MT_NORMAL)) |       \
+                     (0x44ULL << (8 * MT_NORMAL_NC)))
+
+/* Descriptor bits */
+#define PTE_TABLE           0x3ULL
+#define PTE_BLOCK           0x1ULL
+#define PTE_ATTRINDX(n)     ((uint64_t)(n) << 2)
+#define PTE_SH_INNER        (3ULL << 8)
+#define PTE_AF              (1ULL << 10)
+#define PTE_PXN             (1ULL << 53)
+#define PTE_UXN             (1ULL << 54)
+
+#define BLOCK_DEVICE    (PTE_BLOCK | PTE_ATTRINDX(MT_DEVICE_nGnRE) | PTE_AF | \
+                         PTE_PXN | PTE_UXN)
+#define BLOCK_NORMAL    (PTE_BLOCK | PTE_ATTRINDX(MT_NORMAL) | PTE_SH_INNER | \
+                         PTE_AF | PTE_UXN)
+#define BLOCK_NORMAL_NC (PTE_BLOCK | PTE_ATTRINDX(MT_NORMAL_NC) | PTE_SH_INNER | \
+                         PTE_AF | PTE_UXN | PTE_PXN)
+
+#define L1_BLOCK_SIZE   0x40000000ULL   /* 1GB */
+#define L2_BLOCK_SIZE   0x00200000ULL   /* 2MB */
+
+/* TCR_EL1: 39-bit VA in TTBR0, 4KB granule, WB WA inner-shareable walks */
+#define TCR_T0SZ        (64 - 39)
+#define TCR_IRGN0_WBWA  (1ULL << 8)
+#define TCR_ORGN0_WBWA  (1ULL << 10)
+#define TCR_SH0_INNER   (3ULL << 12)
+#define TCR_TG0_4K      (0ULL << 14)
+#define TCR_EPD1        (1ULL << 23)    /* No TTBR1 walks */
+#define TCR_IPS_SHIFT   32
+
+#define TCR_VALUE       (TCR_T0SZ | TCR_IRGN0_WBWA | TCR_ORGN0_WBWA | \
+                         TCR_SH0_INNER | TCR_TG0_4K | TCR_EPD1)
+
+/* SCTLR_EL1 bits */
+#define SCTLR_M         (1ULL << 0)
+#define SCTLR_A         (1ULL << 1)
+#define SCTLR_C         (1ULL << 2)
+#define SCTLR_I         (1ULL << 12)
+
+#define CACHE_LINE      64
+
+static uint64_t l1_table[512] __attribute__((aligned(4096)));
+static uint64_t l2_ram[512] __attribute__((aligned(4096)));
+
+void dcache_clean_range(const void* start, size_t size) {
+    uintptr_t p = (uintptr_t)start & ~(uintptr_t)(CACHE_LINE - 1);
+    uintptr_t end = (uintptr_t)start + size;
+    for (; p < end; p += CACHE_LINE) {
+        __asm__ volatile("dc cvac, %0" : : "r"(p) : "memory");
+    }
+    __asm__ volatile("dsb sy" ::: "memory");
+}
+
+void dcache_flush_range(const void* start, size_t size) {
+    uintptr_t p = (uintptr_t)start & ~(uintptr_t)(CACHE_LINE - 1);
+    uintptr_t end = (uintptr_t)start + size;
+    for (; p < end; p += CACHE_LINE) {
+        __asm__ volatile("dc civac, %0" : : "r"(p) : "memory");
+    }
+    __asm__ volatile("dsb sy" ::: "memory");
+}
+
+void mmu_init(void) {
+    for (int i = 0; i < 512; i++) {
+        l1_table[i] = 0;
+    }
+
+    /* First GB: MMIO devices */
+    l1_table[0] = 0 | BLOCK_DEVICE;
+
+    /* Second GB: RAM, with the DMA window uncached */
+    for (int i = 0; i < 512; i++) {
+        uint64_t pa = MMU_RAM_START + (uint64_t)i * L2_BLOCK_SIZE;
+        if (pa >= MMU_DMA_START && pa < MMU_DMA_END) {
+            l2_ram[i] = pa | BLOCK_NORMAL_NC;
+        } else {
+            l2_ram[i] = pa | BLOCK_NORMAL;
+        }
+    }
+    l1_table[MMU_RAM_START / L1_BLOCK_SIZE] = (uint64_t)l2_ram | PTE_TABLE;
+
+    /* For walkers with the MMU off */
+    dcache_clean_range(l1_table, sizeof(l1_table));
+    dcache_clean_range(l2_ram, sizeof(l2_ram));
+
+    mmu_enable();
+}
+
+void mmu_enable(void) {
+    uint64_t mmfr0, sctlr;
+
+    /* IPS = supported physical address range */
+    __asm__ volatile("mrs %0, id_aa64mmfr0_el1" : "=r"(mmfr0));
+    uint64_t tcr = TCR_VALUE | ((mmfr0 & 0x7) << TCR_IPS_SHIFT);
+
+    __asm__ volatile("msr mair_el1, %0" : : "r"((uint64_t)MAIR_VALUE));
+    __asm__ volatile("msr tcr_el1, %0" : : "r"(tcr));
+    __asm__ volatile("msr ttbr0_el1, %0" : : "r"((uint64_t)l1_table));
+    __asm__ volatile("isb");
+
+    /* Drop any stale translations and instructions */
+    __asm__ volatile("tlbi vmalle1\n"
+                     "ic iallu\n"
+                     "dsb nsh\n"
+                     "isb" ::: "memory");
+
+    __asm__ volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+    sctlr &= ~SCTLR_A;
+    __asm__ volatile("msr sctlr_el1, %0\n"
+                     "isb" : : "r"(sctlr) : "memory");
+}
+
+int mmu_is_enabled(void) {
+    uint64_t sctlr;
+    __asm__ volatile("mrs %0, sctlr_el1" : "=r"(sctlr));
+    return (sctlr & SCTLR_M) != 0;
+}
@@ -7,10 +7,12 @@
 #include "virtio_net.h"
 #include "memory.h"
 #include "tcp.h"
+#include "timer.h"
 
-/* Packet buffers */
-static uint8_t rx_buf[2048];
+/* Packet buffers (received frames are parsed in their RX buffer) */
 static uint8_t tx_buf[2048];
+static int rx_current = -1;     /* RX buffer of the frame being processed */
+static int rx_csum_valid = 0;   /* Device validated its transport checksum */
 
 /* Network configuration */
 static net_config_t config = {
@@ -22,21 +24,58 @@ static net_config_t config = {
     .dhcp_state = 0
 };
 
-/* ARP cache */
-#define ARP_CACHE_SIZE 8
-static struct {
+/* Neighbor (ARP) table: entries hashed by IP. Frames for a neighbor
+ * still being resolved wait in a shared pool, a few per neighbor */
+#define ARP_TABLE_SIZE      16
+#define ARP_HASH_SIZE       16      /* Power of two */
+#define ARP_HOLD_FRAMES     8
+#define ARP_HOLD_PER_NEIGH  3
+
+#define ARP_FREE            0
+#define ARP_INCOMPLETE      1       /* Request sent, frames may be held */
+#define ARP_REACHABLE       2
+
+#define ARP_RETRY_MS        1000    /* Between requests */
+#define ARP_MAX_PROBES      3       /* Unanswered requests before giving up */
+#define ARP_REACHABLE_MS    60000   /* Confirmed entries refresh after this */
+#define ARP_STALE_MS        30000   /* ...and are dropped if that fails */
+
+typedef struct {
+    int state;
     uint8_t ip[4];
     uint8_t mac[6];
-    int valid;
-} arp_cache[ARP_CACHE_SIZE];
+    uint32_t confirmed_ms;  /* Last heard from (timer_ms) */
+    uint32_t probe_ms;      /* Next request may go out (timer_ms) */
+    int probes;             /* Requests sent while incomplete */
+    int held;               /* First held frame, -1 if none */
+    int next;               /* Hash chain */
+} arp_entry_t;
+
+static arp_entry_t arp_table[ARP_TABLE_SIZE];
+static int arp_hash[ARP_HASH_SIZE];
+
+static struct {
+    uint8_t data[ETH_HLEN + 1500];
+    uint16_t len;
+    int next;               /* Next frame of the neighbor, or free list */
+} arp_hold[ARP_HOLD_FRAMES];
+static int arp_hold_free = -1;
+
+/* ARP frames have their own buffer so they can go out while a caller is
+ * building a frame in tx_buf */
+static uint8_t arp_buf[ETH_HLEN + sizeof(struct arp_hdr)];
+
+/* Counters for netstat */
+static net_stats_t stats = {0};
 
 /* Ping tracking */
 static ping_status_t ping_status = {0};
 static uint16_t ping_seq = 0;
-static uint32_t ping_sent_time = 0;
+static uint32_t ping_sent_time = 0;     /* timer_ms() at send */
 
-/* Simple tick counter (incremented by net_poll) */
-static uint32_t tick_counter = 0;
+/* DHCP retransmit interval and next deadline */
+#define DHCP_RETRY_MS   3000
+static uint32_t dhcp_retry_ms = 0;
 
 /* DHCP state */
 #define DHCP_IDLE       0
@@ -55,25 +94,98 @@ static void send_dhcp_request(const uint8_t* server_ip);
 static void send_dhcp_discover(void);
 static void handle_dns_response(uint8_t* data, int len);
 
-/* IP checksum calculation */
-static uint16_t ip_checksum(const void* data, int len) {
-    const uint16_t* ptr = (const uint16_t*)data;
-    uint32_t sum = 0;
+/* ==================== Checksums ==================== */
+
+/*
+ * The ones' complement sum is taken over 16-bit words in memory order,
+ * so it needs no byte swapping and the result is stored as is. Bytes up
+ * to 16-byte alignment are summed one at a time; on ARM64 the aligned
+ * body then runs 32 bytes per iteration with NEON widening pairwise adds
+ * (UADALP) into 32-bit lanes.
+ */
 
+#define CSUM_CHUNK  65536   /* Bytes per NEON pass: lanes stay below 2^32 */
+
+static inline uint32_t csum_fold16(uint64_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint32_t)sum;
+}
+
+#ifdef __aarch64__
+/* Sum n bytes (a nonzero multiple of 32, 16-byte aligned) as words */
+static uint64_t csum_wide(const uint8_t* p, size_t n) {
+    uint64_t sum;
+    __asm__ volatile(
+        "movi v2.4s, #0\n"
+        "movi v3.4s, #0\n"
+        "1: ld1 {v0.8h, v1.8h}, [%1], #32\n"
+        "   subs %2, %2, #32\n"
+        "   uadalp v2.4s, v0.8h\n"
+        "   uadalp v3.4s, v1.8h\n"
+        "   b.ne 1b\n"
+        "uaddl v4.2d, v2.2s, v3.2s\n"
+        "uaddl2 v5.2d, v2.4s, v3.4s\n"
+        "add v4.2d, v4.2d, v5.2d\n"
+        "addp d4, v4.2d\n"
+        "fmov %0, d4\n"
+        : "=r"(sum), "+r"(p), "+r"(n)
+        :
+        : "v0", "v1", "v2", "v3", "v4", "v5", "cc", "memory");
+    return sum;
+}
+#endif
+
+uint32_t net_csum_add(uint32_t sum, const void* data, int len) {
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t acc = sum;
+    int odd = 0;        /* Next byte is the high half of a word */
+
+    while (len > 0 && ((uintptr_t)p & 15)) {
+        acc += odd ? (uint32_t)*p << 8 : *p;
+        odd ^= 1;
+        p++;
+        len--;
+    }
+
+    /* After an odd head the body's words pair up the other way round;
+     * swapping its folded sum makes up for that */
+    uint64_t body = 0;
+#ifdef __aarch64__
+    while (len >= 32) {
+        int n = (len < CSUM_CHUNK ? len : CSUM_CHUNK) & ~31;
+        body += csum_wide(p, n);
+        p += n;
+        len -= n;
+    }
+#endif
     while (len > 1) {
-        sum += *ptr++;
+        body += *(const uint16_t*)p;
+        p += 2;
         len -= 2;
     }
+    uint32_t b = csum_fold16(body);
+    acc += odd ? ((b & 0xFF) << 8) | (b >> 8) : b;
 
     if (len == 1) {
-        sum += *(const uint8_t*)ptr;
+        acc += odd ? (uint32_t)*p << 8 : *p;
     }
+    return csum_fold16(acc);
+}
 
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
+uint16_t net_csum_fold(uint32_t sum) {
+    return ~csum_fold16(sum);
+}
 
-    return ~sum;
+uint32_t net_csum_pseudo(const struct ip_hdr* ip, uint8_t protocol, int len) {
+    uint32_t sum = net_csum_add(0, ip->src_ip, 8);     /* Source, then dest */
+    return sum + htons(protocol) + htons(len);
+}
+
+/* IP checksum calculation */
+static uint16_t ip_checksum(const void* data, int len) {
+    return net_csum_fold(net_csum_add(0, data, len));
 }
 
 /* Compare IP addresses */
@@ -92,40 +204,188 @@ static void mac_copy(uint8_t* dst, const uint8_t* src) {
     for (int i = 0; i < 6; i++) dst[i] = src[i];
 }
 
-/* ARP cache lookup - exported for TCP */
+/* ==================== Neighbor table ==================== */
+
+static inline int arp_bucket(const uint8_t* ip) {
+    uint32_t h = ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) |
+                 ((uint32_t)ip[2] << 8) | ip[3];
+    return ((h * 0x9E3779B1) >> 16) & (ARP_HASH_SIZE - 1);
+}
+
+static arp_entry_t* arp_find(const uint8_t* ip) {
+    for (int i = arp_hash[arp_bucket(ip)]; i >= 0; i = arp_table[i].next) {
+        if (ip_match(arp_table[i].ip, ip)) return &arp_table[i];
+    }
+    return NULL;
+}
+
+/* Drop an entry and the frames it holds */
+static void arp_remove(arp_entry_t* e) {
+    while (e->held >= 0) {
+        int f = e->held;
+        e->held = arp_hold[f].next;
+        arp_hold[f].next = arp_hold_free;
+        arp_hold_free = f;
+        stats.arp_unresolved++;
+    }
+
+    int idx = e - arp_table;
+    int* link = &arp_hash[arp_bucket(e->ip)];
+    while (*link != idx) link = &arp_table[*link].next;
+    *link = e->next;
+    e->state = ARP_FREE;
+}
+
+/* New entry for ip: a free slot, else the longest-silent resolved entry.
+ * NULL if every entry is mid-resolution (those expire in arp_age) */
+static arp_entry_t* arp_create(const uint8_t* ip) {
+    arp_entry_t* e = NULL;
+    for (int i = 0; i < ARP_TABLE_SIZE; i++) {
+        arp_entry_t* c = &arp_table[i];
+        if (c->state == ARP_FREE) {
+            e = c;
+            break;
+        }
+        if (c->state == ARP_REACHABLE &&
+            (!e || (int32_t)(c->confirmed_ms - e->confirmed_ms) < 0)) {
+            e = c;
+        }
+    }
+    if (!e) return NULL;
+    if (e->state != ARP_FREE) arp_remove(e);
+
+    memset(e, 0, sizeof(arp_entry_t));
+    ip_copy(e->ip, ip);
+    e->held = -1;
+    int b = arp_bucket(ip);
+    e->next = arp_hash[b];
+    arp_hash[b] = e - arp_table;
+    return e;
+}
+
+/* Send a request now if the entry is due one */
+static void arp_probe(arp_entry_t* e) {
+    if (!timer_expired(e->probe_ms)) return;
+    net_send_arp_request(e->ip);
+    e->probes++;
+    e->probe_ms = timer_ms() + ARP_RETRY_MS;
+}
+
+/* Neighbor lookup - exported for TCP. A miss starts resolution; an entry
+ * past ARP_REACHABLE_MS is still used while it is refreshed */
 int net_arp_lookup(const uint8_t* ip, uint8_t* mac_out) {
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (arp_cache[i].valid && ip_match(arp_cache[i].ip, ip)) {
-            mac_copy(mac_out, arp_cache[i].mac);
-            return 1;
+    arp_entry_t* e = arp_find(ip);
+    if (!e || e->state != ARP_REACHABLE) {
+        stats.arp_miss++;
+        if (!e && (e = arp_create(ip)) != NULL) {
+            e->state = ARP_INCOMPLETE;
+            arp_probe(e);
         }
+        return 0;
+    }
+
+    if (timer_ms() - e->confirmed_ms > ARP_REACHABLE_MS) {
+        arp_probe(e);
+    }
+    mac_copy(mac_out, e->mac);
+    return 1;
+}
+
+int net_arp_hold(const uint8_t* ip, const void* frame, int len) {
+    arp_entry_t* e = arp_find(ip);
+    if (!e || e->state != ARP_INCOMPLETE || arp_hold_free < 0 ||
+        len > (int)sizeof(arp_hold[0].data)) {
+        stats.arp_hold_full++;
+        return -1;
+    }
+
+    /* Append, keeping the neighbor's frames in order */
+    int count = 0;
+    int* link = &e->held;
+    while (*link >= 0) {
+        link = &arp_hold[*link].next;
+        count++;
     }
+    if (count >= ARP_HOLD_PER_NEIGH) {
+        stats.arp_hold_full++;
+        return -1;
+    }
+
+    int f = arp_hold_free;
+    arp_hold_free = arp_hold[f].next;
+    memcpy(arp_hold[f].data, frame, len);
+    arp_hold[f].len = len;
+    arp_hold[f].next = -1;
+    *link = f;
+    stats.arp_held++;
     return 0;
 }
 
-/* ARP cache add */
+/* Neighbor learned or confirmed: send the frames waiting for it */
 static void arp_add(const uint8_t* ip, const uint8_t* mac) {
-    /* Check if already exists */
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (arp_cache[i].valid && ip_match(arp_cache[i].ip, ip)) {
-            mac_copy(arp_cache[i].mac, mac);
-            return;
-        }
+    arp_entry_t* e = arp_find(ip);
+    if (!e) {
+        e = arp_create(ip);
+        if (!e) return;
     }
 
-    /* Find empty slot */
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (!arp_cache[i].valid) {
-            ip_copy(arp_cache[i].ip, ip);
-            mac_copy(arp_cache[i].mac, mac);
-            arp_cache[i].valid = 1;
-            return;
+    mac_copy(e->mac, mac);
+    e->state = ARP_REACHABLE;
+    e->confirmed_ms = timer_ms();
+    e->probes = 0;
+
+    while (e->held >= 0) {
+        int f = e->held;
+        mac_copy(arp_hold[f].data, mac);            /* eth->dest */
+        virtio_net_send(arp_hold[f].data, arp_hold[f].len);
+        e->held = arp_hold[f].next;
+        arp_hold[f].next = arp_hold_free;
+        arp_hold_free = f;
+    }
+}
+
+/* Retry unanswered requests, giving up after ARP_MAX_PROBES, and forget
+ * neighbors silent for too long */
+static void arp_age(void) {
+    for (int i = 0; i < ARP_TABLE_SIZE; i++) {
+        arp_entry_t* e = &arp_table[i];
+        if (e->state == ARP_INCOMPLETE) {
+            if (timer_expired(e->probe_ms)) {
+                if (e->probes >= ARP_MAX_PROBES) arp_remove(e);
+                else arp_probe(e);
+            }
+        } else if (e->state == ARP_REACHABLE &&
+                   timer_ms() - e->confirmed_ms > ARP_REACHABLE_MS + ARP_STALE_MS) {
+            arp_remove(e);
         }
     }
+}
 
-    /* Replace first entry if full */
-    ip_copy(arp_cache[0].ip, ip);
-    mac_copy(arp_cache[0].mac, mac);
+static void arp_init(void) {
+    for (int i = 0; i < ARP_HASH_SIZE; i++) {
+        arp_hash[i] = -1;
+    }
+    for (int i = 0; i < ARP_TABLE_SIZE; i++) {
+        arp_table[i].state = ARP_FREE;
+        arp_table[i].held = -1;
+    }
+    arp_hold_free = -1;
+    for (int i = ARP_HOLD_FRAMES - 1; i >= 0; i--) {
+        arp_hold[i].next = arp_hold_free;
+        arp_hold_free = i;
+    }
+}
+
+/* Send an IPv4 frame built in `frame` to next_hop, or hold it until the
+ * neighbor is resolved */
+static void ip_output(const uint8_t* next_hop, uint8_t* frame, int len) {
+    uint8_t mac[6];
+    if (net_arp_lookup(next_hop, mac)) {
+        mac_copy(((struct eth_hdr*)frame)->dest, mac);
+        virtio_net_send(frame, len);
+    } else {
+        net_arp_hold(next_hop, frame, len);
+    }
 }
 
 /* Send ARP request - exported for TCP */
@@ -133,8 +393,8 @@ void net_send_arp_request(const uint8_t* target_ip) {
     net_status_t* ns = virtio_net_get_status();
     if (!ns->available) return;
 
-    struct eth_hdr* eth = (struct eth_hdr*)tx_buf;
-    struct arp_hdr* arp = (struct arp_hdr*)(tx_buf + ETH_HLEN);
+    struct eth_hdr* eth = (struct eth_hdr*)arp_buf;
+    struct arp_hdr* arp = (struct arp_hdr*)(arp_buf + ETH_HLEN);
 
     /* Ethernet header */
     mac_copy(eth->dest, broadcast_mac);
@@ -152,7 +412,8 @@ void net_send_arp_request(const uint8_t* target_ip) {
     memset(arp->target_mac, 0, 6);
     ip_copy(arp->target_ip, target_ip);
 
-    virtio_net_send(tx_buf, ETH_HLEN + sizeof(struct arp_hdr));
+    virtio_net_send(arp_buf, ETH_HLEN + sizeof(struct arp_hdr));
+    stats.arp_requests++;
 }
 
 /* Send ARP reply */
@@ -160,8 +421,8 @@ static void send_arp_reply(const uint8_t* target_mac, const uint8_t* target_ip)
     net_status_t* ns = virtio_net_get_status();
     if (!ns->available) return;
 
-    struct eth_hdr* eth = (struct eth_hdr*)tx_buf;
-    struct arp_hdr* arp = (struct arp_hdr*)(tx_buf + ETH_HLEN);
+    struct eth_hdr* eth = (struct eth_hdr*)arp_buf;
+    struct arp_hdr* arp = (struct arp_hdr*)(arp_buf + ETH_HLEN);
 
     /* Ethernet header */
     mac_copy(eth->dest, target_mac);
@@ -179,7 +440,8 @@ static void send_arp_reply(const uint8_t* target_mac, const uint8_t* target_ip)
     mac_copy(arp->target_mac, target_mac);
     ip_copy(arp->target_ip, target_ip);
 
-    virtio_net_send(tx_buf, ETH_HLEN + sizeof(struct arp_hdr));
+    virtio_net_send(arp_buf, ETH_HLEN + sizeof(struct arp_hdr));
+    stats.arp_replies++;
 }
 
 /* Handle ARP packet */
@@ -247,8 +509,7 @@ static void send_icmp_request(const uint8_t* dest_ip) {
     net_status_t* ns = virtio_net_get_status();
     if (!ns->available || !config.configured) return;
 
-    /* Need MAC address - use gateway for non-local IPs */
-    uint8_t dest_mac[6];
+    /* Use gateway for non-local IPs */
     const uint8_t* target_ip = dest_ip;
 
     /* For simplicity, always go through gateway if configured */
@@ -256,17 +517,11 @@ static void send_icmp_request(const uint8_t* dest_ip) {
         target_ip = config.gateway;
     }
 
-    if (!net_arp_lookup(target_ip, dest_mac)) {
-        net_send_arp_request(target_ip);
-        return;
-    }
-
     struct eth_hdr* eth = (struct eth_hdr*)tx_buf;
     struct ip_hdr* ip = (struct ip_hdr*)(tx_buf + ETH_HLEN);
     struct icmp_hdr* icmp = (struct icmp_hdr*)(tx_buf + ETH_HLEN + 20);
 
-    /* Ethernet */
-    mac_copy(eth->dest, dest_mac);
+    /* Ethernet (destination filled in by ip_output) */
     mac_copy(eth->src, ns->mac);
     eth->ethertype = htons(ETH_P_IP);
 
@@ -296,10 +551,10 @@ static void send_icmp_request(const uint8_t* dest_ip) {
 
     icmp->checksum = ip_checksum(icmp, 8 + 8);
 
-    virtio_net_send(tx_buf, ETH_HLEN + 20 + 8 + 8);
+    ip_output(target_ip, tx_buf, ETH_HLEN + 20 + 8 + 8);
 
     ping_status.sent++;
-    ping_sent_time = tick_counter;
+    ping_sent_time = timer_ms();
 }
 
 /* Handle ICMP packet */
@@ -316,7 +571,7 @@ static void handle_icmp(struct eth_hdr* eth, struct ip_hdr* ip, struct icmp_hdr*
     } else if (icmp->type == ICMP_ECHO_REPLY) {
         /* Got ping response */
         ping_status.received++;
-        ping_status.last_rtt_ms = (tick_counter - ping_sent_time) / 10;  /* Rough estimate */
+        ping_status.last_rtt_ms = timer_ms() - ping_sent_time;
     }
 }
 
@@ -399,36 +654,61 @@ static void handle_udp(struct eth_hdr* eth, struct ip_hdr* ip, struct udp_hdr* u
 
 /* Handle IP packet */
 static void handle_ip(struct eth_hdr* eth, struct ip_hdr* ip, int len) {
-    (void)len;
-    if ((ip->version_ihl >> 4) != 4) return;
-
     int ip_hdr_len = (ip->version_ihl & 0x0F) * 4;
-    if (ip_hdr_len < 20) return;
+    if ((ip->version_ihl >> 4) != 4 || ip_hdr_len < 20) {
+        stats.rx_malformed++;
+        return;
+    }
 
     /* Check if it's for us (or broadcast) */
     if (!ip_match(ip->dest_ip, config.ip) &&
         !ip_match(ip->dest_ip, broadcast_ip)) {
+        stats.rx_not_ours++;
         return;
     }
 
     uint8_t* payload = (uint8_t*)ip + ip_hdr_len;
     int payload_len = ntohs(ip->total_len) - ip_hdr_len;
+    if (payload_len > len - ip_hdr_len) {           /* Truncated */
+        stats.rx_malformed++;
+        return;
+    }
+    stats.ip_rx++;
 
     switch (ip->protocol) {
         case IP_PROTO_ICMP:
-            if (payload_len >= 8) {
-                handle_icmp(eth, ip, (struct icmp_hdr*)payload, payload_len);
+            if (payload_len < 8) {
+                stats.rx_malformed++;
+                break;
             }
+            stats.icmp_rx++;
+            handle_icmp(eth, ip, (struct icmp_hdr*)payload, payload_len);
             break;
         case IP_PROTO_TCP:
-            if (payload_len >= 20) {
-                tcp_handle_packet(eth, ip, (struct tcp_hdr*)payload, payload_len);
+            if (payload_len < 20) {
+                stats.rx_malformed++;
+                break;
+            }
+            /* Verify the checksum unless the device already has */
+            if (!rx_csum_valid &&
+                net_csum_fold(net_csum_add(net_csum_pseudo(ip, IP_PROTO_TCP, payload_len),
+                                           payload, payload_len)) != 0) {
+                stats.rx_bad_csum++;
+                break;
             }
+            stats.tcp_rx++;
+            tcp_handle_packet(eth, ip, (struct tcp_hdr*)payload, payload_len);
             break;
         case IP_PROTO_UDP:
-            if (payload_len >= 8) {
-                handle_udp(eth, ip, (struct udp_hdr*)payload, payload_len);
+            if (payload_len < 8) {
+                stats.rx_malformed++;
+                break;
             }
+            stats.udp_rx++;
+            handle_udp(eth, ip, (struct udp_hdr*)payload, payload_len);
+            break;
+        default:
+            stats.rx_unknown++;
             break;
     }
 }
@@ -561,30 +841,39 @@ static void send_dhcp_request(const uint8_t* server_ip) {
 
 /* Process received packet */
 static void process_packet(uint8_t* pkt, int len) {
-    if (len < ETH_HLEN) return;
+    if (len < ETH_HLEN) {
+        stats.rx_malformed++;
+        return;
+    }
 
     struct eth_hdr* eth = (struct eth_hdr*)pkt;
     uint16_t ethertype = ntohs(eth->ethertype);
 
     switch (ethertype) {
         case ETH_P_ARP:
-            if ((uint32_t)len >= ETH_HLEN + sizeof(struct arp_hdr)) {
-                handle_arp((struct arp_hdr*)(pkt + ETH_HLEN));
+            if ((uint32_t)len < ETH_HLEN + sizeof(struct arp_hdr)) {
+                stats.rx_malformed++;
+                break;
             }
+            stats.arp_rx++;
+            handle_arp((struct arp_hdr*)(pkt + ETH_HLEN));
             break;
         case ETH_P_IP:
-            if (len >= ETH_HLEN + 20) {
-                handle_ip(eth, (struct ip_hdr*)(pkt + ETH_HLEN), len - ETH_HLEN);
+            if (len < ETH_HLEN + 20) {
+                stats.rx_malformed++;
+                break;
             }
+            handle_ip(eth, (struct ip_hdr*)(pkt + ETH_HLEN), len - ETH_HLEN);
+            break;
+        default:
+            stats.rx_unknown++;
             break;
     }
 }
 
 void net_init(void) {
     /* Clear state */
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        arp_cache[i].valid = 0;
-    }
+    arp_init();
     ping_status.sent = 0;
     ping_status.received = 0;
 
@@ -595,27 +884,49 @@ void net_init(void) {
     tcp_init();
 }
 
-void net_poll(void) {
-    tick_counter++;
-
-    if (!virtio_net_available()) return;
+int net_poll(void) {
+    if (!virtio_net_available()) return 0;
 
     virtio_net_poll();
 
-    int len = virtio_net_recv(rx_buf, sizeof(rx_buf));
-    if (len > 0) {
-        process_packet(rx_buf, len);
+    /* Drain up to a budget of frames, then refill the ring with one notify */
+    net_rxbuf_t rx;
+    for (int n = 0; n < NET_RX_BUDGET && virtio_net_rx_take(&rx); n++) {
+        rx_current = rx.id;
+        rx_csum_valid = rx.csum_valid;
+        process_packet(rx.data, rx.len);
+        rx_current = -1;
+        virtio_net_rx_release(rx.id);
     }
+    virtio_net_rx_refill();
+    virtio_net_tx_kick();       /* In case a burst was left unkicked */
 
-    /* Poll TCP for timeouts/retransmissions */
+    /* Poll TCP for timeouts/retransmissions, ARP for unanswered requests */
     tcp_poll();
+    arp_age();
 
-    /* Start DHCP if not configured - retry every 30000 ticks */
+    /* Start DHCP if not configured - retry every DHCP_RETRY_MS */
     if (!config.configured && config.dhcp_state != DHCP_CONFIGURED) {
-        if (config.dhcp_state == DHCP_IDLE || (tick_counter % 30000) == 0) {
+        if (config.dhcp_state == DHCP_IDLE || timer_expired(dhcp_retry_ms)) {
             send_dhcp_discover();
+            dhcp_retry_ms = timer_ms() + DHCP_RETRY_MS;
         }
     }
+
+    return virtio_net_rx_pending();
+}
+
+int net_rx_hold(void) {
+    if (rx_current < 0 || virtio_net_rx_hold(rx_current) != 0) return -1;
+    return rx_current;
+}
+
+int net_rx_hold_room(void) {
+    return virtio_net_rx_hold_room();
+}
+
+void net_rx_release(int handle) {
+    if (handle >= 0) virtio_net_rx_release(handle);
 }
 
 net_config_t* net_get_config(void) {
@@ -626,6 +937,19 @@ ping_status_t* net_get_ping_status(void) {
     return &ping_status;
 }
 
+net_stats_t* net_get_stats(void) {
+    return &stats;
+}
+
+void net_hist_add(net_hist_t* h, uint32_t value) {
+    int b = value ? 32 - __builtin_clz(value) : 0;
+    if (b >= NET_HIST_BUCKETS) b = NET_HIST_BUCKETS - 1;
+    h->count[b]++;
+    h->samples++;
+    h->sum += value;
+    if (value > h->max) h->max = value;
+}
+
 void net_ping_gateway(void) {
     if (config.configured && config.gateway[0] != 0) {
         send_icmp_request(config.gateway);
@@ -664,6 +988,17 @@ void net_mac_to_str(const uint8_t* mac, char* buf) {
 static dns_query_t* active_dns_query = NULL;
 static uint16_t dns_query_id_counter = 1;
 
+/* Answer cache */
+typedef struct {
+    int valid;
+    int negative;            /* Name has no A record */
+    char name[64];
+    uint8_t ip[4];
+    uint32_t expires_ms;     /* timer_ms deadline */
+} dns_cache_entry_t;
+
+static dns_cache_entry_t dns_cache[DNS_CACHE_SIZE];
+
 /* Send generic UDP packet */
 void net_send_udp(const uint8_t* dest_ip, uint16_t src_port, uint16_t dest_port,
                   const void* data, int len) {
@@ -677,15 +1012,7 @@ void net_send_udp(const uint8_t* dest_ip, uint16_t src_port, uint16_t dest_port,
     struct udp_hdr* udp = (struct udp_hdr*)(tx_buf + ETH_HLEN + 20);
     uint8_t* payload = tx_buf + ETH_HLEN + 20 + 8;
 
-    /* Get gateway MAC */
-    uint8_t dest_mac[6];
-    if (!net_arp_lookup(config.gateway, dest_mac)) {
-        net_send_arp_request(config.gateway);
-        return;
-    }
-
-    /* Ethernet */
-    mac_copy(eth->dest, dest_mac);
+    /* Ethernet (destination: the gateway, filled in by ip_output) */
     mac_copy(eth->src, ns->mac);
     eth->ethertype = htons(ETH_P_IP);
 
@@ -712,7 +1039,7 @@ void net_send_udp(const uint8_t* dest_ip, uint16_t src_port, uint16_t dest_port,
     /* Payload */
     memcpy(payload, data, len);
 
-    virtio_net_send(tx_buf, ETH_HLEN + total_len);
+    ip_output(config.gateway, tx_buf, ETH_HLEN + total_len);
 }
 
 /* Build DNS query packet */
@@ -753,12 +1080,60 @@ static int build_dns_query(uint8_t* buf, uint16_t id, const char* hostname) {
     return p - buf;
 }
 
-/* Start DNS resolution */
+/* Host names compare without regard to case */
+static int dns_name_match(const char* a, const char* b) {
+    for (;; a++, b++) {
+        char ca = (*a >= 'A' && *a <= 'Z') ? *a + 32 : *a;
+        char cb = (*b >= 'A' && *b <= 'Z') ? *b + 32 : *b;
+        if (ca != cb) return 0;
+        if (ca == 0) return 1;
+    }
+}
+
+static dns_cache_entry_t* dns_cache_find(const char* name) {
+    for (int i = 0; i < DNS_CACHE_SIZE; i++) {
+        dns_cache_entry_t* e = &dns_cache[i];
+        if (!e->valid) continue;
+        if (timer_expired(e->expires_ms)) {
+            e->valid = 0;
+            continue;
+        }
+        if (dns_name_match(e->name, name)) return e;
+    }
+    return NULL;
+}
+
+/* Remember an answer (ip) or a failure (NULL) for ttl_ms, replacing the
+ * name's entry, else a free one, else the one expiring first */
+static void dns_cache_add(const char* name, const uint8_t* ip, uint32_t ttl_ms) {
+    if (ttl_ms == 0) return;
+    if (ttl_ms > DNS_MAX_TTL_MS) ttl_ms = DNS_MAX_TTL_MS;
+
+    dns_cache_entry_t* e = dns_cache_find(name);
+    for (int i = 0; !e && i < DNS_CACHE_SIZE; i++) {
+        if (!dns_cache[i].valid) e = &dns_cache[i];
+    }
+    for (int i = 0; !e && i < DNS_CACHE_SIZE; i++) {
+        if (i == 0 || (int32_t)(dns_cache[i].expires_ms - e->expires_ms) < 0) {
+            e = &dns_cache[i];
+        }
+    }
+
+    int i;
+    for (i = 0; i < 63 && name[i]; i++) e->name[i] = name[i];
+    e->name[i] = 0;
+    e->negative = (ip == NULL);
+    if (ip) ip_copy(e->ip, ip);
+    e->expires_ms = timer_ms() + ttl_ms;
+    e->valid = 1;
+}
+
+/* Start DNS resolution. A cached answer completes it at once */
 void dns_resolve_start(dns_query_t* query, const char* hostname) {
     query->state = DNS_STATE_PENDING;
     query->query_id = dns_query_id_counter++;
-    query->timeout_tick = tick_counter + 30000;  /* 30 sec timeout */
-    query->retry_tick = tick_counter + 1000;     /* Retry every 1 sec */
+    query->timeout_ms = timer_ms() + DNS_TIMEOUT_MS;
+    query->retry_ms = timer_ms() + DNS_RETRY_MS;
     memset(query->result_ip, 0, 4);
 
     /* Store hostname for retries */
@@ -768,6 +1143,17 @@ void dns_resolve_start(dns_query_t* query, const char* hostname) {
     }
     query->hostname[i] = 0;
 
+    dns_cache_entry_t* cached = dns_cache_find(query->hostname);
+    if (cached) {
+        if (cached->negative) {
+            query->state = DNS_STATE_ERROR;
+        } else {
+            ip_copy(query->result_ip, cached->ip);
+            query->state = DNS_STATE_DONE;
+        }
+        return;
+    }
+
     /* Build and send DNS query */
     uint8_t dns_buf[256];
     int len = build_dns_query(dns_buf, query->query_id, hostname);
@@ -805,7 +1191,21 @@ static void dns_retry(dns_query_t* query, const char* hostname) {
     net_send_udp(dns_server, 12345, DNS_PORT, dns_buf, len);
 }
 
-/* Handle DNS response in UDP handler */
+/* Step over an encoded name: labels, ended by a zero or a compression
+ * pointer. NULL if it runs past end */
+static uint8_t* dns_skip_name(uint8_t* p, uint8_t* end) {
+    while (p < end) {
+        if (*p == 0) return p + 1;
+        if ((*p & 0xC0) == 0xC0) return p + 2 <= end ? p + 2 : NULL;
+        p += *p + 1;
+    }
+    return NULL;
+}
+
+/* Handle DNS response in UDP handler. The first A record among the
+ * answers (possibly after CNAMEs) is the result, cached for its TTL;
+ * NXDOMAIN and answers without one are cached as failures. Other errors
+ * (SERVFAIL and the like) may be transient and are not cached */
 static void handle_dns_response(uint8_t* data, int len) {
     if (len < 12) return;
     if (!active_dns_query || active_dns_query->state != DNS_STATE_PENDING) return;
@@ -816,63 +1216,73 @@ static void handle_dns_response(uint8_t* data, int len) {
 
     uint16_t flags = (data[2] << 8) | data[3];
     if ((flags & 0x8000) == 0) return;  /* Not a response */
-    if ((flags & 0x000F) != 0) {        /* RCODE error */
+    uint16_t rcode = flags & 0x000F;
+    if (rcode == 3) {                   /* NXDOMAIN */
+        dns_cache_add(active_dns_query->hostname, NULL, DNS_NEG_TTL_MS);
         active_dns_query->state = DNS_STATE_ERROR;
         return;
     }
-
-    uint16_t ancount = (data[6] << 8) | data[7];
-    if (ancount == 0) {
+    if (rcode != 0) {
         active_dns_query->state = DNS_STATE_ERROR;
         return;
     }
 
-    /* Skip question section - find answer */
+    uint16_t qdcount = (data[4] << 8) | data[5];
+    uint16_t ancount = (data[6] << 8) | data[7];
     uint8_t* p = data + 12;
     uint8_t* end = data + len;
 
-    /* Skip QNAME */
-    while (p < end && *p != 0) {
-        if ((*p & 0xC0) == 0xC0) { p += 2; break; }
-        p += *p + 1;
-    }
-    if (p < end && *p == 0) p++;
-    p += 4;  /* Skip QTYPE and QCLASS */
-
-    /* Parse first answer */
-    if (p + 12 > end) return;
-
-    /* Skip NAME (might be pointer) */
-    if ((*p & 0xC0) == 0xC0) p += 2;
-    else {
-        while (p < end && *p != 0) p += *p + 1;
-        if (p < end && *p == 0) p++;
+    /* Skip question section */
+    for (int q = 0; q < qdcount && p; q++) {
+        p = dns_skip_name(p, end);
+        if (p) p += 4;                  /* QTYPE and QCLASS */
     }
 
-    if (p + 10 > end) return;
+    /* Walk the answers for an A record */
+    for (int a = 0; a < ancount && p; a++) {
+        p = dns_skip_name(p, end);
+        if (!p || p + 10 > end) {
+            p = NULL;               /* Truncated */
+            break;
+        }
 
-    uint16_t atype = (p[0] << 8) | p[1];
-    uint16_t rdlen = (p[8] << 8) | p[9];
-    p += 10;  /* Skip TYPE, CLASS, TTL, RDLEN headers */
+        uint16_t atype = (p[0] << 8) | p[1];
+        uint16_t aclass = (p[2] << 8) | p[3];
+        uint32_t ttl = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) |
+                       ((uint32_t)p[6] << 8) | p[7];
+        uint16_t rdlen = (p[8] << 8) | p[9];
+        p += 10;  /* Skip TYPE, CLASS, TTL, RDLEN headers */
+        if (p + rdlen > end) {
+            p = NULL;
+            break;
+        }
 
-    if (atype == 1 && rdlen == 4 && p + 4 <= end) {
-        /* A record - IPv4 address */
-        memcpy(active_dns_query->result_ip, p, 4);
-        active_dns_query->state = DNS_STATE_DONE;
-    } else {
-        active_dns_query->state = DNS_STATE_ERROR;
+        if (atype == 1 && aclass == 1 && rdlen == 4) {
+            /* A record - IPv4 address */
+            memcpy(active_dns_query->result_ip, p, 4);
+            active_dns_query->state = DNS_STATE_DONE;
+            if (ttl > DNS_MAX_TTL_MS / 1000) ttl = DNS_MAX_TTL_MS / 1000;
+            dns_cache_add(active_dns_query->hostname, p, ttl * 1000);
+            return;
+        }
+        p += rdlen;
     }
+
+    /* NOERROR without an address. SOA minimums in the authority section
+     * aren't read; such failures are remembered for a fixed time */
+    if (p) dns_cache_add(active_dns_query->hostname, NULL, DNS_NEG_TTL_MS);
+    active_dns_query->state = DNS_STATE_ERROR;
 }
 
 /* Poll DNS resolution status */
 int dns_resolve_poll(dns_query_t* query) {
     if (query->state == DNS_STATE_PENDING) {
-        if (tick_counter > query->timeout_tick) {
+        if (timer_expired(query->timeout_ms)) {
             query->state = DNS_STATE_ERROR;
-        } else if (tick_counter > query->retry_tick) {
+        } else if (timer_expired(query->retry_ms)) {
             /* Retry DNS query */
             dns_retry(query, query->hostname);
-            query->retry_tick = tick_counter + 500;
+            query->retry_ms = timer_ms() + DNS_RETRY_MS;
         }
     }
     return query->state;
@@ -0,0 +1,140 @@
+/*
+ * TinyOS Packet Capture
+ *
+ * The virtio-net driver hands every frame it queues or takes to
+ * pcap_record(), which copies up to PCAP_SNAPLEN bytes and the counter
+ * timestamp into a ring allocated by pcap_start(). The ring overwrites
+ * its oldest frames, so a long capture keeps the most recent ones.
+ * pcap_save() converts timestamps and writes the classic libpcap file
+ * format that tcpdump and Wireshark read.
+ *
+ * Everything runs from net_poll() and the shell on one task, so the
+ * ring needs no locking.
+ */
+
+#include "pcap.h"
+#include "timer.h"
+#include "fs.h"
+#include "memory.h"
+
+/* libpcap file format */
+#define PCAP_MAGIC          0xa1b2c3d4  /* Microsecond timestamps */
+#define PCAP_VERSION_MAJOR  2
+#define PCAP_VERSION_MINOR  4
+#define PCAP_LINKTYPE_ETH   1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} __attribute__((packed)) pcap_file_hdr_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} __attribute__((packed)) pcap_rec_hdr_t;
+
+/* One captured frame */
+typedef struct {
+    uint64_t stamp;             /* timer_counter() */
+    uint16_t len;               /* On the wire */
+    uint16_t caplen;            /* Kept, up to PCAP_SNAPLEN */
+    uint8_t data[PCAP_SNAPLEN];
+} pcap_frame_t;
+
+static pcap_frame_t* ring = NULL;
+static uint32_t ring_size = 0;
+static uint32_t frame_count = 0;
+static int running = 0;
+
+int pcap_start(int frames) {
+    if (frames <= 0) frames = PCAP_DEFAULT_FRAMES;
+    if (frames > PCAP_MAX_FRAMES) frames = PCAP_MAX_FRAMES;
+
+    running = 0;
+    free(ring);
+    ring = malloc(frames * sizeof(pcap_frame_t));
+    if (!ring) {
+        ring_size = 0;
+        return -1;
+    }
+
+    ring_size = frames;
+    frame_count = 0;
+    running = 1;
+    return 0;
+}
+
+void pcap_stop(void) {
+    running = 0;
+}
+
+int pcap_running(void) {
+    return running;
+}
+
+void pcap_record(const void* frame, uint32_t len) {
+    if (!running) return;
+
+    pcap_frame_t* f = &ring[frame_count % ring_size];
+    f->stamp = timer_counter();
+    f->len = len;
+    f->caplen = len < PCAP_SNAPLEN ? len : PCAP_SNAPLEN;
+    memcpy(f->data, frame, f->caplen);
+    frame_count++;
+}
+
+uint32_t pcap_frames(void) {
+    return frame_count;
+}
+
+uint32_t pcap_kept(void) {
+    return frame_count < ring_size ? frame_count : ring_size;
+}
+
+int pcap_save(const char* path) {
+    if (!ring) return -1;
+
+    int fd = fs_open(path, FS_O_WRITE | FS_O_CREATE | FS_O_TRUNC);
+    if (fd < 0) return -1;
+
+    pcap_file_hdr_t fh = {
+        PCAP_MAGIC, PCAP_VERSION_MAJOR, PCAP_VERSION_MINOR,
+        0, 0, PCAP_SNAPLEN, PCAP_LINKTYPE_ETH
+    };
+    if (fs_write(fd, &fh, sizeof(fh)) != (int)sizeof(fh)) {
+        fs_close(fd);
+        return -1;
+    }
+
+    /* Oldest first; header and data go out in one write */
+    uint32_t n = pcap_kept();
+    uint32_t first = frame_count - n;
+    uint32_t freq = timer_freq();
+    uint8_t rec[sizeof(pcap_rec_hdr_t) + PCAP_SNAPLEN];
+    pcap_rec_hdr_t* rh = (pcap_rec_hdr_t*)rec;
+
+    for (uint32_t i = 0; i < n; i++) {
+        const pcap_frame_t* f = &ring[(first + i) % ring_size];
+        rh->ts_sec = f->stamp / freq;
+        rh->ts_usec = (f->stamp % freq) * 1000000 / freq;
+        rh->incl_len = f->caplen;
+        rh->orig_len = f->len;
+        memcpy(rec + sizeof(pcap_rec_hdr_t), f->data, f->caplen);
+
+        int len = sizeof(pcap_rec_hdr_t) + f->caplen;
+        if (fs_write(fd, rec, len) != len) {
+            fs_close(fd);
+            return -1;
+        }
+    }
+
+    if (fs_close(fd) != 0) return -1;
+    return (int)n;
+}
@@ -0,0 +1,286 @@
+/*
+ * TinyOS Sampling Profiler
+ *
+ * A periodic interrupt - PMU event counter 0 counting CPU cycles and
+ * overflowing every period, or the EL1 physical timer when there is no
+ * PMU - records the interrupted PC. ELR_EL1 still holds it while the
+ * handler runs, since IRQs are not nested. The interrupted code's frame
+ * pointer is found two frame records up from prof_irq's (prof_irq, then
+ * irq_handler; vectors.S leaves x29 alone), so the callers come from
+ * the frame chain. That relies on frame pointers, which the -O0 build
+ * keeps.
+ *
+ * Samples go into a fixed ring that overwrites the oldest ones. Reports
+ * resolve PCs with the symbol table the build embeds from kernel64.elf
+ * (tools/gensyms.py, second link pass).
+ *
+ * Counter 0 is used rather than the cycle counter, so bench.c's cycle
+ * measurements are unaffected.
+ */
+
+#include "prof.h"
+#include "gic.h"
+#include "timer.h"
+#include "fs.h"
+#include "memory.h"
+
+/* PMU registers bits */
+#define PMU_EVENT_CPU_CYCLES    0x11
+#define PMU_COUNTER0            (1 << 0)
+#define PMCR_E                  (1 << 0)
+
+/* CNTP_CTL_EL0 bits */
+#define CNTP_CTL_ENABLE         (1 << 0)
+
+/* Frame pointers outside RAM end the stack walk */
+#define RAM_START               0x40000000UL
+#define RAM_END                 0x48000000UL
+
+/* Symbol table from tools/gensyms.py (weak: absent in the first link) */
+extern const uint32_t prof_sym_count __attribute__((weak));
+extern const uint64_t prof_sym_addrs[] __attribute__((weak));
+extern const uint32_t prof_sym_names[] __attribute__((weak));
+extern const char prof_sym_strtab[] __attribute__((weak));
+
+static uint32_t ring[PROF_RING_SIZE][PROF_DEPTH];
+static volatile uint32_t sample_count = 0;
+static volatile int running = 0;
+static int source = PROF_SOURCE_PMU;
+static uint32_t period = 0;         /* Cycles or timer ticks per sample */
+
+/* ==================== Sampling ==================== */
+
+static inline void pmu_arm(void) {
+    /* Overflows (bit 31 -> 32) after `period` cycles */
+    uint64_t start = (uint64_t)(0x100000000ULL - period);
+    __asm__ volatile("msr pmselr_el0, %0; isb; msr pmxevcntr_el0, %1"
+                     : : "r"((uint64_t)0), "r"(start));
+}
+
+static inline void timer_arm(void) {
+    __asm__ volatile("msr cntp_tval_el0, %0" : : "r"((uint64_t)period));
+}
+
+/* fp: prof_irq's frame record, taken there so that whether record() is
+ * inlined doesn't matter */
+static void record(uint64_t* fp) {
+    uint32_t* s = ring[sample_count % PROF_RING_SIZE];
+    uint64_t pc;
+    __asm__ volatile("mrs %0, elr_el1" : "=r"(pc));
+    s[0] = (uint32_t)pc;
+
+    /* prof_irq's frame, then irq_handler's, then the interrupted one */
+    for (int skip = 0; skip < 2 && fp; skip++) {
+        fp = (uint64_t*)fp[0];
+    }
+
+    int depth = 1;
+    while (depth < PROF_DEPTH) {
+        uint64_t addr = (uint64_t)fp;
+        if (addr < RAM_START || addr >= RAM_END || (addr & 0xF)) break;
+        uint64_t lr = fp[1];
+        if (lr < RAM_START || lr >= RAM_END) break;
+        s[depth++] = (uint32_t)(lr - 4);    /* The call, not the return */
+        uint64_t* next = (uint64_t*)fp[0];
+        if (next <= fp) break;              /* Frames grow upwards */
+        fp = next;
+    }
+    while (depth < PROF_DEPTH) s[depth++] = 0;
+
+    sample_count++;
+}
+
+static void prof_irq(uint32_t irq) {
+    (void)irq;
+    if (!running) return;
+    record((uint64_t*)__builtin_frame_address(0));
+    if (source == PROF_SOURCE_PMU) {
+        __asm__ volatile("msr pmovsclr_el0, %0" : : "r"((uint64_t)PMU_COUNTER0));
+        pmu_arm();
+    } else {
+        timer_arm();
+    }
+}
+
+static int pmu_present(void) {
+    uint64_t dfr0;
+    __asm__ volatile("mrs %0, id_aa64dfr0_el1" : "=r"(dfr0));
+    uint32_t pmuver = (dfr0 >> 8) & 0xF;
+    return pmuver != 0 && pmuver != 0xF;
+}
+
+/* Count cycles on counter 0 for 10 ms to size the period (0 = not counting) */
+static uint32_t pmu_calibrate(uint32_t hz) {
+    uint64_t pmcr;
+    __asm__ volatile("mrs %0, pmcr_el0" : "=r"(pmcr));
+    __asm__ volatile("msr pmcr_el0, %0" : : "r"(pmcr | PMCR_E));
+    __asm__ volatile("msr pmselr_el0, %0; isb; msr pmxevtyper_el0, %1"
+                     : : "r"((uint64_t)0), "r"((uint64_t)PMU_EVENT_CPU_CYCLES));
+    __asm__ volatile("msr pmcntenset_el0, %0; isb" : : "r"((uint64_t)PMU_COUNTER0));
+
+    uint64_t c0, c1;
+    uint32_t t0 = timer_ms();
+    __asm__ volatile("isb; mrs %0, pmxevcntr_el0" : "=r"(c0));
+    while (timer_ms() - t0 < 10) { }
+    __asm__ volatile("isb; mrs %0, pmxevcntr_el0" : "=r"(c1));
+
+    uint32_t cycles = (uint32_t)(c1 - c0);
+    return (uint32_t)((uint64_t)cycles * 100 / hz);
+}
+
+int prof_start(int src) {
+    prof_stop();
+    sample_count = 0;
+
+    if (src == PROF_SOURCE_PMU && pmu_present()) {
+        period = pmu_calibrate(PROF_HZ);
+        if (period == 0) src = PROF_SOURCE_TIMER;
+    } else {
+        src = PROF_SOURCE_TIMER;
+    }
+    source = src;
+
+    if (source == PROF_SOURCE_PMU) {
+        gic_register_handler(PROF_PMU_IRQ, prof_irq);
+        gic_set_priority(PROF_PMU_IRQ, 0x80);
+        __asm__ volatile("msr pmovsclr_el0, %0" : : "r"((uint64_t)PMU_COUNTER0));
+        pmu_arm();
+        __asm__ volatile("msr pmintenset_el1, %0; isb" : : "r"((uint64_t)PMU_COUNTER0));
+        running = 1;
+        gic_enable_irq(PROF_PMU_IRQ);
+    } else {
+        period = timer_freq() / PROF_HZ;
+        if (period == 0) return -1;
+        gic_register_handler(PROF_TIMER_IRQ, prof_irq);
+        gic_set_priority(PROF_TIMER_IRQ, 0x80);
+        timer_arm();
+        __asm__ volatile("msr cntp_ctl_el0, %0; isb" : : "r"((uint64_t)CNTP_CTL_ENABLE));
+        running = 1;
+        gic_enable_irq(PROF_TIMER_IRQ);
+    }
+    return source;
+}
+
+void prof_stop(void) {
+    if (!running) return;
+    running = 0;
+    if (source == PROF_SOURCE_PMU) {
+        gic_disable_irq(PROF_PMU_IRQ);
+        __asm__ volatile("msr pmintenclr_el1, %0" : : "r"((uint64_t)PMU_COUNTER0));
+        __asm__ volatile("msr pmcntenclr_el0, %0" : : "r"((uint64_t)PMU_COUNTER0));
+        __asm__ volatile("msr pmovsclr_el0, %0; isb" : : "r"((uint64_t)PMU_COUNTER0));
+    } else {
+        gic_disable_irq(PROF_TIMER_IRQ);
+        __asm__ volatile("msr cntp_ctl_el0, %0; isb" : : "r"((uint64_t)0));
+    }
+}
+
+int prof_running(void) {
+    return running;
+}
+
+uint32_t prof_samples(void) {
+    return sample_count;
+}
+
+/* ==================== Symbols and report ==================== */
+
+static uint32_t sym_count(void) {
+    return &prof_sym_count ? prof_sym_count : 0;
+}
+
+/* Index of the symbol containing addr, or -1 */
+static int sym_find(uint64_t addr) {
+    uint32_t n = sym_count();
+    if (n == 0 || addr < prof_sym_addrs[0]) return -1;
+
+    uint32_t lo = 0, hi = n;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (prof_sym_addrs[mid] <= addr) lo = mid;
+        else hi = mid;
+    }
+    return (int)lo;
+}
+
+static uint32_t kept(void) {
+    return sample_count < PROF_RING_SIZE ? sample_count : PROF_RING_SIZE;
+}
+
+int prof_report(prof_entry_t* out, int max) {
+    uint32_t n = kept();
+    uint32_t syms = sym_count();
+    if (n == 0 || max <= 0) return 0;
+
+    /* Leaf samples per symbol; the extra bucket holds unresolved PCs */
+    uint32_t* counts = (uint32_t*)malloc((syms + 1) * sizeof(uint32_t));
+    if (!counts) return 0;
+    memset(counts, 0, (syms + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i++) {
+        int s = sym_find(ring[i][0]);
+        counts[s < 0 ? syms : (uint32_t)s]++;
+    }
+
+    int filled = 0;
+    while (filled < max) {
+        uint32_t best = 0, best_count = 0;
+        for (uint32_t s = 0; s <= syms; s++) {
+            if (counts[s] > best_count) {
+                best = s;
+                best_count = counts[s];
+            }
+        }
+        if (best_count == 0) break;
+
+        prof_entry_t* e = &out[filled++];
+        e->count = best_count;
+        if (best < syms) {
+            e->name = prof_sym_strtab + prof_sym_names[best];
+            e->addr = prof_sym_addrs[best];
+        } else {
+            e->name = NULL;
+            e->addr = 0;
+        }
+        counts[best] = 0;
+    }
+
+    free(counts);
+    return filled;
+}
+
+/* ==================== Raw dump ==================== */
+
+static int put_hex(char* buf, uint32_t v) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 7; i >= 0; i--) {
+        buf[7 - i] = digits[(v >> (i * 4)) & 0xF];
+    }
+    return 8;
+}
+
+int prof_dump(const char* path) {
+    int fd = fs_open(path, FS_O_WRITE | FS_O_CREATE | FS_O_TRUNC);
+    if (fd < 0) return -1;
+
+    /* Oldest first */
+    uint32_t n = kept();
+    uint32_t first = sample_count - n;
+    char line[PROF_DEPTH * 9 + 1];
+
+    for (uint32_t i = 0; i < n; i++) {
+        const uint32_t* s = ring[(first + i) % PROF_RING_SIZE];
+        int len = 0;
+        for (int d = 0; d < PROF_DEPTH && s[d]; d++) {
+            if (d > 0) line[len++] = ' ';
+            len += put_hex(line + len, s[d]);
+        }
+        line[len++] = '\n';
+        if (fs_write(fd, line, len) != len) {
+            fs_close(fd);
+            return -1;
+        }
+    }
+
+    if (fs_close(fd) != 0) return -1;
+    return (int)n;
+}
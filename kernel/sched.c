@@ -0,0 +1,119 @@
+/*
+ * TinyOS Cooperative Scheduler
+ *
+ * Tasks are poll functions that do a bounded amount of work and return
+ * how long they can sleep. A task is ready when it was woken (IRQ or
+ * another task), its ready() check passes, or its deadline expired. The
+ * highest-priority ready task always runs next, so queued input is
+ * handled before background network sessions get a turn; equal
+ * priorities round-robin. When nothing is ready the CPU waits in WFI for
+ * the next tick or device interrupt.
+ */
+
+#include "sched.h"
+#include "timer.h"
+
+typedef struct {
+    const char* name;
+    sched_poll_fn poll;
+    sched_ready_fn ready;
+    void* arg;
+    int prio;
+    int active;
+    volatile int woken;
+    int has_deadline;
+    uint32_t deadline_ms;
+    uint32_t last_run;          /* Pass sequence number of last run */
+    uint32_t gen;               /* Bumped each time the slot is reused */
+} sched_task_t;
+
+static sched_task_t tasks[SCHED_MAX_TASKS];
+static uint32_t run_seq = 0;
+
+int sched_add(const char* name, sched_poll_fn poll, sched_ready_fn ready,
+              void* arg, int prio) {
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        sched_task_t* t = &tasks[i];
+        if (t->active) continue;
+        t->name = name;
+        t->poll = poll;
+        t->ready = ready;
+        t->arg = arg;
+        t->prio = prio;
+        t->woken = 1;
+        t->has_deadline = 0;
+        t->deadline_ms = 0;
+        t->last_run = 0;
+        t->gen++;
+        t->active = 1;
+        return i;
+    }
+    return -1;
+}
+
+void sched_remove(int id) {
+    if (id < 0 || id >= SCHED_MAX_TASKS) return;
+    tasks[id].active = 0;
+}
+
+void sched_wake(int id) {
+    if (id < 0 || id >= SCHED_MAX_TASKS) return;
+    tasks[id].woken = 1;
+}
+
+static int task_ready(sched_task_t* t) {
+    if (t->woken) return 1;
+    if (t->has_deadline && timer_expired(t->deadline_ms)) return 1;
+    if (t->ready && t->ready()) return 1;
+    return 0;
+}
+
+/* Highest priority first, then least recently run */
+static int pick_task(void) {
+    int best = -1;
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        sched_task_t* t = &tasks[i];
+        if (!t->active || !task_ready(t)) continue;
+        if (best < 0 || t->prio < tasks[best].prio ||
+            (t->prio == tasks[best].prio &&
+             (int32_t)(t->last_run - tasks[best].last_run) < 0)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int sched_run_once(void) {
+    int id = pick_task();
+    if (id < 0) return 0;
+
+    sched_task_t* t = &tasks[id];
+    t->woken = 0;
+    t->last_run = ++run_seq;
+    uint32_t gen = t->gen;
+
+    int next = t->poll(t->arg);
+
+    /* The task may have removed itself (and the slot been reused) */
+    if (!t->active || t->gen != gen) return 1;
+
+    if (next == SCHED_DONE) {
+        t->active = 0;
+    } else if (next == SCHED_WAIT) {
+        t->has_deadline = 0;
+    } else {
+        t->has_deadline = 1;
+        t->deadline_ms = timer_ms() + (uint32_t)next;
+    }
+    return 1;
+}
+
+void sched_run(void) {
+    while (1) {
+        if (!sched_run_once()) {
+            /* Nothing ready: deadlines are checked again after the next
+             * tick, device IRQs wake us earlier */
+            timer_idle();
+        }
+    }
+}
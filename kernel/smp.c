@@ -0,0 +1,170 @@
+/*
+ * TinyOS SMP support
+ *
+ * Secondary cores are started with PSCI CPU_ON. Each gets its own stack,
+ * passed as the PSCI context ID, initialises its GIC CPU interface and
+ * then sleeps in WFE until work is queued for it with smp_call().
+ */
+
+#include "smp.h"
+#include "gic.h"
+
+/* PSCI conduit: QEMU virt and the Android emulator use HVC at EL1 */
+#define PSCI_USE_SMC    0
+
+/* Debug UART output */
+#define UART0_BASE 0x09000000
+static void smp_puts(const char* s) {
+    while (*s) *(volatile uint32_t*)UART0_BASE = *s++;
+}
+
+/* Entry point in boot.S - expects stack top in x0 */
+extern char secondary_entry[];
+
+/* Per-CPU stacks for secondaries (CPU 0 keeps the boot stack) */
+static uint8_t cpu_stacks[SMP_MAX_CPUS][SMP_STACK_SIZE] __attribute__((aligned(16)));
+
+/* Per-CPU work queue */
+typedef struct {
+    smp_work_fn fn;
+    void* arg;
+} smp_work_t;
+
+typedef struct {
+    spinlock_t lock;
+    uint32_t head;                  /* Next slot to write */
+    uint32_t tail;                  /* Next slot to run */
+    smp_work_t items[SMP_WORK_QUEUE_SIZE];
+} smp_queue_t;
+
+static smp_queue_t work_queues[SMP_MAX_CPUS];
+
+/* Online flags - each written only by its own core (CPU 0 always online) */
+static volatile uint32_t cpu_online[SMP_MAX_CPUS] = { 1 };
+
+static int64_t psci_call(uint64_t fn, uint64_t a0, uint64_t a1, uint64_t a2) {
+    register uint64_t x0 __asm__("x0") = fn;
+    register uint64_t x1 __asm__("x1") = a0;
+    register uint64_t x2 __asm__("x2") = a1;
+    register uint64_t x3 __asm__("x3") = a2;
+#if PSCI_USE_SMC
+    __asm__ volatile("smc #0"
+#else
+    __asm__ volatile("hvc #0"
+#endif
+                     : "+r"(x0)
+                     : "r"(x1), "r"(x2), "r"(x3)
+                     : "memory");
+    return (int64_t)x0;
+}
+
+int smp_cpu_id(void) {
+    uint64_t mpidr;
+    __asm__ volatile("mrs %0, mpidr_el1" : "=r"(mpidr));
+    return (int)(mpidr & 0xFF);
+}
+
+int smp_cpu_online(int cpu) {
+    if (cpu < 0 || cpu >= SMP_MAX_CPUS) return 0;
+    return cpu_online[cpu] != 0;
+}
+
+int smp_num_cpus(void) {
+    int n = 0;
+    for (int i = 0; i < SMP_MAX_CPUS; i++) {
+        if (smp_cpu_online(i)) n++;
+    }
+    return n;
+}
+
+int smp_call(int cpu, smp_work_fn fn, void* arg) {
+    if (!smp_cpu_online(cpu) || fn == NULL) return -1;
+
+    smp_queue_t* q = &work_queues[cpu];
+    spin_lock(&q->lock);
+    if (q->head - q->tail >= SMP_WORK_QUEUE_SIZE) {
+        spin_unlock(&q->lock);
+        return -1;
+    }
+    smp_work_t* w = &q->items[q->head & SMP_WORK_QUEUE_MASK];
+    w->fn = fn;
+    w->arg = arg;
+    q->head++;
+    spin_unlock(&q->lock);
+
+    /* Wake the target if it is sleeping in WFE */
+    __asm__ volatile("dsb ish\n sev" ::: "memory");
+    return 0;
+}
+
+int smp_run_pending(void) {
+    smp_queue_t* q = &work_queues[smp_cpu_id()];
+    int count = 0;
+
+    while (1) {
+        spin_lock(&q->lock);
+        if (q->tail == q->head) {
+            spin_unlock(&q->lock);
+            break;
+        }
+        smp_work_t* w = &q->items[q->tail & SMP_WORK_QUEUE_MASK];
+        smp_work_fn fn = w->fn;
+        void* arg = w->arg;
+        q->tail++;
+        spin_unlock(&q->lock);
+
+        /* Run outside the lock so work may queue more work */
+        fn(arg);
+        count++;
+    }
+    return count;
+}
+
+void smp_secondary_main(uint64_t cpu) {
+    if (cpu >= SMP_MAX_CPUS) return;
+
+    /* Banked GIC CPU interface must be enabled on every core */
+    gic_cpu_init();
+
+    __asm__ volatile("dmb ish" ::: "memory");
+    cpu_online[cpu] = 1;
+    __asm__ volatile("dsb ish\n sev" ::: "memory");
+
+    while (1) {
+        if (smp_run_pending() == 0) {
+            __asm__ volatile("wfe");
+        }
+    }
+}
+
+void smp_init(void) {
+    int64_t version = psci_call(PSCI_VERSION, 0, 0, 0);
+    if (version < 0) {
+        smp_puts("SMP: PSCI not available\r\n");
+        return;
+    }
+
+    for (int cpu = 1; cpu < SMP_MAX_CPUS; cpu++) {
+        uint64_t stack_top = (uint64_t)&cpu_stacks[cpu][SMP_STACK_SIZE];
+
+        /* Target MPIDR: Aff0 = cpu on a single cluster */
+        int64_t ret = psci_call(PSCI_CPU_ON_64, (uint64_t)cpu,
+                                (uint64_t)secondary_entry, stack_top);
+        if (ret != PSCI_SUCCESS && ret != PSCI_ALREADY_ON) {
+            /* No such CPU - later ones won't exist either */
+            break;
+        }
+
+        /* Wait for it to report in */
+        for (volatile int i = 0; i < 10000000; i++) {
+            if (smp_cpu_online(cpu)) break;
+        }
+        if (!smp_cpu_online(cpu)) {
+            smp_puts("SMP: CPU failed to start\r\n");
+        }
+    }
+
+    smp_puts("SMP: ");
+    *(volatile uint32_t*)UART0_BASE = '0' + smp_num_cpus();
+    smp_puts(" CPU(s) online\r\n");
+}
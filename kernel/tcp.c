@@ -6,6 +6,7 @@
 #include "net.h"
 #include "virtio_net.h"
 #include "memory.h"
+#include "timer.h"
 
 /* IP protocol number for TCP */
 #define IP_PROTO_TCP 6
@@ -16,26 +17,277 @@ static uint8_t tcp_tx_buf[2048];
 /* Connection pool */
 static tcp_conn_t connections[MAX_TCP_CONNS];
 
-/* Local port counter */
-static uint16_t next_local_port = 49152;
+/* 4-tuple hash chains through the pool. Slots stay linked after they
+ * close (lookups skip them) and move when they are reused */
+static int hash_head[TCP_HASH_SIZE];
+static int hash_next[MAX_TCP_CONNS];
+static int hash_bucket[MAX_TCP_CONNS];     /* -1 if not linked */
+
+/* Listening sockets */
+typedef struct {
+    int active;
+    uint16_t port;
+    int backlog;
+} tcp_listener_t;
 
-/* Tick counter for timeouts */
-static uint32_t tcp_ticks = 0;
+static tcp_listener_t listeners[MAX_TCP_LISTENERS];
 
+/* Local port counter */
+static uint16_t next_local_port = TCP_EPHEMERAL_FIRST;
+
+/* Counters for netstat */
+static tcp_stats_t stats = {0};
+
+
+/* Progress of our FIN (conn->fin) */
+#define FIN_NONE    0
+#define FIN_QUEUED  1       /* Goes out after the queued data */
+#define FIN_SENT    2
+#define FIN_ACKED   3
+
+/* TCP option kinds */
+#define TCPOPT_EOL          0
+#define TCPOPT_NOP          1
+#define TCPOPT_MSS          2
+#define TCPOPT_WSCALE       3
+#define TCPOPT_SACK_PERM    4
+#define TCPOPT_SACK         5
+#define TCPOPT_TIMESTAMP    8
+
+#define TCP_MAX_OPT_LEN     40
+#define TCP_MAX_WSCALE      14
+#define TCP_TS_LEN          12      /* NOP, NOP, timestamps */
+
+/* Options of a received segment */
+typedef struct {
+    uint16_t mss;           /* 0 if absent */
+    int wscale;             /* -1 if absent */
+    int sack_ok;
+    int ts_ok;
+    uint32_t tsval;
+    uint32_t tsecr;
+} tcp_opts_t;
 
 /* Forward declarations */
-static void send_tcp_packet(tcp_conn_t* conn, uint8_t flags,
+static int send_tcp_segment(tcp_conn_t* conn, uint8_t flags, uint32_t seq,
+                            const void* data, int data_len, int more);
+static int send_tcp_packet(tcp_conn_t* conn, uint8_t flags,
                            const void* data, int data_len);
-static uint16_t tcp_checksum(struct ip_hdr* ip, struct tcp_hdr* tcp, int tcp_len);
+static void tcp_output(tcp_conn_t* conn);
+
+/* Sequence number comparison (modulo 2^32) */
+static inline int seq_lt(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static inline int seq_leq(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) <= 0;
+}
+
+static inline uint32_t get_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void put_be32(uint8_t* p, uint32_t v) {
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
 
 void tcp_init(void) {
     for (int i = 0; i < MAX_TCP_CONNS; i++) {
         connections[i].state = TCP_CLOSED;
+        connections[i].rx_count = 0;
         connections[i].rx_len = 0;
         connections[i].rx_ready = 0;
+        hash_bucket[i] = -1;
+    }
+    for (int i = 0; i < TCP_HASH_SIZE; i++) {
+        hash_head[i] = -1;
+    }
+    for (int i = 0; i < MAX_TCP_LISTENERS; i++) {
+        listeners[i].active = 0;
+    }
+}
+
+/* ==================== Receive queues ==================== */
+
+/* Append in-order payload to the receive ring; the caller's reference to
+ * the RX buffer moves into the queue */
+static void rx_append(tcp_conn_t* conn, const uint8_t* data, int len, int buf) {
+    tcp_seg_t* seg = &conn->rx_segs[(conn->rx_head + conn->rx_count) % TCP_RX_SEGS];
+    seg->data = data;
+    seg->len = len;
+    seg->buf = buf;
+    conn->rx_count++;
+    conn->rx_len += len;
+    conn->rx_ready = 1;
+    conn->bytes_in += len;
+    conn->thru_bytes += len;
+}
+
+/* Receive window: free bytes, capped by the full segments that can still
+ * be queued (ring slots, and RX buffers the driver will lend) so that
+ * what it admits isn't dropped */
+static uint32_t rx_window(tcp_conn_t* conn) {
+    uint32_t space = TCP_RX_BUF_SIZE - conn->rx_len;
+    int segs = TCP_RX_SEGS - conn->rx_count;
+    int room = net_rx_hold_room();
+    if (room < segs) segs = room;
+
+    uint32_t limit = (uint32_t)segs * TCP_MSS;
+    return limit < space ? limit : space;
+}
+
+/* Move out-of-order segments that the new ack_num reaches */
+static void ooo_drain(tcp_conn_t* conn) {
+    while (conn->ooo_count > 0 && seq_leq(conn->ooo[0].seq, conn->ack_num)) {
+        tcp_seg_t seg = conn->ooo[0];
+        int skip = conn->ack_num - seg.seq;
+        int len = seg.len - skip;
+        if (len > 0 && (conn->rx_count == TCP_RX_SEGS ||
+                        conn->rx_len + len > TCP_RX_BUF_SIZE)) {
+            return;     /* Wait until the application reads */
+        }
+
+        conn->ooo_count--;
+        memmove(&conn->ooo[0], &conn->ooo[1], conn->ooo_count * sizeof(tcp_seg_t));
+        if (len > 0) {
+            rx_append(conn, seg.data + skip, len, seg.buf);
+            conn->ack_num += len;
+        } else {
+            net_rx_release(seg.buf);        /* Already covered */
+        }
     }
 }
 
+/* Take in payload starting at or before ack_num; a retransmitted front
+ * is trimmed, and what doesn't fit the window is left for the peer to
+ * resend. Returns bytes accepted */
+static int rx_accept(tcp_conn_t* conn, uint32_t seq, const uint8_t* data, int len) {
+    int skip = conn->ack_num - seq;
+    if (skip >= len) {                  /* Duplicate */
+        stats.dup_segments++;
+        return 0;
+    }
+    data += skip;
+    len -= skip;
+
+    int space = TCP_RX_BUF_SIZE - conn->rx_len;
+    if (len > space) len = space;
+    if (len <= 0 || conn->rx_count == TCP_RX_SEGS) return 0;
+
+    int buf = net_rx_hold();
+    if (buf < 0) return 0;
+    rx_append(conn, data, len, buf);
+    conn->ack_num += len;
+
+    ooo_drain(conn);
+    return len;
+}
+
+/* Keep a segment that arrived ahead of a hole, trimmed to the window and
+ * to the segments already queued around it */
+static void ooo_insert(tcp_conn_t* conn, uint32_t seq, const uint8_t* data, int len) {
+    uint32_t right = conn->ack_num + (TCP_RX_BUF_SIZE - conn->rx_len);
+    if (seq_leq(right, seq)) {
+        stats.ooo_dropped++;
+        return;
+    }
+    if (seq_lt(right, seq + len)) len = right - seq;
+
+    /* First queued segment starting after seq */
+    int i = 0;
+    while (i < conn->ooo_count && seq_leq(conn->ooo[i].seq, seq)) i++;
+
+    if (i > 0) {
+        tcp_seg_t* prev = &conn->ooo[i - 1];
+        int overlap = prev->seq + prev->len - seq;
+        if (overlap >= len) {
+            stats.dup_segments++;
+            return;
+        }
+        if (overlap > 0) {
+            seq += overlap;
+            data += overlap;
+            len -= overlap;
+        }
+    }
+    if (i < conn->ooo_count && seq_lt(conn->ooo[i].seq, seq + len)) {
+        len = conn->ooo[i].seq - seq;
+    }
+    if (len <= 0) {
+        stats.dup_segments++;
+        return;
+    }
+
+    int buf = conn->ooo_count < TCP_OOO_SEGS ? net_rx_hold() : -1;
+    if (buf < 0) {
+        stats.ooo_dropped++;
+        return;
+    }
+
+    memmove(&conn->ooo[i + 1], &conn->ooo[i], (conn->ooo_count - i) * sizeof(tcp_seg_t));
+    conn->ooo[i].seq = seq;
+    conn->ooo[i].data = data;
+    conn->ooo[i].len = len;
+    conn->ooo[i].buf = buf;
+    conn->ooo_count++;
+    conn->ooo_last = seq;
+}
+
+/* Release every queued segment */
+static void rx_flush(tcp_conn_t* conn) {
+    while (conn->rx_count > 0) {
+        net_rx_release(conn->rx_segs[conn->rx_head].buf);
+        conn->rx_head = (conn->rx_head + 1) % TCP_RX_SEGS;
+        conn->rx_count--;
+    }
+    for (int i = 0; i < conn->ooo_count; i++) {
+        net_rx_release(conn->ooo[i].buf);
+    }
+    conn->ooo_count = 0;
+    conn->rx_len = 0;
+    conn->rx_ready = 0;
+}
+
+/* Enter CLOSED, handing any unread segments back to the RX ring (not
+ * used when the peer closes gracefully; see TCP_LAST_ACK) */
+static void conn_closed(tcp_conn_t* conn) {
+    rx_flush(conn);
+    conn->state = TCP_CLOSED;
+}
+
+/* ==================== Connection table ==================== */
+
+static inline int conn_hash(const uint8_t* ip, uint16_t local_port, uint16_t remote_port) {
+    uint32_t h = ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) |
+                 ((uint32_t)ip[2] << 8) | ip[3];
+    h ^= ((uint32_t)local_port << 16) | remote_port;
+    h *= 0x9E3779B1;                    /* Fibonacci hashing: mix the top bits */
+    return (h >> 16) & (TCP_HASH_SIZE - 1);
+}
+
+static void hash_unlink(int idx) {
+    int b = hash_bucket[idx];
+    if (b < 0) return;
+
+    int* link = &hash_head[b];
+    while (*link != idx) link = &hash_next[*link];
+    *link = hash_next[idx];
+    hash_bucket[idx] = -1;
+}
+
+static void hash_link(int idx) {
+    tcp_conn_t* conn = &connections[idx];
+    int b = conn_hash(conn->remote_ip, conn->local_port, conn->remote_port);
+    hash_next[idx] = hash_head[b];
+    hash_head[b] = idx;
+    hash_bucket[idx] = b;
+}
+
 /* Find a free connection slot */
 static int find_free_conn(void) {
     for (int i = 0; i < MAX_TCP_CONNS; i++) {
@@ -48,7 +300,8 @@ static int find_free_conn(void) {
 
 /* Find connection by remote IP/port */
 static int find_conn(const uint8_t* ip, uint16_t local_port, uint16_t remote_port) {
-    for (int i = 0; i < MAX_TCP_CONNS; i++) {
+    int i = hash_head[conn_hash(ip, local_port, remote_port)];
+    for (; i >= 0; i = hash_next[i]) {
         if (connections[i].state != TCP_CLOSED &&
             connections[i].local_port == local_port &&
             connections[i].remote_port == remote_port &&
@@ -62,6 +315,65 @@ static int find_conn(const uint8_t* ip, uint16_t local_port, uint16_t remote_por
     return -1;
 }
 
+/* Reset a free slot for a connection with this 4-tuple and link it */
+static tcp_conn_t* conn_setup(int idx, const uint8_t* ip, uint16_t local_port,
+                              uint16_t remote_port) {
+    tcp_conn_t* conn = &connections[idx];
+    rx_flush(conn);     /* Unread data of the slot's last connection */
+    memset(conn, 0, sizeof(tcp_conn_t));
+
+    conn->remote_ip[0] = ip[0];
+    conn->remote_ip[1] = ip[1];
+    conn->remote_ip[2] = ip[2];
+    conn->remote_ip[3] = ip[3];
+    conn->local_port = local_port;
+    conn->remote_port = remote_port;
+    conn->thru_start = timer_ms();
+
+    hash_unlink(idx);
+    hash_link(idx);
+    return conn;
+}
+
+static int find_listener(uint16_t port) {
+    for (int i = 0; i < MAX_TCP_LISTENERS; i++) {
+        if (listeners[i].active && listeners[i].port == port) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* A local port is taken while any connection or listener uses it */
+static int port_in_use(uint16_t port) {
+    if (find_listener(port) >= 0) return 1;
+    for (int i = 0; i < MAX_TCP_CONNS; i++) {
+        if (connections[i].state != TCP_CLOSED && connections[i].local_port == port) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Next free ephemeral port, 0 if the range is exhausted */
+static uint16_t alloc_local_port(void) {
+    for (int tries = 0; tries <= TCP_EPHEMERAL_LAST - TCP_EPHEMERAL_FIRST; tries++) {
+        uint16_t port = next_local_port++;
+        if (next_local_port > TCP_EPHEMERAL_LAST) next_local_port = TCP_EPHEMERAL_FIRST;
+        if (!port_in_use(port)) return port;
+    }
+    return 0;
+}
+
+/* (Re)send our SYN, or SYN-ACK when the peer opened; it always carries
+ * the initial sequence number */
+static void send_syn(tcp_conn_t* conn) {
+    uint8_t flags = conn->state == TCP_SYN_RECEIVED ? (TCP_SYN | TCP_ACK) : TCP_SYN;
+    if (send_tcp_segment(conn, flags, conn->snd_una, NULL, 0, 0) == 0) {
+        conn->seq_num = conn->snd_una + 1;
+    }
+}
+
 /* Simple pseudo-random for initial sequence number */
 static uint32_t get_initial_seq(void) {
     static uint32_t seed = 0x12345678;
@@ -80,93 +392,243 @@ int tcp_connect(const uint8_t* ip, uint16_t port) {
         return -1;
     }
 
-    tcp_conn_t* conn = &connections[idx];
-    memset(conn, 0, sizeof(tcp_conn_t));
-
-    conn->remote_ip[0] = ip[0];
-    conn->remote_ip[1] = ip[1];
-    conn->remote_ip[2] = ip[2];
-    conn->remote_ip[3] = ip[3];
-    conn->remote_port = port;
-    conn->local_port = next_local_port++;
-    if (next_local_port > 65000) next_local_port = 49152;
+    uint16_t local_port = alloc_local_port();
+    if (local_port == 0) {
+        return -1;
+    }
 
-    conn->seq_num = get_initial_seq();
+    tcp_conn_t* conn = conn_setup(idx, ip, local_port, port);
+    conn->snd_una = get_initial_seq();
+    conn->seq_num = conn->snd_una;
     conn->ack_num = 0;
     conn->state = TCP_SYN_SENT;
-    conn->timeout_tick = tcp_ticks + 500;  /* 0.5 second timeout - faster retry */
+    conn->timeout_ms = timer_ms() + TCP_SYN_TIMEOUT_MS;
     conn->retries = 0;
-    conn->rx_len = 0;
-    conn->rx_ready = 0;
-
 
     /* Send SYN */
-    send_tcp_packet(conn, TCP_SYN, NULL, 0);
+    send_syn(conn);
+    stats.active_opens++;
 
     return idx;
 }
 
-/* Calculate TCP checksum with pseudo-header */
-static uint16_t tcp_checksum(struct ip_hdr* ip, struct tcp_hdr* tcp, int tcp_len) {
-    uint32_t sum = 0;
+int tcp_listen(uint16_t port, int backlog) {
+    if (port == 0 || find_listener(port) >= 0) return -1;
 
-    /* Pseudo-header */
-    sum += (ip->src_ip[0] << 8) | ip->src_ip[1];
-    sum += (ip->src_ip[2] << 8) | ip->src_ip[3];
-    sum += (ip->dest_ip[0] << 8) | ip->dest_ip[1];
-    sum += (ip->dest_ip[2] << 8) | ip->dest_ip[3];
-    sum += IP_PROTO_TCP;
-    sum += tcp_len;
+    for (int i = 0; i < MAX_TCP_LISTENERS; i++) {
+        if (!listeners[i].active) {
+            if (backlog < 1) backlog = 1;
+            if (backlog > TCP_MAX_BACKLOG) backlog = TCP_MAX_BACKLOG;
+            listeners[i].active = 1;
+            listeners[i].port = port;
+            listeners[i].backlog = backlog;
+            return i;
+        }
+    }
+    return -1;
+}
 
-    /* TCP header + data - read as bytes to handle alignment */
-    uint8_t* ptr = (uint8_t*)tcp;
-    int remaining = tcp_len;
-    while (remaining > 1) {
-        sum += (ptr[0] << 8) | ptr[1];
-        ptr += 2;
-        remaining -= 2;
+int tcp_accept(int l) {
+    if (l < 0 || l >= MAX_TCP_LISTENERS || !listeners[l].active) return -1;
+
+    /* Anything past the handshake, even if the peer already closed */
+    for (int i = 0; i < MAX_TCP_CONNS; i++) {
+        tcp_conn_t* conn = &connections[i];
+        if (conn->listener == l + 1 && !conn->accepted &&
+            conn->state != TCP_CLOSED && conn->state != TCP_SYN_RECEIVED) {
+            conn->accepted = 1;
+            return i;
+        }
     }
-    if (remaining == 1) {
-        sum += ptr[0] << 8;
+    return -1;
+}
+
+void tcp_unlisten(int l) {
+    if (l < 0 || l >= MAX_TCP_LISTENERS) return;
+
+    listeners[l].active = 0;
+    for (int i = 0; i < MAX_TCP_CONNS; i++) {
+        tcp_conn_t* conn = &connections[i];
+        if (conn->listener == l + 1 && !conn->accepted && conn->state != TCP_CLOSED) {
+            send_tcp_segment(conn, TCP_RST | TCP_ACK, conn->seq_num, NULL, 0, 0);
+            conn_closed(conn);
+        }
     }
+}
+
+/* ==================== Options ==================== */
 
-    while (sum >> 16) {
-        sum = (sum & 0xFFFF) + (sum >> 16);
+/* Window scale we offer: the smallest shift that fits the receive
+ * window in the 16-bit field */
+static uint8_t offered_wscale(void) {
+    uint8_t shift = 0;
+    while ((TCP_RX_BUF_SIZE >> shift) > 0xFFFF && shift < TCP_MAX_WSCALE) {
+        shift++;
     }
+    return shift;
+}
 
-    return ~sum;
+static void parse_options(const uint8_t* opt, int len, tcp_opts_t* out) {
+    memset(out, 0, sizeof(tcp_opts_t));
+    out->wscale = -1;
+
+    int i = 0;
+    while (i < len) {
+        uint8_t kind = opt[i];
+        if (kind == TCPOPT_EOL) break;
+        if (kind == TCPOPT_NOP) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= len) break;
+        int olen = opt[i + 1];
+        if (olen < 2 || i + olen > len) break;      /* Malformed: stop */
+
+        const uint8_t* v = opt + i + 2;
+        switch (kind) {
+            case TCPOPT_MSS:
+                if (olen == 4) out->mss = (v[0] << 8) | v[1];
+                break;
+            case TCPOPT_WSCALE:
+                if (olen == 3) {
+                    out->wscale = v[0] < TCP_MAX_WSCALE ? v[0] : TCP_MAX_WSCALE;
+                }
+                break;
+            case TCPOPT_SACK_PERM:
+                if (olen == 2) out->sack_ok = 1;
+                break;
+            case TCPOPT_TIMESTAMP:
+                if (olen == 10) {
+                    out->ts_ok = 1;
+                    out->tsval = get_be32(v);
+                    out->tsecr = get_be32(v + 4);
+                }
+                break;
+            default:
+                break;      /* Includes SACK blocks: we resend from snd_una */
+        }
+        i += olen;
+    }
 }
 
-/* Send a TCP packet */
-static void send_tcp_packet(tcp_conn_t* conn, uint8_t flags,
-                           const void* data, int data_len) {
+/* SACK blocks for the out-of-order queue: contiguous segments merge, and
+ * the block with the latest arrival goes first (RFC 2018). Returns bytes */
+static int put_sack_blocks(tcp_conn_t* conn, uint8_t* opt, int max_blocks) {
+    uint32_t start[TCP_OOO_SEGS], end[TCP_OOO_SEGS];
+    int runs = 0, first = 0;
+    for (int i = 0; i < conn->ooo_count; i++) {
+        const tcp_seg_t* seg = &conn->ooo[i];
+        if (runs > 0 && end[runs - 1] == seg->seq) {
+            end[runs - 1] += seg->len;
+        } else {
+            start[runs] = seg->seq;
+            end[runs] = seg->seq + seg->len;
+            runs++;
+        }
+        if (seg->seq == conn->ooo_last) first = runs - 1;
+    }
+    opt[0] = TCPOPT_NOP;
+    opt[1] = TCPOPT_NOP;
+    opt[2] = TCPOPT_SACK;
+
+    int n = 4, blocks = 0;
+    for (int k = -1; k < runs && blocks < max_blocks; k++) {
+        if (k == first) continue;
+        int r = k < 0 ? first : k;
+        put_be32(opt + n, start[r]);
+        put_be32(opt + n + 4, end[r]);
+        n += 8;
+        blocks++;
+    }
+    opt[3] = 2 + 8 * blocks;
+    return n;
+}
+
+/* Options for an outgoing segment: all we support on our SYN, on a
+ * SYN-ACK what the peer's SYN offered, then timestamps and SACK blocks
+ * as negotiated. Returns the length, a multiple of 4 */
+static int build_options(tcp_conn_t* conn, uint8_t flags, uint8_t* opt) {
+    int n = 0;
+
+    if (flags & TCP_SYN) {
+        int offer = !(flags & TCP_ACK);
+        int sack = offer || conn->sack_ok;
+        int ts = offer || conn->ts_ok;
+
+        opt[n++] = TCPOPT_MSS;
+        opt[n++] = 4;
+        opt[n++] = (TCP_MSS >> 8) & 0xFF;
+        opt[n++] = TCP_MSS & 0xFF;
+        if (sack != ts) {
+            opt[n++] = TCPOPT_NOP;      /* Pad a lone one to a word */
+            opt[n++] = TCPOPT_NOP;
+        }
+        if (sack) {
+            opt[n++] = TCPOPT_SACK_PERM;
+            opt[n++] = 2;
+        }
+        if (ts) {
+            opt[n++] = TCPOPT_TIMESTAMP;
+            opt[n++] = 10;
+            put_be32(opt + n, timer_ms());
+            put_be32(opt + n + 4, conn->ts_recent);
+            n += 8;
+        }
+        if (offer || conn->ws_ok) {
+            opt[n++] = TCPOPT_NOP;
+            opt[n++] = TCPOPT_WSCALE;
+            opt[n++] = 3;
+            opt[n++] = offered_wscale();
+        }
+        return n;
+    }
+
+    if (conn->ts_ok) {
+        opt[n++] = TCPOPT_NOP;
+        opt[n++] = TCPOPT_NOP;
+        opt[n++] = TCPOPT_TIMESTAMP;
+        opt[n++] = 10;
+        put_be32(opt + n, timer_ms());
+        put_be32(opt + n + 4, conn->ts_recent);
+        n += 8;
+    }
+    if (conn->sack_ok && conn->ooo_count > 0) {
+        n += put_sack_blocks(conn, opt + n, (TCP_MAX_OPT_LEN - n - 4) / 8);
+    }
+    return n;
+}
+
+/* Send a TCP segment starting at `seq`; with `more` set the device kick
+ * is left to a later segment of the burst. Returns 0 if queued or held
+ * for ARP, -1 if it couldn't be (hold queue or TX ring full) */
+static int send_tcp_segment(tcp_conn_t* conn, uint8_t flags, uint32_t seq,
+                            const void* data, int data_len, int more) {
     net_status_t* ns = virtio_net_get_status();
     net_config_t* nc = net_get_config();
-    if (!ns->available || !nc->configured) return;
+    if (!ns->available || !nc->configured) return -1;
 
     memset(tcp_tx_buf, 0, sizeof(tcp_tx_buf));
 
     struct eth_hdr* eth = (struct eth_hdr*)tcp_tx_buf;
     struct ip_hdr* ip = (struct ip_hdr*)(tcp_tx_buf + ETH_HLEN);
     struct tcp_hdr* tcp = (struct tcp_hdr*)(tcp_tx_buf + ETH_HLEN + 20);
-    uint8_t* payload = tcp_tx_buf + ETH_HLEN + 20 + 20;
+    int opt_len = build_options(conn, flags, (uint8_t*)tcp + 20);
+    int tcp_len = 20 + opt_len;
+    uint8_t* payload = (uint8_t*)tcp + tcp_len;
 
-    /* Get gateway MAC for routing */
+    /* Get gateway MAC for routing; without it the frame is held until
+     * ARP resolves it, so it needs its checksum in full */
     uint8_t dest_mac[6];
     const uint8_t* route_ip = nc->gateway;  /* Route through gateway */
+    int resolved = net_arp_lookup(route_ip, dest_mac);
 
-    if (!net_arp_lookup(route_ip, dest_mac)) {
-        /* Don't have MAC yet - send ARP and retry later */
-        net_send_arp_request(route_ip);
-        return;
-    }
     /* Ethernet */
-    memcpy(eth->dest, dest_mac, 6);
+    if (resolved) memcpy(eth->dest, dest_mac, 6);
     memcpy(eth->src, ns->mac, 6);
     eth->ethertype = htons(ETH_P_IP);
 
     /* IP header */
-    int total_len = 20 + 20 + data_len;  /* IP + TCP + data */
+    int total_len = 20 + tcp_len + data_len;  /* IP + TCP + data */
     ip->version_ihl = 0x45;
     ip->tos = 0;
     ip->total_len = htons(total_len);
@@ -178,16 +640,10 @@ static void send_tcp_packet(tcp_conn_t* conn, uint8_t flags,
     memcpy(ip->src_ip, nc->ip, 4);
     memcpy(ip->dest_ip, conn->remote_ip, 4);
 
-    /* IP checksum - read bytes to avoid alignment issues */
+    /* IP checksum - in memory order, stored byte by byte for alignment */
     uint8_t* ip_bytes = (uint8_t*)ip;
-    uint32_t ip_sum = 0;
-    for (int i = 0; i < 20; i += 2) {
-        ip_sum += (ip_bytes[i] << 8) | ip_bytes[i+1];
-    }
-    while (ip_sum >> 16) ip_sum = (ip_sum & 0xFFFF) + (ip_sum >> 16);
-    uint16_t ip_csum = ~ip_sum;
-    ip_bytes[10] = (ip_csum >> 8) & 0xFF;
-    ip_bytes[11] = ip_csum & 0xFF;
+    uint16_t ip_csum = net_csum_fold(net_csum_add(0, ip_bytes, 20));
+    memcpy(ip_bytes + 10, &ip_csum, 2);
 
     /* TCP header - write byte by byte in network (big-endian) order */
     uint8_t* tcp_bytes = (uint8_t*)tcp;
@@ -201,10 +657,10 @@ static void send_tcp_packet(tcp_conn_t* conn, uint8_t flags,
     tcp_bytes[3] = conn->remote_port & 0xFF;
 
     /* Sequence number - manual big endian */
-    tcp_bytes[4] = (conn->seq_num >> 24) & 0xFF;
-    tcp_bytes[5] = (conn->seq_num >> 16) & 0xFF;
-    tcp_bytes[6] = (conn->seq_num >> 8) & 0xFF;
-    tcp_bytes[7] = conn->seq_num & 0xFF;
+    tcp_bytes[4] = (seq >> 24) & 0xFF;
+    tcp_bytes[5] = (seq >> 16) & 0xFF;
+    tcp_bytes[6] = (seq >> 8) & 0xFF;
+    tcp_bytes[7] = seq & 0xFF;
 
     /* Ack number - manual big endian */
     tcp_bytes[8] = (conn->ack_num >> 24) & 0xFF;
@@ -212,12 +668,17 @@ static void send_tcp_packet(tcp_conn_t* conn, uint8_t flags,
     tcp_bytes[10] = (conn->ack_num >> 8) & 0xFF;
     tcp_bytes[11] = conn->ack_num & 0xFF;
 
-    tcp_bytes[12] = 0x50;  /* data_off: 5 * 4 = 20 bytes header */
+    tcp_bytes[12] = (tcp_len / 4) << 4;  /* data_off: header in words */
     tcp_bytes[13] = flags;
 
-    /* Window size - manual big endian */
-    tcp_bytes[14] = (TCP_RX_BUF_SIZE >> 8) & 0xFF;
-    tcp_bytes[15] = TCP_RX_BUF_SIZE & 0xFF;
+    /* Window size (see rx_window), scaled except on a SYN - manual big
+     * endian */
+    uint8_t shift = (flags & TCP_SYN) ? 0 : conn->rcv_wscale;
+    uint32_t window = rx_window(conn) >> shift;
+    if (window > 0xFFFF) window = 0xFFFF;
+    tcp_bytes[14] = (window >> 8) & 0xFF;
+    tcp_bytes[15] = window & 0xFF;
+    conn->wnd_sent = window << shift;
 
     tcp_bytes[16] = 0;  /* checksum placeholder */
     tcp_bytes[17] = 0;
@@ -229,62 +690,339 @@ static void send_tcp_packet(tcp_conn_t* conn, uint8_t flags,
         memcpy(payload, data, data_len);
     }
 
-    /* TCP checksum - calculate and write byte by byte */
-    uint16_t tcp_csum = tcp_checksum(ip, (struct tcp_hdr*)tcp_bytes, 20 + data_len);
-    tcp_bytes[16] = (tcp_csum >> 8) & 0xFF;
-    tcp_bytes[17] = tcp_csum & 0xFF;
+    /* TCP checksum. With offload the device sums the segment and we
+     * leave it the pseudo-header sum, uncomplemented */
+    uint32_t pseudo = net_csum_pseudo(ip, IP_PROTO_TCP, tcp_len + data_len);
+    int sent;
+    if (!resolved) {
+        uint16_t tcp_csum = net_csum_fold(net_csum_add(pseudo, tcp_bytes, tcp_len + data_len));
+        memcpy(tcp_bytes + 16, &tcp_csum, 2);
+        sent = net_arp_hold(route_ip, tcp_tx_buf, ETH_HLEN + total_len);
+    } else if (ns->tx_csum) {
+        uint16_t partial = ~net_csum_fold(pseudo);
+        memcpy(tcp_bytes + 16, &partial, 2);
+        sent = virtio_net_xmit_csum(tcp_tx_buf, ETH_HLEN + total_len,
+                                    ETH_HLEN + 20, 16, more);
+    } else {
+        uint16_t tcp_csum = net_csum_fold(net_csum_add(pseudo, tcp_bytes, tcp_len + data_len));
+        memcpy(tcp_bytes + 16, &tcp_csum, 2);
+        sent = virtio_net_xmit(tcp_tx_buf, ETH_HLEN + total_len, more);
+    }
+    if (sent != 0) {
+        stats.tx_fail++;
+        return -1;
+    }
+    stats.segs_out++;
+    stats.bytes_out += data_len;
+    conn->last_ack_sent = conn->ack_num;
+    conn->ack_pending = 0;      /* Every segment carries the ACK */
+    return 0;
+}
 
-    /* Send packet */
-    virtio_net_send(tcp_tx_buf, ETH_HLEN + total_len);
+/* Send a single TCP packet at seq_num and kick the device. Returns 0 if
+ * sent - seq_num only advances then - or -1 */
+static int send_tcp_packet(tcp_conn_t* conn, uint8_t flags,
+                           const void* data, int data_len) {
+    if (send_tcp_segment(conn, flags, conn->seq_num, data, data_len, 0) != 0) {
+        return -1;
+    }
 
     /* Update sequence number for data sent */
     if (flags & TCP_SYN) conn->seq_num++;
     if (flags & TCP_FIN) conn->seq_num++;
     if (data_len > 0) conn->seq_num += data_len;
+    return 0;
 }
 
-int tcp_send(int idx, const void* data, int len) {
-    if (idx < 0 || idx >= MAX_TCP_CONNS) return -1;
+/* ==================== Send ring and retransmission ==================== */
 
-    tcp_conn_t* conn = &connections[idx];
-    if (conn->state != TCP_ESTABLISHED) {
+static inline uint32_t min_u32(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+/* Note how far the sequence space has been sent (retransmits rewind
+ * seq_num, but ACKs up to snd_max stay valid) */
+static inline void advance_seq(tcp_conn_t* conn, uint32_t n) {
+    conn->seq_num += n;
+    if (seq_lt(conn->snd_max, conn->seq_num)) conn->snd_max = conn->seq_num;
+}
+
+/* Sent but unacknowledged sequence space (including a sent FIN) */
+static inline uint32_t in_flight(const tcp_conn_t* conn) {
+    return conn->seq_num - conn->snd_una;
+}
+
+static void arm_rtx(tcp_conn_t* conn) {
+    conn->rtx_deadline = timer_ms() + conn->rto_ms;
+    conn->rtx_armed = 1;
+}
+
+/* Send up to len queued bytes from `off` past snd_una, stopping at the
+ * ring end so the payload is one piece. Returns bytes sent, -1 on failure */
+static int send_from_ring(tcp_conn_t* conn, uint32_t off, int len, int more) {
+    int pos = (conn->tx_head + off) % TCP_TX_BUF_SIZE;
+    if (len > TCP_TX_BUF_SIZE - pos) len = TCP_TX_BUF_SIZE - pos;
+    if (send_tcp_segment(conn, TCP_ACK | TCP_PSH, conn->snd_una + off,
+                         conn->tx_ring + pos, len, more) != 0) {
         return -1;
     }
+    if (seq_lt(conn->snd_una + off, conn->snd_max)) {
+        stats.retransmits++;
+        conn->retransmits++;
+    }
+    return len;
+}
+
+/* Resend the oldest unacknowledged segment (or the FIN) */
+static void retransmit_first(tcp_conn_t* conn) {
+    if (conn->tx_len > 0) {
+        send_from_ring(conn, 0, min_u32(conn->tx_len, conn->mss), 0);
+    } else if (conn->fin == FIN_SENT &&
+               send_tcp_segment(conn, TCP_FIN | TCP_ACK, conn->snd_una, NULL, 0, 0) == 0) {
+        stats.retransmits++;
+        conn->retransmits++;
+    }
+    conn->rtt_timing = 0;   /* Karn: no samples from retransmissions */
+}
 
-    /* Send in chunks if needed */
+/* Send queued data the windows allow, then the FIN once the data is out */
+static void tcp_output(tcp_conn_t* conn) {
+    uint32_t wnd = min_u32(conn->cwnd, conn->snd_wnd);
     int sent = 0;
-    const uint8_t* ptr = (const uint8_t*)data;
 
-    while (sent < len) {
-        int chunk = len - sent;
-        if (chunk > 1400) chunk = 1400;  /* MSS */
+    for (;;) {
+        uint32_t off = in_flight(conn);
+        if (off >= (uint32_t)conn->tx_len || off >= wnd) break;
+
+        int len = min_u32(min_u32(conn->tx_len - off, wnd - off), conn->mss);
+        int n = send_from_ring(conn, off, len, 1);
+        if (n < 0) break;
+
+        /* Time one segment per round trip */
+        if (!conn->rtt_timing && !conn->ts_ok) {
+            conn->rtt_timing = 1;
+            conn->rtt_seq = conn->seq_num + n;
+            conn->rtt_start = timer_ms();
+        }
+        advance_seq(conn, n);
+        sent = 1;
+    }
 
-        send_tcp_packet(conn, TCP_ACK | TCP_PSH, ptr + sent, chunk);
-        sent += chunk;
+    if (conn->fin == FIN_QUEUED &&
+        conn->seq_num == conn->snd_una + conn->tx_len &&
+        send_tcp_segment(conn, TCP_FIN | TCP_ACK, conn->seq_num, NULL, 0, 1) == 0) {
+        advance_seq(conn, 1);
+        conn->fin = FIN_SENT;
+        conn->timeout_ms = timer_ms() + TCP_FIN_TIMEOUT_MS;
+        sent = 1;
     }
 
-    return sent;
+    if (sent) {
+        virtio_net_tx_kick();
+    }
+
+    /* Data in flight, or a closed window to probe */
+    if (!conn->rtx_armed && (in_flight(conn) > 0 || conn->tx_len > 0)) {
+        arm_rtx(conn);
+    }
 }
 
-int tcp_recv(int idx, void* buffer, int max_len) {
+/* RFC 6298 estimator: srtt scaled by 8, rttvar by 4 */
+static void rtt_sample(tcp_conn_t* conn, uint32_t rtt) {
+    int m = rtt > 0 ? (int)rtt : 1;
+    net_hist_add(&conn->rtt_hist, m);
+    if (conn->srtt == 0) {
+        conn->srtt = m << 3;
+        conn->rttvar = m << 1;
+    } else {
+        int delta = m - (conn->srtt >> 3);
+        conn->srtt += delta;
+        if (delta < 0) delta = -delta;
+        conn->rttvar += delta - (conn->rttvar >> 2);
+    }
+
+    uint32_t rto = (conn->srtt >> 3) + conn->rttvar;
+    if (rto < TCP_RTO_MIN_MS) rto = TCP_RTO_MIN_MS;
+    if (rto > TCP_RTO_MAX_MS) rto = TCP_RTO_MAX_MS;
+    conn->rto_ms = rto;
+}
+
+/* Process the peer's cumulative ACK and (unscaled) window. `pure` is set
+ * for segments without data, SYN or FIN (candidates for duplicate ACKs);
+ * `tsecr` is the echoed timestamp, 0 if none */
+static void tcp_ack(tcp_conn_t* conn, uint32_t ack, uint32_t window, int pure,
+                    uint32_t tsecr) {
+    if (seq_lt(conn->snd_max, ack)) return;     /* Acks data never sent */
+
+    if (seq_lt(conn->snd_una, ack)) {
+        uint32_t acked = ack - conn->snd_una;
+        uint32_t data = min_u32(acked, conn->tx_len);
+        conn->tx_head = (conn->tx_head + data) % TCP_TX_BUF_SIZE;
+        conn->tx_len -= data;
+        if (acked > data) conn->fin = FIN_ACKED;
+        conn->bytes_out += data;
+        conn->thru_bytes += data;
+        conn->snd_una = ack;
+        if (seq_lt(conn->seq_num, ack)) conn->seq_num = ack;   /* After go-back */
+        conn->snd_wnd = window;
+        conn->retries = 0;
+
+        /* The echoed timestamp times every ACK, retransmissions too */
+        if (tsecr != 0) {
+            rtt_sample(conn, timer_ms() - tsecr);
+            conn->rtt_timing = 0;
+        } else if (conn->rtt_timing && seq_leq(conn->rtt_seq, ack)) {
+            rtt_sample(conn, timer_ms() - conn->rtt_start);
+            conn->rtt_timing = 0;
+        }
+
+        if (conn->in_recovery) {
+            if (seq_leq(conn->recover, ack)) {
+                /* Everything sent before the loss is in: deflate */
+                conn->in_recovery = 0;
+                conn->cwnd = conn->ssthresh;
+            } else {
+                /* Partial ACK: the next segment was lost too */
+                retransmit_first(conn);
+                conn->cwnd = conn->cwnd > acked ? conn->cwnd - acked + conn->mss : conn->mss;
+            }
+        } else if (conn->cwnd < conn->ssthresh) {
+            conn->cwnd += min_u32(acked, conn->mss);              /* Slow start */
+        } else {
+            conn->cwnd += conn->mss * conn->mss / conn->cwnd + 1; /* Avoidance */
+        }
+        conn->dup_acks = 0;
+
+        conn->rtx_armed = 0;
+        if (in_flight(conn) > 0) arm_rtx(conn);
+    } else if (ack == conn->snd_una) {
+        if (pure && in_flight(conn) > 0 && window != 0 && window == conn->snd_wnd) {
+            conn->dup_acks++;
+            if (conn->in_recovery) {
+                conn->cwnd += conn->mss;    /* Each dup ACK: a segment left */
+            } else if (conn->dup_acks == 3 && seq_lt(conn->recover, ack)) {
+                /* Fast retransmit; NewReno recovery until `recover` is acked */
+                conn->ssthresh = in_flight(conn) / 2;
+                if (conn->ssthresh < 2 * conn->mss) conn->ssthresh = 2 * conn->mss;
+                conn->recover = conn->seq_num;
+                conn->in_recovery = 1;
+                stats.fast_retransmits++;
+                retransmit_first(conn);
+                conn->cwnd = conn->ssthresh + 3 * conn->mss;
+            }
+        }
+        conn->snd_wnd = window;
+    }
+
+    tcp_output(conn);
+}
+
+/* Retransmit timer expired */
+static void tcp_rto(tcp_conn_t* conn) {
+    conn->rtx_armed = 0;
+
+    uint32_t flight = in_flight(conn);
+    if (conn->snd_wnd == 0 && conn->tx_len > 0) {
+        /* Persist: probe the peer's closed window with one byte. A peer
+         * that keeps its window shut doesn't count as unreachable */
+        if (send_from_ring(conn, 0, 1, 0) == 1 && flight == 0) {
+            advance_seq(conn, 1);
+        }
+    } else if (flight > 0) {
+        stats.rto_timeouts++;
+        if (++conn->retries > TCP_MAX_RETRIES) {
+            conn_closed(conn);
+            return;
+        }
+        conn->ssthresh = flight / 2;
+        if (conn->ssthresh < 2 * conn->mss) conn->ssthresh = 2 * conn->mss;
+        conn->cwnd = conn->mss;
+        conn->recover = conn->seq_num;
+        conn->in_recovery = 0;
+        conn->dup_acks = 0;
+
+        /* Go back to snd_una and resend under slow start */
+        conn->seq_num = conn->snd_una;
+        if (conn->fin == FIN_SENT) conn->fin = FIN_QUEUED;
+    }
+    conn->rtt_timing = 0;
+
+    conn->rto_ms *= 2;
+    if (conn->rto_ms > TCP_RTO_MAX_MS) conn->rto_ms = TCP_RTO_MAX_MS;
+    arm_rtx(conn);
+    tcp_output(conn);
+}
+
+int tcp_send(int idx, const void* data, int len) {
     if (idx < 0 || idx >= MAX_TCP_CONNS) return -1;
 
     tcp_conn_t* conn = &connections[idx];
-    if (conn->rx_len == 0) return 0;
+    if (conn->state != TCP_ESTABLISHED) {
+        return -1;
+    }
 
-    int to_copy = conn->rx_len;
-    if (to_copy > max_len) to_copy = max_len;
+    /* Accept what fits in the send ring (in up to two pieces) */
+    int space = TCP_TX_BUF_SIZE - conn->tx_len;
+    if (len > space) len = space;
+    if (len <= 0) return 0;
 
-    memcpy(buffer, conn->rx_buffer, to_copy);
+    const uint8_t* ptr = (const uint8_t*)data;
+    int pos = (conn->tx_head + conn->tx_len) % TCP_TX_BUF_SIZE;
+    int first = len < TCP_TX_BUF_SIZE - pos ? len : TCP_TX_BUF_SIZE - pos;
+    memcpy(conn->tx_ring + pos, ptr, first);
+    memcpy(conn->tx_ring, ptr + first, len - first);
+    conn->tx_len += len;
+
+    tcp_output(conn);
+    return len;
+}
+
+int tcp_send_space(int idx) {
+    if (idx < 0 || idx >= MAX_TCP_CONNS) return 0;
+
+    tcp_conn_t* conn = &connections[idx];
+    if (conn->state != TCP_ESTABLISHED) return 0;
+    return TCP_TX_BUF_SIZE - conn->tx_len;
+}
 
-    /* Shift remaining data */
-    if (to_copy < conn->rx_len) {
-        memmove(conn->rx_buffer, conn->rx_buffer + to_copy, conn->rx_len - to_copy);
+int tcp_recv(int idx, void* buffer, int max_len) {
+    if (idx < 0 || idx >= MAX_TCP_CONNS) return -1;
+
+    tcp_conn_t* conn = &connections[idx];
+    uint8_t* out = (uint8_t*)buffer;
+    int copied = 0;
+
+    /* The one copy: RX buffer to caller, releasing drained segments */
+    while (copied < max_len && conn->rx_count > 0) {
+        tcp_seg_t* seg = &conn->rx_segs[conn->rx_head];
+        int n = seg->len;
+        if (n > max_len - copied) n = max_len - copied;
+
+        memcpy(out + copied, seg->data, n);
+        copied += n;
+        seg->data += n;
+        seg->len -= n;
+        if (seg->len == 0) {
+            net_rx_release(seg->buf);
+            conn->rx_head = (conn->rx_head + 1) % TCP_RX_SEGS;
+            conn->rx_count--;
+        }
     }
-    conn->rx_len -= to_copy;
+    conn->rx_len -= copied;
     conn->rx_ready = (conn->rx_len > 0);
 
-    return to_copy;
+    /* Out-of-order data that now fits moves in. ACK it, or send a window
+     * update once the window opened by two segments since it was last
+     * advertised (the peer may be stalled on it) */
+    uint32_t ack_before = conn->ack_num;
+    ooo_drain(conn);
+    int window = rx_window(conn);
+    if (conn->state == TCP_ESTABLISHED &&
+        (conn->ack_num != ack_before || window - (int)conn->wnd_sent >= 2 * TCP_MSS)) {
+        send_tcp_packet(conn, TCP_ACK, NULL, 0);
+    }
+
+    return copied;
 }
 
 int tcp_data_available(int idx) {
@@ -296,12 +1034,14 @@ void tcp_close(int idx) {
     if (idx < 0 || idx >= MAX_TCP_CONNS) return;
 
     tcp_conn_t* conn = &connections[idx];
+    rx_flush(conn);
     if (conn->state == TCP_ESTABLISHED) {
-        send_tcp_packet(conn, TCP_FIN | TCP_ACK, NULL, 0);
+        /* FIN follows whatever is still queued */
         conn->state = TCP_FIN_WAIT_1;
-        conn->timeout_tick = tcp_ticks + 5000;
+        conn->fin = FIN_QUEUED;
+        tcp_output(conn);
     } else {
-        conn->state = TCP_CLOSED;
+        conn_closed(conn);
     }
 }
 
@@ -310,35 +1050,137 @@ int tcp_get_state(int idx) {
     return connections[idx].state;
 }
 
-void tcp_poll(void) {
-    tcp_ticks++;
+tcp_conn_t* tcp_get_conn(int idx) {
+    if (idx < 0 || idx >= MAX_TCP_CONNS) return NULL;
+    return &connections[idx];
+}
+
+tcp_stats_t* tcp_get_stats(void) {
+    return &stats;
+}
 
+/* Close a throughput interval: a busy one adds its rate in KB/s */
+static void thru_sample(tcp_conn_t* conn) {
+    uint32_t elapsed = timer_ms() - conn->thru_start;
+    if (elapsed < TCP_THRU_INTERVAL_MS) return;
+
+    if (conn->thru_bytes > 0) {
+        net_hist_add(&conn->thru_hist,
+                     (uint32_t)((uint64_t)conn->thru_bytes * 1000 / elapsed / 1024));
+    }
+    conn->thru_start = timer_ms();
+    conn->thru_bytes = 0;
+}
+
+void tcp_poll(void) {
     /* Check for timeouts */
     for (int i = 0; i < MAX_TCP_CONNS; i++) {
         tcp_conn_t* conn = &connections[i];
         if (conn->state == TCP_CLOSED) continue;
 
-        if (tcp_ticks > conn->timeout_tick) {
-            if (conn->state == TCP_SYN_SENT) {
-                /* Retry SYN */
+        thru_sample(conn);
+
+        if (conn->rtx_armed && timer_expired(conn->rtx_deadline)) {
+            tcp_rto(conn);
+            if (conn->state == TCP_CLOSED) continue;
+        }
+
+        if (conn->ack_pending && timer_expired(conn->delack_deadline)) {
+            send_tcp_packet(conn, TCP_ACK, NULL, 0);
+        }
+
+        if (timer_expired(conn->timeout_ms)) {
+            if (conn->state == TCP_SYN_SENT || conn->state == TCP_SYN_RECEIVED) {
+                /* Retry SYN (or SYN-ACK) */
                 conn->retries++;
-                if (conn->retries > 5) {
-                    conn->state = TCP_CLOSED;
+                if (conn->retries > TCP_SYN_RETRIES) {
+                    conn_closed(conn);
                 } else {
-                    /* Reset seq_num for retry - SYN should use same seq */
-                    conn->seq_num--;
-                    send_tcp_packet(conn, TCP_SYN, NULL, 0);
-                    conn->timeout_tick = tcp_ticks + 500;
+                    send_syn(conn);
+                    conn->timeout_ms = timer_ms() + TCP_SYN_TIMEOUT_MS;
                 }
-            } else if (conn->state == TCP_FIN_WAIT_1 ||
+            } else if ((conn->state == TCP_FIN_WAIT_1 && conn->fin != FIN_QUEUED) ||
                        conn->state == TCP_FIN_WAIT_2 ||
                        conn->state == TCP_TIME_WAIT) {
-                conn->state = TCP_CLOSED;
+                /* (FIN_WAIT_1 counts from the FIN, not while data drains) */
+                conn_closed(conn);
             }
         }
     }
 }
 
+/* ==================== Handshake ==================== */
+
+/* Options take effect where both SYNs carried them */
+static void apply_syn_options(tcp_conn_t* conn, const tcp_opts_t* opts) {
+    conn->mss = opts->mss ? opts->mss : TCP_DEFAULT_MSS;
+    if (conn->mss > TCP_MSS) conn->mss = TCP_MSS;
+    if (opts->wscale >= 0) {
+        conn->ws_ok = 1;
+        conn->snd_wscale = opts->wscale;
+        conn->rcv_wscale = offered_wscale();
+    }
+    conn->sack_ok = opts->sack_ok;
+    conn->ts_ok = opts->ts_ok;
+    if (conn->ts_ok) {
+        conn->ts_recent = opts->tsval;
+        conn->mss -= TCP_TS_LEN;    /* Room in every segment */
+    }
+}
+
+/* Our SYN is acknowledged: the connection is up. The send side starts
+ * in slow start with the initial RTO */
+static void establish(tcp_conn_t* conn, uint32_t ack, uint32_t window) {
+    conn->state = TCP_ESTABLISHED;
+    conn->retries = 0;
+
+    conn->snd_una = ack;
+    conn->snd_max = ack;
+    conn->snd_wnd = window;
+    conn->cwnd = TCP_INIT_CWND * conn->mss;
+    conn->ssthresh = 0xFFFF;
+    conn->recover = ack - 1;
+    conn->rto_ms = TCP_RTO_INIT_MS;
+}
+
+/* Connections of a listener that tcp_accept() hasn't taken */
+static int backlog_count(int l) {
+    int n = 0;
+    for (int i = 0; i < MAX_TCP_CONNS; i++) {
+        if (connections[i].state != TCP_CLOSED &&
+            connections[i].listener == l + 1 && !connections[i].accepted) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/* A SYN for no connection: answer it if the port is listening and its
+ * backlog has room. Returns 0, or -1 if it is dropped */
+static int passive_open(struct ip_hdr* ip, uint16_t local_port, uint16_t remote_port,
+                        uint32_t seq, const tcp_opts_t* opts) {
+    int l = find_listener(local_port);
+    if (l < 0 || backlog_count(l) >= listeners[l].backlog) return -1;
+
+    int idx = find_free_conn();
+    if (idx < 0) return -1;
+
+    tcp_conn_t* conn = conn_setup(idx, ip->src_ip, local_port, remote_port);
+    conn->listener = l + 1;
+    conn->ack_num = seq + 1;
+    apply_syn_options(conn, opts);
+
+    conn->snd_una = get_initial_seq();
+    conn->seq_num = conn->snd_una;
+    conn->state = TCP_SYN_RECEIVED;
+    conn->timeout_ms = timer_ms() + TCP_SYN_TIMEOUT_MS;
+    conn->retries = 0;
+
+    send_syn(conn);
+    stats.passive_opens++;
+    return 0;
+}
+
 void tcp_handle_packet(struct eth_hdr* eth, struct ip_hdr* ip,
                        struct tcp_hdr* tcp, int len) {
     (void)eth;
@@ -352,27 +1194,72 @@ void tcp_handle_packet(struct eth_hdr* eth, struct ip_hdr* ip,
     uint32_t ack = ((uint32_t)tcp_bytes[8] << 24) | ((uint32_t)tcp_bytes[9] << 16) |
                    ((uint32_t)tcp_bytes[10] << 8) | tcp_bytes[11];
     uint8_t flags = tcp_bytes[13];
+    uint32_t window = (tcp_bytes[14] << 8) | tcp_bytes[15];
+
+    /* Calculate header and data length */
+    int tcp_hdr_len = (tcp->data_off >> 4) * 4;
+    if (tcp_hdr_len < 20 || tcp_hdr_len > len) {
+        stats.bad_header++;
+        return;
+    }
+    int data_len = len - tcp_hdr_len;
+    stats.segs_in++;
+    stats.bytes_in += data_len;
+    uint8_t* data = (uint8_t*)tcp + tcp_hdr_len;
+
+    tcp_opts_t opts;
+    parse_options(tcp_bytes + 20, tcp_hdr_len - 20, &opts);
 
     /* Find matching connection */
     int idx = find_conn(ip->src_ip, dest_port, src_port);
     if (idx < 0) {
-        /* No connection - ignore (could send RST in full impl) */
+        /* No connection: a listener may take a SYN, the rest is ignored
+         * (could send RST in full impl) */
+        if ((flags & (TCP_SYN | TCP_ACK | TCP_RST)) == TCP_SYN &&
+            passive_open(ip, dest_port, src_port, seq, &opts) == 0) {
+            return;
+        }
+        stats.no_conn++;
         return;
     }
 
     tcp_conn_t* conn = &connections[idx];
 
-    /* Calculate header and data length */
-    int tcp_hdr_len = (tcp->data_off >> 4) * 4;
-    int data_len = len - tcp_hdr_len;
-    uint8_t* data = (uint8_t*)tcp + tcp_hdr_len;
+    /* Windows are scaled on everything but a SYN */
+    if (!(flags & TCP_SYN)) window <<= conn->snd_wscale;
+
+    /* Timestamp to echo: the newest one at or before our last ACK */
+    if (conn->ts_ok && opts.ts_ok && seq_leq(seq, conn->last_ack_sent) &&
+        (int32_t)(opts.tsval - conn->ts_recent) >= 0) {
+        conn->ts_recent = opts.tsval;
+    }
 
     /* Handle RST */
     if (flags & TCP_RST) {
-        conn->state = TCP_CLOSED;
+        stats.rst_rx++;
+        conn_closed(conn);
         return;
     }
 
+    /* Handshake of a connection we accepted: a repeated SYN means our
+     * SYN-ACK was lost; the ACK of it establishes the connection, and may
+     * already carry data */
+    if (conn->state == TCP_SYN_RECEIVED) {
+        if (flags & TCP_SYN) {
+            send_syn(conn);
+            return;
+        }
+        if (!(flags & TCP_ACK) || ack != conn->snd_una + 1) return;
+        establish(conn, ack, window);
+    }
+
+    /* Acknowledgments and window updates for our data */
+    if ((flags & TCP_ACK) && conn->state != TCP_SYN_SENT) {
+        int pure = data_len == 0 && !(flags & (TCP_SYN | TCP_FIN));
+        tcp_ack(conn, ack, window, pure, conn->ts_ok && opts.ts_ok ? opts.tsecr : 0);
+        if (conn->state == TCP_CLOSED) return;
+    }
+
     /* State machine */
     switch (conn->state) {
         case TCP_SYN_SENT:
@@ -380,54 +1267,60 @@ void tcp_handle_packet(struct eth_hdr* eth, struct ip_hdr* ip,
                 /* Got SYN-ACK, send ACK */
                 conn->ack_num = seq + 1;
                 if (ack == conn->seq_num) {
-                    conn->state = TCP_ESTABLISHED;
+                    apply_syn_options(conn, &opts);
+                    establish(conn, ack, window);
+
                     /* Send ACK */
                     send_tcp_packet(conn, TCP_ACK, NULL, 0);
-                    conn->last_ack_sent = conn->ack_num;
                 }
             }
             break;
 
         case TCP_ESTABLISHED:
-            /* Update ack number for received data */
+            /* Queue data in place. Data past a hole waits in the
+             * out-of-order queue; the duplicate ACK tells the peer */
             if (data_len > 0) {
-                /* Copy data to receive buffer */
-                int space = TCP_RX_BUF_SIZE - conn->rx_len;
-                int to_copy = data_len;
-                if (to_copy > space) to_copy = space;
-
-                if (to_copy > 0) {
-                    memcpy(conn->rx_buffer + conn->rx_len, data, to_copy);
-                    conn->rx_len += to_copy;
-                    conn->rx_ready = 1;
+                uint32_t ack_before = conn->ack_num;
+                int had_hole = conn->ooo_count > 0;
+                if (seq_leq(seq, conn->ack_num)) {
+                    rx_accept(conn, seq, data, data_len);
+                } else {
+                    stats.ooo_segments++;
+                    ooo_insert(conn, seq, data, data_len);
                 }
 
-                conn->ack_num = seq + data_len;
-                /* Send ACK */
-                send_tcp_packet(conn, TCP_ACK, NULL, 0);
-                conn->last_ack_sent = conn->ack_num;
+                /* Delayed ACK: every second segment, or after
+                 * TCP_DELACK_MS. Duplicates and anything around a hole
+                 * are ACKed at once - the peer's recovery runs on those */
+                if (conn->ack_num == ack_before || had_hole ||
+                    conn->ooo_count > 0 || ++conn->ack_pending >= 2) {
+                    send_tcp_packet(conn, TCP_ACK, NULL, 0);
+                } else if (conn->ack_pending == 1) {
+                    conn->delack_deadline = timer_ms() + TCP_DELACK_MS;
+                }
             }
 
-            /* Handle FIN */
-            if (flags & TCP_FIN) {
-                conn->ack_num = seq + 1;
+            /* Handle FIN (only once all data before it is in) */
+            if ((flags & TCP_FIN) && conn->ack_num == seq + data_len) {
+                conn->ack_num = seq + data_len + 1;
                 send_tcp_packet(conn, TCP_ACK, NULL, 0);
                 conn->state = TCP_CLOSE_WAIT;
-                /* Send our FIN */
-                send_tcp_packet(conn, TCP_FIN | TCP_ACK, NULL, 0);
+                /* Send our FIN (after any data still queued) */
                 conn->state = TCP_LAST_ACK;
+                conn->fin = FIN_QUEUED;
+                tcp_output(conn);
             }
             break;
 
         case TCP_FIN_WAIT_1:
-            if (flags & TCP_ACK) {
+            if (conn->fin == FIN_ACKED) {
                 conn->state = TCP_FIN_WAIT_2;
             }
             if (flags & TCP_FIN) {
                 conn->ack_num = seq + 1;
                 send_tcp_packet(conn, TCP_ACK, NULL, 0);
                 conn->state = TCP_TIME_WAIT;
-                conn->timeout_tick = tcp_ticks + 2000;
+                conn->timeout_ms = timer_ms() + TCP_TIME_WAIT_MS;
             }
             break;
 
@@ -436,12 +1329,14 @@ void tcp_handle_packet(struct eth_hdr* eth, struct ip_hdr* ip,
                 conn->ack_num = seq + 1;
                 send_tcp_packet(conn, TCP_ACK, NULL, 0);
                 conn->state = TCP_TIME_WAIT;
-                conn->timeout_tick = tcp_ticks + 2000;
+                conn->timeout_ms = timer_ms() + TCP_TIME_WAIT_MS;
             }
             break;
 
         case TCP_LAST_ACK:
-            if (flags & TCP_ACK) {
+            if (conn->fin == FIN_ACKED) {
+                /* Graceful: data before the FIN stays readable until
+                 * tcp_close or slot reuse */
                 conn->state = TCP_CLOSED;
             }
             break;
@@ -4,6 +4,8 @@
  */
 
 #include "terminal.h"
+#include "bcache.h"
+#include "bench.h"
 #include "event.h"
 #include "font.h"
 #include "fs.h"
@@ -11,10 +13,17 @@
 #include "http.h"
 #include "keyboard.h"
 #include "memory.h"
+#include "mmu.h"
+#include "pcap.h"
+#include "prof.h"
+#include "sched.h"
+#include "smp.h"
+#include "arena.h"
 #include "tcp.h"
 #include "types.h"
 #include "virtio_blk.h"
 #include "virtio_input.h"
+#include "virtio_net.h"
 #include "websocket.h"
 
 /* Terminal configuration */
@@ -41,9 +50,6 @@ static uint32_t color_bg = DEFAULT_BG;
 static uint32_t color_text = DEFAULT_TEXT;
 static uint32_t color_prompt = DEFAULT_PROMPT;
 
-/* Uptime counter (incremented in main loop) */
-static uint64_t uptime_ticks = 0;
-
 /* Command buffer */
 static char cmd_buffer[MAX_CMD_LEN];
 static int cmd_pos = 0;
@@ -68,8 +74,25 @@ static int touch_scrolling = 0;
 static int touch_active = 0;
 static int32_t touch_x = 0, touch_y = 0;
 
-/* Display state */
-static int needs_redraw = 1;
+/*
+ * Display state. Only the parts flagged dirty are repainted; the
+ * history area is tracked per visible row so new output scrolls the
+ * existing pixels and renders just the new lines.
+ */
+#define DIRTY_TITLE 0x01
+#define DIRTY_HISTORY 0x02  /* History window changed */
+#define DIRTY_PROMPT 0x04
+#define DIRTY_KEYBOARD 0x08
+#define DIRTY_FULL 0x10     /* Clear and repaint everything */
+static int dirty = DIRTY_FULL;
+
+/* What the screen currently shows, in absolute history line numbers */
+static uint32_t history_total = 0; /* Lines ever added */
+static uint32_t drawn_start = 0;   /* First line shown on row 0 */
+static uint32_t drawn_end = 0;     /* One past the last line shown */
+static int drawn_kb_h = -1;        /* Keyboard height of that layout */
+static int drawn_indicator = 0;    /* Scroll indicator on row 0 */
+static uint8_t row_dirty[MAX_HISTORY];
 
 /* Close flag - when set, shell wants to return to home */
 static int want_close = 0;
@@ -81,6 +104,7 @@ static int back_btn_pressed = 0;
 static void shell_print(const char *str);
 static void shell_println(const char *str);
 static void execute_command(void);
+static void session_task_start(void);
 
 /* Helper: string compare */
 static int strcmp(const char *a, const char *b) {
@@ -103,6 +127,7 @@ static void history_add(const char *line) {
   }
   history[history_head][i] = 0;
   history_head = (history_head + 1) % MAX_HISTORY;
+  history_total++;
   if (history_count < MAX_HISTORY)
     history_count++;
 }
@@ -116,7 +141,7 @@ static void shell_flush(void) {
   }
   /* Auto-scroll to bottom when new content added */
   scroll_offset = 0;
-  needs_redraw = 1;
+  dirty |= DIRTY_HISTORY;
 }
 
 /* Scroll helpers */
@@ -126,14 +151,14 @@ static void scroll_up(int lines) {
   scroll_offset += lines;
   if (scroll_offset > max_scroll)
     scroll_offset = max_scroll;
-  needs_redraw = 1;
+  dirty |= DIRTY_HISTORY;
 }
 
 static void scroll_down(int lines) {
   scroll_offset -= lines;
   if (scroll_offset < 0)
     scroll_offset = 0;
-  needs_redraw = 1;
+  dirty |= DIRTY_HISTORY;
 }
 
 /* Print string (accumulates in line buffer) */
@@ -207,12 +232,18 @@ static void cmd_help(int argc, char **argv) {
   shell_println(" color   - Change colors");
   shell_println(" calc    - Calculator");
   shell_println(" touch   - Touch info/debug");
+  shell_println(" bench   - Run micro-benchmarks");
+  shell_println(" prof    - Sampling profiler");
+  shell_println(" netstat - Network counters");
+  shell_println(" pcap    - Packet capture");
   shell_println("Filesystem:");
   shell_println(" disk    - Disk info");
   shell_println(" ls      - List files");
   shell_println(" cat     - Read file");
   shell_println(" write   - Write file");
   shell_println(" rm      - Delete file");
+  shell_println(" mkdir   - Make directory");
+  shell_println(" sync    - Write changes to disk");
   shell_println(" format  - Format disk");
 }
 
@@ -221,7 +252,27 @@ static void cmd_clear(int argc, char **argv) {
   (void)argv;
   history_count = 0;
   history_head = 0;
-  needs_redraw = 1;
+  history_total = 0;
+  dirty |= DIRTY_FULL;
+}
+
+/* Print per-arena usage: name, live bytes, high-water mark, reserved */
+static void print_arena_stats(void) {
+  arena_t *a = arena_first();
+  if (!a)
+    return;
+  shell_println("Arenas (used/peak/reserved):");
+  for (; a; a = a->next_arena) {
+    shell_print("  ");
+    shell_print(a->name);
+    shell_print(": ");
+    print_dec(a->used);
+    shell_print("/");
+    print_dec(a->peak);
+    shell_print("/");
+    print_dec(a->reserved);
+    shell_println("");
+  }
 }
 
 static void cmd_heap(int argc, char **argv) {
@@ -234,6 +285,7 @@ static void cmd_heap(int argc, char **argv) {
   shell_print("  Used: ");
   print_dec(heap_used_bytes());
   shell_println(" bytes");
+  print_arena_stats();
 }
 
 static void cmd_reboot(int argc, char **argv) {
@@ -244,8 +296,9 @@ static void cmd_reboot(int argc, char **argv) {
   cmd_buffer[0] = 0;
   history_count = 0;
   history_head = 0;
+  history_total = 0;
   line_pos = 0;
-  needs_redraw = 1;
+  dirty |= DIRTY_FULL;
   /* Reinitialize terminal welcome message */
   shell_println("ClaudeOS Terminal v1.0");
   shell_println("Type 'help' for commands");
@@ -301,6 +354,9 @@ static void cmd_cpu(int argc, char **argv) {
     shell_println("Qualcomm");
   else
     shell_println("Unknown");
+  shell_print("  Cores online: ");
+  print_dec(smp_num_cpus());
+  shell_println("");
 }
 
 static void cmd_mem(int argc, char **argv) {
@@ -311,9 +367,12 @@ static void cmd_mem(int argc, char **argv) {
   shell_println("  Heap:    0x40210000 - 0x41F00000");
   shell_println("  FB:      0x42000000");
   shell_println("  VirtIO:  0x46000000");
+  shell_println(mmu_is_enabled() ? "  Caches:  on (0x42000000 - 0x47E00000 uncached)"
+                                 : "  Caches:  off");
   shell_print("  Free:    ");
   print_dec(heap_free_bytes());
   shell_println(" bytes");
+  print_arena_stats();
 }
 
 static void cmd_logo(int argc, char **argv) {
@@ -524,7 +583,7 @@ static void cmd_color(int argc, char **argv) {
     if (argc >= 4)
       color_prompt = parse_color(argv[3]);
   }
-  needs_redraw = 1;
+  dirty |= DIRTY_FULL;
   shell_println("Colors updated!");
 }
 
@@ -566,7 +625,9 @@ static void cmd_draw(int argc, char **argv) {
       }
     }
   }
+  goldfish_fb_damage_all();
   goldfish_fb_flush();
+  dirty |= DIRTY_FULL;
   shell_println("Graphics demo! Press key to return.");
 }
 
@@ -592,18 +653,47 @@ static void cmd_touch(int argc, char **argv) {
   shell_print(" y=");
   print_dec(ty);
   shell_flush();
+  shell_print("Events: ");
+  print_dec(event_coalesced());
+  shell_print(" coalesced, ");
+  print_dec(event_dropped());
+  shell_println(" dropped");
   shell_println("Use 'touch debug' to see events");
 }
 
+/* Per-session scratch arenas for network commands */
+static arena_t http_arena;
+static arena_t ws_arena;
+
 /* HTTP curl command - async/non-blocking */
-static http_request_t http_req;
+static http_request_t *http_req = NULL;
 static int http_active = 0;
+static int http_out_fd = -1;      /* curl -o: body streamed to this file */
+
+/* Drop the finished request and everything allocated for it */
+static void http_session_end(void) {
+  http_request_close(http_req);
+  http_req = NULL;
+  http_active = 0;
+  if (http_out_fd >= 0) {
+    fs_close(http_out_fd);
+    http_out_fd = -1;
+  }
+  arena_reset(&http_arena);
+}
 
 static void cmd_curl(int argc, char **argv) {
-  if (argc < 2) {
-    shell_println("Usage: curl <url>");
+  const char *url = argv[1];
+  const char *out = NULL;
+  if (argc == 4 && strcmp(argv[1], "-o") == 0) {
+    out = argv[2];
+    url = argv[3];
+  }
+  if (argc < 2 || (argc != 2 && !out)) {
+    shell_println("Usage: curl [-o <file>] <url>");
     shell_println("  curl http://example.com/");
     shell_println("  curl http://httpbin.org/ip");
+    shell_println("  curl -o page.html http://example.com/");
     return;
   }
 
@@ -612,19 +702,45 @@ static void cmd_curl(int argc, char **argv) {
     shell_println("Request already in progress");
     return;
   }
+  if (out && !fs_mounted()) {
+    shell_println("Filesystem not mounted");
+    return;
+  }
+
+  http_req = arena_calloc(&http_arena, sizeof(http_request_t));
+  if (!http_req) {
+    shell_println("Out of memory");
+    return;
+  }
 
   shell_print("Fetching ");
-  shell_println(argv[1]);
+  shell_println(url);
 
-  if (http_request_start(&http_req, HTTP_GET, argv[1], NULL, 0) == 0) {
-    http_active = 1;
-  } else {
+  if (http_request_start(http_req, HTTP_GET, url, NULL, 0) != 0) {
     shell_println("Failed to start request");
+    http_req = NULL;
+    arena_reset(&http_arena);
+    return;
   }
+
+  /* Stream the body to the file rather than buffering it */
+  if (out) {
+    http_out_fd = fs_open(out, FS_O_WRITE | FS_O_CREATE | FS_O_TRUNC);
+    if (http_out_fd < 0) {
+      shell_print("Cannot create: ");
+      shell_println(out);
+      http_session_end();
+      return;
+    }
+    http_request_set_fd(http_req, http_out_fd);
+  }
+
+  http_active = 1;
+  session_task_start();
 }
 
 /* WebSocket command */
-static websocket_t ws_conn;
+static websocket_t *ws_conn = NULL;
 static int ws_active = 0;
 
 static void cmd_ws(int argc, char **argv) {
@@ -647,18 +763,26 @@ static void cmd_ws(int argc, char **argv) {
       shell_println("Already connected. Use 'ws close' first.");
       return;
     }
+    ws_conn = arena_calloc(&ws_arena, sizeof(websocket_t));
+    if (!ws_conn) {
+      shell_println("Out of memory");
+      return;
+    }
     shell_print("Connecting to ");
     shell_println(argv[2]);
 
-    if (ws_connect(&ws_conn, argv[2]) == 0) {
+    if (ws_connect(ws_conn, argv[2]) == 0) {
       ws_active = 1;
+      session_task_start();
       shell_println("Connection started...");
       shell_println("Use 'ws status' to check");
     } else {
       shell_println("Connect failed!");
+      ws_conn = NULL;
+      arena_reset(&ws_arena);
     }
   } else if (strcmp(argv[1], "send") == 0) {
-    if (!ws_active || ws_get_state(&ws_conn) != WS_STATE_OPEN) {
+    if (!ws_active || ws_get_state(ws_conn) != WS_STATE_OPEN) {
       shell_println("Not connected!");
       return;
     }
@@ -678,23 +802,25 @@ static void cmd_ws(int argc, char **argv) {
     }
     msg[pos] = 0;
 
-    if (ws_send_text(&ws_conn, msg) >= 0) {
+    if (ws_send_text(ws_conn, msg) >= 0) {
       shell_print("Sent: ");
       shell_println(msg);
     } else {
       shell_println("Send failed!");
     }
   } else if (strcmp(argv[1], "ping") == 0) {
-    if (!ws_active || ws_get_state(&ws_conn) != WS_STATE_OPEN) {
+    if (!ws_active || ws_get_state(ws_conn) != WS_STATE_OPEN) {
       shell_println("Not connected!");
       return;
     }
-    ws_send_ping(&ws_conn);
+    ws_send_ping(ws_conn);
     shell_println("Ping sent");
   } else if (strcmp(argv[1], "close") == 0) {
     if (ws_active) {
-      ws_close(&ws_conn);
+      ws_close(ws_conn);
+      ws_conn = NULL;
       ws_active = 0;
+      arena_reset(&ws_arena);
       shell_println("Connection closed");
     } else {
       shell_println("Not connected");
@@ -704,7 +830,7 @@ static void cmd_ws(int argc, char **argv) {
       shell_println("State: Not connected");
       return;
     }
-    int state = ws_get_state(&ws_conn);
+    int state = ws_get_state(ws_conn);
     shell_print("State: ");
     switch (state) {
     case WS_STATE_CLOSED:
@@ -725,9 +851,9 @@ static void cmd_ws(int argc, char **argv) {
     }
 
     /* Check for messages */
-    if (ws_message_ready(&ws_conn)) {
+    if (ws_message_ready(ws_conn)) {
       char buf[256];
-      int len = ws_get_message(&ws_conn, buf, sizeof(buf));
+      int len = ws_get_message(ws_conn, buf, sizeof(buf));
       shell_print("Received (");
       print_dec(len);
       shell_println(" bytes):");
@@ -739,12 +865,12 @@ static void cmd_ws(int argc, char **argv) {
       return;
     }
     /* Poll WebSocket */
-    ws_poll(&ws_conn);
+    ws_poll(ws_conn);
     shell_println("Polled");
 
-    if (ws_message_ready(&ws_conn)) {
+    if (ws_message_ready(ws_conn)) {
       char buf[256];
-      int len = ws_get_message(&ws_conn, buf, sizeof(buf));
+      int len = ws_get_message(ws_conn, buf, sizeof(buf));
       shell_print("Message (");
       print_dec(len);
       shell_println(" bytes):");
@@ -854,6 +980,19 @@ static void cmd_disk(int argc, char **argv) {
   print_dec(mb);
   shell_println(" MB");
 
+  /* Block cache activity since boot */
+  bcache_stats_t cs;
+  bcache_stats(&cs);
+  shell_print("  Cache: ");
+  print_dec(cs.hits);
+  shell_print(" hits, ");
+  print_dec(cs.misses);
+  shell_print(" misses, ");
+  print_dec(cs.dirty);
+  shell_print(" dirty, ");
+  print_dec(cs.writebacks);
+  shell_println(" written");
+
   /* Filesystem status */
   if (fs_mounted()) {
     fs_stats_t stats;
@@ -875,8 +1014,6 @@ static void cmd_disk(int argc, char **argv) {
 }
 
 static void cmd_ls(int argc, char **argv) {
-  (void)argc;
-  (void)argv;
   if (!fs_mounted()) {
     shell_println("Filesystem not mounted");
     shell_println("Use 'format' to format disk");
@@ -884,7 +1021,7 @@ static void cmd_ls(int argc, char **argv) {
   }
 
   fs_dirent_t entries[32];
-  int count = fs_readdir("/", entries, 32);
+  int count = fs_readdir(argc > 1 ? argv[1] : "/", entries, 32);
 
   if (count < 0) {
     shell_println("Error reading directory");
@@ -900,6 +1037,10 @@ static void cmd_ls(int argc, char **argv) {
   for (int i = 0; i < count; i++) {
     shell_print("  ");
     shell_print(entries[i].name);
+    if (entries[i].flags & FS_FLAG_DIR) {
+      shell_println("/");
+      continue;
+    }
     shell_print("  ");
     print_dec(entries[i].size);
     shell_println(" bytes");
@@ -1023,6 +1164,39 @@ static void cmd_rm(int argc, char **argv) {
   }
 }
 
+static void cmd_mkdir(int argc, char **argv) {
+  if (argc < 2) {
+    shell_println("Usage: mkdir <dir>");
+    return;
+  }
+  if (!fs_mounted()) {
+    shell_println("Filesystem not mounted");
+    return;
+  }
+
+  if (fs_mkdir(argv[1]) == 0) {
+    shell_print("Created: ");
+    shell_println(argv[1]);
+  } else {
+    shell_print("Cannot create: ");
+    shell_println(argv[1]);
+  }
+}
+
+static void cmd_sync(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  if (!fs_mounted()) {
+    shell_println("Filesystem not mounted");
+    return;
+  }
+  if (fs_sync() == 0) {
+    shell_println("Synced");
+  } else {
+    shell_println("Sync failed!");
+  }
+}
+
 static void cmd_format(int argc, char **argv) {
   (void)argc;
   (void)argv;
@@ -1047,6 +1221,357 @@ static void cmd_format(int argc, char **argv) {
   }
 }
 
+/* ==================== Benchmarks ==================== */
+
+static void cmd_bench(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  static bench_result_t results[BENCH_MAX_RESULTS];
+  char line[BENCH_LINE_LEN];
+
+  shell_println("Running benchmarks...");
+  int count = bench_run_all(results, BENCH_MAX_RESULTS);
+  if (count == 0) {
+    shell_println("Out of memory");
+    return;
+  }
+
+  shell_println("name            iters       cyc/op         time     MB/s");
+  for (int i = 0; i < count; i++) {
+    bench_format(&results[i], line, sizeof(line));
+    shell_println(line);
+  }
+
+  if (bench_save(results, count) == 0) {
+    shell_println("Saved to " BENCH_LOG_FILE);
+  } else {
+    shell_println("Not saved (no filesystem)");
+  }
+  dirty |= DIRTY_FULL;
+}
+
+/* ==================== Profiler ==================== */
+
+#define PROF_TOP_DEFAULT 10
+#define PROF_TOP_MAX 20
+
+static void prof_print_report(int top) {
+  static prof_entry_t entries[PROF_TOP_MAX];
+  uint32_t total = prof_samples();
+  uint32_t kept = total < PROF_RING_SIZE ? total : PROF_RING_SIZE;
+  if (kept == 0) {
+    shell_println("No samples");
+    return;
+  }
+
+  print_dec(total);
+  shell_print(" samples (last ");
+  print_dec(kept);
+  shell_println(" kept)");
+  int count = prof_report(entries, top);
+  for (int i = 0; i < count; i++) {
+    /* Percentage with one decimal */
+    uint32_t permille = entries[i].count * 1000 / kept;
+    shell_print("  ");
+    if (permille < 100)
+      shell_print(" ");
+    print_dec(permille / 10);
+    shell_print(".");
+    print_dec(permille % 10);
+    shell_print("%  ");
+    shell_println(entries[i].name ? entries[i].name : "(unknown)");
+  }
+}
+
+static void cmd_prof(int argc, char **argv) {
+  if (argc < 2) {
+    shell_println("Usage: prof start [timer] | stop | report [n] | dump <file>");
+    return;
+  }
+
+  if (strcmp(argv[1], "start") == 0) {
+    int want = PROF_SOURCE_PMU;
+    if (argc > 2 && strcmp(argv[2], "timer") == 0)
+      want = PROF_SOURCE_TIMER;
+    int source = prof_start(want);
+    if (source < 0) {
+      shell_println("Profiler failed to start");
+    } else if (source == PROF_SOURCE_PMU) {
+      shell_println("Sampling on PMU cycle overflow");
+    } else {
+      shell_println(want == PROF_SOURCE_PMU ? "No PMU, sampling on timer"
+                                            : "Sampling on timer");
+    }
+  } else if (strcmp(argv[1], "stop") == 0) {
+    prof_stop();
+    print_dec(prof_samples());
+    shell_println(" samples");
+  } else if (strcmp(argv[1], "report") == 0) {
+    int top = PROF_TOP_DEFAULT;
+    if (argc > 2) {
+      top = 0;
+      for (char *p = argv[2]; *p >= '0' && *p <= '9'; p++)
+        top = top * 10 + (*p - '0');
+      if (top < 1)
+        top = 1;
+      if (top > PROF_TOP_MAX)
+        top = PROF_TOP_MAX;
+    }
+    prof_print_report(top);
+  } else if (strcmp(argv[1], "dump") == 0) {
+    if (argc < 3) {
+      shell_println("Usage: prof dump <file>");
+      return;
+    }
+    if (!fs_mounted()) {
+      shell_println("Filesystem not mounted");
+      return;
+    }
+    int n = prof_dump(argv[2]);
+    if (n < 0) {
+      shell_println("Dump failed");
+      return;
+    }
+    print_dec(n);
+    shell_print(" samples written to ");
+    shell_println(argv[2]);
+  } else {
+    shell_println("Usage: prof start [timer] | stop | report [n] | dump <file>");
+  }
+  dirty |= DIRTY_FULL;
+}
+
+/* ==================== Network statistics ==================== */
+
+static const char *tcp_state_names[] = {
+    "CLOSED",     "SYN_SENT",  "ESTABLISHED", "FIN_WAIT_1",  "FIN_WAIT_2",
+    "CLOSE_WAIT", "LAST_ACK",  "TIME_WAIT",   "SYN_RECEIVED"};
+
+/* " label value", wrapping to an indented line when it might not fit */
+static void stat_item(const char *label, uint64_t val) {
+  if (line_pos > CHARS_PER_LINE - 18) {
+    shell_flush();
+    shell_print("   ");
+  }
+  shell_print(" ");
+  shell_print(label);
+  shell_print(" ");
+  print_dec(val);
+}
+
+/* Summary line, then the non-empty buckets as "low-high:count" */
+static void print_hist(const char *name, const char *unit,
+                       const net_hist_t *h) {
+  shell_print("  ");
+  shell_print(name);
+  if (h->samples == 0) {
+    shell_println(": no samples");
+    return;
+  }
+  shell_print(" (");
+  shell_print(unit);
+  shell_print("):");
+  stat_item("n", h->samples);
+  stat_item("avg", h->sum / h->samples);
+  stat_item("max", h->max);
+  shell_flush();
+
+  shell_print("   ");
+  for (int b = 0; b < NET_HIST_BUCKETS; b++) {
+    if (h->count[b] == 0)
+      continue;
+    if (line_pos > CHARS_PER_LINE - 20) {
+      shell_flush();
+      shell_print("   ");
+    }
+    uint32_t low = b ? 1u << (b - 1) : 0;
+    shell_print(" ");
+    print_dec(low);
+    if (b == NET_HIST_BUCKETS - 1) {
+      shell_print("+");
+    } else if (b > 1) {
+      shell_print("-");
+      print_dec((1u << b) - 1);
+    }
+    shell_print(":");
+    print_dec(h->count[b]);
+  }
+  shell_flush();
+}
+
+static void netstat_summary(void) {
+  net_link_stats_t *link = virtio_net_get_stats();
+  net_stats_t *ns = net_get_stats();
+  tcp_stats_t *ts = tcp_get_stats();
+
+  shell_print("Link: rx");
+  stat_item("pkts", link->rx_packets);
+  stat_item("bytes", link->rx_bytes);
+  shell_print(", tx");
+  stat_item("pkts", link->tx_packets);
+  stat_item("bytes", link->tx_bytes);
+  shell_flush();
+  shell_print("  drops:");
+  stat_item("ring full", link->tx_ring_full);
+  stat_item("too big", link->tx_too_big);
+  stat_item("runts", link->rx_runts);
+  stat_item("hold full", link->rx_hold_full);
+  shell_flush();
+  shell_print(" ");
+  stat_item("kicks", link->tx_kicks);
+  shell_flush();
+
+  shell_print("IP: in");
+  stat_item("arp", ns->arp_rx);
+  stat_item("ip", ns->ip_rx);
+  stat_item("icmp", ns->icmp_rx);
+  stat_item("udp", ns->udp_rx);
+  stat_item("tcp", ns->tcp_rx);
+  shell_flush();
+  shell_print("  drops:");
+  stat_item("bad hdr", ns->rx_malformed);
+  stat_item("not ours", ns->rx_not_ours);
+  stat_item("unknown", ns->rx_unknown);
+  stat_item("csum", ns->rx_bad_csum);
+  shell_flush();
+
+  shell_print("ARP:");
+  stat_item("requests", ns->arp_requests);
+  stat_item("replies", ns->arp_replies);
+  stat_item("misses", ns->arp_miss);
+  stat_item("held", ns->arp_held);
+  shell_flush();
+  shell_print("  drops:");
+  stat_item("hold full", ns->arp_hold_full);
+  stat_item("unresolved", ns->arp_unresolved);
+  shell_flush();
+
+  shell_print("TCP: in");
+  stat_item("segs", ts->segs_in);
+  stat_item("bytes", ts->bytes_in);
+  shell_print(", out");
+  stat_item("segs", ts->segs_out);
+  stat_item("bytes", ts->bytes_out);
+  shell_flush();
+  shell_print(" ");
+  stat_item("retransmits", ts->retransmits);
+  stat_item("rto", ts->rto_timeouts);
+  stat_item("fast", ts->fast_retransmits);
+  stat_item("ooo", ts->ooo_segments);
+  stat_item("dup", ts->dup_segments);
+  shell_flush();
+  shell_print("  drops:");
+  stat_item("no conn", ts->no_conn);
+  stat_item("bad hdr", ts->bad_header);
+  stat_item("ooo", ts->ooo_dropped);
+  stat_item("tx fail", ts->tx_fail);
+  shell_flush();
+  shell_print("  opens:");
+  stat_item("active", ts->active_opens);
+  stat_item("passive", ts->passive_opens);
+  stat_item("resets in", ts->rst_rx);
+  shell_flush();
+}
+
+static void netstat_conns(void) {
+  int shown = 0;
+  for (int i = 0; i < MAX_TCP_CONNS; i++) {
+    tcp_conn_t *c = tcp_get_conn(i);
+    if (c->state == TCP_CLOSED)
+      continue;
+
+    char ip[16];
+    net_ip_to_str(c->remote_ip, ip);
+    shell_print("#");
+    print_dec(i);
+    shell_print(" :");
+    print_dec(c->local_port);
+    shell_print(" -> ");
+    shell_print(ip);
+    shell_print(":");
+    print_dec(c->remote_port);
+    shell_print(" ");
+    shell_println(tcp_state_names[c->state]);
+
+    shell_print(" ");
+    stat_item("in", c->bytes_in);
+    stat_item("out", c->bytes_out);
+    stat_item("retrans", c->retransmits);
+    stat_item("srtt", c->srtt >> 3);
+    stat_item("rto", c->rto_ms);
+    shell_flush();
+    print_hist("rtt", "ms", &c->rtt_hist);
+    print_hist("throughput", "KB/s", &c->thru_hist);
+    shown++;
+  }
+  if (shown == 0)
+    shell_println("No open connections");
+}
+
+static void cmd_netstat(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "conn") == 0) {
+    netstat_conns();
+  } else if (argc > 1) {
+    shell_println("Usage: netstat [conn]");
+  } else {
+    netstat_summary();
+  }
+  dirty |= DIRTY_FULL;
+}
+
+static void cmd_pcap(int argc, char **argv) {
+  if (argc < 2) {
+    shell_println("Usage: pcap start [n] | stop | save <file>");
+    return;
+  }
+
+  if (strcmp(argv[1], "start") == 0) {
+    int frames = PCAP_DEFAULT_FRAMES;
+    if (argc > 2) {
+      frames = 0;
+      for (char *p = argv[2]; *p >= '0' && *p <= '9'; p++)
+        frames = frames * 10 + (*p - '0');
+      if (frames < 1)
+        frames = 1;
+      if (frames > PCAP_MAX_FRAMES)
+        frames = PCAP_MAX_FRAMES;
+    }
+    if (pcap_start(frames) != 0) {
+      shell_println("Out of memory");
+      return;
+    }
+    shell_print("Capturing, last ");
+    print_dec(frames);
+    shell_println(" frames kept");
+  } else if (strcmp(argv[1], "stop") == 0) {
+    pcap_stop();
+    print_dec(pcap_frames());
+    shell_print(" frames (last ");
+    print_dec(pcap_kept());
+    shell_println(" kept)");
+  } else if (strcmp(argv[1], "save") == 0) {
+    if (argc < 3) {
+      shell_println("Usage: pcap save <file>");
+      return;
+    }
+    if (!fs_mounted()) {
+      shell_println("Filesystem not mounted");
+      return;
+    }
+    int n = pcap_save(argv[2]);
+    if (n < 0) {
+      shell_println("Save failed");
+      return;
+    }
+    print_dec(n);
+    shell_print(" frames written to ");
+    shell_println(argv[2]);
+  } else {
+    shell_println("Usage: pcap start [n] | stop | save <file>");
+  }
+  dirty |= DIRTY_FULL;
+}
+
 /* Command table */
 struct command {
   const char *name;
@@ -1073,12 +1598,18 @@ static struct command commands[] = {{"help", cmd_help},
                                     {"touch", cmd_touch},
                                     {"curl", cmd_curl},
                                     {"ws", cmd_ws},
+                                    {"bench", cmd_bench},
+                                    {"prof", cmd_prof},
+                                    {"netstat", cmd_netstat},
+                                    {"pcap", cmd_pcap},
                                     /* Filesystem commands */
                                     {"disk", cmd_disk},
                                     {"ls", cmd_ls},
                                     {"cat", cmd_cat},
                                     {"write", cmd_write},
                                     {"rm", cmd_rm},
+                                    {"mkdir", cmd_mkdir},
+                                    {"sync", cmd_sync},
                                     {"format", cmd_format},
                                     {NULL, NULL}};
 
@@ -1141,19 +1672,23 @@ void terminal_init(void) {
   cmd_buffer[0] = 0;
   history_count = 0;
   history_head = 0;
+  history_total = 0;
   line_pos = 0;
   shift_held = 0;
   touch_active = 0;
   scroll_offset = 0;
   touch_scrolling = 0;
-  needs_redraw = 1;
-  uptime_ticks = 0;
+  dirty = DIRTY_FULL;
   want_close = 0;
   back_btn_pressed = 0;
 
   /* Initialize boot timer */
   boot_counter = read_cntpct();
 
+  /* Scratch arenas (no-op after the first session) */
+  arena_init(&http_arena, "http", sizeof(http_request_t));
+  arena_init(&ws_arena, "ws", sizeof(websocket_t));
+
   /* Initialize soft keyboard */
   uint32_t w = goldfish_fb_get_width();
   uint32_t h = goldfish_fb_get_height();
@@ -1169,19 +1704,19 @@ void terminal_init(void) {
 static void poll_network_tasks(void) {
   /* Poll active HTTP request */
   if (http_active) {
-    int state = http_request_poll(&http_req);
+    int state = http_request_poll(http_req);
     if (state == HTTP_STATE_DONE) {
       /* Request complete - show response */
       shell_print("HTTP ");
-      print_dec(http_req.response.status_code);
+      print_dec(http_req->response.status_code);
       shell_print(" (");
-      print_dec(http_req.response.body_len);
+      print_dec(http_req->response.body_total);
       shell_println(" bytes)");
 
-      /* Print body */
-      if (http_req.response.body_len > 0) {
-        char *p = http_req.response.body;
-        while (*p && (p - http_req.response.body) < 500) {
+      /* Print body (or nothing, when it went to a file) */
+      if (http_req->response.body_len > 0) {
+        char *p = http_req->response.body;
+        while (*p && (p - http_req->response.body) < 500) {
           if (*p == '\n') {
             shell_flush();
           } else if (*p != '\r') {
@@ -1193,30 +1728,44 @@ static void poll_network_tasks(void) {
         }
         if (line_pos > 0)
           shell_flush();
-        if (http_req.response.body_len > 500)
+        if (http_req->response.body_total > 500)
           shell_println("...");
       }
-      http_request_close(&http_req);
-      http_active = 0;
-      needs_redraw = 1;
+      if (http_out_fd >= 0)
+        shell_println("Saved");
+      http_session_end();
+      dirty |= DIRTY_HISTORY;
     } else if (state == HTTP_STATE_ERROR) {
-      shell_println("HTTP request failed");
-      http_request_close(&http_req);
-      http_active = 0;
-      needs_redraw = 1;
+      shell_println(http_out_fd >= 0 ? "HTTP request failed (file incomplete)"
+                                     : "HTTP request failed");
+      http_session_end();
+      dirty |= DIRTY_HISTORY;
     }
   }
 
   /* Poll active WebSocket */
   if (ws_active) {
-    ws_poll(&ws_conn);
+    ws_poll(ws_conn);
   }
 }
 
-void terminal_tick(void) {
-  uptime_ticks++;
-  /* Poll network tasks every tick (non-blocking) */
+/* Background task for curl/ws sessions; retires when both are idle */
+static int session_task_id = -1;
+
+static int session_task(void *arg) {
+  (void)arg;
   poll_network_tasks();
+  if (!http_active && !ws_active) {
+    session_task_id = -1;
+    return SCHED_DONE;
+  }
+  return 1;
+}
+
+static void session_task_start(void) {
+  if (session_task_id < 0)
+    session_task_id =
+        sched_add("term-net", session_task, NULL, NULL, SCHED_PRIO_LOW);
 }
 
 int terminal_update(void) {
@@ -1240,10 +1789,13 @@ int terminal_update(void) {
       cmd_buffer[cmd_pos++] = kb_char;
       cmd_buffer[cmd_pos] = 0;
     }
-    needs_redraw = 1;
+    dirty |= DIRTY_PROMPT | DIRTY_KEYBOARD;
   }
 
-  while (event_pop(&ev) == 0) {
+  input_event_t batch[EVENT_BATCH_MAX];
+  int batch_len = event_pop_batch(batch, EVENT_BATCH_MAX);
+  for (int ei = 0; ei < batch_len; ei++) {
+    ev = batch[ei];
 
     if (ev.type == EVENT_KEY) {
       /* Handle shift keys */
@@ -1270,25 +1822,25 @@ int terminal_update(void) {
         cmd_pos = 0;
         cmd_buffer[0] = 0;
         scroll_offset = 0; /* Scroll to bottom on command */
-        needs_redraw = 1;
+        dirty |= DIRTY_PROMPT;
       } else if (ev.code == KEY_BACKSPACE) {
         if (cmd_pos > 0) {
           cmd_pos--;
           cmd_buffer[cmd_pos] = 0;
-          needs_redraw = 1;
+          dirty |= DIRTY_PROMPT;
         }
       } else {
         char c = keycode_to_char(ev.code);
         if (c && cmd_pos < MAX_CMD_LEN - 1) {
           cmd_buffer[cmd_pos++] = c;
           cmd_buffer[cmd_pos] = 0;
-          needs_redraw = 1;
+          dirty |= DIRTY_PROMPT;
         }
       }
     } else if (ev.type == EVENT_TOUCH) {
       /* Let keyboard handle touch first */
       if (keyboard_handle_touch(ev.subtype, ev.x, ev.y)) {
-        needs_redraw = 1;
+        dirty |= DIRTY_KEYBOARD;
         continue;
       }
 
@@ -1312,7 +1864,7 @@ int terminal_update(void) {
         } else {
           back_btn_pressed = 0;
         }
-        needs_redraw = 1;
+        dirty |= DIRTY_TITLE;
       } else if (ev.subtype == TOUCH_MOVE) {
         touch_active = 1;
         touch_x = ev.x;
@@ -1327,13 +1879,14 @@ int terminal_update(void) {
           touch_start_y = ev.y;
           touch_scrolling = 1;
           back_btn_pressed = 0; /* Cancel button press on scroll */
+          dirty |= DIRTY_TITLE;
         } else if (dy < -scroll_threshold) {
           scroll_up(1);
           touch_start_y = ev.y;
           touch_scrolling = 1;
           back_btn_pressed = 0; /* Cancel button press on scroll */
+          dirty |= DIRTY_TITLE;
         }
-        needs_redraw = 1;
       } else if (ev.subtype == TOUCH_UP) {
         /* Scale touch coords */
         uint32_t width = goldfish_fb_get_width();
@@ -1353,7 +1906,7 @@ int terminal_update(void) {
         back_btn_pressed = 0;
         touch_active = 0;
         touch_scrolling = 0;
-        needs_redraw = 1;
+        dirty |= DIRTY_TITLE;
       } else if (ev.subtype == TOUCH_SCROLL_UP) {
         scroll_up(ev.y > 0 ? ev.y : 1);
       } else if (ev.subtype == TOUCH_SCROLL_DOWN) {
@@ -1362,7 +1915,7 @@ int terminal_update(void) {
     }
   }
 
-  return needs_redraw;
+  return dirty != 0;
 }
 
 /* Draw a left arrow icon */
@@ -1436,17 +1989,22 @@ static void draw_title_bar(uint32_t *fb, uint32_t width, int btn_pressed) {
   }
 }
 
+/* Fill full-width pixel rows and report them as damaged */
+static void fill_rows(uint32_t *fb, uint32_t width, int y, int h,
+                      uint32_t color) {
+  if (h <= 0)
+    return;
+  uint32_t *p = fb + (uint32_t)y * width;
+  for (uint32_t i = 0; i < (uint32_t)h * width; i++)
+    p[i] = color;
+  goldfish_fb_damage(0, y, width, h);
+}
+
 void terminal_draw(void) {
   uint32_t *fb = goldfish_fb_get_buffer();
   uint32_t width = goldfish_fb_get_width();
   uint32_t height = goldfish_fb_get_height();
 
-  /* Clear screen */
-  goldfish_fb_clear(color_bg);
-
-  /* Draw title bar */
-  draw_title_bar(fb, width, back_btn_pressed);
-
   /* Adjust available height for title bar and keyboard */
   int kb_h = keyboard_get_height();
   int available_height = height - kb_h - TITLE_BAR_HEIGHT;
@@ -1454,22 +2012,80 @@ void terminal_draw(void) {
 
   /* Calculate visible lines */
   int line_height = FONT_HEIGHT + 2;
+  int hist_y = content_start_y + 10;
+  int prompt_y = height - kb_h - line_height - 10;
   max_visible_lines = (available_height - line_height - 20) / line_height;
+  if (max_visible_lines < 0)
+    max_visible_lines = 0;
+  if (max_visible_lines > MAX_HISTORY)
+    max_visible_lines = MAX_HISTORY;
+
+  /* Calculate view window with scroll offset (absolute line numbers) */
+  uint32_t first_valid = history_total - history_count;
+  uint32_t end = history_total - scroll_offset;
+  uint32_t start = end - max_visible_lines;
+  if ((int32_t)(start - first_valid) < 0)
+    start = first_valid;
+  if ((int32_t)(end - first_valid) < 0)
+    end = first_valid;
+
+  /* A keyboard toggle moves everything */
+  if (kb_h != drawn_kb_h)
+    dirty |= DIRTY_FULL;
+
+  if (dirty & DIRTY_FULL) {
+    goldfish_fb_clear(color_bg);
+    dirty = DIRTY_TITLE | DIRTY_PROMPT | DIRTY_KEYBOARD;
+    for (int r = 0; r < max_visible_lines; r++)
+      row_dirty[r] = 1;
+  } else {
+    /* Scroll the pixels of rows that stay visible */
+    int delta = (int32_t)(start - drawn_start);
+    int shifted = delta != 0 && delta > -max_visible_lines &&
+                  delta < max_visible_lines;
+    if (shifted) {
+      int keep = max_visible_lines - (delta > 0 ? delta : -delta);
+      int src = hist_y + (delta > 0 ? delta * line_height : 0);
+      int dst = hist_y + (delta > 0 ? 0 : -delta * line_height);
+      memmove(fb + (uint32_t)dst * width, fb + (uint32_t)src * width,
+              (uint32_t)keep * line_height * width * 4);
+      goldfish_fb_damage(0, hist_y, width, max_visible_lines * line_height);
+    }
+
+    /* A row is still correct if the same line (or blank) moved into it */
+    for (int r = 0; r < max_visible_lines; r++) {
+      int q = r + delta;
+      uint32_t line = start + r;
+      int shown = (int32_t)(line - end) < 0;
+      int was_shown = (int32_t)(line - drawn_end) < 0;
+      if ((delta != 0 && !shifted) || q < 0 || q >= max_visible_lines ||
+          shown != was_shown)
+        row_dirty[r] = 1;
+    }
+  }
 
-  /* Calculate view window with scroll offset */
-  int end_line = history_count - scroll_offset;
-  int start_line = end_line - max_visible_lines;
-  if (start_line < 0)
-    start_line = 0;
-  if (end_line < 0)
-    end_line = 0;
+  /* The scroll indicator shares row 0 */
+  if ((drawn_indicator || scroll_offset > 0) && max_visible_lines > 0)
+    row_dirty[0] = 1;
 
-  /* Draw history */
-  int y = content_start_y + 10;
-  for (int i = start_line; i < end_line; i++) {
-    int idx = (history_head - history_count + i + MAX_HISTORY) % MAX_HISTORY;
-    draw_string(fb, 10, y, history[idx], color_text, width, height);
-    y += line_height;
+  /* Draw title bar */
+  if (dirty & DIRTY_TITLE) {
+    draw_title_bar(fb, width, back_btn_pressed);
+    goldfish_fb_damage(0, 0, width, TITLE_BAR_HEIGHT);
+  }
+
+  /* Draw history rows that changed */
+  for (int r = 0; r < max_visible_lines; r++) {
+    if (!row_dirty[r])
+      continue;
+    row_dirty[r] = 0;
+    int y = hist_y + r * line_height;
+    fill_rows(fb, width, y, line_height, color_bg);
+    uint32_t line = start + r;
+    if ((int32_t)(line - end) < 0) {
+      draw_string(fb, 10, y, history[line % MAX_HISTORY], color_text, width,
+                  height);
+    }
   }
 
   /* Draw scroll indicator if scrolled */
@@ -1489,23 +2105,32 @@ void terminal_draw(void) {
   }
 
   /* Draw prompt and current command */
-  char prompt[MAX_CMD_LEN + 4];
-  prompt[0] = '>';
-  prompt[1] = ' ';
-  for (int i = 0; i <= cmd_pos; i++) {
-    prompt[i + 2] = cmd_buffer[i];
-  }
-  /* Add cursor */
-  prompt[cmd_pos + 2] = '_';
-  prompt[cmd_pos + 3] = 0;
+  if (dirty & DIRTY_PROMPT) {
+    char prompt[MAX_CMD_LEN + 4];
+    prompt[0] = '>';
+    prompt[1] = ' ';
+    for (int i = 0; i <= cmd_pos; i++) {
+      prompt[i + 2] = cmd_buffer[i];
+    }
+    /* Add cursor */
+    prompt[cmd_pos + 2] = '_';
+    prompt[cmd_pos + 3] = 0;
 
-  int prompt_y = height - kb_h - line_height - 10;
-  draw_string(fb, 10, prompt_y, prompt, color_prompt, width, height);
+    fill_rows(fb, width, prompt_y, line_height, color_bg);
+    draw_string(fb, 10, prompt_y, prompt, color_prompt, width, height);
+  }
 
-  /* Draw soft keyboard if visible */
-  keyboard_draw(fb, width, height);
+  /* Draw soft keyboard if visible (it blends, so clear under it first) */
+  if ((dirty & DIRTY_KEYBOARD) && kb_h > 0) {
+    fill_rows(fb, width, height - kb_h, kb_h, color_bg);
+    keyboard_draw(fb, width, height);
+  }
 
-  needs_redraw = 0;
+  drawn_start = start;
+  drawn_end = end;
+  drawn_kb_h = kb_h;
+  drawn_indicator = scroll_offset > 0;
+  dirty = 0;
 }
 
 int terminal_should_close(void) { return want_close; }
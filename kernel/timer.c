@@ -0,0 +1,82 @@
+/*
+ * TinyOS Kernel Timebase
+ *
+ * The EL1 virtual timer raises a PPI every 1/TIMER_HZ seconds so that
+ * WFI always wakes up in time for the next deadline. Millisecond time is
+ * derived from CNTVCT_EL0 directly, so it stays correct even if ticks are
+ * delayed by masked interrupts.
+ */
+
+#include "timer.h"
+#include "gic.h"
+
+/* CNTV_CTL_EL0 bits */
+#define CNTV_CTL_ENABLE     (1 << 0)
+#define CNTV_CTL_IMASK      (1 << 1)
+
+static uint32_t cntfrq = 0;
+static uint32_t tick_interval = 0;     /* Counter ticks per timer tick */
+static uint64_t boot_count = 0;
+static volatile uint64_t tick_count = 0;
+
+static inline uint64_t read_cntvct(void) {
+    uint64_t val;
+    __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cntv_tval(uint32_t val) {
+    __asm__ volatile("msr cntv_tval_el0, %0" : : "r"((uint64_t)val));
+}
+
+static inline void write_cntv_ctl(uint32_t val) {
+    __asm__ volatile("msr cntv_ctl_el0, %0; isb" : : "r"((uint64_t)val));
+}
+
+static void timer_irq(uint32_t irq) {
+    (void)irq;
+    tick_count++;
+    /* Re-arm relative to now; clears the level-triggered condition */
+    write_cntv_tval(tick_interval);
+}
+
+void timer_init(void) {
+    uint64_t frq;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(frq));
+    cntfrq = (uint32_t)frq;
+    if (cntfrq == 0) cntfrq = 62500000;  /* QEMU default */
+
+    tick_interval = cntfrq / TIMER_HZ;
+    boot_count = read_cntvct();
+
+    gic_register_handler(TIMER_IRQ, timer_irq);
+    gic_set_priority(TIMER_IRQ, 0x80);
+
+    write_cntv_tval(tick_interval);
+    write_cntv_ctl(CNTV_CTL_ENABLE);
+
+    gic_enable_irq(TIMER_IRQ);
+}
+
+uint32_t timer_ms(void) {
+    if (cntfrq == 0) return 0;
+    uint64_t delta = read_cntvct() - boot_count;
+    return (uint32_t)((delta * 1000) / cntfrq);
+}
+
+uint64_t timer_counter(void) {
+    return read_cntvct();
+}
+
+uint64_t timer_ticks(void) {
+    return tick_count;
+}
+
+uint32_t timer_freq(void) {
+    return cntfrq;
+}
+
+void timer_idle(void) {
+    /* Interrupts must be enabled for the tick to end the sleep */
+    __asm__ volatile("dsb sy; wfi" ::: "memory");
+}
@@ -208,132 +208,305 @@ static int build_upgrade_request(websocket_t* ws, char* buf, int buf_size) {
     return pos;
 }
 
-/* Check for upgrade response (HTTP 101) */
-static int check_upgrade_response(const char* data, int len) {
-    /* Look for "101 Switching Protocols" */
-    if (len < 20) return 0;
-
-    /* Simple check for HTTP/1.1 101 */
-    if (str_ncmp(data, "HTTP/1.1 101", 12) == 0 ||
-        str_ncmp(data, "HTTP/1.0 101", 12) == 0) {
-        /* Check for end of headers */
-        for (int i = 0; i < len - 3; i++) {
-            if (data[i] == '\r' && data[i+1] == '\n' &&
-                data[i+2] == '\r' && data[i+3] == '\n') {
-                return i + 4;  /* Return offset to frame data */
+/* Gather the upgrade response a byte at a time, so no frame data that
+ * follows it is read. Returns 1 once it is complete and is a 101, -1 if
+ * it is complete and isn't, else 0 */
+static int read_upgrade_response(websocket_t* ws) {
+    while (tcp_data_available(ws->tcp_conn)) {
+        char c;
+        if (tcp_recv(ws->tcp_conn, &c, 1) != 1) break;
+        if (ws->hs_len < (int)sizeof(ws->hs_status) - 1) {
+            ws->hs_status[ws->hs_len] = c;
+        }
+        ws->hs_len++;
+        ws->hs_tail = (ws->hs_tail << 8) | (uint8_t)c;
+
+        if (ws->hs_tail == 0x0D0A0D0A) {    /* "\r\n\r\n" */
+            /* Look for "101 Switching Protocols" */
+            if (str_ncmp(ws->hs_status, "HTTP/1.1 101", 12) == 0 ||
+                str_ncmp(ws->hs_status, "HTTP/1.0 101", 12) == 0) {
+                return 1;
             }
+            return -1;
         }
     }
     return 0;
 }
 
-/* Send WebSocket frame */
-static int send_frame(websocket_t* ws, uint8_t opcode, const uint8_t* data, int len) {
-    uint8_t frame[WS_MAX_MESSAGE + 14];  /* Max frame overhead */
+/* ==================== Masking ==================== */
+
+/* XOR data with the masking key, `phase` bytes into its 4-byte cycle.
+ * NEON takes 16 bytes at a time; 16 being a multiple of 4, the phase is
+ * the same for the tail */
+static void ws_mask(uint8_t* data, int len, const uint8_t* key, uint32_t phase) {
+    int i = 0;
+#ifdef __aarch64__
+    if (len >= 16) {
+        uint32_t k = key[phase & 3] | (key[(phase + 1) & 3] << 8) |
+                     (key[(phase + 2) & 3] << 16) | ((uint32_t)key[(phase + 3) & 3] << 24);
+        uint8_t* p = data;
+        int n = len & ~15;
+        i = n;
+        __asm__ volatile(
+            "dup v1.4s, %w2\n"
+            "1: ld1 {v0.16b}, [%0]\n"
+            "   eor v0.16b, v0.16b, v1.16b\n"
+            "   st1 {v0.16b}, [%0], #16\n"
+            "   subs %w1, %w1, #16\n"
+            "   b.ne 1b\n"
+            : "+r"(p), "+r"(n)
+            : "r"(k)
+            : "v0", "v1", "cc", "memory");
+    }
+#endif
+    for (; i < len; i++) {
+        data[i] ^= key[(phase + i) & 3];
+    }
+}
+
+/* ==================== Sending ==================== */
+
+/* Frame header for a masked client frame; returns its length */
+static int build_frame_header(uint8_t* hdr, uint8_t opcode, uint64_t len,
+                              uint8_t* mask_out) {
     int pos = 0;
 
     /* First byte: FIN + opcode */
-    frame[pos++] = 0x80 | (opcode & 0x0F);
+    hdr[pos++] = 0x80 | (opcode & 0x0F);
 
     /* Second byte: MASK + length */
     /* Client MUST mask frames */
     if (len < 126) {
-        frame[pos++] = 0x80 | len;
+        hdr[pos++] = 0x80 | len;
     } else if (len < 65536) {
-        frame[pos++] = 0x80 | 126;
-        frame[pos++] = (len >> 8) & 0xFF;
-        frame[pos++] = len & 0xFF;
+        hdr[pos++] = 0x80 | 126;
+        hdr[pos++] = (len >> 8) & 0xFF;
+        hdr[pos++] = len & 0xFF;
     } else {
-        /* 8-byte length - not supported for simplicity */
-        return -1;
+        hdr[pos++] = 0x80 | 127;
+        for (int i = 7; i >= 0; i--) hdr[pos++] = (len >> (i * 8)) & 0xFF;
     }
 
     /* Masking key */
     uint32_t mask = ws_rand();
-    frame[pos++] = (mask >> 24) & 0xFF;
-    frame[pos++] = (mask >> 16) & 0xFF;
-    frame[pos++] = (mask >> 8) & 0xFF;
-    frame[pos++] = mask & 0xFF;
-
-    /* Masked payload */
-    uint8_t* mask_bytes = &frame[pos - 4];
-    for (int i = 0; i < len; i++) {
-        frame[pos++] = data[i] ^ mask_bytes[i % 4];
+    for (int i = 0; i < 4; i++) {
+        mask_out[i] = hdr[pos++] = (mask >> (24 - i * 8)) & 0xFF;
     }
+    return pos;
+}
 
-    return tcp_send(ws->tcp_conn, frame, pos);
+int ws_flush(websocket_t* ws) {
+    if (ws->tx_len == 0) return 0;
+    /* Frames go out whole or not at all */
+    if (tcp_send_space(ws->tcp_conn) < ws->tx_len) return -1;
+    tcp_send(ws->tcp_conn, ws->tx_buf, ws->tx_len);
+    ws->tx_len = 0;
+    return 0;
 }
 
-/* Parse incoming frame */
-static int parse_frame(websocket_t* ws, const uint8_t* data, int len) {
-    if (len < 2) return 0;  /* Need more data */
+/* Send WebSocket frame: small ones are added to tx_buf, larger ones
+ * follow what is there straight into the TCP send ring, masked a piece
+ * at a time. Returns len or -1 */
+static int send_frame(websocket_t* ws, uint8_t opcode, const uint8_t* data, int len) {
+    uint8_t hdr[WS_MAX_HEADER];
+    uint8_t mask[4];
+    int hlen = build_frame_header(hdr, opcode, len, mask);
+    int total = hlen + len;
+
+    if (total <= WS_COALESCE_MAX) {
+        if (ws->tx_len + total > WS_TX_COALESCE && ws_flush(ws) != 0) return -1;
+        uint8_t* p = ws->tx_buf + ws->tx_len;
+        memcpy(p, hdr, hlen);
+        if (len > 0) {
+            memcpy(p + hlen, data, len);
+            ws_mask(p + hlen, len, mask, 0);
+        }
+        ws->tx_len += total;
+        return len;
+    }
+
+    if (ws_flush(ws) != 0) return -1;
+    if (tcp_send_space(ws->tcp_conn) < total) return -1;
+    tcp_send(ws->tcp_conn, hdr, hlen);
+    uint8_t piece[1024];
+    for (int off = 0; off < len; off += sizeof(piece)) {
+        int n = len - off < (int)sizeof(piece) ? len - off : (int)sizeof(piece);
+        memcpy(piece, data + off, n);
+        ws_mask(piece, n, mask, off);
+        tcp_send(ws->tcp_conn, piece, n);
+    }
+    return len;
+}
 
-    int pos = 0;
-    uint8_t byte1 = data[pos++];
-    uint8_t byte2 = data[pos++];
+/* Close with a status code after a protocol violation */
+static void ws_fail(websocket_t* ws, uint16_t code) {
+    uint8_t status[2] = { code >> 8, code & 0xFF };
+    ws_log("WS: Protocol error\r\n");
+    send_frame(ws, WS_OP_CLOSE, status, 2);
+    ws_flush(ws);
+    ws->state = WS_STATE_CLOSED;
+}
 
-    int fin = (byte1 >> 7) & 1;
-    int opcode = byte1 & 0x0F;
-    int mask = (byte2 >> 7) & 1;
-    int payload_len = byte2 & 0x7F;
+/* ==================== Receiving ==================== */
+
+/* Room in the message buffer for `more` bytes and a NUL, at least
+ * doubling it when it grows. Returns 0 or -1 */
+static int msg_reserve(websocket_t* ws, uint64_t more) {
+    uint64_t need = (uint64_t)ws->msg_len + more + 1;
+    if (need <= (uint64_t)ws->msg_cap) return 0;
+    if (need > WS_MAX_MESSAGE + 1) return -1;
+
+    int cap = ws->msg_cap ? ws->msg_cap : WS_MSG_INITIAL;
+    while ((uint64_t)cap < need) cap *= 2;
+    if (cap > WS_MAX_MESSAGE + 1) cap = WS_MAX_MESSAGE + 1;
+    uint8_t* m = (uint8_t*)realloc(ws->msg, cap);
+    if (!m) return -1;
+    ws->msg = m;
+    ws->msg_cap = cap;
+    return 0;
+}
 
-    (void)fin;  /* We don't handle fragmentation */
+/* Header complete: check it against the message in progress */
+static void frame_begin(websocket_t* ws) {
+    uint8_t* h = ws->hdr;
+    int pos = 2;
+    ws->frame_fin = (h[0] >> 7) & 1;
+    ws->frame_opcode = h[0] & 0x0F;
+    ws->frame_mask = (h[1] >> 7) & 1;
 
     /* Extended length */
-    if (payload_len == 126) {
-        if (len < 4) return 0;
-        payload_len = (data[pos] << 8) | data[pos + 1];
-        pos += 2;
-    } else if (payload_len == 127) {
-        /* 8-byte length - just read lower 32 bits */
-        if (len < 10) return 0;
-        pos += 4;  /* Skip high 32 bits */
-        payload_len = (data[pos] << 24) | (data[pos+1] << 16) |
-                      (data[pos+2] << 8) | data[pos+3];
-        pos += 4;
+    uint64_t len = h[1] & 0x7F;
+    if (len == 126) {
+        len = (h[2] << 8) | h[3];
+        pos = 4;
+    } else if (len == 127) {
+        len = 0;
+        for (int i = 0; i < 8; i++) len = (len << 8) | h[2 + i];
+        pos = 10;
     }
 
     /* Masking key (server shouldn't mask, but handle it) */
-    uint8_t mask_key[4] = {0};
-    if (mask) {
-        if (pos + 4 > len) return 0;
-        for (int i = 0; i < 4; i++) mask_key[i] = data[pos++];
+    if (ws->frame_mask) {
+        for (int i = 0; i < 4; i++) ws->frame_mask_key[i] = h[pos + i];
     }
 
-    /* Check we have full payload */
-    if (pos + payload_len > len) return 0;
-
-    /* Copy and unmask payload */
-    ws->rx_opcode = opcode;
-    ws->rx_len = 0;
+    uint8_t op = ws->frame_opcode;
+    if (op & 0x08) {
+        /* Control frames: unfragmented and small, may come mid-message */
+        if (!ws->frame_fin || len > WS_MAX_CONTROL ||
+            (op != WS_OP_CLOSE && op != WS_OP_PING && op != WS_OP_PONG)) {
+            ws_fail(ws, WS_CLOSE_PROTOCOL);
+            return;
+        }
+        ws->ctrl_len = 0;
+    } else if (op == WS_OP_TEXT || op == WS_OP_BINARY) {
+        if (ws->msg_opcode) {
+            ws_fail(ws, WS_CLOSE_PROTOCOL);     /* Previous one unfinished */
+            return;
+        }
+        ws->msg_opcode = op;
+        ws->msg_len = 0;
+    } else if (op != WS_OP_CONTINUATION || !ws->msg_opcode) {
+        ws_fail(ws, WS_CLOSE_PROTOCOL);
+        return;
+    }
 
-    for (int i = 0; i < payload_len && ws->rx_len < WS_MAX_MESSAGE - 1; i++) {
-        uint8_t b = data[pos + i];
-        if (mask) b ^= mask_key[i % 4];
-        ws->rx_buffer[ws->rx_len++] = b;
+    if (!(op & 0x08) && !ws->handler && msg_reserve(ws, len) != 0) {
+        ws_fail(ws, WS_CLOSE_TOO_BIG);
+        return;
     }
-    ws->rx_buffer[ws->rx_len] = 0;
-
-    /* Handle control frames */
-    if (opcode == WS_OP_PING) {
-        /* Send pong with same payload */
-        send_frame(ws, WS_OP_PONG, ws->rx_buffer, ws->rx_len);
-        ws->rx_ready = 0;
-    } else if (opcode == WS_OP_CLOSE) {
-        ws_log("WS: Close frame\r\n");
-        /* Send close response */
-        send_frame(ws, WS_OP_CLOSE, NULL, 0);
-        ws->state = WS_STATE_CLOSED;
-        ws->rx_ready = 0;
-    } else if (opcode == WS_OP_PONG) {
-        /* Ignore pong */
-        ws->rx_ready = 0;
-    } else {
-        /* Text or binary message */
-        ws->rx_ready = 1;
+
+    ws->frame_left = len;
+    ws->frame_pos = 0;
+    ws->in_payload = 1;
+}
+
+/* Payload complete: act on control frames, finish messages */
+static void frame_end(websocket_t* ws) {
+    ws->in_payload = 0;
+    ws->hdr_len = 0;
+    ws->hdr_need = 2;
+
+    switch (ws->frame_opcode) {
+        case WS_OP_PING:
+            /* Send pong with same payload */
+            send_frame(ws, WS_OP_PONG, ws->ctrl, ws->ctrl_len);
+            break;
+        case WS_OP_CLOSE:
+            ws_log("WS: Close frame\r\n");
+            /* Send close response */
+            send_frame(ws, WS_OP_CLOSE, NULL, 0);
+            ws_flush(ws);
+            ws->state = WS_STATE_CLOSED;
+            break;
+        case WS_OP_PONG:
+            /* Ignore pong */
+            break;
+        default:
+            /* Text or binary message (or part of one) */
+            if (!ws->frame_fin) break;
+            if (ws->handler) {
+                ws->handler(ws->handler_ctx, ws->msg_opcode, NULL, 0, 1);
+            } else {
+                ws->msg[ws->msg_len] = 0;
+                ws->rx_opcode = ws->msg_opcode;
+                ws->rx_ready = 1;
+            }
+            ws->msg_opcode = 0;
+            break;
     }
+}
+
+/* Read what is available of the current frame; each read stops at the end
+ * of the header or payload, so frames may straddle TCP segments. Payload
+ * of a reassembled message is read straight into its buffer */
+static void receive_frames(websocket_t* ws) {
+    while (ws->state == WS_STATE_OPEN && !ws->rx_ready &&
+           tcp_data_available(ws->tcp_conn)) {
+        if (!ws->in_payload) {
+            int got = tcp_recv(ws->tcp_conn, ws->hdr + ws->hdr_len,
+                               ws->hdr_need - ws->hdr_len);
+            if (got <= 0) break;
+            ws->hdr_len += got;
+            if (ws->hdr_len == 2) {
+                int len7 = ws->hdr[1] & 0x7F;
+                ws->hdr_need = 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0) +
+                               ((ws->hdr[1] & 0x80) ? 4 : 0);
+            }
+            if (ws->hdr_len == ws->hdr_need) {
+                frame_begin(ws);
+                if (ws->in_payload && ws->frame_left == 0) frame_end(ws);
+            }
+            continue;
+        }
 
-    return pos + payload_len;  /* Bytes consumed */
+        uint8_t piece[1024];
+        uint8_t* dst;
+        int want = ws->frame_left < 65536 ? (int)ws->frame_left : 65536;
+        if (ws->frame_opcode & 0x08) {
+            dst = ws->ctrl + ws->ctrl_len;
+        } else if (ws->handler) {
+            dst = piece;
+            if (want > (int)sizeof(piece)) want = sizeof(piece);
+        } else {
+            dst = ws->msg + ws->msg_len;
+        }
+
+        int got = tcp_recv(ws->tcp_conn, dst, want);
+        if (got <= 0) break;
+        if (ws->frame_mask) ws_mask(dst, got, ws->frame_mask_key, ws->frame_pos);
+        ws->frame_pos += got;
+        ws->frame_left -= got;
+
+        if (ws->frame_opcode & 0x08) {
+            ws->ctrl_len += got;
+        } else if (ws->handler) {
+            ws->handler(ws->handler_ctx, ws->msg_opcode, dst, got, 0);
+        } else {
+            ws->msg_len += got;
+        }
+        if (ws->frame_left == 0) frame_end(ws);
+    }
 }
 
 int ws_poll(websocket_t* ws) {
@@ -358,21 +531,19 @@ int ws_poll(websocket_t* ws) {
         }
 
         /* Check for upgrade response */
-        if (ws->handshake_sent && tcp_data_available(ws->tcp_conn)) {
-            char buf[512];
-            int len = tcp_recv(ws->tcp_conn, buf, sizeof(buf) - 1);
-            buf[len] = 0;
-
-            int frame_start = check_upgrade_response(buf, len);
-            if (frame_start > 0) {
+        if (ws->handshake_sent) {
+            int upgraded = read_upgrade_response(ws);
+            if (upgraded > 0) {
                 ws_log("WS: Upgraded!\r\n");
                 ws->state = WS_STATE_OPEN;
                 ws->handshake_complete = 1;
+                ws->hdr_need = 2;
 
-                /* Process any remaining data as frame */
-                if (frame_start < len) {
-                    parse_frame(ws, (uint8_t*)(buf + frame_start), len - frame_start);
-                }
+                /* Process any frames that came with it */
+                receive_frames(ws);
+            } else if (upgraded < 0) {
+                ws_log("WS: Upgrade refused\r\n");
+                ws->state = WS_STATE_CLOSED;
             }
         }
     } else if (ws->state == WS_STATE_OPEN) {
@@ -383,18 +554,18 @@ int ws_poll(websocket_t* ws) {
         }
 
         /* Receive frames */
-        if (tcp_data_available(ws->tcp_conn)) {
-            uint8_t buf[1024];
-            int len = tcp_recv(ws->tcp_conn, buf, sizeof(buf));
-            if (len > 0) {
-                parse_frame(ws, buf, len);
-            }
-        }
+        receive_frames(ws);
     }
 
+    if (ws->state == WS_STATE_OPEN) ws_flush(ws);
     return ws->state;
 }
 
+void ws_set_handler(websocket_t* ws, ws_handler_t handler, void* ctx) {
+    ws->handler = handler;
+    ws->handler_ctx = ctx;
+}
+
 int ws_send_text(websocket_t* ws, const char* message) {
     if (ws->state != WS_STATE_OPEN) return -1;
     return send_frame(ws, WS_OP_TEXT, (const uint8_t*)message, str_len(message));
@@ -414,17 +585,21 @@ int ws_message_ready(websocket_t* ws) {
     return ws->rx_ready;
 }
 
+int ws_message_len(websocket_t* ws) {
+    return ws->rx_ready ? ws->msg_len : 0;
+}
+
 int ws_get_message(websocket_t* ws, char* buffer, int max_len) {
     if (!ws->rx_ready) return 0;
 
-    int to_copy = ws->rx_len;
+    int to_copy = ws->msg_len;
     if (to_copy > max_len - 1) to_copy = max_len - 1;
 
-    memcpy(buffer, ws->rx_buffer, to_copy);
+    memcpy(buffer, ws->msg, to_copy);
     buffer[to_copy] = 0;
 
     ws->rx_ready = 0;
-    ws->rx_len = 0;
+    ws->msg_len = 0;
 
     return to_copy;
 }
@@ -436,10 +611,16 @@ int ws_get_opcode(websocket_t* ws) {
 void ws_close(websocket_t* ws) {
     if (ws->state == WS_STATE_OPEN) {
         send_frame(ws, WS_OP_CLOSE, NULL, 0);
+        ws_flush(ws);
         ws->state = WS_STATE_CLOSING;
     }
     tcp_close(ws->tcp_conn);
     ws->state = WS_STATE_CLOSED;
+
+    free(ws->msg);
+    ws->msg = NULL;
+    ws->msg_cap = 0;
+    ws->msg_len = 0;
 }
 
 int ws_get_state(websocket_t* ws) {
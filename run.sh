@@ -49,7 +49,7 @@ fi
 # Create disk image if it doesn't exist
 if [ ! -f "$DISK" ]; then
     echo "Creating disk image..."
-    qemu-img create -f raw "$DISK" 16M
+    qemu-img create -f raw "$DISK" 256M
 fi
 
 echo "Starting ClaudeOS..."
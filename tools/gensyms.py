@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""
+Generate the profiler's symbol table from `nm -n` output.
+Emits an assembly file defining the tables kernel/prof.c resolves
+samples with: sorted function addresses, name offsets and a string table.
+
+Usage: aarch64-elf-nm -n kernel64.pre.elf | python3 gensyms.py > kernel64.syms.S
+"""
+
+import sys
+
+# Text symbol types: global/local code, weak code
+TEXT_TYPES = {'T', 't', 'W', 'w'}
+
+
+def read_symbols(lines):
+    """Return [(addr, name)] for code symbols, sorted, one name per address."""
+    syms = {}
+    for line in lines:
+        parts = line.split()
+        if len(parts) != 3 or parts[1] not in TEXT_TYPES:
+            continue
+        addr, name = int(parts[0], 16), parts[2]
+        # Skip assembler local labels and mapping symbols ($x, $d)
+        if name.startswith('.L') or name.startswith('$'):
+            continue
+        if addr not in syms or name[0] != '_':
+            syms[addr] = name
+    return sorted(syms.items())
+
+
+def emit(symbols, out):
+    out.write('/* Generated by tools/gensyms.py - do not edit */\n\n')
+    out.write('    .section .rodata.prof_syms, "a"\n')
+
+    out.write('    .balign 4\n')
+    out.write('    .global prof_sym_count\n')
+    out.write('prof_sym_count:\n')
+    out.write('    .word %d\n\n' % len(symbols))
+
+    out.write('    .balign 8\n')
+    out.write('    .global prof_sym_addrs\n')
+    out.write('prof_sym_addrs:\n')
+    for addr, _ in symbols:
+        out.write('    .quad 0x%x\n' % addr)
+
+    out.write('\n    .global prof_sym_names\n')
+    out.write('prof_sym_names:\n')
+    offset = 0
+    for _, name in symbols:
+        out.write('    .word %d\n' % offset)
+        offset += len(name) + 1
+
+    out.write('\n    .global prof_sym_strtab\n')
+    out.write('prof_sym_strtab:\n')
+    for _, name in symbols:
+        out.write('    .asciz "%s"\n' % name)
+
+
+def main():
+    emit(read_symbols(sys.stdin), sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,7 +1,8 @@
 #!/usr/bin/env python3
 """
 Convert PNG image to C header for embedding in TinyOS.
-Outputs raw BGRA pixel data (matching framebuffer format).
+Outputs a packed pixel stream that image.c decodes row by row
+(see "Packed images" in kernel/include/image.h).
 
 Usage: python3 png2header.py input.png output.h [max_width] [max_height]
 """
@@ -9,13 +10,69 @@ Usage: python3 png2header.py input.png output.h [max_width] [max_height]
 import sys
 from pathlib import Path
 
-try:
-    from PIL import Image
-except ImportError:
-    print("Error: Pillow not installed. Run: pip3 install Pillow")
-    sys.exit(1)
+# Packed stream opcodes (must match kernel/image.c)
+OP_INDEX = 0x00     # 00iiiiii: pixel from the 64-entry recent-color table
+OP_DIFF = 0x40      # 01rrggbb: small per-channel delta (-2..1) from previous
+OP_LUMA = 0x80      # 10gggggg rrrrbbbb: green delta, red/blue relative to it
+OP_RUN = 0xC0       # 11llllll: repeat previous pixel 1..62 times
+OP_RGB = 0xFE       # 0xFE r g b: literal pixel
+MAX_RUN = 62
+
+
+def color_hash(p):
+    r, g, b = (p >> 16) & 0xFF, (p >> 8) & 0xFF, p & 0xFF
+    return (r * 3 + g * 5 + b * 7) % 64
+
+
+def pack_pixels(pixels):
+    """Encode 0x00RRGGBB pixels; the stream carries over row boundaries."""
+    out = bytearray()
+    index = [0] * 64
+    prev = 0
+    run = 0
+
+    for p in pixels:
+        if p == prev:
+            run += 1
+            if run == MAX_RUN:
+                out.append(OP_RUN | (run - 1))
+                run = 0
+            continue
+        if run:
+            out.append(OP_RUN | (run - 1))
+            run = 0
+
+        h = color_hash(p)
+        if index[h] == p:
+            out.append(OP_INDEX | h)
+        else:
+            index[h] = p
+            r, g, b = (p >> 16) & 0xFF, (p >> 8) & 0xFF, p & 0xFF
+            pr, pg, pb = (prev >> 16) & 0xFF, (prev >> 8) & 0xFF, prev & 0xFF
+            dr = ((r - pr + 128) & 0xFF) - 128
+            dg = ((g - pg + 128) & 0xFF) - 128
+            db = ((b - pb + 128) & 0xFF) - 128
+            if -2 <= dr <= 1 and -2 <= dg <= 1 and -2 <= db <= 1:
+                out.append(OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2))
+            elif -32 <= dg <= 31 and -8 <= dr - dg <= 7 and -8 <= db - dg <= 7:
+                out.append(OP_LUMA | (dg + 32))
+                out.append(((dr - dg + 8) << 4) | (db - dg + 8))
+            else:
+                out += bytes([OP_RGB, r, g, b])
+        prev = p
+
+    if run:
+        out.append(OP_RUN | (run - 1))
+    return out
+
+
+def load_png(input_path, max_width, max_height):
+    try:
+        from PIL import Image
+    except ImportError:
+        print("Error: Pillow not installed. Run: pip3 install Pillow")
+        sys.exit(1)
 
-def convert_png_to_header(input_path, output_path, max_width=360, max_height=640):
     # Load image
     img = Image.open(input_path)
 
@@ -27,15 +84,18 @@ def convert_png_to_header(input_path, output_path, max_width=360, max_height=640
     if img.width > max_width or img.height > max_height:
         img.thumbnail((max_width, max_height), Image.Resampling.LANCZOS)
 
-    width, height = img.size
-    pixels = list(img.getdata())
+    # The framebuffer is BGRX (X ignored): (B << 0) | (G << 8) | (R << 16)
+    pixels = [(r << 16) | (g << 8) | b for (r, g, b, a) in img.getdata()]
+    return img.width, img.height, pixels
 
+
+def write_header(output_path, source_name, width, height, pixels):
     # Generate variable name from filename
-    name = Path(input_path).stem.replace('-', '_').replace('.', '_').upper()
+    name = Path(source_name).stem.replace('-', '_').replace('.', '_').upper()
+    packed = pack_pixels(pixels)
 
-    # Generate C header
     header = f"""/*
- * Auto-generated image data from {Path(input_path).name}
+ * Auto-generated image data from {Path(source_name).name}
  * Size: {width}x{height}
  */
 
@@ -46,30 +106,16 @@ def convert_png_to_header(input_path, output_path, max_width=360, max_height=640
 
 #define {name}_WIDTH  {width}
 #define {name}_HEIGHT {height}
+#define {name}_PACKED_SIZE {len(packed)}
 
-/* BGRA pixel data (matches framebuffer format) */
-static const uint32_t {name.lower()}_data[{width * height}] = {{
+/* Packed BGRX pixel stream, decoded on the fly by image.c */
+static const uint8_t {name.lower()}_packed[{len(packed)}] = {{
 """
 
-    # Convert pixels to BGRA format
-    pixel_lines = []
-    line = []
-    for i, (r, g, b, a) in enumerate(pixels):
-        # BGRA format: 0xAARRGGBB but framebuffer uses 0x00RRGGBB
-        # Actually the framebuffer is BGRX where X is ignored
-        # So we want: (B << 0) | (G << 8) | (R << 16)
-        bgra = (r << 16) | (g << 8) | b
-        line.append(f"0x{bgra:08X}")
-
-        if len(line) == 8:
-            pixel_lines.append(", ".join(line))
-            line = []
-
-    # Add remaining pixels
-    if line:
-        pixel_lines.append(", ".join(line))
-
-    header += "    " + ",\n    ".join(pixel_lines)
+    lines = []
+    for i in range(0, len(packed), 16):
+        lines.append(", ".join(f"0x{b:02X}" for b in packed[i:i + 16]))
+    header += "    " + ",\n    ".join(lines)
     header += f"""
 }};
 
@@ -80,10 +126,16 @@ static const uint32_t {name.lower()}_data[{width * height}] = {{
     with open(output_path, 'w') as f:
         f.write(header)
 
-    print(f"Converted {input_path} -> {output_path}")
+    print(f"Converted {source_name} -> {output_path}")
     print(f"  Size: {width}x{height}")
     print(f"  Pixels: {width * height}")
-    print(f"  Data size: {width * height * 4} bytes")
+    print(f"  Data size: {len(packed)} bytes packed ({width * height * 4} raw)")
+
+
+def convert_png_to_header(input_path, output_path, max_width=360, max_height=640):
+    width, height, pixels = load_png(input_path, max_width, max_height)
+    write_header(output_path, input_path, width, height, pixels)
+
 
 if __name__ == "__main__":
     if len(sys.argv) < 3:
@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+"""
+Fold a TinyOS profiler dump (`prof dump <file>`) into flame graph input.
+Each dump line is a sampled PC followed by its return addresses, in hex;
+the output has one "outer;...;leaf count" line per distinct stack, as
+read by flamegraph.pl and speedscope.
+
+Usage: aarch64-elf-nm -n kernel64.elf > kernel64.nm
+       python3 prof_fold.py kernel64.nm prof.txt > prof.folded
+"""
+
+import bisect
+import sys
+from collections import Counter
+
+from gensyms import read_symbols
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip(), file=sys.stderr)
+        sys.exit(1)
+
+    with open(sys.argv[1]) as f:
+        symbols = read_symbols(f)
+    addrs = [addr for addr, _ in symbols]
+
+    def name_of(pc):
+        i = bisect.bisect_right(addrs, pc) - 1
+        return symbols[i][1] if i >= 0 else '0x%x' % pc
+
+    stacks = Counter()
+    with open(sys.argv[2]) as f:
+        for line in f:
+            pcs = [int(word, 16) for word in line.split()]
+            if pcs:
+                # Dump order is leaf first; flame graphs want root first
+                stacks[';'.join(name_of(pc) for pc in reversed(pcs))] += 1
+
+    for stack, count in sorted(stacks.items()):
+        print('%s %d' % (stack, count))
+
+
+if __name__ == '__main__':
+    main()